@@ -9,6 +9,7 @@
 #include "bigq.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <utility>
@@ -47,7 +48,7 @@ private:
   // Takes ownership.
   // nullptr token here is just used to distinguish from the version
   // that takes an int64 (would be ambiguous with BigInt(0)).
-  explicit BigInt(BigZ z, nullptr_t token) : bigz(z) {}
+  explicit BigInt(BigZ z, std::nullptr_t token) : bigz(z) {}
   
   // BigZ is a pointer to a bigz struct, which is the
   // header followed by digits.
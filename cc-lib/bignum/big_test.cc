@@ -1,14 +1,179 @@
 
 #include "big.h"
 #include <cstdint>
+#include <random>
+#include <vector>
 
 #include "../base/logging.h"
+#include "../timer.h"
 
 using int64 = int64_t;
 
+// Random nonnegative BigZ with exactly this many digits.
+static BigZ RandomBigZ(std::mt19937_64 *gen, BigNumLength digits) {
+  BigZ z = BzCreate(digits);
+  for (BigNumLength i = 0; i < digits; i++) BzSetDigit(z, i, (*gen)());
+  if (BzGetDigit(z, digits - 1) == 0) BzSetDigit(z, digits - 1, 1);
+  BzSetSign(z, BZ_PLUS);
+  return z;
+}
+
+// Schoolbook product (the way BnnMultiply always worked) for reference.
+static BigZ SchoolbookMultiply(const BigZ y, const BigZ z) {
+  const BigNumLength yl = BzNumDigits(y), zl = BzNumDigits(z);
+  BigZ n = BzCreate(yl + zl);
+  BigNumLength pl = yl + zl;
+  for (BigNumLength i = 0; i < zl; i++)
+    (void)BnnMultiplyDigit(BzToBn(n) + i, pl--, BzToBn(y), yl,
+                           BzGetDigit(z, i));
+  BzSetSign(n, BZ_PLUS);
+  return n;
+}
+
+// Euclid's algorithm (the way BzGcd always worked) for reference.
+static BigZ EuclidGcd(const BigZ y, const BigZ z) {
+  BigZ a = BzAbs(y), b = BzAbs(z);
+  while (BzGetSign(b) != BZ_ZERO) {
+    BigZ r = BzMod(a, b);
+    BzFree(a);
+    a = b;
+    b = r;
+  }
+  BzFree(b);
+  return a;
+}
+
+static void CheckEq(const BigZ a, const BigZ b, const char *what) {
+  CHECK(BzCompare(a, b) == BZ_EQ) << what << ": "
+                                  << BzNumDigits(a) << " digits vs "
+                                  << BzNumDigits(b);
+}
+
+static void TestMultiply() {
+  std::mt19937_64 gen(1);
+  // Around the thresholds, and unbalanced.
+  for (BigNumLength yl : {1, 2, 31, 32, 33, 64, 100, 159, 160, 161,
+                          200, 480, 1000, 2500}) {
+    for (BigNumLength zl : {1, 17, 32, 33, 80, 160, 170, 481, 1000}) {
+      BigZ y = RandomBigZ(&gen, yl), z = RandomBigZ(&gen, zl);
+      BigZ expected = SchoolbookMultiply(y, z);
+      BigZ a = BzMultiply(y, z), b = BzMultiply(z, y);
+      CheckEq(expected, a, "y * z");
+      CheckEq(expected, b, "z * y");
+      for (BigZ x : {y, z, expected, a, b}) BzFree(x);
+    }
+  }
+
+  // All ones digits maximize the carries.
+  for (BigNumLength len : {40, 200, 700}) {
+    BigZ y = BzCreate(len);
+    for (BigNumLength i = 0; i < len; i++) BzSetDigit(y, i, ~(BigNumDigit)0);
+    BzSetSign(y, BZ_PLUS);
+    BigZ expected = SchoolbookMultiply(y, y);
+    BigZ a = BzMultiply(y, y);
+    CheckEq(expected, a, "ones");
+    for (BigZ x : {y, expected, a}) BzFree(x);
+  }
+
+  // Through the C++ interface, with signs.
+  BigInt x("-123456789012345678901234567890123456789012345678901234567890"
+           "1234567890123456789012345678901234567890123456789012345678901"
+           "2345678901234567890123456789012345678901234567890123456789012"
+           "3456789012345678901234567890123456789012345678901234567890123"
+           "4567890123456789012345678901234567890123456789012345678901234"
+           "5678901234567890123456789012345678901234567890123456789012345"
+           "6789012345678901234567890123456789012345678901234567890");
+  BigInt sq = BigInt::Times(x, x);
+  CHECK(BigInt::Compare(BigInt::Div(sq, x), x) == 0);
+  CHECK(BigInt::Compare(BigInt::Times(x, BigInt::Negate(x)),
+                        BigInt::Negate(sq)) == 0);
+}
+
+static void TestGcd() {
+  std::mt19937_64 gen(2);
+  for (BigNumLength len : {1, 2, 3, 10, 50, 200}) {
+    for (int i = 0; i < 10; i++) {
+      BigZ g = RandomBigZ(&gen, 1 + gen() % len);
+      BigZ y0 = RandomBigZ(&gen, len), z0 = RandomBigZ(&gen, 1 + gen() % len);
+      // With a common factor g, and without.
+      BigZ y = BzMultiply(y0, g), z = BzMultiply(z0, g);
+      if (i & 1) BzSetSign(y, BZ_MINUS);
+      BigZ expected = EuclidGcd(y, z), actual = BzGcd(y, z);
+      CheckEq(expected, actual, "gcd");
+      BigZ r = BzMod(actual, g);
+      CHECK(BzGetSign(r) == BZ_ZERO);
+      BigZ expected0 = EuclidGcd(y0, z0), actual0 = BzGcd(z0, y0);
+      CheckEq(expected0, actual0, "gcd0");
+      for (BigZ x : {g, y0, z0, y, z, expected, actual, r,
+                     expected0, actual0})
+        BzFree(x);
+    }
+  }
+
+  // Fibonacci numbers are the worst case for Euclid: every quotient
+  // is 1.
+  BigZ a = BzFromInteger(1), b = BzFromInteger(1);
+  for (int i = 0; i < 3000; i++) {
+    BigZ c = BzAdd(a, b);
+    BzFree(a);
+    a = b;
+    b = c;
+  }
+  BigZ one = BzFromInteger(1), g = BzGcd(a, b);
+  CheckEq(one, g, "fib");
+  for (BigZ x : {a, b, one, g}) BzFree(x);
+}
+
+// Operands of 1k to 100k decimal digits.
+static void Bench() {
+  std::mt19937_64 gen(3);
+  for (int decimal : {1000, 10000, 100000}) {
+    // About 19.3 decimal digits per 64-bit digit.
+    const BigNumLength len = (BigNumLength)(decimal / 19.27) + 1;
+    BigZ y = RandomBigZ(&gen, len), z = RandomBigZ(&gen, len);
+    const int reps = decimal >= 100000 ? 1 : (decimal >= 10000 ? 10 : 500);
+
+    Timer school_timer;
+    for (int r = 0; r < reps; r++) BzFree(SchoolbookMultiply(y, z));
+    const double school_ms = school_timer.MS() / reps;
+
+    Timer mul_timer;
+    for (int r = 0; r < reps; r++) BzFree(BzMultiply(y, z));
+    const double mul_ms = mul_timer.MS() / reps;
+
+    // Give them a common factor, as in BigRat normalization.
+    BigZ g = RandomBigZ(&gen, len / 2);
+    BigZ yg = BzMultiply(y, g), zg = BzMultiply(z, g);
+    const int gcd_reps = decimal >= 10000 ? 1 : 20;
+    double euclid_ms = 0.0;
+    if (decimal <= 10000) {
+      Timer euclid_timer;
+      for (int r = 0; r < gcd_reps; r++) BzFree(EuclidGcd(yg, zg));
+      euclid_ms = euclid_timer.MS() / gcd_reps;
+    }
+    Timer gcd_timer;
+    for (int r = 0; r < gcd_reps; r++) BzFree(BzGcd(yg, zg));
+    const double gcd_ms = gcd_timer.MS() / gcd_reps;
+
+    printf("%6d digits: multiply %9.3fms (schoolbook %9.3fms, %.1fx)  "
+           "gcd %9.3fms",
+           decimal, mul_ms, school_ms, school_ms / mul_ms, gcd_ms);
+    if (euclid_ms > 0.0) {
+      printf(" (euclid %9.3fms, %.1fx)", euclid_ms, euclid_ms / gcd_ms);
+    }
+    printf("\n");
+    fflush(stdout);
+    for (BigZ x : {y, z, g, yg, zg}) BzFree(x);
+  }
+}
+
 int main(int argc, char **argv) {
   printf("Start.\n");
   fflush(stdout);
+
+  TestMultiply();
+  TestGcd();
+  Bench();
   {
     BigInt i{1234567LL};
     BigInt j{33LL};
@@ -23,6 +188,7 @@ int main(int argc, char **argv) {
     fflush(stdout);
   }
 
+  Timer series_timer;
   BigRat sum;
   for (int i = 0; i < 10000; i++) {
     // + 1/1, - 1/3, + 1/5
@@ -42,6 +208,8 @@ int main(int argc, char **argv) {
     
   }
 
+  printf("10000 terms in %.3fs\n", series_timer.Seconds());
+
   BigRat res = BigRat::Times(sum, BigRat(4, 1));
   printf("Final approx pi: %s\n",
          res.ToString().c_str());
@@ -61,6 +61,8 @@
 
 #include "bign.h"
 
+#include <vector>
+
 static void
 BnnDivideHelper(BigNum nn, BigNumLength nl, BigNum dd, BigNumLength dl);
 
@@ -607,6 +609,18 @@ BnnMultiplyDigit(BigNum pp,
                 return (BnnAdd(pp, pl, mm, ml, BN_NOCARRY));
         }
 
+#if     defined(__SIZEOF_INT128__)
+        /*
+         * The compiler has a double-digit product, which is much
+         * faster than the four half-digit products below.
+         */
+        for (i = 0; i < ml; ++i) {
+                unsigned __int128 x = (unsigned __int128)mm[i] * d + *pp + c;
+                --pl;
+                *(pp++) = (BigNumDigit)x;
+                c = (BigNumProduct)(x >> BN_DIGIT_SIZE);
+        }
+#else
         for (i = 0; i < ml; ++i) {
                 BigNumDigit     Lm;
                 BigNumDigit     Hm;
@@ -635,6 +649,7 @@ BnnMultiplyDigit(BigNum pp,
                 *(pp++) = (BigNumDigit)c;
                 c = X3 + HIGH(X1) + HIGH(X2);
         }
+#endif
 
         if (pl == 0) {
                 return (BN_NOCARRY);
@@ -812,6 +827,310 @@ BnnIsZero(const BigNum nn, BigNumLength nl) {
         }
 }
 
+/*
+ *      Subquadratic multiplication
+ *
+ * Products where the smaller factor has fewer than
+ * BNN_KARATSUBA_THRESHOLD digits use the schoolbook method. Above
+ * that, Karatsuba's method (three half-size products instead of
+ * four), and above BNN_TOOM3_THRESHOLD, Toom-Cook 3-way (five
+ * third-size products instead of nine). The thresholds were tuned
+ * with big_test on x86-64.
+ */
+
+#if     !defined(BNN_KARATSUBA_THRESHOLD)
+#define BNN_KARATSUBA_THRESHOLD ((BigNumLength)32)
+#endif
+
+#if     !defined(BNN_TOOM3_THRESHOLD)
+#define BNN_TOOM3_THRESHOLD     ((BigNumLength)160)
+#endif
+
+static void BnnProduct(BigNum rr, BigNum mm, BigNumLength ml,
+                       BigNum nn, BigNumLength nl);
+
+static void
+BnnSchoolbook(BigNum rr, BigNum mm, BigNumLength ml,
+              BigNum nn, BigNumLength nl) {
+        /*
+         * M * N => R, where Size(R) = Size(M) + Size(N).
+         */
+
+        BigNumLength i;
+        BigNumLength rl = ml + nl;
+
+        BnnSetToZero(rr, rl);
+        for (i = 0; i < nl; ++i) {
+                (void)BnnMultiplyDigit(&rr[i], rl--, mm, ml, nn[i]);
+        }
+}
+
+static void
+BnnKaratsuba(BigNum rr, BigNum mm, BigNumLength ml,
+             BigNum nn, BigNumLength nl) {
+        /*
+         * M * N => R. With M = M1 * B + M0 and N = N1 * B + N0, where
+         * B = Base ** h,
+         *
+         *   M * N = M1 N1 B^2 + ((M0 + M1)(N0 + N1) - M0 N0 - M1 N1) B
+         *           + M0 N0.
+         *
+         * Assumes ml >= nl > h = ceil(ml / 2).
+         */
+
+        const BigNumLength h = (ml + 1) / 2;
+        const BigNumLength rl = ml + nl;
+
+        /*
+         * M0 N0 and M1 N1 go directly in the low and high parts of R.
+         */
+
+        BnnProduct(rr, mm, h, nn, h);
+        BnnProduct(rr + 2 * h, mm + h, ml - h, nn + h, nl - h);
+
+        std::vector<BigNumDigit> ms(h + 1), ns(h + 1), mid(2 * h + 2);
+        BnnAssign(ms.data(), mm, h);
+        (void)BnnAdd(ms.data(), h + 1, mm + h, ml - h, BN_NOCARRY);
+        BnnAssign(ns.data(), nn, h);
+        (void)BnnAdd(ns.data(), h + 1, nn + h, nl - h, BN_NOCARRY);
+        BnnProduct(mid.data(), ms.data(), h + 1, ns.data(), h + 1);
+
+        (void)BnnSubtract(mid.data(), 2 * h + 2, rr, 2 * h, BN_CARRY);
+        (void)BnnSubtract(mid.data(), 2 * h + 2, rr + 2 * h, rl - 2 * h,
+                          BN_CARRY);
+        (void)BnnAdd(rr + h, rl - h, mid.data(),
+                     BnnNumDigits(mid.data(), 2 * h + 2), BN_NOCARRY);
+}
+
+/*
+ * Signed temporaries for Toom-3, whose interpolation goes through
+ * negative values. The magnitude has no leading zero digits (so zero
+ * is empty).
+ */
+
+namespace {
+struct BnnSigned {
+        std::vector<BigNumDigit> mag;
+        bool neg = false;
+};
+}
+
+static BnnSigned
+BnnSignedFrom(BigNum nn, BigNumLength nl) {
+        BnnSigned r;
+        while (nl > 0 && nn[nl - 1] == 0) nl--;
+        r.mag.assign(nn, nn + nl);
+        return r;
+}
+
+static void
+BnnSignedTrim(BnnSigned *a) {
+        while (!a->mag.empty() && a->mag.back() == 0) a->mag.pop_back();
+        if (a->mag.empty()) a->neg = false;
+}
+
+static BnnSigned
+BnnSignedAdd(const BnnSigned &a, const BnnSigned &b, bool negate_b) {
+        /*
+         * A + B, or A - B if negate_b.
+         */
+
+        const bool bneg = negate_b ? !b.neg : b.neg;
+        BnnSigned r;
+
+        if (a.neg == bneg) {
+                const BnnSigned &big = a.mag.size() >= b.mag.size() ? a : b;
+                const BnnSigned &small = &big == &a ? b : a;
+                r.mag.resize(big.mag.size() + 1);
+                BnnAssign(r.mag.data(), (BigNum)big.mag.data(),
+                          big.mag.size());
+                (void)BnnAdd(r.mag.data(), r.mag.size(),
+                             (BigNum)small.mag.data(), small.mag.size(),
+                             BN_NOCARRY);
+                r.neg = a.neg;
+        } else  {
+                /*
+                 * Subtract the smaller magnitude from the larger.
+                 */
+                const bool a_bigger =
+                        BnnCompare((BigNum)a.mag.data(), a.mag.size(),
+                                   (BigNum)b.mag.data(), b.mag.size()) != BN_LT;
+                const BnnSigned &big = a_bigger ? a : b;
+                const BnnSigned &small = a_bigger ? b : a;
+                r.mag = big.mag;
+                (void)BnnSubtract(r.mag.data(), r.mag.size(),
+                                  (BigNum)small.mag.data(), small.mag.size(),
+                                  BN_CARRY);
+                r.neg = a_bigger ? a.neg : bneg;
+        }
+
+        BnnSignedTrim(&r);
+        return r;
+}
+
+static BnnSigned
+BnnSignedMultiply(const BnnSigned &a, const BnnSigned &b) {
+        BnnSigned r;
+        if (a.mag.empty() || b.mag.empty()) return r;
+        r.mag.resize(a.mag.size() + b.mag.size());
+        BnnProduct(r.mag.data(),
+                   (BigNum)a.mag.data(), a.mag.size(),
+                   (BigNum)b.mag.data(), b.mag.size());
+        r.neg = a.neg != b.neg;
+        BnnSignedTrim(&r);
+        return r;
+}
+
+static void
+BnnSignedShiftLeft1(BnnSigned *a) {
+        a->mag.push_back(0);
+        (void)BnnShiftLeft(a->mag.data(), a->mag.size(), 1);
+        BnnSignedTrim(a);
+}
+
+static void
+BnnSignedHalve(BnnSigned *a) {
+        /*
+         * Exact division by 2.
+         */
+
+        if (a->mag.empty()) return;
+        (void)BnnShiftRight(a->mag.data(), a->mag.size(), 1);
+        BnnSignedTrim(a);
+}
+
+static void
+BnnSignedThird(BnnSigned *a) {
+        /*
+         * Exact division by 3, from the most significant half-digit
+         * down, so that the running remainder (< 3) and a half-digit
+         * always fit in a digit.
+         */
+
+        BigNumDigit r = 0;
+        for (BigNumLength i = a->mag.size(); i-- > 0;) {
+                BigNumDigit x = (r << (BN_DIGIT_SIZE / 2)) | HIGH(a->mag[i]);
+                BigNumDigit qh = x / 3;
+                r = x % 3;
+                x = (r << (BN_DIGIT_SIZE / 2)) | LOW(a->mag[i]);
+                r = x % 3;
+                a->mag[i] = L2H(qh) | (x / 3);
+        }
+        BnnSignedTrim(a);
+}
+
+static void
+BnnToom3(BigNum rr, BigNum mm, BigNumLength ml,
+         BigNum nn, BigNumLength nl) {
+        /*
+         * M * N => R. Split each into three pieces of k digits, as
+         * the polynomials M(x) = M2 x^2 + M1 x + M0 (likewise N) at
+         * x = Base ** k, evaluate them at 0, 1, -1, -2 and infinity,
+         * multiply pointwise, and interpolate the product's five
+         * coefficients. This is Bodrato's sequence for the evaluation
+         * and interpolation.
+         *
+         * Assumes ml >= nl > 2 * k, where k = ceil(ml / 3).
+         */
+
+        const BigNumLength k = (ml + 2) / 3;
+        const BigNumLength rl = ml + nl;
+
+        auto Evaluate = [k](BigNum xx, BigNumLength xl,
+                            BnnSigned *p0, BnnSigned *p1, BnnSigned *pm1,
+                            BnnSigned *pm2, BnnSigned *pinf) {
+                const BnnSigned x0 = BnnSignedFrom(xx, k);
+                const BnnSigned x1 = BnnSignedFrom(xx + k, k);
+                const BnnSigned x2 = BnnSignedFrom(xx + 2 * k, xl - 2 * k);
+                const BnnSigned t = BnnSignedAdd(x0, x2, false);
+                *p0 = x0;
+                *p1 = BnnSignedAdd(t, x1, false);
+                *pm1 = BnnSignedAdd(t, x1, true);
+                /* (p(-1) + x2) * 2 - x0 */
+                *pm2 = BnnSignedAdd(*pm1, x2, false);
+                BnnSignedShiftLeft1(pm2);
+                *pm2 = BnnSignedAdd(*pm2, x0, true);
+                *pinf = x2;
+        };
+
+        BnnSigned m0, m1, mm1, mm2, minf;
+        BnnSigned n0, n1, nm1, nm2, ninf;
+        Evaluate(mm, ml, &m0, &m1, &mm1, &mm2, &minf);
+        Evaluate(nn, nl, &n0, &n1, &nm1, &nm2, &ninf);
+
+        const BnnSigned r0 = BnnSignedMultiply(m0, n0);
+        BnnSigned r1 = BnnSignedMultiply(m1, n1);
+        const BnnSigned rm1 = BnnSignedMultiply(mm1, nm1);
+        const BnnSigned rm2 = BnnSignedMultiply(mm2, nm2);
+        const BnnSigned r4 = BnnSignedMultiply(minf, ninf);
+
+        BnnSigned r3 = BnnSignedAdd(rm2, r1, true);
+        BnnSignedThird(&r3);
+        r1 = BnnSignedAdd(r1, rm1, true);
+        BnnSignedHalve(&r1);
+        BnnSigned r2 = BnnSignedAdd(rm1, r0, true);
+        r3 = BnnSignedAdd(r2, r3, true);
+        BnnSignedHalve(&r3);
+        {
+                BnnSigned r4x2 = r4;
+                BnnSignedShiftLeft1(&r4x2);
+                r3 = BnnSignedAdd(r3, r4x2, false);
+        }
+        r2 = BnnSignedAdd(BnnSignedAdd(r2, r1, false), r4, true);
+        r1 = BnnSignedAdd(r1, r3, true);
+
+        /*
+         * The coefficients are all nonnegative now. Add them up.
+         */
+
+        BnnSetToZero(rr, rl);
+        const BnnSigned *coeffs[5] = { &r0, &r1, &r2, &r3, &r4 };
+        for (BigNumLength i = 0; i < 5; i++) {
+                const BnnSigned &c = *coeffs[i];
+                if (!c.mag.empty()) {
+                        (void)BnnAdd(rr + i * k, rl - i * k,
+                                     (BigNum)c.mag.data(), c.mag.size(),
+                                     BN_NOCARRY);
+                }
+        }
+}
+
+static void
+BnnProduct(BigNum rr, BigNum mm, BigNumLength ml,
+           BigNum nn, BigNumLength nl) {
+        /*
+         * M * N => R, where Size(R) = Size(M) + Size(N), choosing
+         * the method by size.
+         */
+
+        if (ml < nl) {
+                BigNum tt = mm; mm = nn; nn = tt;
+                BigNumLength tl = ml; ml = nl; nl = tl;
+        }
+
+        if (nl < BNN_KARATSUBA_THRESHOLD) {
+                BnnSchoolbook(rr, mm, ml, nn, nl);
+        } else  if (nl <= (ml + 1) / 2) {
+                /*
+                 * Unbalanced. Multiply N by nl-digit chunks of M,
+                 * which are balanced.
+                 */
+                const BigNumLength rl = ml + nl;
+                std::vector<BigNumDigit> tmp(2 * nl);
+                BnnSetToZero(rr, rl);
+                for (BigNumLength i = 0; i < ml; i += nl) {
+                        const BigNumLength cl = ml - i < nl ? ml - i : nl;
+                        BnnProduct(tmp.data(), mm + i, cl, nn, nl);
+                        (void)BnnAdd(rr + i, rl - i, tmp.data(), cl + nl,
+                                     BN_NOCARRY);
+                }
+        } else  if (nl >= BNN_TOOM3_THRESHOLD && nl > 2 * ((ml + 2) / 3)) {
+                BnnToom3(rr, mm, ml, nn, nl);
+        } else  {
+                BnnKaratsuba(rr, mm, ml, nn, nl);
+        }
+}
+
 BigNumCarry
 BnnMultiply(BigNum pp,
             BigNumLength pl,
@@ -836,6 +1155,15 @@ BnnMultiply(BigNum pp,
         BigNumLength i;
         BigNumCarry  c = BN_NOCARRY;
 
+        if ((ml < nl ? ml : nl) >= BNN_KARATSUBA_THRESHOLD) {
+                /*
+                 * Compute the product separately, then add it in.
+                 */
+                std::vector<BigNumDigit> rr(ml + nl);
+                BnnProduct(rr.data(), mm, ml, nn, nl);
+                return (BnnAdd(pp, pl, rr.data(), ml + nl, BN_NOCARRY));
+        }
+
         /*
          * Multiply one digit at a time
          */
@@ -55,6 +55,9 @@
 #include <string.h>
 #include <ctype.h>
 
+#include <utility>
+#include <vector>
+
 #include "bigz.h"
 
 #define MaxInt(a, b)            (((a) < (b)) ? (b) : (a))
@@ -2314,47 +2317,173 @@ BzLcm(const BigZ y, const BigZ z) {
         return (r);
 }
 
-BigZ
-BzGcd(const BigZ y, const BigZ z) {
+/*
+ * Lehmer's gcd (Knuth 4.5.2, Algorithm L). Most steps of Euclid's
+ * algorithm only depend on the leading bits of the two numbers, so
+ * run them on the leading BZ_LEHMER_BITS bits alone, keeping track of
+ * the cofactors, and then apply those to the whole numbers at once.
+ * This replaces a bignum division (and allocation) per quotient with
+ * two linear passes per 30 or so bits of progress.
+ */
+
+#define BZ_LEHMER_BITS  ((BigNumLength)60)
+
+static BzInt
+BzLehmerBits(BigNum nn, BigNumLength nl, BigNumLength shift) {
         /*
-         * Returns gcd(Y, Z).
+         * Returns bits [shift, shift + BZ_LEHMER_BITS) of N.
          */
 
-        if (BzGetSign(y) == BZ_ZERO) {
-                return (BzAbs(z));
-        } else  if (BzGetSign(z) == BZ_ZERO) {
-                return (BzAbs(y));
-        } else  {
-                BigZ yc;
-                BigZ zc;
+        const BigNumLength d = shift / BN_DIGIT_SIZE;
+        const BigNumLength b = shift % BN_DIGIT_SIZE;
+        BigNumDigit x = (d < nl) ? (nn[d] >> b) : BN_ZERO;
 
-                if ((yc = BzAbs(y)) == BZNULL) {
-                        /* a fresh copy failed */
-                        return BZNULL;
+        if (b != 0 && d + 1 < nl) {
+                x |= nn[d + 1] << (BN_DIGIT_SIZE - b);
+        }
+
+        return ((BzInt)(x & ((BN_ONE << BZ_LEHMER_BITS) - 1)));
+}
+
+static void
+BzLehmerCombine(std::vector<BigNumDigit> *out,
+                std::vector<BigNumDigit> *x, BigNumLength xl,
+                std::vector<BigNumDigit> *y, BigNumLength yl,
+                BzInt s, BzInt t) {
+        /*
+         * s X + t Y => out, where s and t don't have the same sign
+         * and the result is nonnegative. Assumes X >= Y.
+         */
+
+        std::vector<BigNumDigit> *pos = x, *neg = y;
+        BigNumLength posl = xl, negl = yl;
+        BigNumDigit ps = (BigNumDigit)s, ns = (BigNumDigit)-t;
+
+        if (t > 0) {
+                pos = y; posl = yl; ps = (BigNumDigit)t;
+                neg = x; negl = xl; ns = (BigNumDigit)-s;
+        }
+
+        std::vector<BigNumDigit> tmp(xl + 1, BN_ZERO);
+        out->assign(xl + 1, BN_ZERO);
+        (void)BnnMultiplyDigit(out->data(), xl + 1, pos->data(), posl, ps);
+        (void)BnnMultiplyDigit(tmp.data(), xl + 1, neg->data(), negl, ns);
+        (void)BnnSubtract(out->data(), xl + 1, tmp.data(), xl + 1, BN_CARRY);
+}
+
+static BigZ
+BzLehmerGcd(const BigZ y, const BigZ z) {
+        /*
+         * Returns gcd(|Y|, |Z|), for nonzero Y and Z.
+         */
+
+        std::vector<BigNumDigit> u(BzToBn(y), BzToBn(y) + BzNumDigits(y));
+        std::vector<BigNumDigit> v(BzToBn(z), BzToBn(z) + BzNumDigits(z));
+        std::vector<BigNumDigit> nu, nv;
+        BigNumLength ul = u.size(), vl = v.size();
+
+        if (BnnCompare(u.data(), ul, v.data(), vl) == BN_LT) {
+                u.swap(v);
+                std::swap(ul, vl);
+        }
+
+        for (;;) {
+                /*
+                 * Invariant: U >= V.
+                 */
+                ul = BnnNumDigits(u.data(), ul);
+                vl = BnnNumDigits(v.data(), vl);
+
+                if (BnnIsZero(v.data(), vl) == BN_TRUE) {
+                        break;
                 }
 
-                if ((zc = BzAbs(z)) == BZNULL) {
-                        /* a fresh copy failed */
-                        BzFree(yc);
-                        return BZNULL;
+                if (ul == 1) {
+                        BigNumDigit a = u[0], b = v[0];
+                        while (b != BN_ZERO) {
+                                BigNumDigit r = a % b;
+                                a = b;
+                                b = r;
+                        }
+                        u[0] = a;
+                        break;
                 }
 
-                while (BzGetSign(zc) != BZ_ZERO) {
-                        BigZ tmp = BzMod(yc, zc);
-                        BzFree(yc);
+                /*
+                 * ul >= 2, so there are more than BZ_LEHMER_BITS bits.
+                 */
+                const BigNumLength shift =
+                        ul * BN_DIGIT_SIZE -
+                        BnnNumLeadingZeroBitsInDigit(u[ul - 1]) -
+                        BZ_LEHMER_BITS;
+                BzInt uh = BzLehmerBits(u.data(), ul, shift);
+                BzInt vh = BzLehmerBits(v.data(), vl, shift);
+                BzInt a = 1, b = 0, c = 0, d = 1;
 
-                        if (tmp == BZNULL) {
-                                yc = BZNULL;
+                /*
+                 * The quotient is right as long as it's the same for
+                 * both extremes of the possible values of U / V.
+                 */
+                while (vh + c != 0 && vh + d != 0) {
+                        const BzInt q = (uh + a) / (vh + c);
+                        BzInt t;
+
+                        if (q != (uh + b) / (vh + d)) {
                                 break;
-                        } else {
-                                yc = zc;
-                                zc = tmp;
                         }
+
+                        t = a - q * c; a = c; c = t;
+                        t = b - q * d; b = d; d = t;
+                        t = uh - q * vh; uh = vh; vh = t;
                 }
 
-                BzFree(zc);
+                if (b == 0) {
+                        /*
+                         * Didn't get anywhere (the quotient is too big
+                         * for the leading bits), so take a full step.
+                         */
+                        BigZ bu = BzFromBigNum(u.data(), ul);
+                        BigZ bv = BzFromBigNum(v.data(), vl);
+                        BigZ r = BzMod(bu, bv);
 
-                return (yc);
+                        if (r == BZNULL) {
+                                BzFree(bu);
+                                BzFree(bv);
+                                return BZNULL;
+                        }
+
+                        u.swap(v);
+                        ul = vl;
+                        v.assign(BzToBn(r), BzToBn(r) + BzNumDigits(r));
+                        vl = v.size();
+                        BzFree(r);
+                        BzFree(bv);
+                        BzFree(bu);
+                } else  {
+                        BzLehmerCombine(&nu, &u, ul, &v, vl, a, b);
+                        BzLehmerCombine(&nv, &u, ul, &v, vl, c, d);
+                        u.swap(nu);
+                        v.swap(nv);
+                        ul = u.size();
+                        vl = v.size();
+                }
+        }
+
+        return (BzFromBigNum(u.data(), ul));
+}
+
+BigZ
+BzGcd(const BigZ y, const BigZ z) {
+        /*
+         * Returns gcd(Y, Z).
+         */
+
+        if (BzGetSign(y) == BZ_ZERO) {
+                return (BzAbs(z));
+        } else  if (BzGetSign(z) == BZ_ZERO) {
+                return (BzAbs(y));
+        } else  {
+                return (BzLehmerGcd(y, z));
         }
 }
 
@@ -2,7 +2,16 @@
 #include "edit-distance.h"
 
 #include <algorithm>
+#include <bit>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+
+#include "threadutil.h"
 
 using namespace std;
 
@@ -215,3 +224,263 @@ int EditDistance::Ukkonen(const string &s1, const string &s2, int threshold) {
 }
 
 // (end copyright)
+
+// Myers' bit-parallel algorithm, "A fast bit-vector algorithm for
+// approximate string matching based on dynamic programming" (1999),
+// as adapted for edit distance with multiple words by Hyyro, "A
+// bit-vector algorithm for computing Levenshtein and Damerau edit
+// distances" (2003).
+//
+// The DP matrix has the pattern down the side (rows) and the text
+// along the top (columns). Instead of the cells, we keep a column's
+// vertical deltas (each -1, 0 or +1) as two bit vectors, one bit per
+// row, and compute the next column's with a few word operations. The
+// score is the cell in the bottom row, updated from its horizontal
+// delta.
+namespace {
+struct MyersPattern {
+  explicit MyersPattern(string_view pattern) :
+    m(pattern.size()),
+    blocks((m + 63) / 64),
+    peq(256 * blocks, 0) {
+    // Bit i of peq[c][b] is set if pattern[b * 64 + i] is c. Rows past
+    // the end of the pattern in the last block match nothing.
+    for (int i = 0; i < m; i++)
+      peq[(uint8_t)pattern[i] * blocks + i / 64] |= uint64_t{1} << (i % 64);
+  }
+
+  // min(distance to text, threshold).
+  int Distance(string_view text, int threshold) const {
+    const int n = text.size();
+    // Can't be less than the difference in lengths.
+    if (threshold <= std::abs(m - n)) return threshold;
+    if (m == 0) return std::min(n, threshold);
+    if (threshold <= 64) return DistanceBand(text, threshold);
+    if (blocks == 1) return Distance1(text, threshold);
+    return DistanceN(text, threshold);
+  }
+
+ private:
+  // Whole pattern in one word.
+  int Distance1(string_view text, int threshold) const {
+    const int n = text.size();
+    const uint64_t last = uint64_t{1} << (m - 1);
+    uint64_t pv = ~uint64_t{0}, mv = 0;
+    int score = m;
+    for (int j = 0; j < n; j++) {
+      const uint64_t eq = peq[(uint8_t)text[j]];
+      const uint64_t xv = eq | mv;
+      const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+      uint64_t ph = mv | ~(xh | pv);
+      uint64_t mh = pv & xh;
+      if (ph & last) score++;
+      else if (mh & last) score--;
+      // The top row is 0, 1, 2, ..., so it always increases.
+      ph = (ph << 1) | 1;
+      mh <<= 1;
+      pv = mh | ~(xv | ph);
+      mv = ph & xv;
+      // Each remaining column can lower the score by at most one.
+      if (score - (n - j - 1) >= threshold) return threshold;
+    }
+    return std::min(score, threshold);
+  }
+
+  // Only the diagonal band that can be on a path of cost < threshold,
+  // in one word, after Hyyro's banded variant. A path through
+  // diagonal j - i = x costs at least |x| + |d - x|, where d = n - m
+  // is the final cell's diagonal, so the band has at most threshold
+  // diagonals. Bit r of the vectors in column j is row j - hi + r,
+  // so the window slides down a row per column; the row that enters
+  // at the bottom starts as an upper bound of one more than the row
+  // above it, and the row above the window is likewise taken to
+  // increase by one per column. Rows above 0 are treated as though
+  // the pattern were padded with characters that match nothing, which
+  // continues the top row's j - i.
+  int DistanceBand(string_view text, int threshold) const {
+    const int n = text.size();
+    const int d = n - m;
+    // Cells above k are as good as the threshold.
+    const int k = threshold - 1;
+    const int e = (k - std::abs(d)) / 2;
+    const int hi = std::max(0, d) + e;
+    const int w = std::abs(d) + 2 * e + 1;
+    const uint64_t bottom = uint64_t{1} << (w - 1);
+    // Bit of the cell on diagonal d, whose value we track to (m, n).
+    const int rd = hi - d;
+    const uint64_t upto_rd = (uint64_t{2} << rd) - 1;
+    const uint64_t above = upto_rd & ~uint64_t{1};
+    const uint64_t below = ((bottom << 1) - 1) & ~upto_rd;
+
+    // Column 0 is |i|, so rows up to 0 (the first hi + 1 bits)
+    // decrease.
+    uint64_t mv = hi >= 63 ? ~uint64_t{0} : (uint64_t{2} << hi) - 1;
+    uint64_t pv = ~mv;
+    int score = std::abs(d);
+    for (int j = 1; j <= n; j++) {
+      pv = (pv >> 1) | bottom;
+      mv = (mv >> 1) & ~bottom;
+      // Bit r is row j - hi + r, which is pattern[j - hi - 1 + r].
+      const uint64_t eq = Window((uint8_t)text[j - 1], j - hi - 1);
+      const uint64_t xv = eq | mv;
+      const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+      uint64_t ph = mv | ~(xh | pv);
+      uint64_t mh = pv & xh;
+      // Diagonally from the previous cell: down, then right.
+      score += ((pv >> rd) & 1) - ((mv >> rd) & 1) +
+        ((ph >> rd) & 1) - ((mh >> rd) & 1);
+      ph = (ph << 1) | 1;
+      mh <<= 1;
+      pv = mh | ~(xv | ph);
+      mv = ph & xv;
+      // Lower bound on the cells in the band, as in DistanceN.
+      if (score - std::popcount(pv & above) - std::popcount(mv & below) > k)
+        return threshold;
+    }
+    return std::min(score, threshold);
+  }
+
+  // 64 bits of the pattern's match vector for c, starting at
+  // position s, which may be negative. Positions outside the pattern
+  // match nothing.
+  uint64_t Window(uint8_t c, int s) const {
+    const uint64_t *eqs = &peq[c * blocks];
+    if (s < 0) return s <= -64 ? 0 : eqs[0] << -s;
+    const int b = s / 64, o = s % 64;
+    if (b >= blocks) return 0;
+    uint64_t x = eqs[b] >> o;
+    if (o != 0 && b + 1 < blocks) x |= eqs[b + 1] << (64 - o);
+    return x;
+  }
+
+  // Blocks of 64 rows, top to bottom, passing the horizontal delta at
+  // each block's bottom row to the next one. With a threshold, only
+  // the blocks that intersect Ukkonen's diagonal band are computed:
+  // outside it, every cell is at least the threshold, so an
+  // overestimate does no harm. Blocks above the band are dropped
+  // (as though their bottom row increased by one per column, which
+  // is an upper bound), and blocks below are started (from the upper
+  // bound of one deletion per row) as the band reaches them.
+  int DistanceN(string_view text, int threshold) const {
+    const int n = text.size();
+    const uint64_t high = uint64_t{1} << 63;
+    const uint64_t last = uint64_t{1} << ((m - 1) % 64);
+    // Cells further than k from the diagonal are > k.
+    const int k = std::min(threshold - 1, m + n);
+    // Whether the threshold could cut off the computation.
+    const bool cutoff = k < m + n;
+    // Value of the cell in each block's bottom row (for the last
+    // block, row m), while the block is active.
+    auto Height = [this](int b) { return std::min(64 * (b + 1), m) - 64 * b; };
+    vector<uint64_t> pvs(blocks, ~uint64_t{0}), mvs(blocks, 0);
+    vector<int> scores(blocks, 0);
+    int first = 0, end = 0;
+    auto Extend = [&](int c) {
+        // Block b's top row is 64b + 1; needed if within k of column c.
+        const int want = std::min(blocks, (c + k - 1) / 64 + 1);
+        for (; end < want; end++)
+          scores[end] = (end == 0 ? 0 : scores[end - 1]) + Height(end);
+      };
+    Extend(1);
+
+    for (int j = 0; j < n; j++) {
+      const uint64_t *eqs = &peq[(uint8_t)text[j] * blocks];
+      int hin = 1;
+      // Lower bound on the computed cells in the column.
+      int lowest = std::numeric_limits<int>::max();
+      for (int b = first; b < end; b++) {
+        uint64_t pv = pvs[b], mv = mvs[b], eq = eqs[b];
+        const uint64_t xv = eq | mv;
+        // A -1 coming in from above acts like a match in the top row.
+        if (hin < 0) eq |= 1;
+        const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        const uint64_t bottom = b == blocks - 1 ? last : high;
+        if (ph & bottom) scores[b]++;
+        else if (mh & bottom) scores[b]--;
+        const int hout = (ph & high) ? 1 : (mh & high) ? -1 : 0;
+        ph <<= 1;
+        mh <<= 1;
+        if (hin < 0) mh |= 1;
+        else if (hin > 0) ph |= 1;
+        pvs[b] = mh | ~(xv | ph);
+        mvs[b] = ph & xv;
+        hin = hout;
+        // No cell is lower than the bottom minus the number of +1
+        // vertical deltas above it.
+        if (cutoff)
+          lowest = std::min(lowest, scores[b] - std::popcount(pvs[b]));
+      }
+
+      // Now at column c. Every path to the end passes through this
+      // column, and never decreases. A computed cell that exceeds k
+      // is not an overestimate of one that doesn't, so if they all
+      // do, so does the answer.
+      if (cutoff && lowest > k) return threshold;
+      const int c = j + 1;
+      if (end == blocks) {
+        if (scores[blocks - 1] - (n - c) >= threshold) return threshold;
+      } else {
+        Extend(c + 1);
+      }
+      // Drop blocks whose rows are all < c - k.
+      while (first < end - 1 && 64 * (first + 1) < c - k) first++;
+    }
+    return std::min(scores[blocks - 1], threshold);
+  }
+
+  const int m, blocks;
+  // 256 characters x blocks.
+  vector<uint64_t> peq;
+};
+}  // namespace
+
+int EditDistance::Myers(const string &s1, const string &s2) {
+  // Fewer blocks with the shorter string as the pattern.
+  const bool swap = s1.size() > s2.size();
+  string_view pattern = swap ? s2 : s1, text = swap ? s1 : s2;
+  // A common prefix or suffix never needs to be edited.
+  while (!pattern.empty() && pattern.front() == text.front()) {
+    pattern.remove_prefix(1);
+    text.remove_prefix(1);
+  }
+  while (!pattern.empty() && pattern.back() == text.back()) {
+    pattern.remove_suffix(1);
+    text.remove_suffix(1);
+  }
+  return MyersPattern(pattern).Distance(text, std::numeric_limits<int>::max());
+}
+
+vector<int> EditDistance::Batch(const string &s, const vector<string> &ts,
+                                int threshold) {
+  MyersPattern pattern(s);
+  vector<int> out;
+  out.reserve(ts.size());
+  for (const string &t : ts) out.push_back(pattern.Distance(t, threshold));
+  return out;
+}
+
+vector<tuple<int, int, int>> EditDistance::AllPairsWithin(
+    const vector<string> &ss, int threshold, int max_concurrency) {
+  if (threshold < 0) return {};
+  // Distances are computed up to this, so that it means "too far."
+  const int limit =
+    threshold == std::numeric_limits<int>::max() ? threshold : threshold + 1;
+  // Row a has the matches (a, b) for b > a. Rows get shorter, but
+  // the pool balances the load.
+  vector<vector<tuple<int, int, int>>> rows =
+    ParallelTabulate(ss.size(), [&ss, threshold, limit](int64_t a) {
+        vector<tuple<int, int, int>> row;
+        const MyersPattern pattern(ss[a]);
+        for (int b = a + 1; b < (int)ss.size(); b++) {
+          const int d = pattern.Distance(ss[b], limit);
+          if (d <= threshold) row.emplace_back((int)a, b, d);
+        }
+        return row;
+      }, max_concurrency);
+
+  vector<tuple<int, int, int>> out;
+  for (const auto &row : rows) out.insert(out.end(), row.begin(), row.end());
+  return out;
+}
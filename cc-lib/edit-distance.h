@@ -2,7 +2,10 @@
 #ifndef _CC_LIB_EDIT_DISTANCE_H
 #define _CC_LIB_EDIT_DISTANCE_H
 
+#include <limits>
 #include <string>
+#include <tuple>
+#include <vector>
 
 struct EditDistance {
 
@@ -15,6 +18,27 @@ struct EditDistance {
   static int Ukkonen(const std::string &s1, const std::string &s2,
                      int threshold);
   
+  // Same as Distance, using Myers' bit-parallel algorithm (in
+  // Hyyro's formulation), which processes 64 characters of the
+  // shorter string at once. Much faster than Distance; Ukkonen can
+  // still win when the threshold is small.
+  static int Myers(const std::string &s1, const std::string &s2);
+
+  // min(Distance(s, t), threshold) for each t in ts, using Myers.
+  // The preprocessing of s is shared, and like Ukkonen, only the
+  // diagonal band within the threshold is computed, stopping once
+  // the threshold is out of reach. Thresholds up to 64 fit the band
+  // in a single word, which is faster than Ukkonen.
+  static std::vector<int> Batch(
+      const std::string &s, const std::vector<std::string> &ts,
+      int threshold = std::numeric_limits<int>::max());
+
+  // All pairs (a, b, distance) with a < b whose distance is at most
+  // threshold, sorted by a then b. Uses up to max_concurrency threads.
+  static std::vector<std::tuple<int, int, int>> AllPairsWithin(
+      const std::vector<std::string> &ss, int threshold,
+      int max_concurrency = 8);
+
   // TODO: Parameterized versions.
 
  private:
@@ -2,9 +2,15 @@
 #include "edit-distance.h"
 
 #include <stdio.h>
+#include <string>
+#include <vector>
+#include <tuple>
 
 #include "base/logging.h"
 #include "util.h"
+#include "arcfour.h"
+#include "randutil.h"
+#include "timer.h"
 
 using namespace std;
 
@@ -47,6 +53,133 @@ static void TestThreshold() {
 
 }
 
+// Random string over the first alphabet_size letters, so that small
+// alphabets give lots of matches.
+static string RandomString(ArcFour *rc, int len, int alphabet_size) {
+  string s;
+  s.reserve(len);
+  for (int i = 0; i < len; i++) s.push_back('a' + RandTo(rc, alphabet_size));
+  return s;
+}
+
+// Copy of s with about edits random edits.
+static string Mutate(ArcFour *rc, string s, int edits) {
+  for (int e = 0; e < edits; e++) {
+    const int pos = s.empty() ? 0 : RandTo(rc, s.size());
+    switch (RandTo(rc, 3)) {
+    case 0: s.insert(s.begin() + pos, 'a' + RandTo(rc, 26)); break;
+    case 1: if (!s.empty()) s.erase(s.begin() + pos); break;
+    default: if (!s.empty()) s[pos] = 'a' + RandTo(rc, 26); break;
+    }
+  }
+  return s;
+}
+
+// Against the DP, including lengths around the word boundaries.
+static void TestMyersRandom() {
+  ArcFour rc("myers");
+  for (int len : {0, 1, 2, 10, 63, 64, 65, 127, 128, 129, 200, 300}) {
+    for (int alphabet : {2, 4, 26}) {
+      for (int i = 0; i < 20; i++) {
+        const string a = RandomString(&rc, len, alphabet);
+        const string b = RandTo(&rc, 2) ?
+          Mutate(&rc, a, RandTo(&rc, 10)) :
+          RandomString(&rc, RandTo(&rc, len + 70), alphabet);
+        const int d = EditDistance::Distance(a, b);
+        CHECK_EQ(d, EditDistance::Myers(a, b)) << a << " " << b;
+        CHECK_EQ(d, EditDistance::Myers(b, a)) << a << " " << b;
+        for (int t : {0, 1, d - 1, d, d + 1, 5, 33, 64, 65, 1000}) {
+          if (t < 0) continue;
+          CHECK_EQ(std::min(d, t), EditDistance::Batch(a, {b}, t)[0])
+            << a << " " << b << " " << t;
+        }
+      }
+    }
+  }
+}
+
+static void TestAllPairs() {
+  ArcFour rc("pairs");
+  vector<string> ss;
+  for (int i = 0; i < 30; i++) ss.push_back(RandomString(&rc, 80, 4));
+  for (int i = 0; i < 60; i++)
+    ss.push_back(Mutate(&rc, ss[RandTo(&rc, ss.size())], RandTo(&rc, 8)));
+
+  for (int threshold : {0, 3, 10}) {
+    vector<tuple<int, int, int>> expected;
+    for (int a = 0; a < (int)ss.size(); a++) {
+      for (int b = a + 1; b < (int)ss.size(); b++) {
+        const int d = EditDistance::Distance(ss[a], ss[b]);
+        if (d <= threshold) expected.emplace_back(a, b, d);
+      }
+    }
+    CHECK(expected == EditDistance::AllPairsWithin(ss, threshold, 4))
+      << threshold;
+    CHECK(!expected.empty() || threshold == 0);
+  }
+}
+
+static void Bench() {
+  ArcFour rc("bench");
+  for (int len : {20, 64, 200, 1000}) {
+    // Pairs that are similar, as in deduplication.
+    vector<pair<string, string>> pairs;
+    for (int i = 0; i < 200; i++) {
+      string a = RandomString(&rc, len, 26);
+      string b = Mutate(&rc, a, len / 10 + 1);
+      pairs.emplace_back(std::move(a), std::move(b));
+    }
+    const int reps = std::max(1, 200000 / (len * len));
+
+    auto Time = [&pairs, reps](auto f) {
+        Timer timer;
+        int64_t total = 0;
+        for (int r = 0; r < reps; r++)
+          for (const auto &[a, b] : pairs) total += f(a, b);
+        CHECK(total > 0);
+        return timer.Seconds() * 1e6 / (reps * pairs.size());
+      };
+
+    const double dp = Time(EditDistance::Distance);
+    const double ukk = Time([](const string &a, const string &b) {
+        return EditDistance::Ukkonen(a, b, a.size() / 5 + 1);
+      });
+    const double myers = Time(EditDistance::Myers);
+    const double batch = Time([](const string &a, const string &b) {
+        return EditDistance::Batch(a, {b}, a.size() / 5 + 1)[0];
+      });
+    printf("len %4d: Distance %8.2fus  Ukkonen(len/5) %8.2fus  "
+           "Myers %8.2fus  Batch(len/5) %8.2fus\n",
+           len, dp, ukk, myers, batch);
+  }
+
+  // One against many, then all pairs.
+  vector<string> ss;
+  for (int i = 0; i < 100; i++) ss.push_back(RandomString(&rc, 100, 26));
+  for (int i = 0; i < 1900; i++)
+    ss.push_back(Mutate(&rc, ss[RandTo(&rc, 100)], RandTo(&rc, 20)));
+
+  {
+    Timer ukk_timer;
+    int64_t total = 0;
+    for (const string &t : ss) total += EditDistance::Ukkonen(ss[0], t, 6);
+    const double ukk_ms = ukk_timer.Seconds() * 1000.0;
+    Timer batch_timer;
+    for (int d : EditDistance::Batch(ss[0], ss, 6)) total -= d;
+    const double batch_ms = batch_timer.Seconds() * 1000.0;
+    CHECK_EQ(total, 0);
+    printf("1 vs %d, threshold 6: Ukkonen %.2fms  Batch %.2fms\n",
+           (int)ss.size(), ukk_ms, batch_ms);
+  }
+
+  {
+    Timer timer;
+    const auto pairs = EditDistance::AllPairsWithin(ss, 5);
+    printf("All pairs of %d within 5: %d pairs in %.2fs\n",
+           (int)ss.size(), (int)pairs.size(), timer.Seconds());
+  }
+}
+
 int main(int argc, char **argv) {
   TestDistance(EditDistance::Distance);
   TestDistance([](const string &a, const string &b) {
@@ -58,6 +191,15 @@ int main(int argc, char **argv) {
       return EditDistance::Ukkonen(a, b, std::max(a.size(), b.size()) + 1);
     });
   TestThreshold();
+
+  TestDistance(EditDistance::Myers);
+  TestDistance([](const string &a, const string &b) {
+      return EditDistance::Batch(a, {b})[0];
+    });
+  TestMyersRandom();
+  TestAllPairs();
+
+  Bench();
   printf("OK\n");
   return 0;
 }
@@ -14,6 +14,13 @@
 #include "stb_image_write.h"
 #include "base/logging.h"
 
+// SSE2 is part of x86-64, so this is the usual case. Elsewhere we
+// get portable loops that the compiler can vectorize if it likes.
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define IMAGE_SSE2 1
+#endif
+
 using namespace std;
 using uint8 = uint8_t;
 using uint32 = uint32_t;
@@ -131,6 +138,109 @@ inline static constexpr uint32 Pack32(uint8 r, uint8 g, uint8 b, uint8 a) {
     ((uint32)r << 24) | ((uint32)g << 16) | ((uint32)b << 8) | (uint32)a;
 }
 
+// Same result as BlendPixel, for a pixel known to be in bounds.
+inline static uint32 BlendOne(uint32 old, uint32 color) {
+  const uint32 a = color & 0xFF;
+  const uint32 oma = 0xFF - a;
+  auto Channel = [old, color, a, oma](int shift) {
+      const uint32 c = (color >> shift) & 0xFF;
+      const uint32 o = (old >> shift) & 0xFF;
+      return ((c * a + o * oma) / 0xFF) << shift;
+    };
+  return Channel(24) | Channel(16) | Channel(8) | 0xFF;
+}
+
+// Clip a span of n pixels, starting at *s in a source of size slimit
+// and at *d in a destination of size dlimit, so that it's in bounds
+// for both. Returns false if nothing is left.
+inline static bool ClipSpan(int *s, int *d, int *n, int slimit, int dlimit) {
+  const int lo = std::max({0, -*s, -*d});
+  const int hi = std::min({*n, slimit - *s, dlimit - *d});
+  if (hi <= lo) return false;
+  *s += lo;
+  *d += lo;
+  *n = hi - lo;
+  return true;
+}
+
+#ifdef IMAGE_SSE2
+// Exact x / 255 for each 16-bit lane, when x <= 255 * 255.
+inline static __m128i Div255x8(__m128i x) {
+  const __m128i t = _mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)),
+                                  _mm_srli_epi16(x, 8));
+  return _mm_srli_epi16(t, 8);
+}
+
+// Two pixels of src blended onto old, each unpacked to 16-bit lanes
+// (so alpha is lanes 0 and 4). Alpha of the result is garbage.
+inline static __m128i Blend2x8(__m128i src, __m128i old) {
+  const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0), 0);
+  const __m128i oma = _mm_sub_epi16(_mm_set1_epi16(0xFF), a);
+  return Div255x8(_mm_add_epi16(_mm_mullo_epi16(src, a),
+                                _mm_mullo_epi16(old, oma)));
+}
+#endif
+
+// Like BlendOne for each pixel of the spans, which don't overlap.
+static void BlendSpan(uint32 *dst, const uint32 *src, int n) {
+  int i = 0;
+#ifdef IMAGE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi32(0xFF);
+  for (; i + 4 <= n; i += 4) {
+    const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    // Images are often mostly opaque or mostly transparent.
+    const __m128i sa = _mm_and_si128(s, opaque);
+    __m128i res;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, opaque)) == 0xFFFF) {
+      res = s;
+    } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, zero)) == 0xFFFF) {
+      res = _mm_or_si128(d, opaque);
+    } else {
+      const __m128i lo = Blend2x8(_mm_unpacklo_epi8(s, zero),
+                                  _mm_unpacklo_epi8(d, zero));
+      const __m128i hi = Blend2x8(_mm_unpackhi_epi8(s, zero),
+                                  _mm_unpackhi_epi8(d, zero));
+      res = _mm_or_si128(_mm_packus_epi16(lo, hi), opaque);
+    }
+    _mm_storeu_si128((__m128i *)(dst + i), res);
+  }
+#endif
+  for (; i < n; i++) dst[i] = BlendOne(dst[i], src[i]);
+}
+
+// Blend the same color onto each pixel of the span.
+static void BlendSpanConst(uint32 *dst, int n, uint32 color) {
+  const uint32 a = color & 0xFF;
+  if (a == 0xFF) {
+    std::fill(dst, dst + n, color);
+    return;
+  }
+  int i = 0;
+#ifdef IMAGE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi32(0xFF);
+  // Source times alpha is the same for every pixel.
+  const __m128i ca =
+    _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32(color), zero),
+                    _mm_set1_epi16(a));
+  const __m128i oma = _mm_set1_epi16(0xFF - a);
+  for (; i + 4 <= n; i += 4) {
+    const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    const __m128i lo =
+      Div255x8(_mm_add_epi16(ca, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+                                                 oma)));
+    const __m128i hi =
+      Div255x8(_mm_add_epi16(ca, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+                                                 oma)));
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+  }
+#endif
+  for (; i < n; i++) dst[i] = BlendOne(dst[i], color);
+}
+
 // TODO: Duplicate code between the different Load routines..
 
 ImageRGBA::ImageRGBA(const std::vector<uint32> &rgba32,
@@ -264,21 +374,26 @@ ImageRGBA ImageRGBA::Crop32(int x, int y, int w, int h,
   return ret;
 }
 
+bool ImageRGBA::operator==(const ImageRGBA &other) const {
+  return other.Width() == Width() &&
+    other.Height() == Height() &&
+    other.rgba == rgba;
+}
+
 ImageRGBA ImageRGBA::ScaleBy(int scale) const {
   // 1 is not useful, but it does work
   CHECK(scale >= 1);
   ImageRGBA ret(width * scale, height * scale);
+  const int ww = ret.width;
+  if (ww == 0) return ret;
   for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      const uint32 color = GetPixel32(x, y);
-      for (int yy = 0; yy < scale; yy++) {
-        for (int xx = 0; xx < scale; xx++) {
-          ret.SetPixel32(x * scale + xx,
-                         y * scale + yy,
-                         color);
-        }
-      }
-    }
+    // Expand the first output row, then copy it.
+    uint32 *dst = ret.rgba.data() + (y * scale) * ww;
+    const uint32 *src = rgba.data() + y * width;
+    for (int x = 0; x < width; x++)
+      std::fill(dst + x * scale, dst + (x + 1) * scale, src[x]);
+    for (int yy = 1; yy < scale; yy++)
+      memcpy(dst + yy * ww, dst, ww * sizeof (uint32));
   }
   return ret;
 }
@@ -291,36 +406,71 @@ ImageRGBA ImageRGBA::ScaleDownBy(int scale) const {
   ImageRGBA ret(ww, hh);
   for (int y = 0; y < hh; y++) {
     for (int x = 0; x < ww; x++) {
-      uint32 rr = 0, gg = 0, bb = 0, aa = 0;
+      const uint32 *box = &rgba[(y * scale) * width + x * scale];
+      // Sums of a, b * a, g * a, r * a.
+      uint32 sums[4];
+#ifdef IMAGE_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      // Multiply the color channels by alpha, and alpha by 1.
+      const __m128i color_lanes = _mm_set_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+      const __m128i one_alpha = _mm_set_epi16(0, 0, 0, 1, 0, 0, 0, 1);
+      auto Weight = [&](__m128i p) {
+          const __m128i a =
+            _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, 0), 0);
+          return _mm_mullo_epi16(
+              p, _mm_or_si128(_mm_and_si128(a, color_lanes), one_alpha));
+        };
+      __m128i acc = zero;
       for (int yy = 0; yy < scale; yy++) {
+        const uint32 *row = box + yy * width;
+        int xx = 0;
+        for (; xx + 2 <= scale; xx += 2) {
+          const __m128i w =
+            Weight(_mm_unpacklo_epi8(
+                       _mm_loadl_epi64((const __m128i *)(row + xx)), zero));
+          acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(w, zero));
+          acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(w, zero));
+        }
+        if (xx < scale) {
+          const __m128i w =
+            Weight(_mm_unpacklo_epi8(
+                       _mm_cvtsi32_si128((int)row[xx]), zero));
+          acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(w, zero));
+        }
+      }
+      _mm_storeu_si128((__m128i *)sums, acc);
+#else
+      sums[0] = sums[1] = sums[2] = sums[3] = 0;
+      for (int yy = 0; yy < scale; yy++) {
+        const uint32 *row = box + yy * width;
         for (int xx = 0; xx < scale; xx++) {
-          const auto [r, g, b, a] = GetPixel(x * scale + xx,
-                                             y * scale + yy);
-
-          // color contributions are alpha-weighted
-          rr += r * a;
-          gg += g * a;
-          bb += b * a;
-          aa += a;
+          const uint32 c = row[xx];
+          const uint32 a = c & 0xFF;
+          sums[0] += a;
+          sums[1] += ((c >> 8) & 0xFF) * a;
+          sums[2] += ((c >> 16) & 0xFF) * a;
+          sums[3] += (c >> 24) * a;
         }
       }
-
-      // Otherwise, the color can be anything, but output black.
+#endif
+      // With no alpha, the color can be anything, but output black.
+      uint32 rr = sums[3], gg = sums[2], bb = sums[1], aa = sums[0];
       if (aa > 0) {
         rr /= aa;
         gg /= aa;
         bb /= aa;
         aa /= scale * scale;
       }
-      ret.SetPixel(x, y, (uint8)rr, (uint8)gg, (uint8)bb, (uint8)aa);
+      ret.rgba[y * ww + x] = Pack32(rr, gg, bb, aa);
     }
   }
   return ret;
 }
 
-
 void ImageRGBA::Clear32(uint32 color) {
-  for (uint32 &c : rgba) c = color;
+  // Compilers vectorize this well, including with wider registers
+  // than SSE2.
+  std::fill(rgba.begin(), rgba.end(), color);
 }
 
 void ImageRGBA::Clear(uint8 r, uint8 g, uint8 b, uint8 a) {
@@ -368,10 +518,13 @@ void ImageRGBA::BlendPixel32(int x, int y, uint32 color) {
 
 void ImageRGBA::BlendRect(int x, int y, int w, int h,
                           uint8 r, uint8 g, uint8 b, uint8 a) {
-  // Easy to clip this to the screen. We could call an unclipped
-  // version of BlendPixel here.
-  if (y < 0) { w += y; y = 0; }
-  if (x < 0) { h += x; x = 0; }
+  BlendRect32(x, y, w, h, Pack32(r, g, b, a));
+}
+
+void ImageRGBA::BlendRect32(int x, int y, int w, int h, uint32 color) {
+  // Easy to clip this to the screen.
+  if (y < 0) { h += y; y = 0; }
+  if (x < 0) { w += x; x = 0; }
 
   const int yover = (y + h) - height;
   if (yover > 0) h -= yover;
@@ -380,16 +533,8 @@ void ImageRGBA::BlendRect(int x, int y, int w, int h,
 
   if (w <= 0 || h <= 0) return;
 
-  for (int yy = y; yy < y + h; yy++) {
-    for (int xx = x; xx < x + w; xx++) {
-      BlendPixel(xx, yy, r, g, b, a);
-    }
-  }
-}
-
-void ImageRGBA::BlendRect32(int x, int y, int w, int h, uint32 color) {
-  const auto [r, g, b, a] = Unpack32(color);
-  BlendRect(x, y, w, h, r, g, b, a);
+  for (int yy = y; yy < y + h; yy++)
+    BlendSpanConst(&rgba[yy * width + x], w, color);
 }
 
 void ImageRGBA::BlendBox32(int x, int y, int w, int h,
@@ -537,112 +682,84 @@ void ImageRGBA::BlendFilledCircle32(int x, int y, int r, uint32 color) {
 }
 
 void ImageRGBA::BlendImage(int x, int y, const ImageRGBA &other) {
-  // PERF can factor out the pixel clipping here, supposing the
-  // compiler cannot.
-  for (int yy = 0; yy < other.height; yy++) {
-    int yyy = y + yy;
-    // Exit early if off-screen.
-    if (yyy >= height) break;
-    for (int xx = 0; xx < other.width; xx++) {
-      int xxx = x + xx;
-      if (xxx >= width) break;
-      BlendPixel32(xxx, yyy, other.GetPixel32(xx, yy));
-    }
-  }
+  BlendImageRect(x, y, other, 0, 0, other.width, other.height);
 }
 
 void ImageRGBA::BlendImageRect(int dstx, int dsty, const ImageRGBA &other,
                                int srcx, int srcy, int srcw, int srch) {
+  // Clip once; then each row is a contiguous span in both images.
+  if (!ClipSpan(&srcy, &dsty, &srch, other.height, height)) return;
+  if (!ClipSpan(&srcx, &dstx, &srcw, other.width, width)) return;
   for (int yy = 0; yy < srch; yy++) {
-    const int syy = srcy + yy;
-    const int dyy = dsty + yy;
-    // Exit early if outside dstination.
-    if (dyy >= height) break;
-    // Exit early if outside source.
-    if (syy >= other.height) break;
-
-    if (syy >= 0 && dyy >= 0) {
-      for (int xx = 0; xx < srcw; xx++) {
-        const int sxx = srcx + xx;
-        const int dxx = dstx + xx;
-        if (dxx >= width) break;
-        if (sxx >= other.width) break;
-
-        if (sxx >= 0 && dxx >= 0) {
-          BlendPixel32(dxx, dyy, other.GetPixel32(sxx, syy));
-        }
-      }
-    }
+    BlendSpan(&rgba[(dsty + yy) * width + dstx],
+              &other.rgba[(srcy + yy) * other.width + srcx],
+              srcw);
   }
 }
 
 void ImageRGBA::CopyImage(int x, int y, const ImageRGBA &other) {
-  // PERF can factor out the pixel clipping here, supposing the
-  // compiler cannot.
-  for (int yy = 0; yy < other.height; yy++) {
-    int yyy = y + yy;
-    // Exit early if off-screen.
-    if (yyy >= height) break;
-    for (int xx = 0; xx < other.width; xx++) {
-      int xxx = x + xx;
-      if (xxx >= width) break;
-      SetPixel32(xxx, yyy, other.GetPixel32(xx, yy));
-    }
-  }
+  CopyImageRect(x, y, other, 0, 0, other.width, other.height);
 }
 
 void ImageRGBA::CopyImageRect(int dstx, int dsty, const ImageRGBA &other,
                               int srcx, int srcy, int srcw, int srch) {
-  for (int yy = 0; yy < srch; yy++) {
-    const int syy = srcy + yy;
-    const int dyy = dsty + yy;
-    // Exit early if outside dstination.
-    if (dyy >= height) break;
-    // Exit early if outside source.
-    if (syy >= other.height) break;
-
-    if (syy >= 0 && dyy >= 0) {
-      for (int xx = 0; xx < srcw; xx++) {
-        const int sxx = srcx + xx;
-        const int dxx = dstx + xx;
-        if (dxx >= width) break;
-        if (sxx >= other.width) break;
-
-        if (sxx >= 0 && dxx >= 0) {
-          SetPixel32(dxx, dyy, other.GetPixel32(sxx, syy));
-        }
-      }
-    }
+  if (!ClipSpan(&srcy, &dsty, &srch, other.height, height)) return;
+  if (!ClipSpan(&srcx, &dstx, &srcw, other.width, width)) return;
+  // other may be this image, so rows can overlap. Copy downward when
+  // the destination is below the source, so that no row is read
+  // after being overwritten.
+  const bool down = &other == this && dsty > srcy;
+  for (int i = 0; i < srch; i++) {
+    const int yy = down ? srch - 1 - i : i;
+    memmove(&rgba[(dsty + yy) * width + dstx],
+            &other.rgba[(srcy + yy) * other.width + srcx],
+            srcw * sizeof (uint32));
   }
 }
 
-
-template<class F>
-inline static ImageA Extract(const ImageRGBA &img, const F &f) {
-  ImageA ret(img.Width(), img.Height());
-  for (int y = 0; y < img.Height(); y++) {
-    for (int x = 0; x < img.Width(); x++) {
-      const auto [r, g, b, a] = img.GetPixel(x, y);
-      ret.SetPixel(x, y, f(r, g, b, a));
-    }
+// Copy the channel at the given bit position into an ImageA.
+static void ExtractChannel(const uint32 *src, int n, int shift, uint8 *dst) {
+  int i = 0;
+#ifdef IMAGE_SSE2
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  const __m128i count = _mm_cvtsi32_si128(shift);
+  auto Load = [src, mask, count](int j) {
+      return _mm_and_si128(
+          _mm_srl_epi32(_mm_loadu_si128((const __m128i *)(src + j)), count),
+          mask);
+    };
+  for (; i + 16 <= n; i += 16) {
+    // Values are at most 255, so the saturating packs are exact.
+    const __m128i lo = _mm_packs_epi32(Load(i), Load(i + 4));
+    const __m128i hi = _mm_packs_epi32(Load(i + 8), Load(i + 12));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
   }
-  return ret;
+#endif
+  for (; i < n; i++) dst[i] = (src[i] >> shift) & 0xFF;
 }
 
 ImageA ImageRGBA::Red() const {
-  return Extract(*this, [](uint8 r, uint8 g, uint8 b, uint8 a) { return r; });
+  ImageA ret(width, height);
+  ExtractChannel(rgba.data(), width * height, 24, ret.alpha.data());
+  return ret;
 }
 
 ImageA ImageRGBA::Green() const {
-  return Extract(*this, [](uint8 r, uint8 g, uint8 b, uint8 a) { return g; });
+  ImageA ret(width, height);
+  ExtractChannel(rgba.data(), width * height, 16, ret.alpha.data());
+  return ret;
 }
 
 ImageA ImageRGBA::Blue() const {
-  return Extract(*this, [](uint8 r, uint8 g, uint8 b, uint8 a) { return b; });
+  ImageA ret(width, height);
+  ExtractChannel(rgba.data(), width * height, 8, ret.alpha.data());
+  return ret;
 }
 
 ImageA ImageRGBA::Alpha() const {
-  return Extract(*this, [](uint8 r, uint8 g, uint8 b, uint8 a) { return a; });
+  ImageA ret(width, height);
+  ExtractChannel(rgba.data(), width * height, 0, ret.alpha.data());
+  return ret;
 }
 
 ImageRGBA ImageRGBA::FromChannels(const ImageA &red,
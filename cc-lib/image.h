@@ -31,6 +31,7 @@ struct ImageRGBA {
   int Width() const { return width; }
   int Height() const { return height; }
 
+  bool operator ==(const ImageRGBA &other) const;
 
   static ImageRGBA *Load(const std::string &filename);
   static ImageRGBA *LoadFromMemory(const std::vector<uint8> &bytes);
@@ -208,6 +209,7 @@ struct ImageA {
   float SampleBilinear(float x, float y) const;
 
 private:
+  friend struct ImageRGBA;
   int width, height;
   // Size width * height.
   std::vector<uint8> alpha;
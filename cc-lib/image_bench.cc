@@ -69,9 +69,172 @@ static void BenchClear32() {
          NUM_CLEARS / (sec * 1000.0));
 }
 
+// Random pixels, with runs of fully opaque and fully transparent
+// ones like a typical sprite.
+static ImageRGBA RandomImage(ArcFour *rc, int w, int h) {
+  ImageRGBA img(w, h);
+  int mode = 0;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      if (RandTo(rc, 16) == 0) mode = RandTo(rc, 3);
+      uint32_t c = Rand32(rc);
+      if (mode == 1) c |= 0xFF;
+      else if (mode == 2) c &= 0xFFFFFF00;
+      img.SetPixel32(x, y, c);
+    }
+  }
+  return img;
+}
+
+// Seconds per call of f, run n times.
+template<class F>
+static double Time(int n, const F &f) {
+  Timer timer;
+  for (int i = 0; i < n; i++) f();
+  return timer.Seconds() / n;
+}
+
+static void Report(const char *what, int64 pixels,
+                   double sec, double scalar_sec) {
+  printf("%-16s %9.1f Mp/sec  (pixel-at-a-time %7.1f Mp/sec) %6.1fx\n",
+         what, pixels / (sec * 1000000.0),
+         pixels / (scalar_sec * 1000000.0), scalar_sec / sec);
+}
+
+// The operations with SIMD implementations, against the same thing
+// done a pixel at a time through GetPixel/SetPixel/BlendPixel, as
+// the code was before. image_test checks that they agree.
+static void BenchOps() {
+  ArcFour rc("bench");
+  const ImageRGBA base = RandomImage(&rc, 1024, 768);
+  const ImageRGBA sprite = RandomImage(&rc, 300, 200);
+  const int64 size = base.Width() * base.Height();
+
+  {
+    ImageRGBA a = base, b = base;
+    double sec = Time(200, [&a]() {
+        a.BlendRect32(-10, 5, 1000, 900, 0x33669980); });
+    double scalar_sec = Time(20, [&b]() {
+        for (int y = 5; y < 5 + 900; y++)
+          for (int x = -10; x < -10 + 1000; x++)
+            b.BlendPixel32(x, y, 0x33669980);
+      });
+    Report("BlendRect32", 990 * 763, sec, scalar_sec);
+  }
+
+  {
+    // Sprites all over, some clipped.
+    ImageRGBA a = base, b = base;
+    double sec = Time(50, [&a, &sprite]() {
+        for (int y = -100; y < 768; y += 150)
+          for (int x = -100; x < 1024; x += 250)
+            a.BlendImage(x, y, sprite);
+      });
+    double scalar_sec = Time(5, [&b, &sprite]() {
+        for (int y = -100; y < 768; y += 150)
+          for (int x = -100; x < 1024; x += 250)
+            for (int yy = 0; yy < sprite.Height(); yy++)
+              for (int xx = 0; xx < sprite.Width(); xx++)
+                b.BlendPixel32(x + xx, y + yy, sprite.GetPixel32(xx, yy));
+      });
+    Report("BlendImage", size, sec, scalar_sec);
+  }
+
+  {
+    ImageRGBA a(1024, 768), b(1024, 768);
+    double sec = Time(500, [&a, &base]() { a.CopyImage(-3, 7, base); });
+    double scalar_sec = Time(20, [&b, &base]() {
+        for (int y = 0; y < base.Height(); y++)
+          for (int x = 0; x < base.Width(); x++)
+            b.SetPixel32(x - 3, y + 7, base.GetPixel32(x, y));
+      });
+    Report("CopyImage", size, sec, scalar_sec);
+  }
+
+  for (int scale : {2, 3}) {
+    ImageRGBA a, b;
+    double sec = Time(50, [&]() { a = base.ScaleBy(scale); });
+    double scalar_sec = Time(5, [&]() {
+        b = ImageRGBA(base.Width() * scale, base.Height() * scale);
+        for (int y = 0; y < b.Height(); y++)
+          for (int x = 0; x < b.Width(); x++)
+            b.SetPixel32(x, y, base.GetPixel32(x / scale, y / scale));
+      });
+    Report(StringPrintf("ScaleBy(%d)", scale).c_str(),
+           size * scale * scale, sec, scalar_sec);
+
+    sec = Time(50, [&]() { a = base.ScaleDownBy(scale); });
+    scalar_sec = Time(5, [&]() {
+        b = ImageRGBA(base.Width() / scale, base.Height() / scale);
+        for (int y = 0; y < b.Height(); y++) {
+          for (int x = 0; x < b.Width(); x++) {
+            uint32_t rr = 0, gg = 0, bb = 0, aa = 0;
+            for (int yy = 0; yy < scale; yy++) {
+              for (int xx = 0; xx < scale; xx++) {
+                const auto [r, g, bl, al] =
+                  base.GetPixel(x * scale + xx, y * scale + yy);
+                rr += r * al;
+                gg += g * al;
+                bb += bl * al;
+                aa += al;
+              }
+            }
+            if (aa > 0) {
+              rr /= aa;
+              gg /= aa;
+              bb /= aa;
+              aa /= scale * scale;
+            }
+            b.SetPixel(x, y, rr, gg, bb, aa);
+          }
+        }
+      });
+    Report(StringPrintf("ScaleDownBy(%d)", scale).c_str(),
+           size, sec, scalar_sec);
+  }
+
+  {
+    ImageRGBA a = base, b = base;
+    double sec = Time(500, [&a]() { a.Clear32(0x11223344); });
+    double scalar_sec = Time(50, [&b]() {
+        for (int y = 0; y < b.Height(); y++)
+          for (int x = 0; x < b.Width(); x++)
+            b.SetPixel32(x, y, 0x11223344);
+      });
+    Report("Clear32", size, sec, scalar_sec);
+  }
+
+  {
+    const char *names[4] = {"Red", "Green", "Blue", "Alpha"};
+    for (int c = 0; c < 4; c++) {
+      ImageA a, b;
+      double sec = Time(200, [&]() {
+          switch (c) {
+          case 0: a = base.Red(); break;
+          case 1: a = base.Green(); break;
+          case 2: a = base.Blue(); break;
+          default: a = base.Alpha(); break;
+          }
+        });
+      double scalar_sec = Time(20, [&]() {
+          b = ImageA(base.Width(), base.Height());
+          for (int y = 0; y < base.Height(); y++) {
+            for (int x = 0; x < base.Width(); x++) {
+              const auto [r, g, bl, al] = base.GetPixel(x, y);
+              const uint8_t v[4] = {r, g, bl, al};
+              b.SetPixel(x, y, v[c]);
+            }
+          }
+        });
+      Report(names[c], size, sec, scalar_sec);
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   BenchBlendPixel();
   BenchClear32();
+  BenchOps();
   
   printf("OK\n");
   return 0;
@@ -131,6 +131,235 @@ static void TestFilledCircle() {
   // TODO: More circle tests
 }
 
+// Straightforward pixel-at-a-time versions of ImageRGBA operations
+// that have optimized implementations, to test those against. They
+// use only the public interface, and rely on SetPixel and BlendPixel
+// to clip. Mostly they follow the original code, but RefBlendRect32
+// doesn't copy its clipping, which was wrong when x < 0.
+static ImageRGBA RefScaleBy(const ImageRGBA &img, int scale) {
+  CHECK(scale >= 1);
+  ImageRGBA ret(img.Width() * scale, img.Height() * scale);
+  for (int y = 0; y < img.Height(); y++) {
+    for (int x = 0; x < img.Width(); x++) {
+      const uint32 color = img.GetPixel32(x, y);
+      for (int yy = 0; yy < scale; yy++) {
+        for (int xx = 0; xx < scale; xx++) {
+          ret.SetPixel32(x * scale + xx,
+                         y * scale + yy,
+                         color);
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+static ImageRGBA RefScaleDownBy(const ImageRGBA &img, int scale) {
+  CHECK(scale >= 1);
+  const int ww = img.Width() / scale;
+  const int hh = img.Height() / scale;
+  ImageRGBA ret(ww, hh);
+  for (int y = 0; y < hh; y++) {
+    for (int x = 0; x < ww; x++) {
+      uint32 rr = 0, gg = 0, bb = 0, aa = 0;
+      for (int yy = 0; yy < scale; yy++) {
+        for (int xx = 0; xx < scale; xx++) {
+          const auto [r, g, b, a] = img.GetPixel(x * scale + xx,
+                                                 y * scale + yy);
+
+          // color contributions are alpha-weighted
+          rr += r * a;
+          gg += g * a;
+          bb += b * a;
+          aa += a;
+        }
+      }
+
+      // Otherwise, the color can be anything, but output black.
+      if (aa > 0) {
+        rr /= aa;
+        gg /= aa;
+        bb /= aa;
+        aa /= scale * scale;
+      }
+      ret.SetPixel(x, y, (uint8)rr, (uint8)gg, (uint8)bb, (uint8)aa);
+    }
+  }
+  return ret;
+}
+
+static void RefClear32(ImageRGBA *img, uint32 color) {
+  for (int y = 0; y < img->Height(); y++)
+    for (int x = 0; x < img->Width(); x++)
+      img->SetPixel32(x, y, color);
+}
+
+static void RefBlendRect32(ImageRGBA *img, int x, int y, int w, int h,
+                           uint32 color) {
+  for (int yy = y; yy < y + h; yy++)
+    for (int xx = x; xx < x + w; xx++)
+      img->BlendPixel32(xx, yy, color);
+}
+
+static void RefBlendImageRect(
+    ImageRGBA *img, int dstx, int dsty, const ImageRGBA &other,
+    int srcx, int srcy, int srcw, int srch) {
+  for (int yy = 0; yy < srch; yy++) {
+    const int syy = srcy + yy;
+    const int dyy = dsty + yy;
+    if (syy < 0 || syy >= other.Height()) continue;
+    for (int xx = 0; xx < srcw; xx++) {
+      const int sxx = srcx + xx;
+      if (sxx < 0 || sxx >= other.Width()) continue;
+      // BlendPixel clips the destination.
+      img->BlendPixel32(dstx + xx, dyy, other.GetPixel32(sxx, syy));
+    }
+  }
+}
+
+static void RefCopyImageRect(
+    ImageRGBA *img, int dstx, int dsty, const ImageRGBA &other,
+    int srcx, int srcy, int srcw, int srch) {
+  for (int yy = 0; yy < srch; yy++) {
+    const int syy = srcy + yy;
+    const int dyy = dsty + yy;
+    if (syy < 0 || syy >= other.Height()) continue;
+    for (int xx = 0; xx < srcw; xx++) {
+      const int sxx = srcx + xx;
+      if (sxx < 0 || sxx >= other.Width()) continue;
+      // SetPixel clips the destination.
+      img->SetPixel32(dstx + xx, dyy, other.GetPixel32(sxx, syy));
+    }
+  }
+}
+
+static ImageA RefChannel(const ImageRGBA &img, int c) {
+  CHECK(c >= 0 && c < 4);
+  ImageA ret(img.Width(), img.Height());
+  for (int y = 0; y < img.Height(); y++) {
+    for (int x = 0; x < img.Width(); x++) {
+      const auto [r, g, b, a] = img.GetPixel(x, y);
+      const uint8 v[4] = {r, g, b, a};
+      ret.SetPixel(x, y, v[c]);
+    }
+  }
+  return ret;
+}
+
+// Random pixels, with runs of fully opaque and fully transparent
+// ones, which the SIMD code treats specially.
+static ImageRGBA RandomImage(ArcFour *rc, int w, int h) {
+  ImageRGBA img(w, h);
+  int mode = 0;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      if (RandTo(rc, 8) == 0) mode = RandTo(rc, 3);
+      uint32 c = Rand32(rc);
+      if (mode == 1) c |= 0xFF;
+      else if (mode == 2) c &= 0xFFFFFF00;
+      img.SetPixel32(x, y, c);
+    }
+  }
+  return img;
+}
+
+// The optimized operations against their straightforward versions,
+// including clipping on every side.
+static void TestAgainstReference() {
+  ArcFour rc("reference");
+  for (int iter = 0; iter < 500; iter++) {
+    const int w = RandTo(&rc, 40), h = RandTo(&rc, 40);
+    const ImageRGBA img = RandomImage(&rc, w, h);
+    const ImageRGBA other = RandomImage(&rc, RandTo(&rc, 30),
+                                        RandTo(&rc, 30));
+    auto Coord = [&rc]() { return (int)RandTo(&rc, 80) - 30; };
+
+    {
+      const uint32 color = Rand32(&rc);
+      const int x = Coord(), y = Coord();
+      const int rw = Coord(), rh = Coord();
+      ImageRGBA a = img, b = img;
+      a.BlendRect32(x, y, rw, rh, color);
+      RefBlendRect32(&b, x, y, rw, rh, color);
+      CHECK(a == b) << x << " " << y << " " << rw << " " << rh;
+      // And the ends of the alpha range.
+      a.BlendRect32(x, y, rw, rh, color | 0xFF);
+      RefBlendRect32(&b, x, y, rw, rh, color | 0xFF);
+      a.BlendRect32(y, x, rh, rw, color & ~0xFF);
+      RefBlendRect32(&b, y, x, rh, rw, color & ~0xFF);
+      CHECK(a == b);
+    }
+
+    {
+      const int x = Coord(), y = Coord();
+      ImageRGBA a = img, b = img;
+      a.BlendImage(x, y, other);
+      RefBlendImageRect(&b, x, y, other, 0, 0, other.Width(), other.Height());
+      CHECK(a == b) << x << " " << y;
+
+      a.CopyImage(x, y, other);
+      RefCopyImageRect(&b, x, y, other, 0, 0, other.Width(), other.Height());
+      CHECK(a == b) << x << " " << y;
+    }
+
+    {
+      const int dx = Coord(), dy = Coord(), sx = Coord(), sy = Coord();
+      const int sw = Coord(), sh = Coord();
+      ImageRGBA a = img, b = img;
+      a.BlendImageRect(dx, dy, other, sx, sy, sw, sh);
+      RefBlendImageRect(&b, dx, dy, other, sx, sy, sw, sh);
+      CHECK(a == b);
+
+      a.CopyImageRect(dx, dy, other, sx, sy, sw, sh);
+      RefCopyImageRect(&b, dx, dy, other, sx, sy, sw, sh);
+      CHECK(a == b);
+
+      // Within one image, nearby so that the rectangles usually
+      // overlap. This is as though the source were copied first.
+      const int ox = sx + (int)RandTo(&rc, 11) - 5;
+      const int oy = sy + (int)RandTo(&rc, 11) - 5;
+      const ImageRGBA before = b;
+      a.CopyImageRect(ox, oy, a, sx, sy, sw, sh);
+      RefCopyImageRect(&b, ox, oy, before, sx, sy, sw, sh);
+      CHECK(a == b) << ox << " " << oy << " " << sx << " " << sy;
+    }
+
+    {
+      const int scale = 1 + RandTo(&rc, 6);
+      CHECK(img.ScaleBy(scale) == RefScaleBy(img, scale));
+      CHECK(img.ScaleDownBy(scale) == RefScaleDownBy(img, scale)) << scale;
+    }
+
+    {
+      const uint32 color = Rand32(&rc);
+      ImageRGBA a = img, b = img;
+      a.Clear32(color);
+      RefClear32(&b, color);
+      CHECK(a == b);
+    }
+
+    CHECK(img.Red() == RefChannel(img, 0));
+    CHECK(img.Green() == RefChannel(img, 1));
+    CHECK(img.Blue() == RefChannel(img, 2));
+    CHECK(img.Alpha() == RefChannel(img, 3));
+  }
+
+  // Every pair of colors and alphas, through both blends.
+  for (int a = 0; a < 256; a++) {
+    ImageRGBA src(256, 256), dst(256, 256);
+    for (int y = 0; y < 256; y++) {
+      for (int x = 0; x < 256; x++) {
+        src.SetPixel(x, y, x, y, 255 - x, a);
+        dst.SetPixel(x, y, y, x, 255 - y, 0xFF);
+      }
+    }
+    ImageRGBA ref = dst;
+    dst.BlendImage(0, 0, src);
+    RefBlendImageRect(&ref, 0, 0, src, 0, 0, 256, 256);
+    CHECK(dst == ref) << a;
+  }
+}
+
 int main(int argc, char **argv) {
   TestCreateAndDestroy();
   TestBilinearResize();
@@ -139,6 +368,7 @@ int main(int argc, char **argv) {
   TestScaleDown();
   TestLineEndpoints();
   TestFilledCircle();
+  TestAgainstReference();
   
   // TODO: More image tests!
   
@@ -8,6 +8,14 @@
 #include <functional>
 #include <cstdint>
 #include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <variant>
+#include <chrono>
 
 #if __cplusplus >= 201703L
 // shared_mutex only available in C++17 and later.
@@ -67,10 +75,186 @@ void WriteWithLock(std::shared_mutex *m, T *t, const T &val) {
 }
 #endif
 
-// TODO: Could have an optimism parameter for most of these that
-// causes each thread to grab up to N work items (using num_threads as
-// a stride) before starting to synchronize for indices. If each item
-// takes the same amount of time, this just has less overhead.
+// Process-wide pool of threads that the Parallel* functions below
+// run on, so that calling them in an inner loop doesn't start and
+// join threads every time.
+//
+// Run splits [0, num) into a contiguous range for each participant
+// and hands them out in chunks; a participant that runs out of its
+// own range steals chunks from the others'. The calling thread is
+// always a participant, so a call from within a task (nested
+// parallelism) makes progress even if all the pool's threads are
+// busy; any idle ones join in.
+//
+// max_concurrency is an upper bound. Run never uses more participants
+// than the pool has (the default pool has one thread per hardware
+// thread, counting the caller), and nothing is guaranteed to run
+// concurrently, so tasks must not wait on one another. Work that
+// needs that many threads at once (tasks that block on each other,
+// or lots of slow I/O) should use ParallelFan or InParallel, which
+// always start threads.
+//
+// The pool also runs asynchronous tasks (Submit; see Async and
+// Future below), when it has no parallel loops to help with.
+struct WorkStealingPool {
+  // Pool with the given number of threads, not counting callers.
+  explicit WorkStealingPool(int num_threads) {
+    threads.reserve(num_threads);
+    for (int i = 0; i < num_threads; i++)
+      threads.emplace_back([this]() { Worker(); });
+  }
+
+  // Process-wide pool. Never destroyed. Has at least one thread,
+  // so that submitted tasks run even if nobody waits for them.
+  static WorkStealingPool *Default() {
+    static WorkStealingPool *pool =
+      new WorkStealingPool(
+          std::max((int)std::thread::hardware_concurrency() - 1, 1));
+    return pool;
+  }
+
+  // Run f on some pool thread, eventually.
+  void Submit(std::function<void()> f) {
+    {
+      MutexLock ml(&m);
+      tasks.push_back(std::move(f));
+    }
+    work_cond.notify_one();
+  }
+
+  // Threads in the pool, plus one for the caller.
+  int Participants() const { return (int)threads.size() + 1; }
+
+  // Number of participants Run will use, which is also a bound on
+  // the slot argument it passes.
+  int Slots(int64_t num, int max_concurrency) const {
+    int64_t slots = std::min((int64_t)Participants(), num);
+    slots = std::min(slots, (int64_t)max_concurrency);
+    return (int)std::max(slots, (int64_t)1);
+  }
+
+  // Call body(slot, start, end) for disjoint ranges [start, end) that
+  // cover [0, num), returning once they're all done. Calls with the
+  // same slot are never concurrent, so they can share per-slot state.
+  void Run(int64_t num, int max_concurrency,
+           const std::function<void(int, int64_t, int64_t)> &body) {
+    if (num <= 0) return;
+    const int slots = Slots(num, max_concurrency);
+    if (slots == 1) {
+      body(0, 0, num);
+      return;
+    }
+
+    Job job(num, slots, &body);
+    {
+      MutexLock ml(&m);
+      queue.push_back(&job);
+    }
+    for (int i = 1; i < slots; i++) work_cond.notify_one();
+
+    job.Participate(0);
+
+    // The work is all claimed, but others may still be running it.
+    std::unique_lock<std::mutex> ul(m);
+    auto it = std::find(queue.begin(), queue.end(), &job);
+    if (it != queue.end()) queue.erase(it);
+    job.done.wait(ul, [&job]() { return job.active == 0; });
+  }
+
+  ~WorkStealingPool() {
+    {
+      MutexLock ml(&m);
+      should_die = true;
+    }
+    work_cond.notify_all();
+    for (std::thread &t : threads) t.join();
+  }
+
+ private:
+  struct Job {
+    Job(int64_t num, int slots,
+        const std::function<void(int, int64_t, int64_t)> *body) :
+      body(body), num_slots(slots),
+      // Chunks are small enough that stealing can balance uneven
+      // work, but big enough to amortize the atomic operation.
+      chunk(std::max(num / (slots * 16), (int64_t)1)),
+      ranges(new Range[slots]) {
+      for (int s = 0; s < slots; s++) {
+        ranges[s].next.store((num * s) / slots, std::memory_order_relaxed);
+        ranges[s].end = (num * (s + 1)) / slots;
+      }
+    }
+
+    // Run chunks from our own range, then everyone else's.
+    void Participate(int slot) {
+      for (int k = 0; k < num_slots; /* in loop */) {
+        Range &r = ranges[(slot + k) % num_slots];
+        const int64_t start =
+          r.next.fetch_add(chunk, std::memory_order_relaxed);
+        if (start >= r.end) {
+          k++;
+        } else {
+          (*body)(slot, start, std::min(start + chunk, r.end));
+        }
+      }
+    }
+
+    struct alignas(64) Range {
+      std::atomic<int64_t> next{0};
+      int64_t end = 0;
+    };
+
+    const std::function<void(int, int64_t, int64_t)> *body = nullptr;
+    const int num_slots = 0;
+    const int64_t chunk = 1;
+    std::unique_ptr<Range[]> ranges;
+    // These are protected by the pool's mutex. The caller is
+    // slot 0.
+    int next_slot = 1;
+    int active = 0;
+    std::condition_variable done;
+  };
+
+  void Worker() {
+    std::unique_lock<std::mutex> ul(m);
+    for (;;) {
+      work_cond.wait(ul, [this]() {
+          return should_die || !queue.empty() || !tasks.empty();
+        });
+      if (should_die) return;
+
+      // Parallel loops first, since someone is waiting for them.
+      if (queue.empty()) {
+        std::function<void()> f = std::move(tasks.front());
+        tasks.pop_front();
+        ul.unlock();
+        f();
+        ul.lock();
+        continue;
+      }
+
+      Job *job = queue.front();
+      const int slot = job->next_slot++;
+      if (job->next_slot == job->num_slots) queue.pop_front();
+      job->active++;
+      ul.unlock();
+
+      job->Participate(slot);
+
+      ul.lock();
+      if (--job->active == 0) job->done.notify_all();
+    }
+  }
+
+  std::mutex m;
+  std::condition_variable work_cond;
+  // Jobs that can take more participants.
+  std::deque<Job *> queue;
+  // Submitted tasks, in order.
+  std::deque<std::function<void()>> tasks;
+  bool should_die = false;
+  std::vector<std::thread> threads;
+};
 
 // A thing that comes up often is where we want to accumulate a
 // sum (maybe on many variables) over an array in parallel. The
@@ -88,54 +272,21 @@ Res ParallelAccumulate(int64_t num,
                        const Add &add,
                        const F &f,
                        int max_concurrency) {
-  if (max_concurrency > num) max_concurrency = num;
-  // Need at least one thread for correctness.
-  int num_threads = std::max(max_concurrency, 1);
-
-  std::mutex index_m;
-  // First num_threads indices are assigned from the start
-  int64_t next_index = num_threads;
-
-  // Each thread gets its own accumulator so there's no need to
+  WorkStealingPool *pool = WorkStealingPool::Default();
+  // Each participant gets its own accumulator so there's no need to
   // synchronize access.
-  std::vector<Res> accs(num_threads, zero);
-
-  auto th = [&accs,
-             &index_m, &next_index, num, &f](int thread_num) {
-    // PERF consider creating the accumulator in the thread as
-    // a local, for numa etc.?
-    int my_idx = thread_num;
-    Res *my_acc = &accs[thread_num];
-    do {
-      // Do work, not holding any locks.
-      (void)f(my_idx, my_acc);
-
-      // Get next index, if any.
-      index_m.lock();
-      if (next_index == num) {
-        // All done. Don't increment counter so that other threads can
-        // notice this too.
-        index_m.unlock();
-        return;
-      }
-      my_idx = next_index++;
-      index_m.unlock();
-    } while (true);
-  };
+  std::vector<Res> accs(pool->Slots(num, max_concurrency), zero);
+  pool->Run(num, max_concurrency,
+            [&accs, &f](int slot, int64_t start, int64_t end) {
+              // PERF consider creating the accumulator in the thread as
+              // a local, for numa etc.?
+              Res *my_acc = &accs[slot];
+              for (int64_t i = start; i < end; i++)
+                (void)f(i, my_acc);
+            });
 
-  std::vector<std::thread> threads;
-  threads.reserve(num_threads);
-  for (int i = 0; i < num_threads; i++) {
-    threads.emplace_back(th, i);
-  }
-
-  // Wait for each thread to finish, and accumulate the thread-local
-  // values into the final one as we do.
   Res res = zero;
-  for (int i = 0; i < num_threads; i++) {
-    threads[i].join();
-    res = add(res, accs[i]);
-  }
+  for (const Res &acc : accs) res = add(res, acc);
   return res;
 }
 
@@ -152,39 +303,11 @@ template<class F>
 void ParallelComp(int64_t num,
                   const F &f,
                   int max_concurrency) {
-  max_concurrency = std::min(num, (int64_t)max_concurrency);
-  // Need at least one thread for correctness.
-  max_concurrency = std::max(max_concurrency, 1);
-  std::mutex index_m;
-  int64_t next_index = 0;
-
-  // Thread applies f repeatedly until there are no more indices.
-  // PERF: Can just start each thread knowing its start index, and avoid
-  // the synchronization overhead at startup.
-  auto th = [&index_m, &next_index, num, &f]() {
-    for (;;) {
-      index_m.lock();
-      if (next_index == num) {
-        // All done. Don't increment counter so that other threads can
-        // notice this too.
-        index_m.unlock();
-        return;
-      }
-      int64_t my_index = next_index++;
-      index_m.unlock();
-
-      // Do work, not holding mutex.
-      (void)f(my_index);
-    }
-  };
-
-  std::vector<std::thread> threads;
-  threads.reserve(max_concurrency);
-  for (int i = 0; i < max_concurrency; i++) {
-    threads.emplace_back(th);
-  }
-  // Now just wait for them all to finish.
-  for (std::thread &t : threads) t.join();
+  WorkStealingPool::Default()->Run(
+      num, max_concurrency,
+      [&f](int slot_unused, int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; i++) (void)f(i);
+      });
 }
 
 // Drop-in serial replacement for debugging, etc.
@@ -225,20 +348,6 @@ void UnParallelApp(const std::vector<T> &vec,
   for (const auto &t : vec) f(t);
 }
 
-// e.g. InParallel(
-//    []() { some code; },
-//    []() { some more code; }
-// );
-
-template<class... Fs>
-inline void InParallel(Fs... fs) {
-  // PERF: Can we do this without copying?
-  std::vector v{std::function<void(void)>(fs)...};
-  ParallelApp(v, [](const std::function<void(void)> &f) {
-      f();
-    }, v.size());
-}
-
 
 // Generate the vector containing {f(0), f(1), ..., f(num - 1)}.
 template<class F>
@@ -377,6 +486,305 @@ void ParallelFan(int num_threads, const F &f) {
   for (std::thread &t : threads) t.join();
 }
 
+// e.g. InParallel(
+//    []() { some code; },
+//    []() { some more code; }
+// );
+// Each gets its own thread, so they really are run in parallel.
+template<class... Fs>
+inline void InParallel(Fs... fs) {
+  // PERF: Can we do this without copying?
+  std::vector v{std::function<void(void)>(fs)...};
+  ParallelFan(v.size(), [&v](int i) { v[i](); });
+}
+
+// Futures, for pipelines of asynchronous tasks on the default pool:
+//
+//   Future<Frame> frame = Async([&]() { return emu->Step(...); });
+//   Future<double> score = frame.Then([](const Frame &f) { ... });
+//   Future<vector<double>> all = WhenAll(std::move(scores));
+//   for (double d : all.Get()) ...
+//
+// A Future is a cheap shared handle. Functions are copied (so must
+// be copyable) and run on the pool once their inputs are ready. Get
+// blocks; while it waits, it runs the tasks its own future depends
+// on (its task, or the tasks of the futures it was made from) if no
+// thread has started them yet, so it can be called from inside a
+// task. It doesn't run unrelated tasks. It can still deadlock if
+// tasks on every pool thread are waiting for something that needs a
+// pool thread that's busy waiting; so tasks should not otherwise
+// block for a long time (e.g. on a BoundedQueue), since that ties up
+// a pool thread. Use threads of your own (InParallel, ParallelFan)
+// for that.
+template<class T> struct Future;
+
+namespace internal_threadutil {
+// What a Future<T> stores: T, or an empty value for void.
+template<class T>
+using Stored = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+// The part of a FutureState that doesn't depend on T.
+struct FutureBase {
+  // Claim the task that computes this, if it hasn't started, and run
+  // it. Returns true if it ran it.
+  bool RunTask() {
+    std::function<void()> f;
+    {
+      MutexLock ml(&m);
+      f = std::move(task);
+      task = nullptr;
+    }
+    if (!f) return false;
+    f();
+    return true;
+  }
+
+  // Same, but if the task is already taken (or doesn't exist yet),
+  // try the futures this is waiting for.
+  bool RunChain() {
+    if (RunTask()) return true;
+    std::vector<std::shared_ptr<FutureBase>> ins;
+    {
+      MutexLock ml(&m);
+      ins = inputs;
+    }
+    for (const auto &in : ins)
+      if (in->RunChain()) return true;
+    return false;
+  }
+
+  // Put the task on the pool; whoever gets to it first runs it.
+  static void Submit(const std::shared_ptr<FutureBase> &st,
+                     std::function<void()> f) {
+    {
+      MutexLock ml(&st->m);
+      st->task = std::move(f);
+    }
+    WorkStealingPool::Default()->Submit([st]() { st->RunTask(); });
+  }
+
+  std::mutex m;
+  std::condition_variable cond;
+  // Protected by m.
+  bool ready = false;
+  // Computes the value, until someone claims it.
+  std::function<void()> task;
+  // Futures whose values this one is waiting for, until ready.
+  std::vector<std::shared_ptr<FutureBase>> inputs;
+};
+
+template<class T>
+struct FutureState : public FutureBase {
+  void Set(Stored<T> v) {
+    std::vector<std::function<void()>> todo;
+    {
+      MutexLock ml(&m);
+      value.emplace(std::move(v));
+      ready = true;
+      inputs.clear();
+      todo.swap(callbacks);
+    }
+    cond.notify_all();
+    for (auto &f : todo) f();
+  }
+
+  // Run f now if ready; otherwise in the thread that sets the value.
+  void OnReady(std::function<void()> f) {
+    {
+      MutexLock ml(&m);
+      if (!ready) {
+        callbacks.push_back(std::move(f));
+        return;
+      }
+    }
+    f();
+  }
+
+  // Written once, holding m.
+  std::optional<Stored<T>> value;
+  std::vector<std::function<void()>> callbacks;
+};
+
+// Result type of a continuation f for a Future<T>.
+template<class T, class F>
+struct ThenResult { using type = std::invoke_result_t<F, const T &>; };
+template<class F>
+struct ThenResult<void, F> { using type = std::invoke_result_t<F>; };
+
+// Set the state to the result of calling g.
+template<class R, class G>
+void Fulfill(FutureState<R> *st, G &g) {
+  if constexpr (std::is_void_v<R>) {
+    g();
+    st->Set(std::monostate{});
+  } else {
+    st->Set(g());
+  }
+}
+}  // namespace internal_threadutil
+
+template<class T>
+struct Future {
+  using State = internal_threadutil::FutureState<T>;
+  explicit Future(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+  bool Ready() const {
+    MutexLock ml(&state->m);
+    return state->ready;
+  }
+
+  // Block until ready, running this future's unstarted tasks in the
+  // meantime.
+  void Wait() const {
+    for (;;) {
+      if (Ready()) return;
+      if (state->RunChain()) continue;
+      // Wake up now and then, since a continuation's task only
+      // exists once its input is ready.
+      std::unique_lock<std::mutex> ul(state->m);
+      state->cond.wait_for(ul, std::chrono::milliseconds(1),
+                           [this]() { return state->ready; });
+    }
+  }
+
+  // Wait and return the value (for Future<void>, nothing). The
+  // reference is valid as long as some Future for it exists, so on
+  // a temporary Future this returns a copy instead.
+  std::add_lvalue_reference_t<const T> Get() const & {
+    Wait();
+    if constexpr (!std::is_void_v<T>) return *state->value;
+  }
+  std::remove_const_t<T> Get() const && {
+    Wait();
+    if constexpr (!std::is_void_v<T>) return *state->value;
+  }
+
+  // Once this is ready, run f(value) (or f() for void) on the pool,
+  // giving a future for its result.
+  template<class F>
+  auto Then(F f) const {
+    using Res = typename internal_threadutil::ThenResult<T, F>::type;
+    auto next = std::make_shared<internal_threadutil::FutureState<Res>>();
+    std::shared_ptr<State> st = state;
+    next->inputs.push_back(st);
+    // The task is owned by next, so it doesn't hold a reference to it.
+    state->OnReady([st, next, f]() {
+        auto *nx = next.get();
+        internal_threadutil::FutureBase::Submit(next, [st, nx, f]() {
+            auto g = [&st, &f]() {
+                if constexpr (std::is_void_v<T>) {
+                  return f();
+                } else {
+                  return f(*st->value);
+                }
+              };
+            internal_threadutil::Fulfill(nx, g);
+          });
+      });
+    return Future<Res>(next);
+  }
+
+  // Run f() in some thread once ready, without a result. It should
+  // be quick, since it may run in whatever thread completes this.
+  void OnReady(std::function<void()> f) const {
+    state->OnReady(std::move(f));
+  }
+
+ private:
+  template<class U> friend auto WhenAll(std::vector<Future<U>> futures);
+  std::shared_ptr<State> state;
+};
+
+// Run f() on the default pool.
+template<class F>
+auto Async(F f) -> Future<std::invoke_result_t<F>> {
+  using R = std::invoke_result_t<F>;
+  auto st = std::make_shared<internal_threadutil::FutureState<R>>();
+  auto *raw = st.get();
+  internal_threadutil::FutureBase::Submit(st, [raw, f]() {
+      internal_threadutil::Fulfill(raw, f);
+    });
+  return Future<R>(st);
+}
+
+// Future for all of the values, in order. For Future<void>, this is
+// a Future<void> that's ready once they all are.
+template<class T>
+auto WhenAll(std::vector<Future<T>> futures) {
+  using Res = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+  auto out = std::make_shared<internal_threadutil::FutureState<Res>>();
+  auto fs = std::make_shared<std::vector<Future<T>>>(std::move(futures));
+  for (const Future<T> &f : *fs) out->inputs.push_back(f.state);
+  auto Finish = [out, fs]() {
+      if constexpr (std::is_void_v<T>) {
+        out->Set(std::monostate{});
+      } else {
+        std::vector<T> values;
+        values.reserve(fs->size());
+        // All ready, so these don't block.
+        for (const Future<T> &f : *fs) values.push_back(f.Get());
+        out->Set(std::move(values));
+      }
+    };
+  if (fs->empty()) {
+    Finish();
+  } else {
+    auto left = std::make_shared<std::atomic<int64_t>>(fs->size());
+    for (const Future<T> &f : *fs) {
+      f.OnReady([left, Finish]() {
+          if (--*left == 0) Finish();
+        });
+    }
+  }
+  return Future<Res>(out);
+}
+
+// Queue with a maximum size, for passing work between the stages of
+// a pipeline that run in their own threads. A producer that gets
+// ahead blocks until there's room, instead of filling up memory.
+template<class T>
+struct BoundedQueue {
+  explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+  // Blocks while the queue is full. Returns false (dropping t) if
+  // the queue has been closed.
+  bool Push(T t) {
+    std::unique_lock<std::mutex> ul(m);
+    not_full.wait(ul, [this]() { return closed || q.size() < capacity; });
+    if (closed) return false;
+    q.push_back(std::move(t));
+    not_empty.notify_one();
+    return true;
+  }
+
+  // Blocks while the queue is empty. Returns nullopt once the queue
+  // is closed and empty.
+  std::optional<T> Pop() {
+    std::unique_lock<std::mutex> ul(m);
+    not_empty.wait(ul, [this]() { return closed || !q.empty(); });
+    if (q.empty()) return std::nullopt;
+    T t = std::move(q.front());
+    q.pop_front();
+    not_full.notify_one();
+    return {std::move(t)};
+  }
+
+  // No more pushes. Consumers still get what's in the queue.
+  void Close() {
+    MutexLock ml(&m);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+ private:
+  const size_t capacity;
+  std::mutex m;
+  std::condition_variable not_full, not_empty;
+  std::deque<T> q;
+  bool closed = false;
+};
+
 // Manages running up to X asynchronous tasks in separate threads.
 // This is intended for use in situations like compressing and writing
 // a bunch of frames of a movie out to disk in a loop. There's
@@ -1,11 +1,14 @@
 
 #include "threadutil.h"
 
+#include <chrono>
+#include <thread>
 #include <vector>
 #include <string>
 
 #include "base/stringprintf.h"
 #include "base/logging.h"
+#include "timer.h"
 
 using namespace std;
 
@@ -123,6 +126,238 @@ static void TestInParallel() {
   CHECK(a == 1 && b == 7);
 }
 
+static void TestPool() {
+  WorkStealingPool pool(7);
+  for (int64 num : {0, 1, 2, 7, 100, 12345}) {
+    for (int conc : {1, 3, 8, 50}) {
+      vector<int> count(num, 0);
+      const int slots = pool.Slots(num, conc);
+      CHECK(slots >= 1 && slots <= conc);
+      // Calls with the same slot must not overlap.
+      vector<std::atomic<int>> busy(slots);
+      pool.Run(num, conc,
+               [&count, &busy, slots](int slot, int64_t start, int64_t end) {
+                 CHECK(slot >= 0 && slot < slots);
+                 CHECK(busy[slot]++ == 0) << slot;
+                 for (int64_t i = start; i < end; i++) count[i]++;
+                 busy[slot]--;
+               });
+      for (int i = 0; i < num; i++) CHECK(count[i] == 1) << num << " " << i;
+    }
+  }
+}
+
+static void TestNested() {
+  WorkStealingPool pool(3);
+  std::atomic<int64> total{0};
+  pool.Run(10, 4, [&pool, &total](int, int64_t start, int64_t end) {
+      for (int64_t i = start; i < end; i++) {
+        pool.Run(1000, 4, [&total](int, int64_t s, int64_t e) {
+            total += e - s;
+          });
+      }
+    });
+  CHECK(total.load() == 10000) << total.load();
+
+  // And with the default pool, through the usual interface.
+  vector<int> v(50, 0);
+  ParallelComp(50, [&v](int64_t i) {
+      int64 sum = ParallelAccumulate<int64>(
+          i, 0LL, [](int64 a, int64 b) { return a + b; },
+          [](int64_t j, int64 *acc) { *acc += j; }, 8);
+      v[i] = (int)sum;
+    }, 8);
+  for (int i = 0; i < 50; i++) CHECK(v[i] == i * (i - 1) / 2) << i;
+}
+
+// Asking for more participants than the pool has starts threads,
+// so they really are all concurrent, and can wait on each other.
+// Asking for more than the pool has runs with what it has, so work
+// that needs that many threads at once uses ParallelFan.
+static void TestMoreThanPool() {
+  WorkStealingPool pool(2);
+  static constexpr int NUM = 16;
+  CHECK(pool.Slots(NUM, NUM) == 3);
+  std::atomic<int> done{0};
+  pool.Run(NUM, NUM, [&](int slot, int64_t start, int64_t end) {
+      CHECK(slot >= 0 && slot < 3);
+      done += end - start;
+    });
+  CHECK(done.load() == NUM);
+
+  std::mutex m;
+  std::condition_variable cond;
+  int arrived = 0;
+  ParallelFan(NUM, [&](int i) {
+      std::unique_lock<std::mutex> ul(m);
+      arrived++;
+      cond.notify_all();
+      CHECK(cond.wait_for(ul, 10s, [&arrived]() { return arrived == NUM; }))
+        << "Only " << arrived << " running at once";
+    });
+  CHECK(arrived == NUM);
+}
+
+static void TestFutures() {
+  Future<int> a = Async([]() { return 3; });
+  Future<string> b = a.Then([](int x) { return StringPrintf("%d", x * 2); });
+  CHECK(b.Get() == "6");
+  CHECK(a.Ready() && a.Get() == 3);
+
+  // Void tasks and continuations.
+  std::atomic<int> count{0};
+  Future<void> v = Async([&count]() { count++; });
+  Future<int> w = v.Then([&count]() { return count.load() + 10; });
+  CHECK(w.Get() == 11);
+
+  // Continuation added after the value is ready.
+  CHECK(a.Then([](int x) { return x + 1; }).Get() == 4);
+
+  // A diamond: two branches from one source, joined.
+  Future<int> src = Async([]() { return 5; });
+  vector<Future<int>> branches = {
+    src.Then([](int x) { return x * x; }),
+    src.Then([](int x) { return x + x; }),
+  };
+  CHECK(WhenAll(branches).Get() == (vector<int>{25, 10}));
+  CHECK(WhenAll(vector<Future<int>>{}).Get().empty());
+
+  // Tasks that wait on other tasks. With more waiters than pool
+  // threads, this only finishes because Get runs the tasks it's
+  // waiting for.
+  vector<Future<int64>> outer;
+  for (int i = 0; i < 20; i++) {
+    outer.push_back(Async([i]() {
+        vector<Future<int64>> inner;
+        for (int j = 0; j < 20; j++)
+          inner.push_back(Async([i, j]() { return (int64)(i * j); }));
+        int64 sum = 0;
+        for (int64 x : WhenAll(std::move(inner)).Get()) sum += x;
+        return sum;
+      }));
+  }
+  vector<int64> sums = WhenAll(std::move(outer)).Get();
+  for (int i = 0; i < 20; i++) CHECK(sums[i] == i * 190) << i;
+
+  vector<Future<void>> voids;
+  for (int i = 0; i < 100; i++)
+    voids.push_back(Async([&count]() { count++; }));
+  WhenAll(std::move(voids)).Get();
+  CHECK(count.load() == 101);
+
+  // A task that waits for a future it made, queued ahead of one
+  // that waits for it. Get used to run whatever task was next, so
+  // with one pool thread, a's Get ran b's task, which then waited
+  // for a, below it on the same stack.
+  Future<int> fa = Async([]() {
+      Future<int> inner = Async([]() { return 7; });
+      return inner.Get() + 1;
+    });
+  Future<int> fb = Async([fa]() { return fa.Get() * 2; });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK(fb.Get() == 16);
+}
+
+static void TestBoundedQueue() {
+  BoundedQueue<int> q(4);
+  std::atomic<int> in_queue{0}, max_in_queue{0};
+  int64 total = 0;
+  InParallel(
+      [&]() {
+        for (int i = 0; i < 1000; i++) {
+          CHECK(q.Push(i));
+          int n = ++in_queue;
+          int m = max_in_queue.load();
+          while (n > m && !max_in_queue.compare_exchange_weak(m, n)) {}
+        }
+        q.Close();
+      },
+      [&]() {
+        int expected = 0;
+        while (std::optional<int> x = q.Pop()) {
+          in_queue--;
+          CHECK(*x == expected) << *x << " " << expected;
+          expected++;
+          total += *x;
+        }
+      });
+  CHECK(total == 999 * 1000 / 2);
+  // The counter is updated after Push, so it can be off by one.
+  CHECK(max_in_queue.load() <= 5) << max_in_queue.load();
+  CHECK(!q.Push(1));
+  CHECK(!q.Pop().has_value());
+}
+
+// The way ParallelComp used to work, for comparison: a thread per
+// call, handing out indices under a mutex.
+template<class F>
+static void SpawnParallelComp(int64_t num, const F &f, int max_concurrency) {
+  max_concurrency = std::max(std::min(num, (int64_t)max_concurrency),
+                             (int64_t)1);
+  std::mutex index_m;
+  int64_t next_index = 0;
+  auto th = [&index_m, &next_index, num, &f]() {
+    for (;;) {
+      index_m.lock();
+      if (next_index == num) {
+        index_m.unlock();
+        return;
+      }
+      int64_t my_index = next_index++;
+      index_m.unlock();
+      (void)f(my_index);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < max_concurrency; i++) threads.emplace_back(th);
+  for (std::thread &t : threads) t.join();
+}
+
+// Per-call overhead with trivial work, for small and large num.
+static void BenchOverhead() {
+  WorkStealingPool pool(3);
+  printf("Default pool has %d participants.\n",
+         WorkStealingPool::Default()->Participants());
+  for (int64 num : {8, 1000, 1000000}) {
+    const int calls = num > 1000 ? 20 : 2000;
+    vector<int> out(num, 0);
+    auto F = [&out](int64_t i) { out[i] += (int)i; };
+
+    Timer spawn_timer;
+    for (int c = 0; c < calls; c++) SpawnParallelComp(num, F, 4);
+    const double spawn_us = spawn_timer.Seconds() * 1e6 / calls;
+
+    Timer pool_timer;
+    for (int c = 0; c < calls; c++)
+      pool.Run(num, 4, [&F](int, int64_t start, int64_t end) {
+          for (int64_t i = start; i < end; i++) F(i);
+        });
+    const double pool_us = pool_timer.Seconds() * 1e6 / calls;
+
+    Timer default_timer;
+    for (int c = 0; c < calls; c++) ParallelComp(num, F, 4);
+    const double default_us = default_timer.Seconds() * 1e6 / calls;
+
+    printf("num %8lld: spawn %10.2fus  pool(3) %10.2fus  "
+           "default %10.2fus per call\n",
+           (long long)num, spawn_us, pool_us, default_us);
+  }
+
+  // Per-task overhead for Async and Then.
+  {
+    const int tasks = 100000;
+    Timer timer;
+    vector<Future<int>> fs;
+    fs.reserve(tasks);
+    for (int i = 0; i < tasks; i++)
+      fs.push_back(Async([i]() { return i; }).Then([](int x) {
+            return x + 1; }));
+    const vector<int> res = WhenAll(std::move(fs)).Get();
+    CHECK(res.size() == tasks && res[tasks - 1] == tasks);
+    printf("Async+Then: %.2fus per pair\n", timer.Seconds() * 1e6 / tasks);
+  }
+}
+
 int main(int argc, char **argv) {
 
   TestMap();
@@ -130,6 +365,13 @@ int main(int argc, char **argv) {
   TestAccumulate();
   TestAsynchronously();
   TestInParallel();
+  TestPool();
+  TestNested();
+  TestMoreThanPool();
+  TestFutures();
+  TestBoundedQueue();
+
+  BenchOverhead();
 
   printf("OK.\n");
   return 0;
@@ -0,0 +1,58 @@
+#include "aot-engine.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace {
+struct AOTGame {
+  const char *symbol;
+  uint8 md5[16];
+  AOTRunFn run;
+};
+}  // namespace
+
+// Function-local so that it's initialized before any registration,
+// whatever order the static initializers run in. Only modified during
+// static initialization, so lookups don't need a lock.
+static std::vector<AOTGame> &Games() {
+  static std::vector<AOTGame> *games = new std::vector<AOTGame>;
+  return *games;
+}
+
+static int HexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+AOTRegistration::AOTRegistration(const char *symbol, const char *md5,
+                                 AOTRunFn run) {
+  AOTGame game;
+  game.symbol = symbol;
+  game.run = run;
+  CHECK(std::string(md5).size() == 32) << symbol << ": " << md5;
+  for (int i = 0; i < 16; i++) {
+    const int hi = HexDigit(md5[i * 2]), lo = HexDigit(md5[i * 2 + 1]);
+    CHECK(hi >= 0 && lo >= 0) << symbol << ": " << md5;
+    game.md5[i] = (hi << 4) | lo;
+  }
+  Games().push_back(game);
+}
+
+AOTRunFn AOTFind(const uint8 md5[16]) {
+  for (const AOTGame &game : Games()) {
+    bool match = true;
+    for (int i = 0; i < 16; i++) {
+      if (game.md5[i] != md5[i]) {
+        match = false;
+        break;
+      }
+    }
+    if (match) return game.run;
+  }
+  return nullptr;
+}
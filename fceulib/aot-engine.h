@@ -0,0 +1,30 @@
+// Runtime side of the ahead-of-time 6502 compiler (aot.exe).
+//
+// aot.exe writes C++ for the fixed PRG banks of a particular ROM; the
+// generated dispatcher registers its Run function here (at static
+// initialization time), keyed by the ROM's MD5. Any number of games can
+// be linked in. An emulator whose ROM matches can then use the compiled
+// code in place of X6502::Run; compiled entry points fall back to the
+// interpreter for code they don't cover (addresses outside the compiled
+// region, interrupts).
+
+#ifndef __AOT_ENGINE_H
+#define __AOT_ENGINE_H
+
+#include "types.h"
+#include "fc.h"
+
+// Has the same contract as X6502::Run(cycles).
+using AOTRunFn = void (*)(FC *fc, int32 cycles);
+
+// Generated code declares one of these at file scope. md5 is the 32
+// lowercase hex digits of the ROM's MD5 (as computed when loading it).
+struct AOTRegistration {
+  AOTRegistration(const char *symbol, const char *md5, AOTRunFn run);
+};
+
+// Returns the Run function compiled for the ROM with the given MD5,
+// or nullptr if there isn't one.
+AOTRunFn AOTFind(const uint8 md5[16]);
+
+#endif
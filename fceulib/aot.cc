@@ -112,6 +112,11 @@ struct RomConfig {
 // the emulated ROM or from ROMConfig.
 struct CodeConfig {
   int entrypoints_per_file = 512;
+  // Straight-line code for an entry point stops after this many
+  // instructions and returns to the dispatcher. Without a limit,
+  // a region of data (e.g. FF FF FF ...) decodes as a long run of
+  // instructions from each entry, which is quadratic code size.
+  int max_entry_instructions = 64;
   bool is_pal = false;
   bool has_map_irq_hook = false;
   // True if reads from this region can be discarded or duplicated
@@ -743,7 +748,7 @@ struct AheadOfTime {
       if (addr_exp.Known()) {
         if (addr_exp.Value() < 0x800) {
           fprintf(f,
-                  I "fceu->RAM[0x%04x] = %s;\n",
+                  I "fceu->WriteRAM(0x%04x, %s);\n",
                   addr_exp.Value(), val_exp.String().c_str());
         } else {
           // PERF! Same deal; when the address is known, avoid indirection.
@@ -1011,7 +1016,7 @@ struct AheadOfTime {
       fprintf(f, I "const uint8 %s = fceu->RAM[%s];\n",
               sym.c_str(), aa.String().c_str());
       Exp<uint8> y = op(Exp<uint8>(sym));
-      fprintf(f, I "fceu->RAM[%s] = %s;\n",
+      fprintf(f, I "fceu->WriteRAM(%s, %s);\n",
               aa.String().c_str(), y.String().c_str());
     };
 
@@ -1024,7 +1029,7 @@ struct AheadOfTime {
       fprintf(f, I "const uint8 %s = fceu->RAM[%s];\n",
               sym.c_str(), aa.String().c_str());
       Exp<uint8> y = op(Exp<uint8>(sym));
-      fprintf(f, I "fceu->RAM[%s] = %s;\n",
+      fprintf(f, I "fceu->WriteRAM(%s, %s);\n",
               aa.String().c_str(), y.String().c_str());
     };
     
@@ -1217,7 +1222,7 @@ struct AheadOfTime {
       const string sym = GenSym("stabx");
       fprintf(f, "const uint8 %s = " LOCAL_X ";\n", sym.c_str());
       Exp<uint8> aa = GetZPI(Exp<uint8>(sym));
-      fprintf(f, I "fceu->RAM[%s] = %s;\n",
+      fprintf(f, I "fceu->WriteRAM(%s, %s);\n",
               aa.String().c_str(), exp.String().c_str());
     };
 
@@ -1225,12 +1230,12 @@ struct AheadOfTime {
       const string sym = GenSym("staby");
       fprintf(f, "const uint8 %s = " LOCAL_Y ";\n", sym.c_str());
       Exp<uint8> aa = GetZPI(Exp<uint8>(sym));
-      fprintf(f, I "fceu->RAM[%s] = %s;\n",
+      fprintf(f, I "fceu->WriteRAM(%s, %s);\n",
               aa.String().c_str(), exp.String().c_str());
     };
     
     auto PUSH = [&code, f](Exp<uint8> v) {
-      fprintf(f, I "fceu->RAM[0x100 + " LOCAL_S "] = %s;\n",
+      fprintf(f, I "fceu->WriteRAM(0x100 + " LOCAL_S ", %s);\n",
               v.String().c_str());
       fprintf(f, I LOCAL_S "--;\n");
     };
@@ -2810,7 +2815,7 @@ struct AheadOfTime {
     DeclLocals(f);
     
     uint32 pc_addr = entry_addr;
-    for (;;) {
+    for (int num_instructions = 0; /* in loop */; num_instructions++) {
       // We don't want to try reading outside the mapped region, of
       // course.
       // Note that we don't really have any effective protection
@@ -2827,6 +2832,14 @@ struct AheadOfTime {
         break;
       }
 
+      if (num_instructions >= config.max_entry_instructions) {
+        fprintf(f, I "// Long enough; the dispatcher continues at $%04x.\n"
+                I LOCAL_PC " = 0x%04x;\n", pc_addr, pc_addr);
+        FlushLocals(f, ~0);
+        fprintf(f, I "return;\n");
+        break;
+      }
+
       const uint8 b1 = code.Get(pc_addr);
       if (!CanGenInstruction(b1)) {
         fprintf(f, I "// Unimplemented instruction $%02x\n", b1);
@@ -2856,6 +2869,10 @@ struct AheadOfTime {
                  symbol.c_str());
 
         fprintf(f, I LOCAL_PI " = " LOCAL_P ";\n");
+        // The interpreter fetches the opcode with RdMem, which leaves
+        // it on the data bus. Implied-mode instructions don't read
+        // anything else, so this is observable.
+        fprintf(f, I LOCAL_DB " = 0x%02x;\n", b1);
 
         const int cycles = CycTable[b1];
         // ADDCYC() macro.
@@ -3037,6 +3054,7 @@ static void GenerateDispatcher(const CodeConfig &config,
                                uint32 addr_start,
                                uint32 addr_past_end,
                                const string &symbol,
+                               const string &md5,
                                const string &filename) {
   FILE *f = fopen(filename.c_str(), "w");
   CHECK(f) << filename;
@@ -3045,7 +3063,8 @@ static void GenerateDispatcher(const CodeConfig &config,
           "#include <cstdint>\n"
           "#include \"x6502.h\"\n"
           "#include \"fc.h\"\n"
-          "#include \"fceu.h\"\n\n");
+          "#include \"fceu.h\"\n"
+          "#include \"aot-engine.h\"\n\n");
   
   // Avoid needing a header file; just generate the externs here.
   for (int i = addr_start; i < addr_past_end; i++) {
@@ -3085,7 +3104,12 @@ static void GenerateDispatcher(const CodeConfig &config,
   fprintf(f, "    (*entry)(fc);\n");
   fprintf(f, "  }\n");
 
-  fprintf(f, "}  // Dispatcher.\n\n\n");
+  fprintf(f, "}  // Dispatcher.\n\n");
+
+  // Emulator::SetAOT finds the dispatcher by the ROM's MD5.
+  fprintf(f, "static AOTRegistration %s_registration(\"%s\", \"%s\", "
+          "&%s_Run);\n\n",
+          symbol.c_str(), symbol.c_str(), md5.c_str(), symbol.c_str());
 
   fprintf(stderr, "Wrote %s.\n", filename.c_str());
   fclose(f);
@@ -3126,33 +3150,108 @@ RomConfig ContraROM() {
   return rom;
 }
 
+RomConfig EscapeROM() {
+  RomConfig rom;
+  // Mapper 4 (MMC3), 32k PRG. MMC3 can switch 8000-9FFF and
+  // A000-BFFF (and C000-DFFF), but escape never writes the bank
+  // registers, so everything stays where it is at power-on. All of
+  // its code is in 8000-9464; then FF padding and data.
+  rom.file = "escape.nes";
+  rom.entrypoints_per_file = 512;
+  rom.code_addr_start = 0x8000;
+  rom.code_addr_after_end = 0x9465;
+  rom.effectless_read_8000_ffff = true;
+  return rom;
+}
+
+// For a game without a preset above, pick the region that the mapper
+// can't bank switch. This is conservative; a game that doesn't
+// actually switch banks would do better with a preset.
+static bool ConfigFromMapper(int mapper, RomConfig *rom) {
+  switch (mapper) {
+  case 0:
+    // NROM. No bank switching at all. (A 16k ROM is mirrored into
+    // both halves, so the whole range is still constant.)
+    rom->code_addr_start = 0x8000;
+    rom->code_addr_after_end = 0x10000;
+    rom->effectless_read_8000_ffff = true;
+    return true;
+  case 2:
+    // UNROM. C000-FFFF is fixed to the last bank.
+    rom->code_addr_start = 0xC000;
+    rom->code_addr_after_end = 0x10000;
+    rom->effectless_read_8000_ffff = true;
+    return true;
+  case 4:
+    // MMC3. E000-FFFF is fixed to the last bank.
+    rom->code_addr_start = 0xE000;
+    rom->code_addr_after_end = 0x10000;
+    rom->effectless_read_8000_ffff = true;
+    return true;
+  default:
+    return false;
+  }
+}
+
 int main(int argc, char **argv) {
   string romdir = "roms/";
 
-  if (argc != 2) {
-    printf("Give the name of a game (no extension) on the command-line; "
-           "it must have already been documented inside aot.cc.\n");
+  if (argc != 2 && argc != 3) {
+    printf("aot.exe game [romfile.nes]\n"
+           "Writes game_*.cc, game.cc, and game.makefile.\n"
+           "With just a game name, it must have a preset inside aot.cc.\n"
+           "With a rom file, uses the preset if there is one, or else\n"
+           "compiles the region that the mapper never bank switches.\n");
     return -1;
   }
 
   string game = argv[1];
   RomConfig rom;
+  bool have_preset = true;
   if (game == "mario") {
     rom = MarioROM();
   } else if (game == "contra") {
     rom = ContraROM();
+  } else if (game == "escape") {
+    rom = EscapeROM();
+  } else {
+    have_preset = false;
+  }
+
+  string romfile;
+  if (argc == 3) {
+    romfile = argv[2];
+  } else if (have_preset) {
+    romfile = romdir + rom.file;
   } else {
-    printf("Unknown game %s. You have to put some constants in aot.cc.\n",
-           game.c_str());
+    printf("Unknown game %s. Give a rom file, or put some constants "
+           "in aot.cc.\n", game.c_str());
     return -1;
   }
-  
-  std::unique_ptr<Emulator> emu(Emulator::Create(romdir + "/" + rom.file));
+
+  std::unique_ptr<Emulator> emu(Emulator::Create(romfile));
+  CHECK(emu.get() != nullptr) << romfile;
 
   Timer compile_timer;
 
   FC *fc = emu->GetFC();
 
+  if (!have_preset) {
+    rom.file = romfile;
+    const int mapper = fc->fceu->GameInfo->mappernum;
+    if (!ConfigFromMapper(mapper, &rom)) {
+      printf("Don't know which code is fixed for mapper %d. Put some "
+             "constants in aot.cc.\n", mapper);
+      return -1;
+    }
+    fprintf(stderr, "Mapper %d: compiling %04x-%04x.\n",
+            mapper, rom.code_addr_start, rom.code_addr_after_end - 1);
+  }
+
+  string md5;
+  for (int i = 0; i < 16; i++)
+    md5 += StringPrintf("%02x", fc->fceu->GameInfo->MD5.data()[i]);
+
   // Note that even if an area isn't writable, it's possible that it's
   // unmapped, in which case the read returns the value of the last
   // read (this is usually predictable statically, but definitely
@@ -3179,12 +3278,11 @@ int main(int argc, char **argv) {
     GenerateCode(config, code, rom.code_addr_start, rom.code_addr_after_end,
                  game, rom.file);
   GenerateDispatcher(config, rom.code_addr_start, rom.code_addr_after_end,
-                     game, game + ".cc");
+                     game, md5, game + ".cc");
   files.push_back(game);
 
   {
-    // This just makes it easier to manually build makefiles during
-    // development. XXX do this a better way.
+    // Included by the makefile when building with AOTGAME=game.
     FILE *mf = fopen(StringPrintf("%s.makefile", game.c_str()).c_str(),
                      "w");
     CHECK(mf != nullptr);
@@ -1,7 +1,11 @@
 
 #include "emulator.h"
+#include "emulator-batch.h"
 
+#include <algorithm>
+#include <cinttypes>
 #include <cmath>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <memory>
@@ -9,6 +13,7 @@
 #include <sstream>
 #include <unistd.h>
 #include <cstdio>
+#include <thread>
 
 #include "base/logging.h"
 #include "base/stringprintf.h"
@@ -17,8 +22,13 @@
 #include "simplefm2.h"
 #include "simplefm7.h"
 #include "timer.h"
+#include "util.h"
+#include "city/city.h"
 
 #include "x6502.h"
+#include "fc.h"
+#include "fceu.h"
+#include "filter.h"
 
 static constexpr const char *ROMFILE = "mario.nes";
 static constexpr uint64 expected_nes = 0x0c8abfc012bf6c84ULL;
@@ -26,13 +36,19 @@ static constexpr uint64 expected_img = 0x9c8975828c9578a7ULL;
 
 std::tuple<uint64, uint64, double> RunBenchmark(Emulator *emu,
                                                 const vector<uint8> &start,
-                                                const vector<uint8> &movie) {
+                                                const vector<uint8> &movie,
+                                                bool no_video) {
   emu->LoadUncompressed(start);
   Timer exec_timer;
 
   // Only the last step needs to be full, so that we render the image.
-  for (int i = 0; i < (int)movie.size() - 1; i++)
-    emu->Step(movie[i], 0);
+  if (no_video) {
+    for (int i = 0; i < (int)movie.size() - 1; i++)
+      emu->StepNoVideo(movie[i], 0);
+  } else {
+    for (int i = 0; i < (int)movie.size() - 1; i++)
+      emu->Step(movie[i], 0);
+  }
   emu->StepFull(movie[movie.size() - 1], 0);
 
   const double exec_seconds = exec_timer.Seconds();
@@ -40,32 +56,30 @@ std::tuple<uint64, uint64, double> RunBenchmark(Emulator *emu,
                     exec_seconds);
 }
 
-int main(int argc, char **argv) {
-  string romdir = "roms/";
+// Runs the benchmark in the given mode and checks the resulting
+// checksums. Returns the exec time, or a negative number if a
+// checksum is wrong.
+static double BenchMode(Emulator *emu,
+                        const vector<uint8> &start,
+                        const vector<uint8> &movie,
+                        bool no_video) {
+  const string mode_string =
+    StringPrintf("%s%s", no_video ? "StepNoVideo" : "Step",
+                 emu->UsingAOT() ? "+AOT" : "");
+  const char *mode = mode_string.c_str();
+  printf("Mode %s:\n", mode);
 
-  Timer startup_timer;
-  // TODO: This is not really fair since it counts all the IO.
-  std::unique_ptr<Emulator> emu(Emulator::Create(ROMFILE));
-  CHECK(emu.get() != nullptr);
-  const double startup_seconds = startup_timer.Seconds();
-  vector<uint8> start = emu->SaveUncompressed();
-  
-  vector<uint8> movie = SimpleFM7::ReadInputs("mario-long.fm7");
-  CHECK(!movie.empty());
-
-  printf("Benchmarking %s. Startup in %0.4f sec...\n",
-         ROMFILE, startup_seconds);
-  
   double exec_seconds = -1.0;
-  
+
   int executions = 0;
   double total_time = 0.0;
   vector<int> last_means;
   for (int i = 0; /* exit upon convergence */; i++) {
-    const auto [ram, img, sec] = RunBenchmark(emu.get(), start, movie);
+    const auto [ram, img, sec] = RunBenchmark(emu, start, movie, no_video);
     executions++;
     total_time += sec;
     double mean = total_time / (double)executions;
+    exec_seconds = mean;
     // TODO: Use actual variance to compute convergence. This
     // depends too much on base 10 (e.g. if the mean is very close
     // to the rounding boundary, it will likely run more times).
@@ -78,7 +92,6 @@ int main(int argc, char **argv) {
           return true;
         }()) {
         // Convergence!
-        exec_seconds = mean;
         break;
       }
       // Discard oldest to keep 5 means.
@@ -89,33 +102,526 @@ int main(int argc, char **argv) {
     fflush(stdout);
     break;
   }
-  
+
   const uint64 nes_checksum = emu->MachineChecksum();
   const uint64 img_checksum = emu->ImageChecksum();
   fprintf(stderr,
-          "NES checksum: %016llx\n"
-          "Img checksum: %016llx\n",
-          nes_checksum,
-          img_checksum);
+          "[%s] NES checksum: %016" PRIx64 "\n"
+          "[%s] Img checksum: %016" PRIx64 "\n",
+          mode, nes_checksum,
+          mode, img_checksum);
 
-  fprintf(stderr,
-          "Startup time: %.4fs\n"
-          "Exec time:    %.4fs\n",
-          startup_seconds, exec_seconds);
-  
-  int status = 0;
+  bool ok = true;
   if (nes_checksum != expected_nes) {
-    fprintf(stderr, "*** NES checksum mismatch. "
-            "Got %016llx; wanted %016llx!\n",
-            nes_checksum, expected_nes);
-    status = -1;
+    fprintf(stderr, "*** [%s] NES checksum mismatch. "
+            "Got %016" PRIx64 "; wanted %016" PRIx64 "!\n",
+            mode, nes_checksum, expected_nes);
+    ok = false;
   }
   if (img_checksum != expected_img) {
-    fprintf(stderr, "*** Img checksum mismatch. "
-            "Got %016llx; wanted %016llx!\n",
-            img_checksum, expected_img);
-    status = -1;
+    fprintf(stderr, "*** [%s] Img checksum mismatch. "
+            "Got %016" PRIx64 "; wanted %016" PRIx64 "!\n",
+            mode, img_checksum, expected_img);
+    ok = false;
   }
-  
-  return status;
+
+  return ok ? exec_seconds : -1.0;
+}
+
+// Compares GetApproximateImage to the real image from StepFull on
+// every frame of the movie, and times the two ways of getting an
+// image for each frame. Returns the mean fraction of pixels that
+// differ.
+static double BenchApproximate(Emulator *emu,
+                               const vector<uint8> &start,
+                               const vector<uint8> &movie) {
+  printf("Approximate image:\n");
+  vector<uint8> img, approx;
+
+  emu->LoadUncompressed(start);
+  int64 diff_pixels = 0;
+  for (uint8 input : movie) {
+    emu->StepFull(input, 0);
+    emu->GetImage(&img);
+    emu->GetApproximateImage(&approx);
+    for (int i = 0; i < 256 * 240 * 4; i += 4) {
+      if (img[i] != approx[i] ||
+          img[i + 1] != approx[i + 1] ||
+          img[i + 2] != approx[i + 2])
+        diff_pixels++;
+    }
+  }
+  const double diff_frac =
+    diff_pixels / ((double)movie.size() * 256.0 * 240.0);
+
+  emu->LoadUncompressed(start);
+  Timer full_timer;
+  for (uint8 input : movie) {
+    emu->StepFull(input, 0);
+    emu->GetImage(&img);
+  }
+  const double full_seconds = full_timer.Seconds();
+
+  emu->LoadUncompressed(start);
+  Timer approx_timer;
+  for (uint8 input : movie) {
+    emu->StepNoVideo(input, 0);
+    emu->GetApproximateImage(&approx);
+  }
+  const double approx_seconds = approx_timer.Seconds();
+
+  fprintf(stderr,
+          "[Approx] %.2f%% of pixels differ from StepFull\n"
+          "[Approx] StepFull + GetImage:                %.4fs\n"
+          "[Approx] StepNoVideo + GetApproximateImage:  %.4fs\n",
+          diff_frac * 100.0, full_seconds, approx_seconds);
+  return diff_frac;
+}
+
+// Compares save/load latency and size for full, compressed, and
+// delta (against the start state) save states, sampling every
+// few frames of the movie.
+static void BenchSaveLoad(Emulator *emu,
+                          const vector<uint8> &start,
+                          const vector<uint8> &movie) {
+  printf("Save/load:\n");
+  static constexpr int EVERY = 16;
+  vector<uint8> full, delta, compressed;
+  double full_save = 0.0, full_load = 0.0;
+  double delta_save = 0.0, delta_load = 0.0;
+  double ex_save = 0.0, ex_load = 0.0;
+  int64 full_bytes = 0, delta_bytes = 0, ex_bytes = 0;
+  int samples = 0;
+
+  emu->LoadUncompressed(start);
+  for (int i = 0; i < (int)movie.size(); i++) {
+    emu->StepNoVideo(movie[i], 0);
+    if (i % EVERY != 0) continue;
+    samples++;
+    const uint64 cx = emu->MachineChecksum();
+
+    {
+      Timer t;
+      full = emu->SaveUncompressed();
+      full_save += t.Seconds();
+    }
+    {
+      Timer t;
+      emu->SaveDelta(start, &delta);
+      delta_save += t.Seconds();
+    }
+    {
+      Timer t;
+      emu->SaveEx(nullptr, &compressed);
+      ex_save += t.Seconds();
+    }
+    full_bytes += full.size();
+    delta_bytes += delta.size();
+    ex_bytes += compressed.size();
+
+    // Load each one back and make sure we end up where we started.
+    {
+      Timer t;
+      emu->LoadUncompressed(full);
+      full_load += t.Seconds();
+    }
+    CHECK_EQ(cx, emu->MachineChecksum());
+    {
+      Timer t;
+      emu->LoadDelta(start, delta);
+      delta_load += t.Seconds();
+    }
+    CHECK_EQ(cx, emu->MachineChecksum());
+    {
+      Timer t;
+      emu->LoadEx(nullptr, compressed);
+      ex_load += t.Seconds();
+    }
+    CHECK_EQ(cx, emu->MachineChecksum());
+  }
+
+  if (samples == 0) return;
+  auto Report = [samples](const char *what, int64 bytes,
+                          double save, double load) {
+    fprintf(stderr,
+            "[Save] %-12s avg %7lld bytes  save %8.2fus  load %8.2fus\n",
+            what, (long long)(bytes / samples),
+            save * 1e6 / samples, load * 1e6 / samples);
+  };
+  Report("Uncompressed", full_bytes, full_save, full_load);
+  Report("Delta", delta_bytes, delta_save, delta_load);
+  Report("Compressed", ex_bytes, ex_save, ex_load);
+}
+
+// The shape of playfun's inner loop (ScoreIntegral): after each step,
+// compare the new memory to the previous memory with some objective.
+// Here the objective is just a count of increasing bytes. Stepping
+// takes much longer than any of this, so only the memory handling
+// is timed, with the three approaches side by side on each step.
+static void BenchMemory(Emulator *emu,
+                        const vector<uint8> &start,
+                        const vector<uint8> &movie) {
+  printf("Memory:\n");
+  static constexpr int RAM = 0x800;
+  auto Score = [](const uint8 *prev, const uint8 *now) {
+    int64 s = 0;
+    for (int i = 0; i < RAM; i += 7) s += prev[i] < now[i];
+    return s;
+  };
+
+  emu->LoadUncompressed(start);
+  // Fresh vector each step, as playfun did.
+  vector<uint8> alloc_prev = emu->GetMemory();
+  // Two snapshots, reused.
+  MemorySnapshot snaps[2];
+  snaps[0].Update(*emu);
+  // Only the previous memory is copied; the new one is read in place.
+  vector<uint8> raw_prev = emu->GetMemory();
+
+  int64 alloc_score = 0, snap_score = 0, raw_score = 0;
+  double alloc_seconds = 0.0, snap_seconds = 0.0, raw_seconds = 0.0;
+  for (int i = 0; i < (int)movie.size(); i++) {
+    emu->StepNoVideo(movie[i], 0);
+
+    {
+      Timer t;
+      vector<uint8> now = emu->GetMemory();
+      alloc_score += Score(alloc_prev.data(), now.data());
+      alloc_prev.swap(now);
+      alloc_seconds += t.Seconds();
+    }
+
+    {
+      Timer t;
+      const vector<uint8> &prev = snaps[i & 1].Get();
+      const vector<uint8> &now = snaps[(i + 1) & 1].Update(*emu);
+      snap_score += Score(prev.data(), now.data());
+      snap_seconds += t.Seconds();
+    }
+
+    {
+      Timer t;
+      const uint8 *now = emu->RawMemory();
+      raw_score += Score(raw_prev.data(), now);
+      memcpy(raw_prev.data(), now, RAM);
+      raw_seconds += t.Seconds();
+    }
+  }
+
+  CHECK(alloc_score == snap_score) << alloc_score << " " << snap_score;
+  CHECK(alloc_score == raw_score) << alloc_score << " " << raw_score;
+
+  const double us = 1000000.0 / movie.size();
+  fprintf(stderr,
+          "[Memory] %d steps; memory handling per step:\n"
+          "[Memory] GetMemory() each step: %.3fus\n"
+          "[Memory] MemorySnapshot:        %.3fus\n"
+          "[Memory] RawMemory:             %.3fus\n",
+          (int)movie.size(),
+          alloc_seconds * us, snap_seconds * us, raw_seconds * us);
+}
+
+// Deduplicating states by hashing after every step.
+static void BenchHash(Emulator *emu,
+                      const vector<uint8> &start,
+                      const vector<uint8> &movie) {
+  printf("Hash:\n");
+  emu->LoadUncompressed(start);
+  uint64 x = 0;
+  double ram_seconds = 0.0, state_seconds = 0.0, machine_seconds = 0.0;
+  for (uint8 b : movie) {
+    emu->StepNoVideo(b, 0);
+    {
+      Timer t;
+      x ^= emu->RAMHash();
+      ram_seconds += t.Seconds();
+    }
+    {
+      Timer t;
+      x ^= emu->StateHash();
+      state_seconds += t.Seconds();
+    }
+    {
+      Timer t;
+      x ^= emu->MachineChecksum();
+      machine_seconds += t.Seconds();
+    }
+  }
+
+  const double us = 1000000.0 / movie.size();
+  fprintf(stderr,
+          "[Hash] (%" PRIx64 ") per step:\n"
+          "[Hash] RAMHash:         %.3fus\n"
+          "[Hash] StateHash:       %.3fus\n"
+          "[Hash] MachineChecksum: %.3fus\n",
+          x, ram_seconds * us, state_seconds * us, machine_seconds * us);
+}
+
+// The mapper from the iNES header and a hash of the rest of the
+// file, so that results are labeled by what actually ran. (Copies
+// of one game with a different header have the same hash.)
+static string DescribeROM(const string &romfile) {
+  const string contents = Util::ReadFile(romfile);
+  if (contents.size() < 16) return "not iNES";
+  const uint8 *h = (const uint8 *)contents.data();
+  const int mapper = (h[6] >> 4) | (h[7] & 0xF0);
+  const uint64 data = CityHash64(contents.data() + 16, contents.size() - 16);
+  return StringPrintf("mapper %d, data %08x", mapper, (uint32)data);
+}
+
+// Reading and writing plain memory directly (FCEU::fast_read etc.)
+// versus always calling the handlers. Other ROMs can be given on
+// the command line (e.g. MMC1 and MMC3 games); they get the same
+// inputs, which is fine for timing even if it's nonsense for the game.
+static void BenchFastPages(const vector<string> &romfiles,
+                           const vector<uint8> &movie) {
+  printf("Fast pages:\n");
+  static constexpr int ROUNDS = 3;
+  const int frames = std::min((int)movie.size(), 10000);
+  for (const string &romfile : romfiles) {
+    std::unique_ptr<Emulator> emu(Emulator::Create(romfile));
+    CHECK(emu.get() != nullptr) << romfile;
+    const vector<uint8> start = emu->SaveUncompressed();
+    // Best time with handlers only, then with the fast paths.
+    double best[2] = {1.0e9, 1.0e9};
+    uint64 cx[2] = {0, 0};
+    for (int round = 0; round < ROUNDS; round++) {
+      for (int fast = 0; fast < 2; fast++) {
+        emu->GetFC()->fceu->SetFastPages(fast == 1);
+        emu->LoadUncompressed(start);
+        Timer t;
+        for (int i = 0; i < frames; i++)
+          emu->StepNoVideo(movie[i], 0);
+        best[fast] = std::min(best[fast], t.Seconds());
+        cx[fast] = emu->MachineChecksum();
+      }
+      CHECK(cx[0] == cx[1]) << romfile;
+    }
+    fprintf(stderr, "[Fast] %s (%s): handlers %.3fs, fast %.3fs (%+.1f%%)\n",
+            romfile.c_str(), DescribeROM(romfile).c_str(), best[0], best[1],
+            (100.0 * (best[0] - best[1])) / best[0]);
+  }
+}
+
+// Cost of profiling (profile.h), which must not change the emulation.
+static void BenchProfile(Emulator *emu,
+                         const vector<uint8> &start,
+                         const vector<uint8> &movie) {
+  printf("Profile:\n");
+  const auto [nes, img, off_seconds] =
+    RunBenchmark(emu, start, movie, true);
+  fprintf(stderr, "[Profile] off:       %.4fs\n", off_seconds);
+  for (int period : {64, 16, 1}) {
+    emu->StartProfile(period);
+    const auto [pnes, pimg, seconds] =
+      RunBenchmark(emu, start, movie, true);
+    CHECK(nes == pnes && img == pimg) << period;
+    fprintf(stderr, "[Profile] period %2d: %.4fs (%+.1f%%)\n",
+            period, seconds, (100.0 * (seconds - off_seconds)) / off_seconds);
+    if (period == 16) {
+      const string report = emu->ProfileReport();
+      CHECK(!report.empty());
+      // Just the top of it.
+      printf("%s\n", report.substr(0, report.find("\nOpcodes")).c_str());
+    }
+    emu->StopProfile();
+  }
+}
+
+// The FIR filter kernels in NeoFilterSound. This is the high-quality
+// sound path (FCEUS_SOUNDQ >= 1), which StepFull doesn't currently
+// use, so we drive a Filter directly with a synthetic signal shaped
+// like the emulator's: one sample per CPU cycle, a frame at a time.
+static void BenchFilter(Emulator *emu) {
+  printf("Filter:\n");
+  static constexpr int FRAMES = 600;
+  static constexpr int CYCLES = 29781;
+  static constexpr int ROUNDS = 3;
+  using Kernel = Filter::Kernel;
+
+  // Pulse and triangle-ish channels, below 32767 as the filter
+  // expects.
+  vector<int32> signal(CYCLES * 8);
+  for (int i = 0; i < (int)signal.size(); i++) {
+    signal[i] = ((i / 113) & 1) * 6000 + ((i / 271) & 1) * 4000 +
+      abs((i % 1024) - 512) * 8;
+  }
+
+  vector<int32> expected;
+  double scalar_seconds = 0.0;
+  for (Kernel k : {Kernel::SCALAR, Kernel::SSE41, Kernel::AVX2}) {
+    if (!Filter::KernelSupported(k)) {
+      fprintf(stderr, "[Filter] %s: unsupported\n", Filter::KernelName(k));
+      continue;
+    }
+    // Best of a few rounds, each with a fresh filter.
+    double seconds = 1.0e9;
+    for (int round = 0; round < ROUNDS; round++) {
+      Filter filter(emu->GetFC());
+      filter.MakeFilters(44100);
+      filter.SetKernel(k);
+
+      vector<int32> in(CYCLES * 2, 0), out(CYCLES, 0), wave;
+      int32 left = 0;
+      Timer timer;
+      for (int f = 0; f < FRAMES; f++) {
+        // Samples left over from the last frame, then this frame's.
+        const int pos = (f * CYCLES) % (signal.size() - CYCLES);
+        memcpy(&in[left], &signal[pos], CYCLES * sizeof (int32));
+        const uint32 inlen = left + CYCLES;
+        const int32 count =
+          filter.NeoFilterSound(in.data(), out.data(), inlen, &left);
+        memmove(in.data(), &in[inlen - left], left * sizeof (int32));
+        wave.insert(wave.end(), out.begin(), out.begin() + count);
+      }
+      seconds = std::min(seconds, timer.Seconds());
+
+      if (k == Kernel::SCALAR && round == 0) {
+        expected = std::move(wave);
+      } else {
+        CHECK(wave == expected) << Filter::KernelName(k);
+      }
+    }
+    if (k == Kernel::SCALAR) scalar_seconds = seconds;
+    fprintf(stderr, "[Filter] %s: %d frames in %.4fs (%.2fx)\n",
+            Filter::KernelName(k), FRAMES, seconds,
+            scalar_seconds / seconds);
+  }
+}
+
+// Steps a batch of emulators through the movie (each starting a
+// different number of frames in, so they aren't all doing the same
+// thing), comparing a serial loop to EmulatorBatch with one wakeup per
+// frame and with one per many frames.
+static void BenchBatch(const LoadedROM &rom,
+                       const vector<uint8> &movie) {
+  printf("Batch:\n");
+  static constexpr int NUM_EMUS = 16;
+  static constexpr int FRAMES = 600;
+  static constexpr int CHUNK = 60;
+  const int num_threads =
+    std::max(1, (int)std::thread::hardware_concurrency());
+  CHECK((int)movie.size() >= FRAMES + NUM_EMUS * 8);
+
+  // inputs[e * FRAMES + f].
+  vector<uint16> inputs;
+  for (int e = 0; e < NUM_EMUS; e++)
+    for (int f = 0; f < FRAMES; f++)
+      inputs.push_back(movie[e * 8 + f]);
+
+  std::unique_ptr<EmulatorBatch> batch{
+    EmulatorBatch::Create(rom, NUM_EMUS, num_threads)};
+  CHECK(batch.get() != nullptr);
+  vector<vector<uint8>> starts;
+  for (int e = 0; e < NUM_EMUS; e++)
+    starts.push_back(batch->Get(e)->SaveUncompressed());
+  auto Reset = [&]() {
+    for (int e = 0; e < NUM_EMUS; e++)
+      batch->Get(e)->LoadUncompressed(starts[e]);
+  };
+
+  Reset();
+  Timer serial_timer;
+  for (int f = 0; f < FRAMES; f++)
+    for (int e = 0; e < NUM_EMUS; e++)
+      batch->Get(e)->StepNoVideo16(inputs[e * FRAMES + f]);
+  const double serial_seconds = serial_timer.Seconds();
+  vector<uint64> expected;
+  for (int e = 0; e < NUM_EMUS; e++)
+    expected.push_back(batch->Get(e)->MachineChecksum());
+
+  auto Check = [&](const char *what) {
+    for (int e = 0; e < NUM_EMUS; e++) {
+      CHECK(batch->Get(e)->MachineChecksum() == expected[e])
+        << what << " " << e;
+    }
+  };
+
+  Reset();
+  vector<uint16> frame_inputs(NUM_EMUS);
+  Timer each_timer;
+  for (int f = 0; f < FRAMES; f++) {
+    for (int e = 0; e < NUM_EMUS; e++)
+      frame_inputs[e] = inputs[e * FRAMES + f];
+    batch->StepAll(frame_inputs);
+  }
+  const double each_seconds = each_timer.Seconds();
+  Check("StepAll");
+
+  Reset();
+  vector<uint16> chunk_inputs(NUM_EMUS * CHUNK);
+  Timer chunk_timer;
+  for (int f = 0; f < FRAMES; f += CHUNK) {
+    for (int e = 0; e < NUM_EMUS; e++)
+      for (int c = 0; c < CHUNK; c++)
+        chunk_inputs[e * CHUNK + c] = inputs[e * FRAMES + f + c];
+    batch->StepAllN(CHUNK, chunk_inputs);
+  }
+  const double chunk_seconds = chunk_timer.Seconds();
+  Check("StepAllN");
+
+  fprintf(stderr,
+          "[Batch] %d emulators x %d frames, %d threads\n"
+          "[Batch] Serial:              %.4fs\n"
+          "[Batch] StepAll each frame:  %.4fs\n"
+          "[Batch] StepAllN(%d):        %.4fs\n",
+          NUM_EMUS, FRAMES, num_threads,
+          serial_seconds, each_seconds, CHUNK, chunk_seconds);
+}
+
+int main(int argc, char **argv) {
+  string romdir = "roms/";
+
+  Timer startup_timer;
+  // TODO: This is not really fair since it counts all the IO.
+  std::unique_ptr<Emulator> emu(Emulator::Create(ROMFILE));
+  CHECK(emu.get() != nullptr);
+  const double startup_seconds = startup_timer.Seconds();
+  vector<uint8> start = emu->SaveUncompressed();
+
+  vector<uint8> movie = SimpleFM7::ReadInputs("mario-long.fm7");
+  CHECK(!movie.empty());
+
+  printf("Benchmarking %s. Startup in %0.4f sec...\n",
+         ROMFILE, startup_seconds);
+
+  const double step_seconds = BenchMode(emu.get(), start, movie, false);
+  const double novideo_seconds = BenchMode(emu.get(), start, movie, true);
+
+  fprintf(stderr,
+          "Startup time:          %.4fs\n"
+          "Exec time (Step):      %.4fs\n"
+          "Exec time (NoVideo):   %.4fs\n",
+          startup_seconds, step_seconds, novideo_seconds);
+
+  // Only if compiled code for the ROM is linked in (see makefile).
+  double aot_seconds = 0.0;
+  if (emu->SetAOT(true)) {
+    aot_seconds = BenchMode(emu.get(), start, movie, true);
+    fprintf(stderr, "Exec time (NoVideo+AOT): %.4fs\n", aot_seconds);
+    emu->SetAOT(false);
+  } else {
+    fprintf(stderr, "(No AOT code linked in for %s.)\n", ROMFILE);
+  }
+
+  BenchApproximate(emu.get(), start, movie);
+  BenchSaveLoad(emu.get(), start, movie);
+  BenchMemory(emu.get(), start, movie);
+  BenchHash(emu.get(), start, movie);
+  {
+    vector<string> romfiles = {ROMFILE};
+    for (int i = 1; i < argc; i++) romfiles.push_back(argv[i]);
+    BenchFastPages(romfiles, movie);
+  }
+  BenchProfile(emu.get(), start, movie);
+  BenchFilter(emu.get());
+
+  {
+    std::unique_ptr<LoadedROM> rom{LoadedROM::Create(ROMFILE)};
+    CHECK(rom.get() != nullptr);
+    BenchBatch(*rom, movie);
+  }
+
+  return (step_seconds < 0.0 || novideo_seconds < 0.0 ||
+          aot_seconds < 0.0) ? -1 : 0;
 }
@@ -62,6 +62,8 @@ void Cart::SetPagePtr(int s, uint32 A, uint8 *p, bool is_ram) {
       Page[AB + x] = 0;
     }
   }
+  for (int x = 0; x < (s >> 1); x++)
+    fc->fceu->UpdateFastPage(AB + x);
 }
 
 // WTF is this? nothing - x*2048 is a pointer before nothing, like
@@ -79,6 +81,7 @@ void Cart::ResetCartMapping() {
     Page[x] = nothing - x * 2048;
     PRGptr[x] = CHRptr[x] = nullptr;
     PRGsize[x] = CHRsize[x] = 0;
+    fc->fceu->UpdateFastPage(x);
   }
   for (int x = 0; x < 8; x++) {
     VPage[x] = nothing - x * 0x400;
@@ -67,6 +67,13 @@ struct Cart {
   // directly.
   void WritePage(uint32 A, uint8 V) { Page[A >> 11][A] = V; }
   uint8 ReadPage(uint32 A) const { return Page[A >> 11][A]; }
+  // nullptr if nothing is mapped there.
+  const uint8 *PagePointer(uint32 A) const {
+    return Page[A >> 11] == nullptr ? nullptr : &Page[A >> 11][A];
+  }
+  // The raw (offset) page pointer, for FCEU::UpdateFastPage.
+  uint8 *PageBase(int p) const { return Page[p]; }
+  bool PageIsRAM(int p) const { return PRGIsRAM[p]; }
 
   void WriteVPage(uint32 A, uint8 V) { VPage[A >> 10][A] = V; }
   uint8 ReadVPage(uint32 A) const { return VPage[A >> 10][A]; }
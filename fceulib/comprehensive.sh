@@ -1,5 +1,8 @@
 #!/bin/bash
 
+# Extra arguments are passed to emulator_test. For example, to check
+# that code compiled ahead of time (see makefile) gives the same
+# results, AOTGAME=mario ./comprehensive.sh --aot
 make -j 12 emulator_test.exe || exit -1
 
 REVISION=`svnversion`
@@ -31,29 +34,13 @@ echo "Running comprehensive tests at SVN version " ${REVISION} >> comprehensive-
 echo "Starting at" `date` >> comprehensive-log.txt
 
 
-./emulator_test.exe --comprehensive --index 0 --modulus 1 || 
-  echo "Revision ${REVISION} shard " 0 " FAILED" >> comprehensive-log.txt &
-# 
-# ./emulator_test.exe --comprehensive --index 1 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 1 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 2 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 2 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 3 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 3 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 4 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 4 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 5 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 5 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 6 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 6 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 7 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 7 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 8 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 8 " FAILED" >> comprehensive-log.txt &
-# ./emulator_test.exe --comprehensive --index 9 --modulus 10 || 
-#   echo "Revision ${REVISION} shard " 9 " FAILED" >> comprehensive-log.txt &
-# 
-wait
+# Checks the tests on all cores, then measures their frames per second
+# one at a time (to catch performance regressions). Per-test results
+# are appended to the report; if this is interrupted, running again
+# picks up where it left off.
+./emulator_test.exe --report comprehensive-${REVISION}.tsv --resume "$@" ||
+  echo "Revision ${REVISION} FAILED" >> comprehensive-log.txt
+
 
 echo -n " ... " ${REVISION} " Finished at " `date` >> comprehensive-log.txt
 svn st
@@ -0,0 +1,140 @@
+#include "emulator-batch.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "emulator.h"
+#include "fceu.h"
+#include "base/logging.h"
+
+// Pin the calling thread to a core, if we know how. It's just a
+// performance hint, so failure is fine.
+static void SetAffinity(int cpu) {
+  #ifdef __linux__
+  const int num_cpus = std::thread::hardware_concurrency();
+  if (num_cpus <= 1) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % num_cpus, &set);
+  (void)pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+  #endif
+}
+
+EmulatorBatch::EmulatorBatch(std::vector<std::unique_ptr<Emulator>> emus_in,
+                             int num_threads) : emus(std::move(emus_in)) {
+  for (const auto &emu : emus) CHECK(emu.get() != nullptr);
+  memory.resize(emus.size() * RAM_SIZE, 0);
+  for (int i = 0; i < (int)emus.size(); i++)
+    memcpy(memory.data() + i * RAM_SIZE, emus[i]->GetFC()->fceu->RAM,
+           RAM_SIZE);
+
+  // No point in having workers with nothing to do.
+  num_threads = std::max(1, std::min(num_threads, (int)emus.size()));
+
+  // Contiguous blocks, as even as possible.
+  blocks.reserve(num_threads + 1);
+  for (int w = 0; w <= num_threads; w++)
+    blocks.push_back((int)((int64)emus.size() * w / num_threads));
+
+  // Worker 0 is the calling thread; it's not pinned.
+  threads.reserve(num_threads - 1);
+  for (int w = 1; w < num_threads; w++)
+    threads.emplace_back([this, w]() { WorkerThread(w); });
+}
+
+EmulatorBatch *EmulatorBatch::Create(const LoadedROM &rom, int n,
+                                     int num_threads) {
+  std::vector<std::unique_ptr<Emulator>> emus;
+  emus.reserve(n);
+  for (int i = 0; i < n; i++) {
+    emus.emplace_back(Emulator::Create(rom));
+    if (emus.back().get() == nullptr) return nullptr;
+  }
+  return new EmulatorBatch(std::move(emus), num_threads);
+}
+
+EmulatorBatch::~EmulatorBatch() {
+  {
+    std::unique_lock<std::mutex> ml(m);
+    should_die = true;
+  }
+  start_cond.notify_all();
+  for (std::thread &t : threads) t.join();
+}
+
+void EmulatorBatch::RunBlock(int start, int end) {
+  for (int i = start; i < end; i++) {
+    Emulator *emu = emus[i].get();
+    const uint16 *in = inputs->data() + (int64)i * frames;
+    if (no_video) {
+      for (int f = 0; f < frames; f++) emu->StepNoVideo16(in[f]);
+    } else {
+      for (int f = 0; f < frames; f++) emu->Step16(in[f]);
+    }
+    memcpy(memory.data() + i * RAM_SIZE, emu->GetFC()->fceu->RAM, RAM_SIZE);
+  }
+}
+
+void EmulatorBatch::WorkerThread(int worker) {
+  SetAffinity(worker);
+  int64 seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> ml(m);
+      start_cond.wait(ml, [this, seen]() {
+          return should_die || generation != seen;
+        });
+      if (should_die) return;
+      seen = generation;
+    }
+
+    RunBlock(blocks[worker], blocks[worker + 1]);
+
+    bool last = false;
+    {
+      std::unique_lock<std::mutex> ml(m);
+      pending--;
+      last = pending == 0;
+    }
+    if (last) done_cond.notify_one();
+  }
+}
+
+void EmulatorBatch::StepAllN(int frames_in,
+                             const std::vector<uint16> &inputs_in) {
+  CHECK(frames_in >= 0);
+  CHECK((int64)inputs_in.size() == (int64)emus.size() * frames_in)
+    << inputs_in.size() << " inputs for " << emus.size()
+    << " emulators and " << frames_in << " frames";
+
+  frames = frames_in;
+  inputs = &inputs_in;
+
+  if (!threads.empty()) {
+    {
+      std::unique_lock<std::mutex> ml(m);
+      pending = (int)threads.size();
+      generation++;
+    }
+    start_cond.notify_all();
+  }
+
+  // Do our share while they do theirs.
+  RunBlock(blocks[0], blocks[1]);
+
+  if (!threads.empty()) {
+    std::unique_lock<std::mutex> ml(m);
+    done_cond.wait(ml, [this]() { return pending == 0; });
+  }
+
+  inputs = nullptr;
+}
+
+void EmulatorBatch::StepAll(const std::vector<uint16> &inputs) {
+  StepAllN(1, inputs);
+}
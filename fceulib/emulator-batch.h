@@ -0,0 +1,94 @@
+/*
+  Steps many Emulator instances in lockstep, each with its own inputs,
+  using a fixed set of worker threads. This is the common pattern in
+  search, where N emulators all advance the same number of frames.
+
+  Each worker owns a contiguous block of the emulators for the life of
+  the batch (and on Linux, is pinned to a core), so an emulator's state
+  tends to stay in one core's cache. StepAllN runs many frames per
+  wakeup, which amortizes the synchronization when frames are cheap.
+
+  After stepping, the RAM of every emulator is available in a single
+  contiguous buffer, copied by the workers.
+*/
+
+#ifndef _FCEULIB_EMULATOR_BATCH_H
+#define _FCEULIB_EMULATOR_BATCH_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+struct Emulator;
+struct LoadedROM;
+
+struct EmulatorBatch {
+  static constexpr int RAM_SIZE = 0x800;
+
+  // Takes ownership of the emulators, which must be non-null. Uses up
+  // to num_threads threads in total, including the calling thread; so
+  // with num_threads = 1, everything runs in the caller.
+  EmulatorBatch(std::vector<std::unique_ptr<Emulator>> emus,
+                int num_threads);
+  // Convenience: n fresh emulators for the same ROM. Returns nullptr
+  // if they can't be created.
+  static EmulatorBatch *Create(const LoadedROM &rom, int n,
+                               int num_threads);
+  ~EmulatorBatch();
+
+  int Size() const { return (int)emus.size(); }
+  // The emulators can be used directly (e.g. to load states) between
+  // calls to StepAll; the batch doesn't cache anything about them.
+  Emulator *Get(int i) { return emus[i].get(); }
+
+  // Steps emulator i with inputs[i] (as in Emulator::Step16).
+  // inputs.size() must be Size().
+  void StepAll(const std::vector<uint16> &inputs);
+  // Same, but runs frames frames. Emulator i gets
+  // inputs[i * frames + f] on frame f.
+  void StepAllN(int frames, const std::vector<uint16> &inputs);
+
+  // If true (default), stepping uses StepNoVideo.
+  void SetNoVideo(bool nv) { no_video = nv; }
+
+  // The RAM of each emulator after the last StepAll(N), with
+  // emulator i's at Memory() + i * RAM_SIZE.
+  const uint8 *Memory() const { return memory.data(); }
+  const uint8 *Memory(int i) const { return memory.data() + i * RAM_SIZE; }
+
+ private:
+  // Step emulators [start, end) and copy their RAM.
+  void RunBlock(int start, int end);
+  void WorkerThread(int worker);
+
+  std::vector<std::unique_ptr<Emulator>> emus;
+  std::vector<uint8> memory;
+  bool no_video = true;
+
+  // Arguments for the current job; only written while the workers
+  // are waiting.
+  int frames = 0;
+  const std::vector<uint16> *inputs = nullptr;
+
+  // blocks[w] is the first emulator for worker w (the caller is
+  // worker 0); blocks[w + 1] is one past the last.
+  std::vector<int> blocks;
+
+  std::mutex m;
+  std::condition_variable start_cond, done_cond;
+  // Incremented to start a job.
+  int64 generation = 0;
+  // Number of worker threads that haven't finished the current job.
+  int pending = 0;
+  bool should_die = false;
+  std::vector<std::thread> threads;
+
+  EmulatorBatch(const EmulatorBatch &) = delete;
+  EmulatorBatch &operator =(const EmulatorBatch &) = delete;
+};
+
+#endif
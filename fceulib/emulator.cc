@@ -1,14 +1,20 @@
 
 #include "emulator.h"
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <zlib.h>
 
+#include "aot-engine.h"
 #include "driver.h"
 #include "fceu.h"
+#include "file.h"
+#include "cart.h"
+#include "ines.h"
 #include "types.h"
 #include "utils/md5.h"
+#include "base/logging.h"
 #include "state.h"
 #include "sound.h"
 #include "palette.h"
@@ -16,6 +22,7 @@
 #include "ppu.h"
 
 #include "fc.h"
+#include "city/city.h"
 
 using namespace std;
 
@@ -37,7 +44,21 @@ uint8 Emulator::ReadRAM(int idx) const {
 }
 
 void Emulator::SetRAM(int idx, uint8 value) {
-  fc->fceu->RAM[idx] = value;
+  memory_generation++;
+  fc->fceu->WriteRAM(idx, value);
+}
+
+uint64 Emulator::RAMHash() const {
+  const uint64 h = fc->fceu->ram_hash;
+  #if VERIFY_RAM_HASH
+  CHECK_EQ(h, fc->fceu->ComputeRAMHash()) << "Incremental RAM hash is "
+    "out of date. Was RAM written without FCEU::WriteRAM?";
+  #endif
+  // The sum's low bits are weak, so mix (murmur3 finalizer).
+  uint64 z = h;
+  z = (z ^ (z >> 33)) * 0xFF51AFD7ED558CCDULL;
+  z = (z ^ (z >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+  return z ^ (z >> 33);
 }
 
 static inline uint64 MD5ToChecksum(const uint8 digest[16]) {
@@ -115,6 +136,10 @@ uint64 Emulator::MachineChecksum() const {
   return MD5ToChecksum(digest);
 }
 
+uint64 Emulator::StateHash() const {
+  return fc->state->StateHash();
+}
+
 /**
  * Initialize all of the subsystem drivers: video, audio, and joystick.
  */
@@ -146,12 +171,19 @@ bool Emulator::DriverInitialize(FCEUGI *gi) {
    render, what virtual input devices to use, etc.).
 
    Returns true on success. */
-bool Emulator::LoadGame(const string &path) {
+bool Emulator::LoadGame(const string &path, const LoadedROM *rom) {
   fc->fceu->FCEU_CloseGame();
   fc->fceu->GameInfo = nullptr;
 
-  if (!fc->fceu->FCEUI_LoadGame(path.c_str(), 1)) {
-    return false;
+  if (rom != nullptr) {
+    if (!fc->fceu->FCEUI_LoadGameFromMemory(path.c_str(), rom->contents,
+                                            rom->ines.get(), 1)) {
+      return false;
+    }
+  } else {
+    if (!fc->fceu->FCEUI_LoadGame(path.c_str(), 1)) {
+      return false;
+    }
   }
 
   // Here we used to do ParseGIInput, which allows the gameinfo
@@ -180,12 +212,56 @@ Emulator::~Emulator() {
   delete fc;
 }
 
-Emulator::Emulator(FC *fc) : fc(fc) {}
+static uint64 NextEmulatorId() {
+  static std::atomic<uint64> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+Emulator::Emulator(FC *fc) : fc(fc), id(NextEmulatorId()) {}
+
+LoadedROM::LoadedROM() {}
+LoadedROM::~LoadedROM() {}
+
+LoadedROM *LoadedROM::Create(const string &romfile) {
+  FceuFile *fp = FCEU_fopen(romfile, "rb", 0);
+  if (fp == nullptr) {
+    fprintf(stderr, "Couldn't open [%s]\n", romfile.c_str());
+    return nullptr;
+  }
+
+  LoadedROM *rom = new LoadedROM;
+  rom->filename = romfile;
+  rom->contents.resize(FCEU_fgetsize(fp));
+  const uint64 got = FCEU_fread(rom->contents.data(), 1,
+                                rom->contents.size(), fp);
+  FCEU_fclose(fp);
+  if (got != rom->contents.size()) {
+    fprintf(stderr, "Couldn't read [%s]\n", romfile.c_str());
+    delete rom;
+    return nullptr;
+  }
+
+  // Other formats (UNIF, FDS) are just parsed from contents
+  // each time.
+  std::unique_ptr<INesImage> image(new INesImage);
+  FceuFile *mfp = FCEU_fopen_memory(romfile, rom->contents);
+  if (INes::DecodeImage(mfp, image.get()))
+    rom->ines = std::move(image);
+  FCEU_fclose(mfp);
+
+  return rom;
+}
 
 Emulator *Emulator::Create(const string &romfile) {
-  // XXX TODO: If AOT is enabled, then we should give an error if the
-  // romfile doesn't match (or just make it possible to have multiple
-  // AOT games compiled in, with fallback).
+  return CreateInternal(romfile, nullptr);
+}
+
+Emulator *Emulator::Create(const LoadedROM &rom) {
+  return CreateInternal(rom.filename, &rom);
+}
+
+Emulator *Emulator::CreateInternal(const string &romfile,
+                                   const LoadedROM *rom) {
   FC *fc = new FC;
 
   // initialize the infrastructure
@@ -220,7 +296,7 @@ Emulator *Emulator::Create(const string &romfile) {
 
   Emulator *emu = new Emulator(fc);
   // Load the game.
-  if (1 != emu->LoadGame(romfile.c_str())) {
+  if (1 != emu->LoadGame(romfile, rom)) {
     fprintf(stderr, "Couldn't load [%s]\n", romfile.c_str());
     delete emu;
     return nullptr;
@@ -234,6 +310,8 @@ enum Skip : int {
   DO_VIDEO_AND_SOUND = 0,
   // Limited ability to skip video and sound.
   SKIP_VIDEO_AND_SOUND = 2,
+  // Also skip drawing pixels into the frame buffer.
+  SKIP_PIXELS_AND_SOUND = 3,
 };
 
 // Make one emulator step with the given input.
@@ -244,6 +322,7 @@ void Emulator::Step(uint8 controller1, uint8 controller2) {
   // the bits are in the same order as in the fm2 file.
   joydata = ((uint32)controller2 << 8) | controller1;
   // Emulate a single frame.
+  memory_generation++;
   fc->fceu->FCEUI_Emulate(SKIP_VIDEO_AND_SOUND);
 }
 
@@ -252,21 +331,63 @@ void Emulator::Step16(uint16 controllers) {
   // the bits are in the same order as in the fm2 file.
   joydata = (uint32)controllers;
   // Emulate a single frame.
+  memory_generation++;
   fc->fceu->FCEUI_Emulate(SKIP_VIDEO_AND_SOUND);
 }
 
+void Emulator::StepNoVideo(uint8 controller1, uint8 controller2) {
+  joydata = ((uint32)controller2 << 8) | controller1;
+  memory_generation++;
+  fc->fceu->FCEUI_Emulate(SKIP_PIXELS_AND_SOUND);
+}
+
+void Emulator::StepNoVideo16(uint16 controllers) {
+  joydata = (uint32)controllers;
+  memory_generation++;
+  fc->fceu->FCEUI_Emulate(SKIP_PIXELS_AND_SOUND);
+}
+
+bool Emulator::SetAOT(bool enable) {
+  fc->X->aot_run =
+    enable ? AOTFind(fc->fceu->GameInfo->MD5.data()) : nullptr;
+  return UsingAOT();
+}
+
+bool Emulator::UsingAOT() const {
+  return fc->X->aot_run != nullptr;
+}
+
+void Emulator::StartProfile(int period) {
+  fc->X->profile.reset(new Profile(period));
+}
+
+void Emulator::StopProfile() {
+  fc->X->profile.reset();
+}
+
+string Emulator::ProfileReport() const {
+  if (fc->X->profile == nullptr) return "";
+  return fc->X->profile->Report();
+}
+
 void Emulator::StepFull(uint8 controller1, uint8 controller2) {
   joydata = ((uint32)controller2 << 8) | controller1;
   // Emulate a single frame.
+  memory_generation++;
   fc->fceu->FCEUI_Emulate(DO_VIDEO_AND_SOUND);
 }
 
 void Emulator::StepFull16(uint16 controllers) {
   joydata = (uint32)controllers;
   // Emulate a single frame.
+  memory_generation++;
   fc->fceu->FCEUI_Emulate(DO_VIDEO_AND_SOUND);
 }
 
+const uint8 *Emulator::RawMemory() const {
+  return fc->fceu->RAM;
+}
+
 const uint8 *Emulator::RawIndexedImage() const {
   return fc->fceu->XBuf;
 }
@@ -335,6 +456,155 @@ vector<uint8> Emulator::GetImageARGB() const {
   return ret;
 }
 
+// Adapted from the renderer in smeight, but handling both axes of
+// scrolling, mirroring (through vnapage), and sprites.
+void Emulator::GetApproximateImage(vector<uint8> *rgba) const {
+  if (rgba->size() != IMAGE_BYTE_SIZE) {
+    rgba->clear();
+    rgba->resize(IMAGE_BYTE_SIZE);
+  }
+
+  const PPU *ppu = fc->ppu;
+  const Cart *cart = fc->cart;
+  const uint8 ppu_ctrl = ppu->PPU_values[0];
+  const uint8 ppu_mask = ppu->PPU_values[1];
+  const uint8 *palram = ppu->PALRAM;
+
+  static constexpr int PIXELS = 256 * 240;
+  if (approx_scratch.size() != PIXELS * 2) approx_scratch.resize(PIXELS * 2);
+  // Color (index into PALRAM) for each pixel. The 0x80 bit is set
+  // when the background is opaque there.
+  uint8 *pal = approx_scratch.data();
+
+  const bool bg_enabled = !!(ppu_mask & 0x08);
+  const bool bg_left = !!(ppu_mask & 0x02);
+  if (bg_enabled) {
+    const uint32 bg_pat_addr = (ppu_ctrl & 0x10) ? 0x1000 : 0x0000;
+    // Scroll position in the 512x480 space of four nametables.
+    const uint32 xscroll = GetXScroll();
+    const uint32 yscroll = GetYScroll();
+    for (int sy = 0; sy < 240; sy++) {
+      const uint32 wy = (yscroll + sy) % 480;
+      const int ty = (wy % 240) >> 3;
+      const int row = wy & 7;
+      uint8 *line = &pal[sy * 256];
+      // Tile by tile; the first and last may be partial.
+      for (int sx = -(int)(xscroll & 7); sx < 256; sx += 8) {
+        const uint32 wx = (xscroll + sx) & 511;
+        const int tx = (wx & 255) >> 3;
+        const uint8 *nt = ppu->vnapage[(wx >> 8) | ((wy >= 240) << 1)];
+        const uint8 tile = nt[ty * 32 + tx];
+        const uint8 attrbyte = nt[0x3C0 + (ty >> 2) * 8 + (tx >> 2)];
+        const uint8 attr =
+          (attrbyte >> (((ty & 2) << 1) | (tx & 2))) & 3;
+        const uint32 addr = bg_pat_addr + tile * 16 + row;
+        const uint8 row_low = *cart->VPagePointer(addr);
+        const uint8 row_high = *cart->VPagePointer(addr + 8);
+        for (int bit = 0; bit < 8; bit++) {
+          const int px = sx + bit;
+          if (px < 0 || px >= 256) continue;
+          const uint8 value =
+            ((row_low >> (7 - bit)) & 1) |
+            (((row_high >> (7 - bit)) & 1) << 1);
+          line[px] = value ? (0x80 | (attr << 2) | value) : 0;
+        }
+      }
+      if (!bg_left) memset(line, 0, 8);
+    }
+  } else {
+    memset(pal, 0, PIXELS);
+  }
+
+  if (ppu_mask & 0x10) {
+    const bool spr_left = !!(ppu_mask & 0x04);
+    const bool tall_sprites = !!(ppu_ctrl & 0x20);
+    const int sprite_height = tall_sprites ? 16 : 8;
+    const uint32 spr_pat_addr = (ppu_ctrl & 0x08) ? 0x1000 : 0x0000;
+    const uint8 *spram = ppu->SPRAM;
+    // A lower-numbered sprite always wins a pixel, even if it is
+    // behind the background there.
+    uint8 *covered = approx_scratch.data() + PIXELS;
+    memset(covered, 0, PIXELS);
+    for (int n = 0; n < 64; n++) {
+      // Sprite data is delayed by one scanline.
+      const int ypos = spram[n * 4 + 0] + 1;
+      const uint8 tile_idx = spram[n * 4 + 1];
+      const uint8 attr = spram[n * 4 + 2];
+      const int xpos = spram[n * 4 + 3];
+      const bool v_flip = !!(attr & 0x80);
+      const bool h_flip = !!(attr & 0x40);
+      const bool behind = !!(attr & 0x20);
+      const uint8 colorbits = attr & 3;
+      if (ypos >= 240) continue;
+
+      for (int r = 0; r < sprite_height; r++) {
+        const int py = ypos + r;
+        if (py >= 240) break;
+        const int srow = v_flip ? sprite_height - 1 - r : r;
+        uint32 addr;
+        if (tall_sprites) {
+          addr = ((tile_idx & 1) ? 0x1000 : 0x0000) +
+            ((tile_idx & 0xFE) + (srow >> 3)) * 16 + (srow & 7);
+        } else {
+          addr = spr_pat_addr + tile_idx * 16 + srow;
+        }
+        const uint8 row_low = *cart->VPagePointer(addr);
+        const uint8 row_high = *cart->VPagePointer(addr + 8);
+        for (int bit = 0; bit < 8; bit++) {
+          const int px = xpos + (h_flip ? 7 - bit : bit);
+          if (px >= 256 || (!spr_left && px < 8)) continue;
+          const uint8 value =
+            ((row_low >> (7 - bit)) & 1) |
+            (((row_high >> (7 - bit)) & 1) << 1);
+          const int idx = py * 256 + px;
+          if (value == 0 || covered[idx]) continue;
+          covered[idx] = 1;
+          if (behind && (pal[idx] & 0x80)) continue;
+          pal[idx] = 0x10 | (colorbits << 2) | value;
+        }
+      }
+    }
+  }
+
+  // Same palette treatment as PPU::DoLine.
+  const bool any_on = bg_enabled || (ppu_mask & 0x10);
+  const uint8 grayscale = (any_on && (ppu_mask & 0x01)) ? 0x30 : 0x3F;
+  auto Index = [ppu_mask](uint8 c) -> uint8 {
+      if ((ppu_mask >> 5) == 0x7) return (c & 0x3F) | 0xC0;
+      else if (ppu_mask & 0xE0) return c | 0x40;
+      else return (c & 0x3F) | 0x80;
+    };
+
+  // There are only 32 possible colors.
+  uint8 colors[32][3];
+  for (int p = 0; p < 32; p++) {
+    // Transparent pixels (any palette) show the backdrop color.
+    const uint8 c = palram[(p & 3) ? p : 0] & 0x3F & grayscale;
+    fc->palette->FCEUD_GetPalette(Index(c),
+                                  &colors[p][0], &colors[p][1], &colors[p][2]);
+  }
+
+  for (int i = 0; i < PIXELS; i++) {
+    const uint8 *color = colors[pal[i] & 0x1F];
+    uint8 *px = &(*rgba)[i * 4];
+    px[0] = color[0];
+    px[1] = color[1];
+    px[2] = color[2];
+    px[3] = 0xFF;
+  }
+  // Like GetImage, the remaining 16 rows aren't interesting.
+  for (int i = 240 * 256 * 4; i < IMAGE_BYTE_SIZE; i += 4) {
+    (*rgba)[i + 0] = (*rgba)[i + 1] = (*rgba)[i + 2] = 0;
+    (*rgba)[i + 3] = 0xFF;
+  }
+}
+
+vector<uint8> Emulator::GetApproximateImage() const {
+  vector<uint8> ret(IMAGE_BYTE_SIZE);
+  GetApproximateImage(&ret);
+  return ret;
+}
+
 void Emulator::GetSound(vector<int16> *wav) {
   int32 *buffer = nullptr;
   int samples = fc->sound->GetSoundBuffer(&buffer);
@@ -372,12 +642,53 @@ vector<uint8> Emulator::SaveUncompressed() const {
 }
 
 void Emulator::LoadUncompressed(const vector<uint8> &in) {
+  memory_generation++;
   if (!fc->state->FCEUSS_LoadRAW(in)) {
     fprintf(stderr, "Couldn't restore from state\n");
     abort();
   }
 }
 
+void Emulator::SaveDelta(const vector<uint8> &base,
+                         vector<uint8> *out) const {
+  if (!fc->state->FCEUSS_SaveDelta(base, out)) {
+    fprintf(stderr, "Couldn't save delta state\n");
+    abort();
+  }
+}
+
+vector<uint8> Emulator::SaveDelta(const vector<uint8> &base) const {
+  vector<uint8> ret;
+  SaveDelta(base, &ret);
+  return ret;
+}
+
+void Emulator::LoadDelta(const vector<uint8> &base,
+                         const vector<uint8> &delta) {
+  memory_generation++;
+  if (!fc->state->FCEUSS_LoadDelta(base, delta)) {
+    fprintf(stderr, "Couldn't restore from delta state\n");
+    abort();
+  }
+}
+
+vector<uint8> Emulator::DeltaEncode(const vector<uint8> &base,
+                                    const vector<uint8> &state) {
+  vector<uint8> ret;
+  State::EncodeDelta(base, state, &ret);
+  return ret;
+}
+
+vector<uint8> Emulator::DeltaDecode(const vector<uint8> &base,
+                                    const vector<uint8> &delta) {
+  vector<uint8> ret;
+  if (!State::DecodeDelta(base, delta, &ret)) {
+    fprintf(stderr, "Malformed delta state\n");
+    abort();
+  }
+  return ret;
+}
+
 void Emulator::Load(const vector<uint8> &state) {
   LoadEx(nullptr, state);
 }
@@ -483,6 +794,7 @@ void Emulator::LoadEx(const vector<uint8> *basis, const vector<uint8> &state) {
     uncompressed[i] += (*basis)[i];
   }
 
+  memory_generation++;
   if (!fc->state->FCEUSS_LoadRAW(uncompressed)) {
     fprintf(stderr, "Couldn't restore from state\n");
     abort();
@@ -498,6 +810,7 @@ void Emulator::SaveEx(vector<uint8> *state, const vector<uint8> *basis) {
 }
 
 void Emulator::LoadEx(vector<uint8> *state, const vector<uint8> *basis) {
+  memory_generation++;
   if (!fc->state->FCEUSS_LoadRAW(*state)) {
     fprintf(stderr, "Couldn't restore from state\n");
     abort();
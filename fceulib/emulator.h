@@ -5,18 +5,16 @@
   comprehensive thread safety!
 
   TODO PERF: At some point I changed emulator so that it is rendering
-  the frame regardless of whether Step or StepFull. Although the PPU
-  code is pretty complicated and can't just be skipped, it seems like
-  we could save a lot of work with a mode (e.g. template parameter)
-  that didn't update the screen buffer. There could also be an
-  approximate version of GetImage that renders the screen purely from
-  the PPU state; I have written this several times. (It would not
-  support e.g. intraframe scrolling, but in something like pftwo we
-  only care about it for diagnostic output.)
-
-  TODO: Concept of a "loaded ROM" which can be used to initialize
-  an Emulator, so that the constructor doesn't bake in file I/O
-  (and other initialization that can be done once).
+  the frame regardless of whether Step or StepFull. StepNoVideo uses
+  a version of the PPU (template parameter) that doesn't update the
+  screen buffer, but keeps the state that the CPU can observe.
+  GetApproximateImage renders the screen purely from the PPU state,
+  for when we only care about it for diagnostic output.
+
+  A LoadedROM can be used to create many Emulators without any
+  file I/O; for iNES carts they also share the PRG and CHR ROM.
+  Mapper initialization still happens per instance, since that
+  sets up mutable state.
 */
 
 #ifndef _FCEULIB_EMULATOR_H
@@ -24,12 +22,38 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 
 #include "types.h"
 
 #include "fc.h"
 
 struct FCEUGI;
+struct INesImage;
+
+// A ROM file read and decoded once, used to create any number of
+// Emulator instances (from any thread). It is immutable after
+// creation and must outlive all the emulators created from it.
+struct LoadedROM {
+  // Returns nullptr on error (e.g. file can't be read).
+  static LoadedROM *Create(const std::string &romfile);
+  ~LoadedROM();
+
+  const std::string &Filename() const { return filename; }
+
+ private:
+  friend struct Emulator;
+  LoadedROM();
+  std::string filename;
+  // The whole file.
+  std::vector<uint8> contents;
+  // Non-null if this is an iNES file.
+  std::unique_ptr<INesImage> ines;
+
+  LoadedROM(const LoadedROM &) = delete;
+  LoadedROM &operator =(const LoadedROM &) = delete;
+};
+
 struct Emulator {
   using string = std::string;
   template<class T> using vector = std::vector<T>;
@@ -39,6 +63,9 @@ struct Emulator {
   // Returns nullptr (or aborts) on error. Upon success, returns
   // a new-ly allocated instance.
   static Emulator *Create(const string &romfile);
+  // Same, but from an already-loaded ROM. This is much faster
+  // when creating many emulators for the same game.
+  static Emulator *Create(const LoadedROM &rom);
 
   ~Emulator();
 
@@ -56,10 +83,49 @@ struct Emulator {
   void Step(uint8 controller1, uint8 controller2);
   // High 8 bits are controller1, low are controller2.
   void Step16(uint16 controllers);
+
+  // Same, but without drawing the frame buffer at all. The machine
+  // state (including sprite 0 hit, NMI timing, and scroll registers)
+  // is exactly the same as after Step, so this is a good choice for
+  // search, but GetImage etc. will return garbage afterwards.
+  void StepNoVideo(uint8 controller1, uint8 controller2);
+  void StepNoVideo16(uint16 controllers);
+
+  // Run the CPU using code compiled ahead of time for this ROM
+  // (by aot.exe, and linked in; see aot-engine.h), falling back to
+  // the interpreter for code that wasn't compiled. The results are
+  // exactly the same, just faster. Returns true if compiled code is
+  // now in use, which is false if none was linked in for this ROM.
+  // Off by default.
+  bool SetAOT(bool enable);
+  bool UsingAOT() const;
+
+  // Profile the emulated program (see profile.h), sampling every
+  // period-th instruction; all memory accesses are counted. This
+  // replaces any profile in progress. Only the interpreter is
+  // profiled, so turn off AOT to see everything. The emulation
+  // itself is exactly the same, just a little slower.
+  void StartProfile(int period);
+  void StopProfile();
+  // Human-readable report of the profile so far, or the empty string
+  // if not profiling.
+  string ProfileReport() const;
   
   // Copy the 0x800 bytes of RAM.
   void GetMemory(vector<uint8> *mem);
   vector<uint8> GetMemory();
+  // The live 0x800 bytes of RAM, without copying. Like
+  // RawIndexedImage, the contents change with any call that runs or
+  // loads the emulator; copy (or see MemorySnapshot below) if you
+  // need them to persist.
+  const uint8 *RawMemory() const;
+  // Incremented by every call that can modify RAM (stepping, loading,
+  // SetRAM), so callers can tell whether a copy is still current.
+  // Modifications through GetFC() are not tracked.
+  uint64 MemoryGeneration() const { return memory_generation; }
+  // Unique to this emulator within the process, even after it's
+  // deleted (unlike its address). Never 0.
+  uint64 Id() const { return id; }
 
   // Fancy stuff.
 
@@ -81,6 +147,17 @@ struct Emulator {
   void GetImageARGB(vector<uint8> *abgr) const;
   vector<uint8> GetImageARGB() const;
 
+  // Render an approximation of the current frame from the PPU state
+  // alone (nametables, attribute tables, pattern tables, palette and
+  // OAM), in the same format as GetImage. This works after Step or
+  // StepNoVideo, so it's much cheaper than StepFull when only some
+  // frames need to be looked at. Since it only sees the state at the
+  // end of the frame, it gets mid-frame effects (split scrolling,
+  // bank switching, palette changes, sprite 0 tricks) wrong, and it
+  // ignores the 8 sprite per line limit and MMC5 extended attributes.
+  void GetApproximateImage(vector<uint8> *rgba) const;
+  vector<uint8> GetApproximateImage() const;
+
   // Get sound. StepFull must have been called to produce this wave.
   // The result is a vector of signed 16-bit samples, mono.
   void GetSound(vector<int16> *wav);
@@ -96,6 +173,19 @@ struct Emulator {
   // Note that the image checksum can only be computed if compiling
   // without DISABLE_VIDEO and after calling StepFull.
   uint64 ImageChecksum() const;
+  // Hash of RAM only. Unlike the checksums this is O(1), since it's
+  // maintained as RAM is written, so it's suitable for deduplicating
+  // states during search. Not stable across versions. Compile with
+  // -DVERIFY_RAM_HASH=1 to check it against a full recomputation on
+  // every call.
+  uint64 RAMHash() const;
+  // Hash of the state that determines what the game does next, for
+  // detecting when two input sequences reach the same state (e.g. a
+  // transposition table in search). This is everything a save state
+  // holds (RAM, CPU, PPU, APU, and the mapper's registers, WRAM and
+  // CHR-RAM) except the running timestamp, so that states reached
+  // at different times can match. Not stable across versions.
+  uint64 StateHash() const;
 
   // Save and load uncompressed. The memory will always be the same
   // size (Save and SaveEx may compress, which makes their output
@@ -104,6 +194,22 @@ struct Emulator {
   vector<uint8> SaveUncompressed() const;
   void LoadUncompressed(const vector<uint8> &in);
 
+  // Save and load as a delta against a base state from
+  // SaveUncompressed (ideally a similar one, like an ancestor in a
+  // search tree). Only the byte ranges that differ are stored, so
+  // this is much smaller than SaveUncompressed for nearby states,
+  // and much faster than SaveEx since there's no compression. The
+  // same base must be used to load.
+  void SaveDelta(const vector<uint8> &base, vector<uint8> *out) const;
+  vector<uint8> SaveDelta(const vector<uint8> &base) const;
+  void LoadDelta(const vector<uint8> &base, const vector<uint8> &delta);
+  // Convert between the two representations without an emulator.
+  // DeltaEncode(base, SaveUncompressed()) is the same as SaveDelta(base).
+  static vector<uint8> DeltaEncode(const vector<uint8> &base,
+                                   const vector<uint8> &state);
+  static vector<uint8> DeltaDecode(const vector<uint8> &base,
+                                   const vector<uint8> &delta);
+
   // States often only differ by a small amount, so a way to reduce
   // their entropy is to diff them against a representative savestate.
   // This gets an uncompressed basis for the current state, which can
@@ -157,7 +263,10 @@ struct Emulator {
 
  private:
   bool DriverInitialize(FCEUGI *gi);
-  bool LoadGame(const string &path);
+  // If rom is non-null, load from it instead of the path.
+  bool LoadGame(const string &path, const LoadedROM *rom);
+  static Emulator *CreateInternal(const string &romfile,
+                                  const LoadedROM *rom);
 
   FC *fc = nullptr;
 
@@ -165,10 +274,40 @@ struct Emulator {
   // the "API". TODO: Move into FCEU or input object?
   uint32 joydata = 0;
 
+  const uint64 id;
+  uint64 memory_generation = 0;
+  // Palette indices and sprite coverage for GetApproximateImage,
+  // which are too big for the stack.
+  mutable vector<uint8> approx_scratch;
+
   // Maybe we should consider supporting cloning, actually.
   Emulator(const Emulator &) = delete;
   Emulator &operator =(const Emulator &) = delete;
 };
 
+// A reusable copy of an emulator's RAM, for code that reads memory
+// after every step (objectives, observations). Update only copies
+// if the emulator has modified RAM since the last Update, and never
+// allocates after the first.
+struct MemorySnapshot {
+  const std::vector<uint8> &Update(const Emulator &emu) {
+    if (emu.Id() != src_id || emu.MemoryGeneration() != generation) {
+      const uint8 *ram = emu.RawMemory();
+      mem.assign(ram, ram + 0x800);
+      src_id = emu.Id();
+      generation = emu.MemoryGeneration();
+    }
+    return mem;
+  }
+
+  const std::vector<uint8> &Get() const { return mem; }
+
+ private:
+  // Emulator::Id of the source, or 0 if none yet.
+  uint64 src_id = 0;
+  uint64 generation = 0;
+  std::vector<uint8> mem;
+};
+
 
 #endif
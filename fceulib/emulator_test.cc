@@ -6,17 +6,22 @@
 //     checksums are, and update them
 
 #include "emulator.h"
+#include "emulator-batch.h"
 
 #include <string>
 #include <vector>
+#include <map>
 #include <memory>
 #include <sys/time.h>
 #include <sstream>
 #include <unistd.h>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <mutex>
 #include <thread>
 #include <optional>
+#include <cinttypes>
 
 // XXX hack
 #define BASE_INT_TYPES_H_
@@ -29,7 +34,9 @@
 #include "simplefm2.h"
 #include "simplefm7.h"
 #include "timer.h"
+#include "util.h"
 #include "randutil.h"
+#include "city/city.h"
 
 #include "threadutil.h"
 #include "tracing.h"
@@ -70,6 +77,12 @@ struct SerialResult {
 struct TestCase {
   Game game;
   SerialResult result;
+  // Largest allowed mean fraction of pixels where GetApproximateImage
+  // differs from the real image. It doesn't model mid-frame changes
+  // (e.g. a status bar with its own scroll), so by default this only
+  // catches a badly broken image; it's tighter for carts where it is
+  // expected to be close.
+  double max_approx_diff = 0.25;
 };
 
 // Generates a deterministic sequence of player-like buttons to
@@ -149,10 +162,28 @@ struct InputStream {
   decltype(v.end()) end() { return v.end(); }
 };
 
+// The inputs that RunGameSerially executes: the fixed ones, then
+// the "random" ones.
+static vector<uint8> TestInputs(const Game &game) {
+  vector<uint8> inputs = game.start_inputs;
+  for (uint8 b : InputStream(game.random_seed,
+                             NUM_RANDOM_INPUTS,
+                             game.input_mask)) {
+    inputs.push_back(b);
+  }
+  return inputs;
+}
+
 // TODO: Add running checksums of ram, cpu.
+// If use_aot, runs with code compiled ahead of time (when it's
+// linked in for the game), which should produce identical results.
+// rom must be game.cart, loaded; the main emulator still loads the
+// file itself, but the others share rom.
 static SerialResult RunGameSerially(
     std::function<void(const string &)> Update,
-    const Game &game) {
+    const LoadedROM &rom,
+    const Game &game,
+    bool use_aot) {
 
   SerialResult res;
 
@@ -186,6 +217,10 @@ static SerialResult RunGameSerially(
 
   Update("Create emulator.");
   std::unique_ptr<Emulator> emu{Emulator::Create(game.cart)};
+  if (use_aot) {
+    Update(emu->SetAOT(true) ? "Using AOT code." :
+           "No AOT code for this game; interpreting.");
+  }
 
   Update("Prep inputs/vectors.");
   // Make inputs.
@@ -212,6 +247,14 @@ static SerialResult RunGameSerially(
   vector<vector<uint8>> actual_rams;
   actual_rams.reserve(num_inputs);
 
+  // RAMHash before executing the corresponding frame, as maintained
+  // incrementally while stepping.
+  vector<uint64> ram_hashes;
+  ram_hashes.reserve(num_inputs);
+  // Same for StateHash, which is computed from scratch.
+  vector<uint64> state_hashes;
+  state_hashes.reserve(num_inputs);
+
 
   // Once we've collected the states, we have not just the checksums
   // but the actual RAMs (in full mode), so we can print better
@@ -282,6 +325,8 @@ static SerialResult RunGameSerially(
       CHECK(csum != 0ULL) << checksums.size() << " " << game.cart;
       checksums.push_back(csum);
       actual_rams.push_back(emu->GetMemory());
+      ram_hashes.push_back(emu->RAMHash());
+      state_hashes.push_back(emu->StateHash());
       emu->StepFull(b, 0);
     };
 
@@ -315,10 +360,19 @@ static SerialResult RunGameSerially(
   for (int i = saves.size() - 2; i >= 0; i--) {
     emu->LoadUncompressed(saves[i]);
     CheckNesStep(i);
+    // Loading recomputes the hash from scratch, which should agree
+    // with the incremental one.
+    CHECK_EQ(emu->RAMHash(), ram_hashes[i]) << i;
+    // Restoring a state restores its state hash too.
+    CHECK_EQ(emu->StateHash(), state_hashes[i]) << i;
     CHECK(i + 1 < (int)saves.size());
     CHECK(i + 1 < (int)inputs.size());
     emu->StepFull(inputs[i], 0);
     CheckNesStep(i + 1);
+    CHECK_EQ(emu->RAMHash(), ram_hashes[i + 1]) << i;
+    // And it should distinguish different memories.
+    CHECK_EQ(ram_hashes[i] == ram_hashes[i + 1],
+             actual_rams[i] == actual_rams[i + 1]) << i;
   }
 
   // Now jump around and make sure that we are able to save and
@@ -328,8 +382,10 @@ static SerialResult RunGameSerially(
 
   // Restore state (can be compressed or not) to the seek point
   // and then run 'dist' steps, checking that we get the same
-  // result as before.
-  auto DoSeekSpan = [&](int seekto, int dist, bool compressed) {
+  // result as before. If no_video, steps with StepNoVideo, which
+  // should not be observable in the machine state.
+  auto DoSeekSpan = [&](int seekto, int dist, bool compressed,
+                        bool no_video) {
       if (compressed) {
         CHECK(seekto < (int)compressed_saves.size());
         emu->LoadEx(&basis, compressed_saves[seekto]);
@@ -340,7 +396,8 @@ static SerialResult RunGameSerially(
       CHECK_NES(checksums[seekto]);
       for (int j = 0; j < dist; j++) {
         if (seekto + j + 1 < (int)saves.size()) {
-          emu->StepFull(inputs[seekto + j], 0);
+          if (no_video) emu->StepNoVideo(inputs[seekto + j], 0);
+          else emu->StepFull(inputs[seekto + j], 0);
           CHECK_NES(checksums[seekto + j + 1]);
         }
       }
@@ -353,7 +410,132 @@ static SerialResult RunGameSerially(
     const int dist = RandTo(&rc, 5) + 1;
     const bool compressed =
       TEST_COMPRESSED_SAVES && rc.Byte() < 32;
-    DoSeekSpan(seekto, dist, compressed);
+    DoSeekSpan(seekto, dist, compressed, false);
+  }
+
+  Update("No-video seeks.");
+  for (int i = 0; i < 200; i++) {
+    const int seekto = RandTo(&rc, saves.size());
+    const int dist = RandTo(&rc, 30) + 1;
+    DoSeekSpan(seekto, dist, false, true);
+  }
+
+  // Delta saves against some earlier save state, which should
+  // restore exactly like the uncompressed save they encode.
+  Update("Delta seeks.");
+  for (int i = 0; i < 100; i++) {
+    const int seekto = RandTo(&rc, saves.size());
+    const int base = RandTo(&rc, seekto + 1);
+    emu->LoadUncompressed(saves[seekto]);
+    vector<uint8> delta = emu->SaveDelta(saves[base]);
+    CHECK(Emulator::DeltaDecode(saves[base], delta) == saves[seekto]);
+    emu->LoadUncompressed(saves[base]);
+    emu->LoadDelta(saves[base], delta);
+    CHECK_NES(checksums[seekto]);
+    if (seekto + 1 < (int)saves.size()) {
+      emu->StepFull(inputs[seekto], 0);
+      CHECK_NES(checksums[seekto + 1]);
+    }
+  }
+
+  // The zero-copy view and snapshots should agree with GetMemory, and
+  // the generation should change with anything that can write RAM.
+  Update("Memory snapshots.");
+  {
+    MemorySnapshot snap;
+    for (int i = 0; i < 50; i++) {
+      const int seekto = RandTo(&rc, saves.size());
+      uint64 gen = emu->MemoryGeneration();
+      emu->LoadUncompressed(saves[seekto]);
+      CHECK(emu->MemoryGeneration() != gen);
+      gen = emu->MemoryGeneration();
+      const vector<uint8> mem = emu->GetMemory();
+      CHECK(0 == memcmp(emu->RawMemory(), mem.data(), mem.size()));
+      CHECK(snap.Update(*emu) == mem);
+      // Reading doesn't count as a modification.
+      CHECK(emu->MemoryGeneration() == gen);
+      CHECK(snap.Update(*emu) == mem);
+
+      const int idx = RandTo(&rc, 0x800);
+      const uint8 old = emu->ReadRAM(idx);
+      emu->SetRAM(idx, old ^ 0x5A);
+      CHECK(emu->MemoryGeneration() != gen);
+      CHECK(snap.Update(*emu)[idx] == (old ^ 0x5A));
+      emu->SetRAM(idx, old);
+
+      if (seekto + 1 < (int)saves.size()) {
+        gen = emu->MemoryGeneration();
+        emu->StepFull(inputs[seekto], 0);
+        CHECK(emu->MemoryGeneration() != gen);
+        CHECK(snap.Update(*emu) == emu->GetMemory());
+        CHECK_NES(checksums[seekto + 1]);
+      }
+    }
+
+    // A new emulator is a different source, even with the same
+    // generation and (likely) the address of a deleted one.
+    std::unique_ptr<Emulator> a{Emulator::Create(rom)};
+    CHECK(a.get() != nullptr) << game.cart;
+    a->LoadUncompressed(saves.front());
+    CHECK(snap.Update(*a) == a->GetMemory());
+    const uint64 gen = a->MemoryGeneration();
+    a.reset();
+    std::unique_ptr<Emulator> b{Emulator::Create(rom)};
+    CHECK(b.get() != nullptr) << game.cart;
+    b->LoadUncompressed(saves.back());
+    CHECK(b->MemoryGeneration() == gen);
+    CHECK(snap.Update(*b) == b->GetMemory());
+  }
+
+  // Emulators created from a LoadedROM (sharing the cartridge's ROM)
+  // should behave identically to one that loaded the file itself,
+  // including when both are running at once.
+  Update("Shared ROM.");
+  {
+    std::unique_ptr<Emulator> emu1{Emulator::Create(rom)};
+    std::unique_ptr<Emulator> emu2{Emulator::Create(rom)};
+    CHECK(emu1.get() != nullptr && emu2.get() != nullptr) << game.cart;
+    emu1->SetAOT(use_aot);
+    CHECK(emu1->MachineChecksum() == checksums[0]);
+    for (int i = 0; i + 1 < (int)checksums.size(); i++) {
+      emu1->StepFull(inputs[i], 0);
+      emu2->Step(inputs[i], 0);
+      CHECK(emu1->MachineChecksum() == checksums[i + 1]) << i;
+      CHECK(emu2->MachineChecksum() == checksums[i + 1]) << i;
+    }
+  }
+
+  // Stepping in lockstep on worker threads should give the same
+  // results too. Emulators 0 and 2 replay the test's inputs, and 1
+  // gets its own (no buttons), checked against a plain emulator.
+  Update("Batch.");
+  {
+    std::unique_ptr<EmulatorBatch> batch{EmulatorBatch::Create(rom, 3, 3)};
+    CHECK(batch.get() != nullptr) << game.cart;
+    std::unique_ptr<Emulator> idle{Emulator::Create(rom)};
+    CHECK(idle.get() != nullptr) << game.cart;
+    static constexpr int CHUNK = 7;
+    vector<uint16> batch_inputs;
+    for (int i = 0; i + CHUNK < (int)checksums.size(); i += CHUNK) {
+      batch_inputs.clear();
+      for (int e = 0; e < 3; e++) {
+        for (int f = 0; f < CHUNK; f++) {
+          batch_inputs.push_back(e == 1 ? 0 : inputs[i + f]);
+        }
+      }
+      batch->StepAllN(CHUNK, batch_inputs);
+      for (int f = 0; f < CHUNK; f++) idle->StepNoVideo(0, 0);
+
+      CHECK(batch->Get(0)->MachineChecksum() == checksums[i + CHUNK]) << i;
+      CHECK(batch->Get(2)->MachineChecksum() == checksums[i + CHUNK]) << i;
+      CHECK(batch->Get(1)->MachineChecksum() == idle->MachineChecksum())
+        << i;
+      for (int e = 0; e < 3; e++) {
+        CHECK(0 == memcmp(batch->Memory(e),
+                          batch->Get(e)->GetMemory().data(),
+                          EmulatorBatch::RAM_SIZE)) << i << " " << e;
+      }
+    }
   }
 
   Update("Delete emu.");
@@ -368,6 +550,7 @@ static SerialResult RunGameSerially(
   checksums.clear();
   Update("(rams)");
   actual_rams.clear();
+  ram_hashes.clear();
   Update("(inputs)");
   inputs.clear();
 
@@ -375,8 +558,8 @@ static SerialResult RunGameSerially(
   return res;
 }
 
-static std::vector<TestCase> TestCases() {
-  const string romdir = "testroms/";
+// romdir ends with a slash.
+static std::vector<TestCase> TestCases(const string &romdir) {
   static constexpr uint8_t NO_PAUSE_MASK = ~(INPUT_T | INPUT_S);
   std::vector<TestCase> cases;
 
@@ -484,6 +667,8 @@ static std::vector<TestCase> TestCases() {
       0x6b3c8af22f464f14, 0x4bf13ff46d43c815,
       0x4c618f04cbdf59c6, 0xd73856ca6cd981de,
       NO_PAUSE_MASK);
+  // No scrolling or split screens.
+  cases.back().max_approx_diff = 0.03;
 
   // MMC5 test
   AddCase(
@@ -582,45 +767,278 @@ static std::vector<TestCase> TestCases() {
   return cases;
 }
 
+// Frames per second replaying the test's inputs from power-on, with
+// Step and then StepNoVideo. RunGameSerially spends most of its time
+// saving and checking, so its running time isn't a good measure of
+// the emulator's speed.
+static std::pair<double, double> MeasureFPS(const LoadedROM &rom,
+                                            const vector<uint8> &inputs,
+                                            bool use_aot) {
+  std::unique_ptr<Emulator> emu{Emulator::Create(rom)};
+  CHECK(emu.get() != nullptr);
+  emu->SetAOT(use_aot);
+  const vector<uint8> start = emu->SaveUncompressed();
+
+  Timer step_timer;
+  for (uint8 b : inputs) emu->Step(b, 0);
+  const double step_seconds = step_timer.Seconds();
+
+  emu->LoadUncompressed(start);
+  Timer novideo_timer;
+  for (uint8 b : inputs) emu->StepNoVideo(b, 0);
+  const double novideo_seconds = novideo_timer.Seconds();
+
+  return {inputs.size() / step_seconds, inputs.size() / novideo_seconds};
+}
+
+// Mean fraction of pixels, over each frame of the inputs, where
+// GetApproximateImage differs from the image that StepFull renders.
+static double ApproximateImageDiff(const LoadedROM &rom,
+                                   const vector<uint8> &inputs) {
+  std::unique_ptr<Emulator> emu{Emulator::Create(rom)};
+  CHECK(emu.get() != nullptr);
+  vector<uint8> img, approx;
+  int64 diff_pixels = 0;
+  for (uint8 b : inputs) {
+    emu->StepFull(b, 0);
+    emu->GetImage(&img);
+    emu->GetApproximateImage(&approx);
+    for (int i = 0; i < 256 * 240 * 4; i += 4) {
+      if (img[i] != approx[i] ||
+          img[i + 1] != approx[i + 1] ||
+          img[i + 2] != approx[i + 2])
+        diff_pixels++;
+    }
+  }
+  return diff_pixels / ((double)inputs.size() * 256.0 * 240.0);
+}
+
+// Tests that run the same cart share its LoadedROM.
+struct ROMCache {
+  const LoadedROM *Get(const string &cart) {
+    MutexLock ml(&m);
+    std::unique_ptr<LoadedROM> &rom = roms[cart];
+    if (rom.get() == nullptr) rom.reset(LoadedROM::Create(cart));
+    return rom.get();
+  }
+
+ private:
+  std::mutex m;
+  std::map<string, std::unique_ptr<LoadedROM>> roms;
+};
+
+// The --report file has one tab-separated line per test, appended as
+// each one's frame rate is measured, so an interrupted run can be
+// continued with --resume (which skips the tests already in the report
+// for the same mode). A test is identified by its cart (file name only,
+// so that runs with different --romdir compare) and a hash of its
+// inputs, since the same cart can be tested with different inputs.
+// Lines starting with # are comments. Passing an earlier report as
+// --baseline flags tests whose frame rate dropped.
+static constexpr const char *REPORT_HEADER =
+  "# cart\tinputs\tmode\tresult\tframes\tseconds\tstep_fps\tnovideo_fps\t"
+  "nes_after_fixed\timg_after_fixed\tnes_after_random\timg_after_random\n";
+
+// The first two fields of the test's report line, which identify it.
+static string ReportKey(const Game &game) {
+  const vector<uint8> inputs = TestInputs(game);
+  const size_t slash = game.cart.rfind('/');
+  const string cart =
+    slash == string::npos ? game.cart : game.cart.substr(slash + 1);
+  return StringPrintf("%s\t%016" PRIx64, cart.c_str(),
+                      CityHash64((const char *)inputs.data(),
+                                 inputs.size()));
+}
+
+// Fields of the report lines for the given mode, by ReportKey.
+static std::map<string, vector<string>> ReadReport(const string &file,
+                                                   const string &mode) {
+  std::map<string, vector<string>> lines;
+  for (const string &line : ReadFileToLines(file)) {
+    if (line.empty() || line[0] == '#') continue;
+    vector<string> fields = Util::Split(line, '\t');
+    if (fields.size() < 8 || fields[2] != mode) continue;
+    lines[fields[0] + "\t" + fields[1]] = std::move(fields);
+  }
+  return lines;
+}
+
+// Frame rates this much lower than the baseline's are reported.
+// Timing is noisy, so this is loose.
+static constexpr double SLOWER_THRESHOLD = 0.90;
+
 int main(int argc, char **argv) {
+  bool use_aot = false;
+  bool resume = false;
+  string romdir = "testroms/";
+  string report_file, baseline_file;
+  int num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    if (arg == "--aot") {
+      use_aot = true;
+    } else if (arg == "--resume") {
+      resume = true;
+    } else if (arg == "--report" && i + 1 < argc) {
+      report_file = argv[++i];
+    } else if (arg == "--baseline" && i + 1 < argc) {
+      baseline_file = argv[++i];
+    } else if (arg == "--romdir" && i + 1 < argc) {
+      romdir = argv[++i];
+      if (romdir.empty() || romdir.back() != '/') romdir += "/";
+    } else if (arg == "--threads" && i + 1 < argc) {
+      num_threads = std::max(1, atoi(argv[++i]));
+    } else {
+      CHECK(false) << "Unknown argument " << arg << ". Usage:\n"
+        "emulator_test.exe [--aot] [--romdir dir] [--threads n] "
+        "[--report file.tsv [--resume]] [--baseline old.tsv]";
+    }
+  }
+  CHECK(!resume || !report_file.empty()) << "--resume needs --report";
+  const string mode = use_aot ? "aot" : "interp";
 
   Timer test_timer;
 
-  const std::vector<TestCase> test_cases = TestCases();
+  const std::vector<TestCase> test_cases = TestCases(romdir);
+
+  // Results already in the report, by ReportKey (for this mode).
+  std::map<string, bool> done;
+  if (resume) {
+    for (const auto &[key, fields] : ReadReport(report_file, mode))
+      done[key] = fields[3] == "ok";
+  }
+
+  const std::map<string, vector<string>> baseline =
+    baseline_file.empty() ? std::map<string, vector<string>>{} :
+    ReadReport(baseline_file, mode);
+  int slower = 0;
 
-  // TODO: Run these in parallel.
   int correct = 0, total = 0;
+  vector<const TestCase *> todo;
   for (const TestCase &tc : test_cases) {
-    Timer serial_timer;
-    SerialResult result =
-      RunGameSerially(
-          [](const string &s) {
-            printf("[%s]\n", s.c_str());
-          }, tc.game);
-    total++;
-    bool is_correct =
-      result.nes_after_fixed == tc.result.nes_after_fixed &&
-      result.img_after_fixed == tc.result.img_after_fixed &&
-      result.nes_after_random == tc.result.nes_after_random &&
-      result.img_after_random == tc.result.img_after_random;
-    if (is_correct)  {
-      correct++;
-      printf("%s [%.2fs]: correct!\n", tc.game.cart.c_str(),
-             serial_timer.Seconds());
+    auto it = done.find(ReportKey(tc.game));
+    if (it == done.end()) {
+      todo.push_back(&tc);
     } else {
-      printf("%s [%.2fs]:\n"
-             "      0x%016llx, 0x%016llx,\n"
-             "      0x%016llx, 0x%016llx,\n",
-             tc.game.cart.c_str(),
-             serial_timer.Seconds(),
-             result.nes_after_fixed,
-             result.img_after_fixed,
-             result.nes_after_random,
-             result.img_after_random);
+      printf("%s: %s in previous run.\n", tc.game.cart.c_str(),
+             it->second ? "correct" : "INCORRECT");
+      total++;
+      if (it->second) correct++;
     }
   }
 
+  FILE *report = nullptr;
+  if (!report_file.empty()) {
+    const bool is_new = !ExistsFile(report_file);
+    report = fopen(report_file.c_str(), "a");
+    CHECK(report != nullptr) << report_file;
+    if (is_new) fprintf(report, "%s", REPORT_HEADER);
+    fprintf(report, "# %d tests, %d threads\n", (int)todo.size(),
+            num_threads);
+    fflush(report);
+  }
+
+  // First check correctness, in parallel.
+  struct Outcome {
+    SerialResult result;
+    double seconds = 0.0;
+    bool is_correct = false;
+  };
+  vector<Outcome> outcomes(todo.size());
+  ROMCache roms;
+  // Protects stdout and the counts.
+  std::mutex out_m;
+  ParallelComp(todo.size(), [&](int64 idx) {
+      const TestCase &tc = *todo[idx];
+      const string &cart = tc.game.cart;
+      const LoadedROM *rom = roms.Get(cart);
+      CHECK(rom != nullptr) << cart;
+
+      Outcome &out = outcomes[idx];
+      Timer serial_timer;
+      out.result =
+        RunGameSerially(
+            [&out_m, &cart](const string &s) {
+              MutexLock ml(&out_m);
+              printf("[%s] %s\n", cart.c_str(), s.c_str());
+            }, *rom, tc.game, use_aot);
+      out.seconds = serial_timer.Seconds();
+
+      const double approx_diff =
+        ApproximateImageDiff(*rom, tc.game.start_inputs);
+
+      const SerialResult &result = out.result;
+      out.is_correct =
+        result.nes_after_fixed == tc.result.nes_after_fixed &&
+        result.img_after_fixed == tc.result.img_after_fixed &&
+        result.nes_after_random == tc.result.nes_after_random &&
+        result.img_after_random == tc.result.img_after_random &&
+        approx_diff <= tc.max_approx_diff;
+
+      MutexLock ml(&out_m);
+      total++;
+      printf("%s: %.2f%% of pixels differ in the approximate image%s\n",
+             cart.c_str(), approx_diff * 100.0,
+             approx_diff > tc.max_approx_diff ? " (TOO MANY)" : "");
+      if (out.is_correct)  {
+        correct++;
+        printf("%s [%.2fs]: correct!\n", cart.c_str(), out.seconds);
+      } else {
+        printf("%s [%.2fs]:\n"
+               "      0x%016" PRIx64 ", 0x%016" PRIx64 ",\n"
+               "      0x%016" PRIx64 ", 0x%016" PRIx64 ",\n",
+               cart.c_str(), out.seconds,
+               result.nes_after_fixed,
+               result.img_after_fixed,
+               result.nes_after_random,
+               result.img_after_random);
+      }
+    }, num_threads);
+
+  // Then measure frame rates one at a time, so that the tests aren't
+  // competing for cores (or memory bandwidth) while being timed.
+  for (int idx = 0; idx < (int)todo.size(); idx++) {
+    const TestCase &tc = *todo[idx];
+    const string &cart = tc.game.cart;
+    const Outcome &out = outcomes[idx];
+    const vector<uint8> inputs = TestInputs(tc.game);
+    const auto [step_fps, novideo_fps] =
+      MeasureFPS(*roms.Get(cart), inputs, use_aot);
+    printf("%s: %.0f fps, %.0f fps without video\n", cart.c_str(),
+           step_fps, novideo_fps);
+
+    const string key = ReportKey(tc.game);
+    auto bit = baseline.find(key);
+    if (bit != baseline.end()) {
+      const double old_fps = atof(bit->second[6].c_str());
+      if (step_fps < old_fps * SLOWER_THRESHOLD) {
+        printf("%s: SLOWER than baseline: %.0f fps, was %.0f\n",
+               cart.c_str(), step_fps, old_fps);
+        slower++;
+      }
+    }
+
+    if (report != nullptr) {
+      fprintf(report,
+              "%s\t%s\t%s\t%d\t%.3f\t%.1f\t%.1f\t"
+              "0x%016" PRIx64 "\t0x%016" PRIx64 "\t"
+              "0x%016" PRIx64 "\t0x%016" PRIx64 "\n",
+              key.c_str(), mode.c_str(),
+              out.is_correct ? "ok" : "mismatch",
+              (int)inputs.size(), out.seconds, step_fps, novideo_fps,
+              out.result.nes_after_fixed,
+              out.result.img_after_fixed,
+              out.result.nes_after_random,
+              out.result.img_after_random);
+      fflush(report);
+    }
+  }
+
+  if (report != nullptr) fclose(report);
+
   printf("Ran everything in %.2fs\n", test_timer.Seconds());
+  if (slower > 0)
+    printf("%d test(s) slower than the baseline.\n", slower);
 
   CHECK(correct == total) << "Only " << correct << "/" << total
                           << " were correct.";
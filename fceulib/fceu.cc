@@ -83,6 +83,7 @@ void FCEU::FCEU_CloseGame() {
   // but it seems like the sane thing to do. -tom7
   memset(GameMemBlock, 0, GAME_MEM_BLOCK_SIZE);
   memset(RAM, 0, 0x800);
+  ram_hash = 0ULL;
   memset(XBuf, 0, 256 * 256);
   memset(XBackBuf, 0, 256 * 256);
 }
@@ -110,6 +111,18 @@ void FCEU::SetWriteHandler(int32 start, int32 end, writefunc func) {
   for (int32 x = start; x <= end; x++) {
     BWrite[x] = func;
   }
+
+  for (int p = start >> 11; p <= (end >> 11); p++) {
+    const int32 base = p << 11;
+    write_uniform[p] = true;
+    for (int32 x = base + 1; x < base + 2048; x++) {
+      if (BWrite[x] != BWrite[base]) {
+        write_uniform[p] = false;
+        break;
+      }
+    }
+    UpdateFastPage(p);
+  }
 }
 
 FCEU::~FCEU() {
@@ -121,11 +134,37 @@ FCEU::~FCEU() {
 
 
 static DECLFW(WriteRamNoMask) {
-  fc->fceu->RAM[A] = V;
+  fc->fceu->WriteRAM(A, V);
 }
 
 static DECLFW(WriteRamMask) {
-  fc->fceu->RAM[A & 0x7FF] = V;
+  fc->fceu->WriteRAM(A & 0x7FF, V);
+}
+
+// Random odd 64-bit numbers (splitmix64), computed at compile time.
+static constexpr std::array<uint64, 0x800> MakeRAMHashKeys() {
+  std::array<uint64, 0x800> keys = {};
+  uint64 state = 0x52414D4841534821ULL;
+  for (uint64 &key : keys) {
+    state += 0x9E3779B97F4A7C15ULL;
+    uint64 z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    key = (z ^ (z >> 31)) | 1ULL;
+  }
+  return keys;
+}
+
+const std::array<uint64, 0x800> FCEU::RAM_HASH_KEYS = MakeRAMHashKeys();
+
+uint64 FCEU::ComputeRAMHash() const {
+  uint64 h = 0ULL;
+  for (int a = 0; a < 0x800; a++) h += RAM_HASH_KEYS[a] * RAM[a];
+  return h;
+}
+
+void FCEU::RehashRAM() {
+  ram_hash = ComputeRAMHash();
 }
 
 static DECLFR(ReadRamNoMask) {
@@ -164,7 +203,21 @@ FCEUGI *FCEU::FCEUI_LoadGame(const char *name, int OverwriteVidMode) {
   }
 
   // file opened ok. start loading.
+  return LoadGameFromFile(name, fp, nullptr, OverwriteVidMode);
+}
+
+FCEUGI *FCEU::FCEUI_LoadGameFromMemory(const char *name,
+                                       const std::vector<uint8> &contents,
+                                       const INesImage *image,
+                                       int OverwriteVidMode) {
+  FceuFile *fp = FCEU_fopen_memory(name, contents);
+  return LoadGameFromFile(name, fp, image, OverwriteVidMode);
+}
 
+// Takes ownership of fp.
+FCEUGI *FCEU::LoadGameFromFile(const char *name, FceuFile *fp,
+                               const INesImage *image,
+                               int OverwriteVidMode) {
   ResetGameLoaded();
 
   // Reset parameters so they're cleared just in case a format's loader
@@ -181,7 +234,7 @@ FCEUGI *FCEU::FCEUI_LoadGame(const char *name, int OverwriteVidMode) {
   GameInfo->cspecial = SIS_NONE;
 
   // Try to load each different format
-  if (fc->ines->iNESLoad(name, fp, OverwriteVidMode) ||
+  if (fc->ines->iNESLoad(name, fp, OverwriteVidMode, image) ||
       fc->unif->UNIFLoad(name, fp) ||
       fc->fds->FDSLoad(name, fp)) {
 
@@ -224,14 +277,18 @@ void FCEU::FCEUI_Emulate(int skip) {
 
   // fprintf(stderr, "ppu loop..\n");
 
-  fc->ppu->FrameLoop();
+  // If skip = 3 we don't even draw pixels.
+  if (skip == 3) fc->ppu->FrameLoop<false>();
+  else fc->ppu->FrameLoop<true>();
 
   // fprintf(stderr, "sound thing loop skip=%d..\n", skip);
 
-  // If skip = 2 we are skipping sound processing
-  if (skip != 2)
+  // If skip >= 2 we are skipping sound processing
+  if (skip < 2)
     (void)fc->sound->FlushEmulateSound();
 
+  if (fc->X->profile) fc->X->profile->EndFrame();
+
   // This is where cheat list stuff happened.
   timestampbase += fc->X->timestamp;
   fc->X->timestamp = 0;
@@ -252,6 +309,7 @@ void FCEU::PowerNES() {
   if (GameInfo == nullptr) return;
 
   FCEU_InitMemory(RAM, 0x800);
+  RehashRAM();
 
   SetReadHandler(0x0000, 0xFFFF, ANull);
   SetWriteHandler(0x0000, 0xFFFF, BNull);
@@ -328,6 +386,56 @@ void FCEU::SetReadHandler(int32 start, int32 end, readfunc func) {
   for (int x = start; x <= end; x++) {
     ARead[x] = func;
   }
+
+  for (int p = start >> 11; p <= (end >> 11); p++) {
+    const int32 base = p << 11;
+    read_uniform[p] = true;
+    for (int32 x = base + 1; x < base + 2048; x++) {
+      if (ARead[x] != ARead[base]) {
+        read_uniform[p] = false;
+        break;
+      }
+    }
+    UpdateFastPage(p);
+  }
+}
+
+void FCEU::SetFastPages(bool enable) {
+  fast_pages_enabled = enable;
+  for (int p = 0; p < 32; p++) UpdateFastPage(p);
+}
+
+void FCEU::UpdateFastPage(int p) {
+  const uint32 A = p << 11;
+  if (!fast_pages_enabled) {
+    fast_read[p] = nullptr;
+    fast_write[p] = nullptr;
+    fast_ram_write = false;
+    return;
+  }
+
+  const readfunc r = read_uniform[p] ? ARead[A] : nullptr;
+  if ((p == 0 && r == ReadRamNoMask) || (p < 4 && r == ReadRamMask)) {
+    fast_read[p] = RAM - A;
+  } else if (r == &Cart::CartBR || r == &Cart::CartBROB) {
+    // Null if nothing is mapped, which CartBR doesn't expect anyway.
+    fast_read[p] = fc->cart->PageBase(p);
+  } else {
+    fast_read[p] = nullptr;
+  }
+
+  const writefunc w = write_uniform[p] ? BWrite[A] : nullptr;
+  fast_write[p] = (w == &Cart::CartBW && fc->cart->PageIsRAM(p)) ?
+    fc->cart->PageBase(p) : nullptr;
+
+  if (p < 4) {
+    fast_ram_write = true;
+    for (int q = 0; q < 4; q++) {
+      const writefunc qw = write_uniform[q] ? BWrite[q << 11] : nullptr;
+      if (!((q == 0 && qw == WriteRamNoMask) || qw == WriteRamMask))
+        fast_ram_write = false;
+    }
+  }
 }
 
 // This is kind of silly since it just eta-expands printf with
@@ -1,6 +1,9 @@
 #ifndef _FCEU_H_
 #define _FCEU_H_
 
+#include <array>
+#include <vector>
+
 #include "types.h"
 #include "git.h"
 
@@ -46,6 +49,8 @@ enum EFCEUI {
 
 struct CartInterface;
 struct MapInterface;
+struct INesImage;
+struct FceuFile;
 
 struct FCEU {
   explicit FCEU(FC *fc);
@@ -81,6 +86,14 @@ struct FCEU {
 
   // returns null if it failed
   FCEUGI *FCEUI_LoadGame(const char *filename, int OverwriteVidMode);
+  // Same, but from the file's contents, already in memory. If the
+  // game is iNES and image is non-null, the cartridge ROM is shared
+  // with the image (see INes::iNESLoad). contents and image must
+  // outlive the game.
+  FCEUGI *FCEUI_LoadGameFromMemory(const char *filename,
+                                   const std::vector<uint8> &contents,
+                                   const INesImage *image,
+                                   int OverwriteVidMode);
 
   // Used by some boards to do delayed memory writes, etc.
   uint64 timestampbase = 0ULL;
@@ -94,6 +107,24 @@ struct FCEU {
   uint8 *RAM = nullptr;
   uint8 *GameMemBlock = nullptr;
 
+  // Hash of RAM, maintained incrementally so that it's O(1) to get:
+  // the sum of RAM_HASH_KEYS[a] * RAM[a] (mod 2^64) over all a.
+  // Writes to RAM must go through WriteRAM, or be followed by
+  // RehashRAM (as after loading a state). Distinct memories collide
+  // with probability about 2^-56 over the choice of keys. The low
+  // bits are weak (e.g. bit 0 is the parity of the bytes' sum), so
+  // mix before using this to index a table; see Emulator::RAMHash.
+  uint64 ram_hash = 0ULL;
+  static const std::array<uint64, 0x800> RAM_HASH_KEYS;
+
+  inline void WriteRAM(uint32 A, uint8 V) {
+    ram_hash += RAM_HASH_KEYS[A] * (uint64)((int)V - (int)RAM[A]);
+    RAM[A] = V;
+  }
+  // Recompute ram_hash from scratch.
+  void RehashRAM();
+  uint64 ComputeRAMHash() const;
+
   // Current frame buffer. 256x256
   uint8 *XBuf = nullptr;
   uint8 *XBackBuf = nullptr;
@@ -101,9 +132,32 @@ struct FCEU {
   // TODO(tom7): Move these to the modules where they're defined.
   // Hooks for reading and writing from memory locations (16-bit
   // addresses). Each one is a function pointer.
+  // Set these with SetReadHandler/SetWriteHandler, or the fast pages
+  // below will be wrong. (The PPU sets its registers directly, which
+  // is OK because they are never fast.)
   readfunc ARead[0x10000];
   writefunc BWrite[0x10000];
 
+  // Fast paths for the CPU. For each 2k page of the address space,
+  // non-null if the read handler for the whole page just reads memory
+  // (internal RAM, or the cart's mapped PRG through Cart::CartBR), so
+  // that the CPU can read fast_read[A >> 11][A] instead of calling
+  // it. Like Cart's pages, the pointer is offset so that it is
+  // indexed by the full address. Likewise fast_write for PRG RAM
+  // written through Cart::CartBW (usually WRAM at $6000).
+  // Internal RAM writes have to maintain ram_hash, so instead
+  // fast_ram_write means they can just call WriteRAM(A & 0x7FF).
+  // Kept current by Set*Handler and the cart's bank switching.
+  const uint8 *fast_read[32] = {};
+  uint8 *fast_write[32] = {};
+  bool fast_ram_write = false;
+  // Recompute the fast pointers for the 2k page, after its handlers
+  // or cart mapping change.
+  void UpdateFastPage(int page);
+  // On by default. Off just for benchmarking the difference; the
+  // emulation is exactly the same either way.
+  void SetFastPages(bool enable);
+
   void (*GameInterface)(FC *fc, GI h) = nullptr;
   void (*GameStateRestore)(FC *fc, int version) = nullptr;
 
@@ -141,7 +195,15 @@ private:
   readfunc *AReadG = nullptr;
   writefunc *BWriteG = nullptr;
 
+  // Whether each 2k page has the same handler throughout, so that
+  // UpdateFastPage (called on every bank switch) need not check.
+  bool read_uniform[32] = {};
+  bool write_uniform[32] = {};
+  bool fast_pages_enabled = true;
+
   void ResetGameLoaded();
+  FCEUGI *LoadGameFromFile(const char *name, FceuFile *fp,
+                           const INesImage *image, int OverwriteVidMode);
 
   FC *fc = nullptr;
 };
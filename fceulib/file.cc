@@ -114,6 +114,15 @@ FceuFile *FCEU_fopen(const std::string &path,
   return fceufp;
 }
 
+FceuFile *FCEU_fopen_memory(const std::string &filename,
+                            const std::vector<uint8> &contents) {
+  FceuFile *fceufp = new FceuFile();
+  fceufp->filename = filename;
+  fceufp->stream = new EmuFile_MEMORY_READONLY(contents);
+  fceufp->size = contents.size();
+  return fceufp;
+}
+
 int FCEU_fclose(FceuFile *fp) {
   delete fp;
   return 1;
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <iostream>
+#include <vector>
 #include "types.h"
 #include "emufile.h"
 
@@ -26,6 +27,10 @@ struct FceuFile {
 };
 
 FceuFile *FCEU_fopen(const std::string &path, const char *mode, const char *ext);
+// Read-only file backed by the vector, which must outlive it.
+// The filename is just used as the name.
+FceuFile *FCEU_fopen_memory(const std::string &filename,
+                            const std::vector<uint8> &contents);
 int FCEU_fclose(FceuFile*);
 uint64 FCEU_fread(void *ptr, size_t size, size_t nmemb, FceuFile*);
 int FCEU_fseek(FceuFile*, long offset, int whence);
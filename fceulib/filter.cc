@@ -9,11 +9,142 @@
 #include "fceu.h"
 #include "filter.h"
 #include "fsettings.h"
+#include "base/logging.h"
 
 // Maybe should be called "fcoeffs.inc" -tom7
 #include "fcoeffs.h"
 
-Filter::Filter(FC *fc) : fc(fc) {}
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTER_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define FILTER_X86_KERNELS 0
+#endif
+
+// The FIR kernel. S points NCOEFFS (or SQ2NCOEFFS) samples before the
+// output sample's input position, and the two sums are for that
+// position and the next, to be interpolated between. Everything is
+// int32 arithmetic, so that wrapping additions in any order give the
+// same result; each product is shifted before accumulating.
+static void ConvolveScalar(const int32 *S, const int32 *D, int n,
+                           int32 *acc_out, int32 *acc2_out) {
+  int32 acc = 0, acc2 = 0;
+  for (unsigned int c = n; c; c--) {
+    acc += (S[c] * *D) >> 6;
+    acc2 += (S[1 + c] * *D) >> 6;
+    D++;
+  }
+  *acc_out = acc;
+  *acc2_out = acc2;
+}
+
+#if FILTER_X86_KERNELS
+// The vector versions rely on the coefficients being symmetric
+// (D[i] == D[n - 1 - i], as MakeFilters makes them), so that the
+// scalar loop's reversed walk over S is the same as this forward
+// one: the sums are over S[1 + i] * D[i] and S[2 + i] * D[i].
+
+__attribute__((target("sse4.1")))
+static void ConvolveSSE41(const int32 *S, const int32 *D, int n,
+                          int32 *acc_out, int32 *acc2_out) {
+  __m128i acc = _mm_setzero_si128(), acc2 = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i d = _mm_loadu_si128((const __m128i *)(D + i));
+    const __m128i a = _mm_loadu_si128((const __m128i *)(S + 1 + i));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(S + 2 + i));
+    acc = _mm_add_epi32(acc, _mm_srai_epi32(_mm_mullo_epi32(a, d), 6));
+    acc2 = _mm_add_epi32(acc2, _mm_srai_epi32(_mm_mullo_epi32(b, d), 6));
+  }
+  // Horizontal sums.
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+  acc2 = _mm_add_epi32(acc2, _mm_shuffle_epi32(acc2, 0x4E));
+  acc2 = _mm_add_epi32(acc2, _mm_shuffle_epi32(acc2, 0xB1));
+  // Unsigned so that wrapping is defined.
+  uint32 a = _mm_cvtsi128_si32(acc), b = _mm_cvtsi128_si32(acc2);
+  for (; i < n; i++) {
+    a += (uint32)((S[1 + i] * D[i]) >> 6);
+    b += (uint32)((S[2 + i] * D[i]) >> 6);
+  }
+  *acc_out = (int32)a;
+  *acc2_out = (int32)b;
+}
+
+__attribute__((target("avx2")))
+static void ConvolveAVX2(const int32 *S, const int32 *D, int n,
+                         int32 *acc_out, int32 *acc2_out) {
+  __m256i acc = _mm256_setzero_si256(), acc2 = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i d = _mm256_loadu_si256((const __m256i *)(D + i));
+    const __m256i a = _mm256_loadu_si256((const __m256i *)(S + 1 + i));
+    const __m256i b = _mm256_loadu_si256((const __m256i *)(S + 2 + i));
+    acc = _mm256_add_epi32(acc,
+                           _mm256_srai_epi32(_mm256_mullo_epi32(a, d), 6));
+    acc2 = _mm256_add_epi32(acc2,
+                            _mm256_srai_epi32(_mm256_mullo_epi32(b, d), 6));
+  }
+  __m128i lo = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                             _mm256_extracti128_si256(acc, 1));
+  __m128i lo2 = _mm_add_epi32(_mm256_castsi256_si128(acc2),
+                              _mm256_extracti128_si256(acc2, 1));
+  lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, 0x4E));
+  lo = _mm_add_epi32(lo, _mm_shuffle_epi32(lo, 0xB1));
+  lo2 = _mm_add_epi32(lo2, _mm_shuffle_epi32(lo2, 0x4E));
+  lo2 = _mm_add_epi32(lo2, _mm_shuffle_epi32(lo2, 0xB1));
+  uint32 a = _mm_cvtsi128_si32(lo), b = _mm_cvtsi128_si32(lo2);
+  for (; i < n; i++) {
+    a += (uint32)((S[1 + i] * D[i]) >> 6);
+    b += (uint32)((S[2 + i] * D[i]) >> 6);
+  }
+  *acc_out = (int32)a;
+  *acc2_out = (int32)b;
+}
+#endif
+
+bool Filter::KernelSupported(Kernel k) {
+  switch (k) {
+  case Kernel::SCALAR: return true;
+#if FILTER_X86_KERNELS
+  case Kernel::SSE41:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+  case Kernel::AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+  default: return false;
+  }
+}
+
+const char *Filter::KernelName(Kernel k) {
+  switch (k) {
+  case Kernel::SCALAR: return "scalar";
+  case Kernel::SSE41: return "sse4.1";
+  case Kernel::AVX2: return "avx2";
+  default: return "?";
+  }
+}
+
+void Filter::SetKernel(Kernel k) {
+  CHECK(KernelSupported(k)) << KernelName(k);
+  kernel = k;
+  switch (k) {
+  default:
+  case Kernel::SCALAR: convolve = &ConvolveScalar; break;
+#if FILTER_X86_KERNELS
+  case Kernel::SSE41: convolve = &ConvolveSSE41; break;
+  case Kernel::AVX2: convolve = &ConvolveAVX2; break;
+#endif
+  }
+}
+
+Filter::Filter(FC *fc) : fc(fc) {
+  if (KernelSupported(Kernel::AVX2)) SetKernel(Kernel::AVX2);
+  else if (KernelSupported(Kernel::SSE41)) SetKernel(Kernel::SSE41);
+  else SetKernel(Kernel::SCALAR);
+}
 
 void Filter::SexyFilter2(int32 *in, int32 count) {
   while (count--) {
@@ -75,15 +206,9 @@ int32 Filter::NeoFilterSound(int32 *in, int32 *out, uint32 inlen,
 
   if (FCEUS_SOUNDQ == 2) {
     for (x = mrindex; x < max; x += mrratio) {
-      int32 acc = 0, acc2 = 0;
+      int32 acc, acc2;
       const int32 *S = &in[(x >> 16) - SQ2NCOEFFS];
-      const int32 *D = sq2coeffs;
-
-      for (unsigned int c = SQ2NCOEFFS; c; c--) {
-        acc += (S[c] * *D) >> 6;
-        acc2 += (S[1 + c] * *D) >> 6;
-        D++;
-      }
+      (*convolve)(S, sq2coeffs, SQ2NCOEFFS, &acc, &acc2);
 
       acc = ((int64)acc * (65536 - (x & 65535)) + (int64)acc2 * (x & 65535)) >>
             (16 + 11);
@@ -93,15 +218,9 @@ int32 Filter::NeoFilterSound(int32 *in, int32 *out, uint32 inlen,
     }
   } else {
     for (x = mrindex; x < max; x += mrratio) {
-      int32 acc = 0, acc2 = 0;
+      int32 acc, acc2;
       const int32 *S = &in[(x >> 16) - NCOEFFS];
-      const int32 *D = coeffs;
-
-      for (unsigned int c = NCOEFFS; c; c--) {
-        acc += (S[c] * *D) >> 6;
-        acc2 += (S[1 + c] * *D) >> 6;
-        D++;
-      }
+      (*convolve)(S, coeffs, NCOEFFS, &acc, &acc2);
 
       acc = ((int64)acc * (65536 - (x & 65535)) + (int64)acc2 * (x & 65535)) >>
             (16 + 11);
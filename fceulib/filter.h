@@ -12,7 +12,25 @@ struct Filter {
   void MakeFilters(int32 rate);
   void SexyFilter(int32 *in, int32 *out, int32 count);
 
+  // Implementations of the FIR convolution in NeoFilterSound, which
+  // is most of the cost of sound. The vector ones are only available
+  // when compiled with GCC or clang for x86, and the CPU supports
+  // them. All produce identical output. The constructor picks the
+  // best supported one.
+  enum class Kernel { SCALAR, SSE41, AVX2, };
+  static bool KernelSupported(Kernel k);
+  static const char *KernelName(Kernel k);
+  // The kernel must be supported.
+  void SetKernel(Kernel k);
+  Kernel GetKernel() const { return kernel; }
+
  private:
+  // Computes both FIR sums for an output sample; see filter.cc.
+  using ConvolveFn = void (*)(const int32 *s, const int32 *d, int n,
+                              int32 *acc, int32 *acc2);
+  Kernel kernel = Kernel::SCALAR;
+  ConvolveFn convolve = nullptr;
+
   // These are initialized by makefilters in sound.cc.
   int32 sq2coeffs[SQ2NCOEFFS] = {};
   int32 coeffs[NCOEFFS] = {};
@@ -0,0 +1,56 @@
+// Profiles a game's 6502 code while playing back a movie, and prints
+// the report (see profile.h). Useful for deciding whether a game is
+// worth compiling with aot.exe, and which mapper handlers are hot.
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "emulator.h"
+#include "simplefm2.h"
+#include "simplefm7.h"
+#include "timer.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: hotspots romfile.nes moviefile.fm2|fm7 "
+	    "[period]\n"
+	    "\nSamples every period-th instruction (default 16).\n");
+    return -1;
+  }
+  const string romfilename = argv[1];
+  const string moviefilename = argv[2];
+  const int period = argc > 3 ? atoi(argv[3]) : 16;
+  if (period < 1) {
+    fprintf(stderr, "Period must be at least 1.\n");
+    return -1;
+  }
+
+  std::unique_ptr<Emulator> emu{Emulator::Create(romfilename)};
+  if (emu.get() == nullptr) {
+    fprintf(stderr, "Couldn't load %s.\n", romfilename.c_str());
+    return -1;
+  }
+
+  const bool fm7 = moviefilename.size() > 4 &&
+    moviefilename.substr(moviefilename.size() - 4) == ".fm7";
+  const vector<pair<uint8, uint8>> movie = fm7 ?
+    SimpleFM7::ReadInputs2P(moviefilename) :
+    SimpleFM2::ReadInputs2P(moviefilename);
+
+  emu->StartProfile(period);
+  Timer run_timer;
+  for (const pair<uint8, uint8> &input : movie)
+    emu->Step(input.first, input.second);
+  const double seconds = run_timer.Seconds();
+
+  printf("%s with %s: %d frames in %.2fs\n\n%s",
+	 romfilename.c_str(), moviefilename.c_str(),
+	 (int)movie.size(), seconds, emu->ProfileReport().c_str());
+  return 0;
+}
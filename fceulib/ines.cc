@@ -121,10 +121,12 @@ void INes::iNESGI(GI h) {
     fc->cart->FCEU_SaveGameSave(&iNESCart);
 
     fc->fceu->cartiface->Close();
-    free(ROM);
+    if (!rom_shared) free(ROM);
     ROM = nullptr;
-    free(VROM);
+    rom_shared = false;
+    if (!vrom_shared) free(VROM);
     VROM = nullptr;
+    vrom_shared = false;
 
     if (fc->fceu->mapiface)
       fc->fceu->mapiface->MapperClose();
@@ -446,8 +448,9 @@ void INes::CheckHInfo() {
       if (ines_correct[x].mapper>=0) {
         if (ines_correct[x].mapper&0x800 && VROM_size) {
           VROM_size=0;
-          free(VROM);
+          if (!vrom_shared) free(VROM);
           VROM = nullptr;
+          vrom_shared = false;
           tofix|=8;
         }
         if (mapper_number!=(ines_correct[x].mapper&0xFF)) {
@@ -817,7 +820,8 @@ static uint32 uppow2(uint32 n) {
 // Returns the number of 16k banks (always a power of two, even
 // for non-power-of-two mappers) and the number of 16k banks to
 // actually read from the cart file (might not be power of two).
-std::pair<uint32, uint32> INes::GetRoundedROMSize() const {
+std::pair<uint32, uint32> INes::GetRoundedROMSize(const Header &head,
+                                                  int mapper_number) {
   const uint32 romsize_pow2 =
     head.ROM_size ? uppow2(head.ROM_size) : 256;
 
@@ -839,16 +843,78 @@ std::pair<uint32, uint32> INes::GetRoundedROMSize() const {
   return {romsize_pow2, romsize_pow2};
 }
 
-bool INes::iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode) {
-  struct md5_context md5;
+bool INes::ReadHeader(FceuFile *fp, Header *h) {
+  if (FCEU_fread(h,1,16,fp)!=16)
+    return false;
 
-  if (FCEU_fread(&head,1,16,fp)!=16)
+  if (memcmp(h,"NES\x1a",4))
     return false;
 
-  if (memcmp(&head,"NES\x1a",4))
+  CleanupHeader(h);
+  return true;
+}
+
+int INes::HeaderMapperNumber(const Header &h) {
+  return (h.ROM_type >> 4) | (h.ROM_type2 & 0xF0);
+}
+
+// Reads the ROM and VROM (already allocated and filled with 0xFF)
+// following the header and trainer, and hashes them.
+static void ReadAndHashROM(FceuFile *fp,
+                           uint8 *rom, uint32 rom_size,
+                           uint32 rom_size_to_read,
+                           uint8 *vrom, uint32 vrom_size,
+                           uint32 vrom_size_to_read,
+                           uint32 *crc32, uint8 md5_out[16]) {
+  // Read the appropriate number of 16k chunks from the file into
+  // ROM. We may not fill all of ROM here, since it may have been
+  // rounded up.
+  FCEU_fread(rom, 0x4000, rom_size_to_read, fp);
+
+  if (vrom_size)
+    FCEU_fread(vrom, 0x2000, vrom_size_to_read, fp);
+
+  struct md5_context md5;
+  md5_starts(&md5);
+  md5_update(&md5, rom, rom_size << 14);
+
+  *crc32 = CalcCRC32(0, rom, rom_size << 14);
+
+  if (vrom_size) {
+    *crc32 = CalcCRC32(*crc32, vrom, vrom_size << 13);
+    md5_update(&md5, vrom, vrom_size << 13);
+  }
+  md5_finish(&md5, md5_out);
+}
+
+bool INes::DecodeImage(FceuFile *fp, INesImage *image) {
+  Header h;
+  if (!ReadHeader(fp, &h))
     return false;
 
-  CleanupHeader(&head);
+  uint32 rom_size_to_read;
+  std::tie(image->ROM_size, rom_size_to_read) =
+    GetRoundedROMSize(h, HeaderMapperNumber(h));
+  image->VROM_size = h.VROM_size ? uppow2(h.VROM_size) : 0;
+
+  image->rom.assign(image->ROM_size << 14, 0xFF);
+  image->vrom.assign(image->VROM_size << 13, 0xFF);
+
+  // Trainer is not part of the image; iNESLoad reads it itself.
+  if (h.ROM_type & 4)
+    FCEU_fseek(fp, 512, SEEK_CUR);
+
+  ReadAndHashROM(fp,
+                 image->rom.data(), image->ROM_size, rom_size_to_read,
+                 image->vrom.data(), image->VROM_size, h.VROM_size,
+                 &image->crc32, image->md5);
+  return true;
+}
+
+bool INes::iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode,
+                    const INesImage *image) {
+  if (!ReadHeader(fp, &head))
+    return false;
 
   memset(&iNESCart, 0, sizeof(iNESCart));
   delete fc->fceu->cartiface;
@@ -857,31 +923,44 @@ bool INes::iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode) {
   delete fc->fceu->mapiface;
   fc->fceu->mapiface = nullptr;
 
-  mapper_number = head.ROM_type >> 4;
-  mapper_number |= (head.ROM_type2 & 0xF0);
+  mapper_number = HeaderMapperNumber(head);
   iNESMirroring = head.ROM_type & 1;
 
   if (head.ROM_type & 8) iNESMirroring = 2;
 
   uint32 rom_size_to_read;
-  std::tie(ROM_size, rom_size_to_read) = GetRoundedROMSize();
-
-  ROM = (uint8 *)FCEU_malloc(ROM_size << 14);
-  if (ROM == nullptr) return false;
-  memset(ROM, 0xFF, ROM_size << 14);
-
-  if (head.VROM_size) {
-    VROM_size = uppow2(head.VROM_size);
-
-    VROM = (uint8 *)FCEU_malloc(VROM_size << 13);
-    if (VROM == nullptr) {
-      free(ROM);
-      ROM = nullptr;
-      return false;
+  std::tie(ROM_size, rom_size_to_read) =
+    GetRoundedROMSize(head, mapper_number);
+
+  if (image != nullptr) {
+    // The image is only read through the cart mapping (PRG and CHR
+    // chip 0 are mapped read-only below), so sharing it is safe.
+    ROM = const_cast<uint8 *>(image->rom.data());
+    rom_shared = true;
+    VROM_size = image->VROM_size;
+    if (VROM_size) {
+      VROM = const_cast<uint8 *>(image->vrom.data());
+      vrom_shared = true;
     }
-    memset(VROM, 0xFF, VROM_size << 13);
   } else {
-    VROM_size = 0;
+    rom_shared = vrom_shared = false;
+    ROM = (uint8 *)FCEU_malloc(ROM_size << 14);
+    if (ROM == nullptr) return false;
+    memset(ROM, 0xFF, ROM_size << 14);
+
+    if (head.VROM_size) {
+      VROM_size = uppow2(head.VROM_size);
+
+      VROM = (uint8 *)FCEU_malloc(VROM_size << 13);
+      if (VROM == nullptr) {
+        free(ROM);
+        ROM = nullptr;
+        return false;
+      }
+      memset(VROM, 0xFF, VROM_size << 13);
+    } else {
+      VROM_size = 0;
+    }
   }
 
   /* Trainer */
@@ -897,24 +976,15 @@ bool INes::iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode) {
   fc->cart->SetupCartPRGMapping(0, ROM, ROM_size << 14, false);
   // SetupCartPRGMapping(1,WRAM,8192,1);
 
-  // Read the appropriate number of 16k chunks from the file into
-  // ROM. We may not fill all of ROM here, since it may have been
-  // rounded up.
-  FCEU_fread(ROM, 0x4000, rom_size_to_read, fp);
-
-  if (VROM_size)
-    FCEU_fread(VROM, 0x2000, head.VROM_size, fp);
-
-  md5_starts(&md5);
-  md5_update(&md5, ROM, ROM_size << 14);
-
-  iNESGameCRC32 = CalcCRC32(0, ROM, ROM_size << 14);
-
-  if (VROM_size) {
-    iNESGameCRC32 = CalcCRC32(iNESGameCRC32, VROM, VROM_size << 13);
-    md5_update(&md5, VROM, VROM_size << 13);
+  if (image != nullptr) {
+    // Already read and hashed.
+    iNESGameCRC32 = image->crc32;
+    memcpy(iNESCart.MD5, image->md5, sizeof iNESCart.MD5);
+  } else {
+    ReadAndHashROM(fp, ROM, ROM_size, rom_size_to_read,
+                   VROM, VROM_size, head.VROM_size,
+                   &iNESGameCRC32, iNESCart.MD5);
   }
-  md5_finish(&md5, iNESCart.MD5);
   memcpy(fc->fceu->GameInfo->MD5.data(), &iNESCart.MD5, sizeof iNESCart.MD5);
 
   iNESCart.CRC32 = iNESGameCRC32;
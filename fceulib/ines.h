@@ -27,6 +27,7 @@
 #include <map>
 #include <string>
 #include <utility>
+#include <vector>
 #include "fceu.h"
 
 #include "fc.h"
@@ -37,6 +38,23 @@
 // http://wiki.nesdev.com/w/index.php/INES
 
 struct FceuFile;
+
+// The read-only part of an iNES cartridge, decoded once so that it
+// can be shared by many emulator instances (see LoadedROM in
+// emulator.h). Everything here is exactly what iNESLoad would
+// compute from the same file.
+struct INesImage {
+  // Number of 16k PRG blocks and 8k CHR blocks, rounded up to
+  // powers of two like INes::ROM_size and INes::VROM_size.
+  uint32 ROM_size = 0;
+  uint32 VROM_size = 0;
+  // ROM_size << 14 and VROM_size << 13 bytes, padded with 0xFF
+  // where the file doesn't fill the rounded-up size.
+  std::vector<uint8> rom, vrom;
+  uint32 crc32 = 0;
+  uint8 md5[16] = {};
+};
+
 struct INesTMasterRomInfo {
   uint64 md5lower;
   const char* params;
@@ -46,8 +64,14 @@ struct INes {
   explicit INes(FC *fc);
   ~INes();
 
-  // Returns true on success.
-  bool iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode);
+  // Returns true on success. If image is non-null, it must have been
+  // decoded from the same file with DecodeImage; then ROM and VROM
+  // point into it rather than being read from fp, and it must outlive
+  // the loaded game.
+  bool iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode,
+                const INesImage *image = nullptr);
+  // Returns false if the file is not an iNES image.
+  static bool DecodeImage(FceuFile *fp, INesImage *image);
   void iNESStateRestore(int version);
 
   void ClearMasterRomInfoParams() {
@@ -83,6 +107,10 @@ struct INes {
   // Actual ROM and video ROM read directly from file.
   uint8 *ROM = nullptr;
   uint8 *VROM = nullptr;
+  // If true, the corresponding buffer belongs to a shared INesImage;
+  // it is never written and must not be freed.
+  bool rom_shared = false;
+  bool vrom_shared = false;
 
   // These perform bank switching, but I'm not sure how they're related
   // to the ones in Cart. Perhaps these are only for old-style mappers?
@@ -111,7 +139,10 @@ struct INes {
   };
 
   Header head;
-  void CleanupHeader(Header *h);
+  static void CleanupHeader(Header *h);
+  // Reads and cleans up the header. Returns false if fp is not iNES.
+  static bool ReadHeader(FceuFile *fp, Header *h);
+  static int HeaderMapperNumber(const Header &h);
 
   uint8 *trainerdata = nullptr;
 
@@ -122,7 +153,8 @@ struct INes {
 
   const INesTMasterRomInfo *MasterRomInfo = nullptr;
   std::map<std::string, std::string> MasterRomInfoParams;
-  std::pair<uint32, uint32> GetRoundedROMSize() const;
+  static std::pair<uint32, uint32> GetRoundedROMSize(const Header &h,
+                                                     int mapper_number);
 
   void (*MapClose)() = nullptr;
 
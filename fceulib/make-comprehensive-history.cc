@@ -68,11 +68,11 @@ int main(int argc, char **argv) {
 
   // Actually run the test; this is what takes hours.
   {
-    // Merely specifying --output-file enables comprehensive mode.
+    // The report has per-test results and frame rates.
     string commandline =
-      StringPrintf("cd clean_%d && emulator_test.exe "
+      StringPrintf("cd clean_%d && ./emulator_test.exe "
                    "--romdir ../roms/ "
-                   "--output-file ../results-%d.txt", rev, rev);
+                   "--report ../results-%d.txt", rev, rev);
     System(commandline);
   }
 
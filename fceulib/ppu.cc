@@ -50,14 +50,8 @@
 #include "driver.h"
 #include "fsettings.h"
 
-// XXX better way of doing this...
-#if ENABLE_AOT
-// XXX get from some generated header...
-extern void contra_Run(FC *fc, int32 cycles);
-#define Run6502(c) contra_Run(fc, c)
-#else
+// (Dispatches to code compiled ahead of time, if enabled.)
 #define Run6502(c) fc->X->Run(c)
-#endif
 
 #define DEBUGF if (0) fprintf
 // #define DCHECK if (0)
@@ -539,7 +533,8 @@ void PPU::LineUpdate() {
     const int l = (fc->fceu->PAL ?
                    ((fc->X->timestamp*48-linestartts)/15) :
                    ((fc->X->timestamp*48-linestartts)>>4) );
-    RefreshLine(l);
+    if (render_pixels) RefreshLine<true>(l);
+    else RefreshLine<false>(l);
   }
 }
 
@@ -572,8 +567,9 @@ void PPU::CheckSpriteHit(int p) {
   }
 }
 
+template<bool RENDER>
 void PPU::EndRL() {
-  RefreshLine(272);
+  RefreshLine<RENDER>(272);
   if (tofix)
     Fixit1();
   CheckSpriteHit(272);
@@ -582,7 +578,8 @@ void PPU::EndRL() {
 
 // Used to be an include hack, replaced with a templated function.
 // Returns {refreshaddr_local, P}, which are both modified.
-template<bool PPUT_MMC5, bool PPUT_MMC5SP, bool PPUT_HOOK, bool PPUT_MMC5CHR1>
+template<bool PPUT_MMC5, bool PPUT_MMC5SP, bool PPUT_HOOK, bool PPUT_MMC5CHR1,
+         bool PPUT_COLOR, bool PPUT_PIXELS>
 inline std::pair<uint32, uint8 *> PPU::PPUTile(const int X1, uint8 *P,
                                                const uint32 vofs,
                                                uint32 refreshaddr_local) {
@@ -598,7 +595,24 @@ inline std::pair<uint32, uint8 *> PPU::PPUTile(const int X1, uint8 *P,
     if (ys >= 0x1E) ys -= 0x1E;
   }
 
-  if (X1 >= 2) {
+  if (X1 >= 2 && PPUT_PIXELS && !PPUT_COLOR) {
+    // Only the transparency of the background matters here. Color 0
+    // of each palette is exactly the set of entries that have bit
+    // 0x40 set during RefreshLine, so the attribute bits and palette
+    // lookup can be skipped.
+    uint32 pixdata = ppulut1[(pshift[0]>>(8-XOffset))&0xFF] |
+                     ppulut2[(pshift[1]>>(8-XOffset))&0xFF];
+    for (int i = 0; i < 8; i++) {
+      P[i] = (pixdata & 3) ? 0 : 0x40;
+      pixdata >>= 4;
+    }
+  }
+
+  if (X1 >= 2 && !PPUT_COLOR) {
+    P += 8;
+  }
+
+  if (X1 >= 2 && PPUT_COLOR) {
     const uint8 *S = PALRAM;
     uint32 pixdata;
 
@@ -695,7 +709,88 @@ inline std::pair<uint32, uint8 *> PPU::PPUTile(const int X1, uint8 *P,
   return std::make_pair(refreshaddr_local, P);
 }
 
+template<bool PPUT_COLOR, bool PPUT_PIXELS>
+std::pair<uint32, uint8 *> PPU::RefreshTiles(int lasttile, uint8 *P,
+                                             const uint32 vofs,
+                                             uint32 refreshaddr_local) {
+  // This high-level graphics MMC5 emulation code was written for MMC5
+  // carts in "CL" mode. It's probably not totally correct for carts in
+  // "SL" mode.
+
+  if (MMC5Hack) {
+    if (MMC5HackCHRMode == 0 && (MMC5HackSPMode & 0x80)) {
+      int tochange=MMC5HackSPMode&0x1F;
+      tochange-=firsttile;
+      for (int X1 = firsttile; X1 < lasttile; X1++) {
+        if ((tochange<=0 && MMC5HackSPMode&0x40) ||
+            (tochange>0 && !(MMC5HackSPMode&0x40))) {
+          TRACELOC();
+          // MMC5 and MMC5SP
+          std::tie(refreshaddr_local, P) =
+            PPUTile<true, true, false, false,
+                    PPUT_COLOR, PPUT_PIXELS>(X1, P, vofs, refreshaddr_local);
+        } else {
+          TRACELOC();
+          // MMC5 only
+          std::tie(refreshaddr_local, P) =
+            PPUTile<true, false, false, false,
+                    PPUT_COLOR, PPUT_PIXELS>(X1, P, vofs, refreshaddr_local);
+        }
+        tochange--;
+      }
+    } else if (MMC5HackCHRMode == 1 && (MMC5HackSPMode & 0x80)) {
+      int tochange=MMC5HackSPMode&0x1F;
+      tochange-=firsttile;
+
+      for (int X1 = firsttile; X1 < lasttile; X1++) {
+        TRACELOC();
+        // MMC5, MMC5SP, MMC5CHR1
+        std::tie(refreshaddr_local, P) =
+          PPUTile<true, true, false, true,
+                  PPUT_COLOR, PPUT_PIXELS>(X1, P, vofs, refreshaddr_local);
+      }
+    } else if (MMC5HackCHRMode == 1) {
+      for (int X1 = firsttile; X1 < lasttile; X1++) {
+        TRACELOC();
+        // MMC5, MMC5CHR1
+        std::tie(refreshaddr_local, P) =
+          PPUTile<true, false, false, true,
+                  PPUT_COLOR, PPUT_PIXELS>(X1, P, vofs, refreshaddr_local);
+      }
+    } else {
+      for (int X1 = firsttile; X1 < lasttile; X1++) {
+        TRACELOC();
+        // MMC5 only
+        std::tie(refreshaddr_local, P) =
+          PPUTile<true, false, false, false,
+                  PPUT_COLOR, PPUT_PIXELS>(X1, P, vofs, refreshaddr_local);
+      }
+    }
+  } else if (PPU_hook) {
+    norecurse = 1;
+    for (int X1 = firsttile; X1 < lasttile; X1++) {
+      TRACELOC();
+      // HOOK
+      std::tie(refreshaddr_local, P) =
+        PPUTile<false, false, true, false,
+                PPUT_COLOR, PPUT_PIXELS>(X1, P, vofs, refreshaddr_local);
+    }
+    norecurse=0;
+  } else {
+    for (int X1 = firsttile; X1 < lasttile; X1++) {
+      TRACELOC();
+      // Nothing.
+      std::tie(refreshaddr_local, P) =
+        PPUTile<false, false, false, false,
+                PPUT_COLOR, PPUT_PIXELS>(X1, P, vofs, refreshaddr_local);
+    }
+  }
+
+  return std::make_pair(refreshaddr_local, P);
+}
+
 // lasttile is really "second to last tile."
+template<bool RENDER>
 void PPU::RefreshLine(int lastpixel) {
   // Not clear why we make a backup copy of this -- probably so that
   // hooks don't see the updated version until we're done. Modified
@@ -771,70 +866,19 @@ void PPU::RefreshLine(int lastpixel) {
   PALRAM[8]|=64;
   PALRAM[0xC]|=64;
 
-  // This high-level graphics MMC5 emulation code was written for MMC5
-  // carts in "CL" mode. It's probably not totally correct for carts in
-  // "SL" mode.
-
-  if (MMC5Hack) {
-    if (MMC5HackCHRMode == 0 && (MMC5HackSPMode & 0x80)) {
-      int tochange=MMC5HackSPMode&0x1F;
-      tochange-=firsttile;
-      for (int X1 = firsttile; X1 < lasttile; X1++) {
-        if ((tochange<=0 && MMC5HackSPMode&0x40) ||
-            (tochange>0 && !(MMC5HackSPMode&0x40))) {
-          TRACELOC();
-          // MMC5 and MMC5SP
-          std::tie(refreshaddr_local, P) =
-            PPUTile<true, true, false, false>(X1, P, vofs, refreshaddr_local);
-        } else {
-          TRACELOC();
-          // MMC5 only
-          std::tie(refreshaddr_local, P) =
-            PPUTile<true, false, false, false>(X1, P, vofs, refreshaddr_local);
-        }
-        tochange--;
-      }
-    } else if (MMC5HackCHRMode == 1 && (MMC5HackSPMode & 0x80)) {
-      int tochange=MMC5HackSPMode&0x1F;
-      tochange-=firsttile;
-
-      for (int X1 = firsttile; X1 < lasttile; X1++) {
-        TRACELOC();
-        // MMC5, MMC5SP, MMC5CHR1
-        std::tie(refreshaddr_local, P) =
-          PPUTile<true, true, false, true>(X1, P, vofs, refreshaddr_local);
-      }
-    } else if (MMC5HackCHRMode == 1) {
-      for (int X1 = firsttile; X1 < lasttile; X1++) {
-        TRACELOC();
-        // MMC5, MMC5CHR1
-        std::tie(refreshaddr_local, P) =
-          PPUTile<true, false, false, true>(X1, P, vofs, refreshaddr_local);
-      }
-    } else {
-      for (int X1 = firsttile; X1 < lasttile; X1++) {
-        TRACELOC();
-        // MMC5 only
-        std::tie(refreshaddr_local, P) =
-          PPUTile<true, false, false, false>(X1, P, vofs, refreshaddr_local);
-      }
-    }
-  } else if (PPU_hook) {
-    norecurse = 1;
-    for (int X1 = firsttile; X1 < lasttile; X1++) {
-      TRACELOC();
-      // HOOK
-      std::tie(refreshaddr_local, P) =
-        PPUTile<false, false, true, false>(X1, P, vofs, refreshaddr_local);
-    }
-    norecurse=0;
+  if (RENDER) {
+    std::tie(refreshaddr_local, P) =
+      RefreshTiles<true, true>(lasttile, P, vofs, refreshaddr_local);
+  } else if (sprite_hit_x != 0x100 && !(PPU_status & 0x40)) {
+    // A sprite 0 hit could still happen on this scanline, so we need
+    // to know which background pixels are transparent.
+    std::tie(refreshaddr_local, P) =
+      RefreshTiles<false, true>(lasttile, P, vofs, refreshaddr_local);
   } else {
-    for (int X1 = firsttile; X1 < lasttile; X1++) {
-      TRACELOC();
-      // Nothing.
-      std::tie(refreshaddr_local, P) =
-        PPUTile<false, false, false, false>(X1, P, vofs, refreshaddr_local);
-    }
+    // Nothing reads the pixels. sprite_hit_x is only set between
+    // scanlines, so it can't become relevant later in this one.
+    std::tie(refreshaddr_local, P) =
+      RefreshTiles<false, false>(lasttile, P, vofs, refreshaddr_local);
   }
 
   TRACEF("After PPU: %d %d", fc->X->reg_PC, refreshaddr_local);
@@ -921,6 +965,7 @@ void PPU::Fixit1() {
   }
 }
 
+template<bool RENDER>
 void PPU::DoLine() {
   #ifdef TRACK_INTERFRAME_SCROLL
   {
@@ -941,43 +986,54 @@ void PPU::DoLine() {
   }
 
   Run6502(256);
-  EndRL();
+  EndRL<RENDER>();
+
+  if (RENDER) {
+    if (!renderbg) {
+      // User asked to not display background data.
+      const uint8 col =
+        (gNoBGFillColor == 0xFF) ? PALRAM[0] : gNoBGFillColor;
+      const uint32 tmp =
+        col | (col << 8) | (col << 16) | (col << 24) | 0x40404040;
+      FCEU_dwmemset(target, tmp, 256);
+    }
 
-  if (!renderbg) {
-    // User asked to not display background data.
-    const uint8 col = (gNoBGFillColor == 0xFF) ? PALRAM[0] : gNoBGFillColor;
-    const uint32 tmp =
-      col | (col << 8) | (col << 16) | (col << 24) | 0x40404040;
-    FCEU_dwmemset(target, tmp, 256);
-  }
+    if (SpriteON)
+      CopySprites(target);
 
-  if (SpriteON)
-    CopySprites(target);
 
+    // What is this?? ANDs every byte in the buffer with 0x30 if
+    // PPU_values[1] has its lowest bit set (this indicates monochrome
+    // mode -tom7).
 
-  // What is this?? ANDs every byte in the buffer with 0x30 if PPU_values[1]
-  // has its lowest bit set (this indicates monochrome mode -tom7).
+    if (ScreenON || SpriteON) {
+      // Yes, very el-cheapo.
+      if (PPU_values[1] & 0x01) {
+        for (int x = 63; x >= 0; x--)
+          *(uint32 *)&target[x << 2] =
+            (*(uint32*)&target[x << 2]) & 0x30303030;
+      }
+    }
 
-  if (ScreenON || SpriteON) {
-    // Yes, very el-cheapo.
-    if (PPU_values[1] & 0x01) {
+    // This might be NTSC emphasis? Document. -tom7
+    if ((PPU_values[1] >> 5) == 0x7) {
+      for (int x = 63; x >= 0; x--)
+        *(uint32 *)&target[x << 2] =
+          ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0xc0c0c0c0;
+    } else if (PPU_values[1] & 0xE0) {
       for (int x = 63; x >= 0; x--)
-        *(uint32 *)&target[x << 2] = (*(uint32*)&target[x << 2]) & 0x30303030;
+        *(uint32 *)&target[x << 2] =
+          (*(uint32*)&target[x << 2]) | 0x40404040;
+    } else {
+      for (int x = 63; x >= 0; x--)
+        *(uint32 *)&target[x << 2] =
+          ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0x80808080;
     }
-  }
-
-  // This might be NTSC emphasis? Document. -tom7
-  if ((PPU_values[1] >> 5) == 0x7) {
-    for (int x = 63; x >= 0; x--)
-      *(uint32 *)&target[x << 2] =
-        ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0xc0c0c0c0;
-  } else if (PPU_values[1] & 0xE0) {
-    for (int x = 63; x >= 0; x--)
-      *(uint32 *)&target[x << 2] = (*(uint32*)&target[x << 2]) | 0x40404040;
   } else {
-    for (int x = 63; x >= 0; x--)
-      *(uint32 *)&target[x << 2] =
-        ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0x80808080;
+    // Pixels are not drawn, but keep the bookkeeping that CopySprites
+    // would have done.
+    if (SpriteON)
+      any_sprites_on_line = 0;
   }
 
   sprite_hit_x = 0x100;
@@ -1005,7 +1061,7 @@ void PPU::DoLine() {
   }
 
   if (SpriteON)
-    RefreshSprites();
+    RefreshSprites<RENDER>();
   if (GameHBIRQHook2 && (ScreenON || SpriteON))
     GameHBIRQHook2(fc);
   scanline++;
@@ -1203,15 +1259,47 @@ void PPU::FetchSpriteData() {
   numsprites = ns;
 }
 
+// Bitmask of the sprite's non-transparent pixels on this line (J
+// below), reversed if the sprite is horizontally flipped. This is
+// what the sprite 0 hit test compares against the background.
+static inline uint8 SpriteHitMask(uint8 J, uint8 atr) {
+  return (atr & H_FLIP) ?
+    ((J << 7) & 0x80) |
+    ((J << 5) & 0x40) |
+    ((J << 3) & 0x20) |
+    ((J << 1) & 0x10) |
+    ((J >> 1) & 0x08) |
+    ((J >> 3) & 0x04) |
+    ((J >> 5) & 0x02) |
+    ((J >> 7) & 0x01) :
+    J;
+}
+
 // As I understand, this takes the sprites on this line (there are
 // numsprites of them, which have already been prepared and put into
 // SPRBUF -- I during the previous scanline) and writes actual pixel
 // data (plus some flags) to sprlinebuf. It also sets up for the
 // sprite 0 hit test.
+//
+// When !RENDER, only the sprite 0 hit test is set up.
+template<bool RENDER>
 void PPU::RefreshSprites() {
   any_sprites_on_line = 0;
   if (!numsprites) return;
 
+  if (!RENDER) {
+    numsprites--;
+    const SPRB *spr0 = (SPRB*)SPRBUF;
+    const uint8 J = spr0->ca[0] | spr0->ca[1];
+    if (J && sprite_0_in_sprbuf && !(PPU_status & 0x40)) {
+      sprite_hit_x = spr0->x;
+      sprite_hit_mask = SpriteHitMask(J, spr0->atr);
+    }
+    sprite_0_in_sprbuf = false;
+    any_sprites_on_line = 1;
+    return;
+  }
+
   // Initialize the line buffer to 0x80, meaning "no pixel here."
   FCEU_dwmemset(sprlinebuf, 0x80808080, 256);
   // XXX It's weird to modify numsprites here; can we just use
@@ -1251,24 +1339,9 @@ void PPU::RefreshSprites() {
       // buffer, it will be at index n == 0.
       if (n == 0 && sprite_0_in_sprbuf && !(PPU_status & 0x40)) {
         sprite_hit_x = x;
-	// bitmask J, maybe reversed if the sprite is horizontally flipped.
-        sprite_hit_mask =
-	  (atr & H_FLIP) ?
-	  ((J << 7) & 0x80) |
-	  ((J << 5) & 0x40) |
-	  ((J << 3) & 0x20) |
-	  ((J << 1) & 0x10) |
-	  ((J >> 1) & 0x08) |
-	  ((J >> 3) & 0x04) |
-	  ((J >> 5) & 0x02) |
-	  ((J >> 7) & 0x01) :
-	  J;
+        sprite_hit_mask = SpriteHitMask(J, atr);
       }
 
-      // PERF If we are in DISABLE_VIDEO we can probably skip
-      // drawing the sprite pixels themselves, since we already
-      // have enough info for the sprite 0 hit test.
-      
       // C is destination for the 8 pixels we'll write
       // on this scanline.
       // C is an array of bytes, each corresponding to
@@ -1506,7 +1579,10 @@ void PPU::FCEUPPU_Power() {
   fc->fceu->BWrite[0x4014] = B4014;
 }
 
+template<bool RENDER>
 void PPU::FrameLoop() {
+  render_pixels = RENDER;
+
   if (true) {
     TRACE_SCOPED_ENABLE_IF(true);
     TRACEFUN();
@@ -1524,7 +1600,7 @@ void PPU::FrameLoop() {
 
   // Needed for Knight Rider, possibly others.
   if (ppudead) {
-    memset(fc->fceu->XBuf, 0x80, 256 * 240);
+    if (RENDER) memset(fc->fceu->XBuf, 0x80, 256 * 240);
     Run6502(scanlines_per_frame * (256 + 85));
     ppudead--;
   } else {
@@ -1579,7 +1655,7 @@ void PPU::FrameLoop() {
     for (scanline = 0; scanline < 240; ) {
       // scanline is incremented in DoLine.  Evil. :/
       deempcnt[deemp]++;
-      DoLine();
+      DoLine<RENDER>();
     }
 
     // Triggers MMC5-specific interrupts, etc.
@@ -1644,3 +1720,6 @@ void PPU::FCEUPPU_SaveState() {
   TempAddrT = TempAddr;
   RefreshAddrT = RefreshAddr;
 }
+
+template void PPU::FrameLoop<true>();
+template void PPU::FrameLoop<false>();
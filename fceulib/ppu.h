@@ -17,6 +17,12 @@ struct PPU {
   void FCEUPPU_Reset();
   void FCEUPPU_Power();
   // Runs one frame. The CPU is driven by the PPU timing.
+  // If RENDER is false, nothing is drawn into XBuf except what is
+  // needed to keep timing-relevant state (sprite 0 hit, sprite
+  // overflow, NMI, scroll registers) exact. The frame buffer then
+  // contains garbage, and zapper-style inputs that inspect the
+  // scanline will not see real pixels.
+  template<bool RENDER>
   void FrameLoop();
 
   void LineUpdate();
@@ -138,7 +144,9 @@ struct PPU {
   const std::vector<SFORMAT> stateinfo;
 
   void FetchSpriteData();
+  template<bool RENDER>
   void RefreshLine(int lastpixel);
+  template<bool RENDER>
   void RefreshSprites();
   void CopySprites(uint8 *target);
 
@@ -146,12 +154,24 @@ struct PPU {
   void Fixit2();
   void ResetRL(uint8 *target);
   void CheckSpriteHit(int p);
+  template<bool RENDER>
   void EndRL();
+  template<bool RENDER>
   void DoLine();
 
   const uint8 *MMC5BGVRAMADR(uint32 V);
 
-  template<bool PPUT_MMC5, bool PPUT_MMC5SP, bool PPUT_HOOK, bool PPUT_MMC5CHR1>
+  // Draws (or for !PPUT_PIXELS, just advances the fetch state over)
+  // tiles firsttile..lasttile-1. If PPUT_COLOR is false, the pixels
+  // only record whether the background is transparent (bit 0x40),
+  // which is all the sprite 0 hit test needs.
+  template<bool PPUT_COLOR, bool PPUT_PIXELS>
+  std::pair<uint32, uint8 *> RefreshTiles(int lasttile, uint8 *P,
+                                          const uint32 vofs,
+                                          uint32 refreshaddr_local);
+
+  template<bool PPUT_MMC5, bool PPUT_MMC5SP, bool PPUT_HOOK, bool PPUT_MMC5CHR1,
+           bool PPUT_COLOR, bool PPUT_PIXELS>
   std::pair<uint32, uint8 *> PPUTile(const int X1, uint8 *P,
                                      const uint32 vofs,
                                      uint32 refreshaddr_local);
@@ -234,6 +254,11 @@ struct PPU {
   // mappers making PPU calls).
   int norecurse = 0;
 
+  // Whether the frame currently being run by FrameLoop is drawing
+  // pixels. LineUpdate is reached from register and mapper writes,
+  // so it needs this to pick the right RefreshLine.
+  bool render_pixels = true;
+
   FC *fc = nullptr;
 };
 
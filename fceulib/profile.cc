@@ -0,0 +1,244 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "base/logging.h"
+#include "base/stringprintf.h"
+#include "fc.h"
+#include "cart.h"
+
+using namespace std;
+
+// Values for the chip byte in Bank that aren't PRG chips.
+static constexpr uint16 RAM_CHIP = 0xFE;
+static constexpr uint16 OTHER_CHIP = 0xFF;
+
+// Including the unofficial ones, by their usual names.
+static constexpr const char MNEMONICS[256 * 3 + 1] =
+  "BRKORAKILSLONOPORAASLSLOPHPORAASLANCNOPORAASLSLO"
+  "BPLORAKILSLONOPORAASLSLOCLCORANOPSLONOPORAASLSLO"
+  "JSRANDKILRLABITANDROLRLAPLPANDROLANCBITANDROLRLA"
+  "BMIANDKILRLANOPANDROLRLASECANDNOPRLANOPANDROLRLA"
+  "RTIEORKILSRENOPEORLSRSREPHAEORLSRALRJMPEORLSRSRE"
+  "BVCEORKILSRENOPEORLSRSRECLIEORNOPSRENOPEORLSRSRE"
+  "RTSADCKILRRANOPADCRORRRAPLAADCRORARRJMPADCRORRRA"
+  "BVSADCKILRRANOPADCRORRRASEIADCNOPRRANOPADCRORRRA"
+  "NOPSTANOPSAXSTYSTASTXSAXDEYNOPTXAXAASTYSTASTXSAX"
+  "BCCSTAKILAHXSTYSTASTXSAXTYASTATXSTASSHYSTASHXAHX"
+  "LDYLDALDXLAXLDYLDALDXLAXTAYLDATAXLAXLDYLDALDXLAX"
+  "BCSLDAKILLAXLDYLDALDXLAXCLVLDATSXLASLDYLDALDXLAX"
+  "CPYCMPNOPDCPCPYCMPDECDCPINYCMPDEXAXSCPYCMPDECDCP"
+  "BNECMPKILDCPNOPCMPDECDCPCLDCMPNOPDCPNOPCMPDECDCP"
+  "CPXSBCNOPISCCPXSBCINCISCINXSBCNOPSBCCPXSBCINCISC"
+  "BEQSBCKILISCNOPSBCINCISCSEDSBCNOPISCNOPSBCINCISC";
+
+static constexpr const char *PPU_REGS[8] = {
+  "PPUCTRL", "PPUMASK", "PPUSTATUS", "OAMADDR",
+  "OAMDATA", "PPUSCROLL", "PPUADDR", "PPUDATA",
+};
+
+static string Mnemonic(uint8 opcode) {
+  return string(&MNEMONICS[opcode * 3], 3);
+}
+
+static double Pct(int64 num, int64 den) {
+  return den > 0 ? (100.0 * num) / den : 0.0;
+}
+
+// Sort descending by count, so the hot stuff is first.
+template<class K>
+static vector<pair<K, int64>> ByCount(vector<pair<K, int64>> v) {
+  std::sort(v.begin(), v.end(),
+	    [](const pair<K, int64> &a, const pair<K, int64> &b) {
+	      if (a.second != b.second) return a.second > b.second;
+	      return a.first < b.first;
+	    });
+  return v;
+}
+
+Profile::Profile(int period) : period(period), countdown(period) {
+  CHECK(period >= 1);
+}
+
+uint16 Profile::Bank(const FC *fc, uint16 pc) {
+  if (pc < 0x2000) return RAM_CHIP << 8;
+  const uint8 *p = fc->cart->PagePointer(pc);
+  if (p != nullptr) {
+    for (int r = 0; r < 32; r++) {
+      const uint8 *chip = fc->cart->PRGptr[r];
+      if (chip != nullptr && p >= chip && p < chip + fc->cart->PRGsize[r]) {
+	return (r << 8) | std::min((int)((p - chip) >> 13), 0xFF);
+      }
+    }
+  }
+  return OTHER_CHIP << 8;
+}
+
+string Profile::BankName(uint16 bank) {
+  const uint16 chip = bank >> 8;
+  if (chip == RAM_CHIP) return "RAM";
+  if (chip == OTHER_CHIP) return "other";
+  // Chip 16 is usually WRAM.
+  return StringPrintf("PRG%d:%02x", (int)chip, bank & 0xFF);
+}
+
+void Profile::Sample(const FC *fc, uint16 pc, uint8 opcode) {
+  samples++;
+  opcodes[opcode]++;
+  pcs[((uint32)Bank(fc, pc) << 16) | pc]++;
+}
+
+Profile::Totals Profile::Current() const {
+  Totals t;
+  for (int p = 0x40; p < 0x100; p++) {
+    t.cart_reads += reads[p];
+    t.cart_writes += writes[p];
+    if (p >= 0x80) t.mapper_writes += writes[p];
+  }
+  for (int i = 0; i < 32; i++) {
+    t.cart_reads -= io_reads[i];
+    t.cart_writes -= io_writes[i];
+  }
+  for (int i = 0; i < 8; i++)
+    t.ppu_accesses += ppu_reads[i] + ppu_writes[i];
+  return t;
+}
+
+void Profile::EndFrame() {
+  const Totals now = Current();
+  auto Update = [](PerFrame *pf, int64 delta) {
+    pf->total += delta;
+    pf->max = std::max(pf->max, delta);
+  };
+  Update(&cart_reads, now.cart_reads - last.cart_reads);
+  Update(&cart_writes, now.cart_writes - last.cart_writes);
+  Update(&mapper_writes, now.mapper_writes - last.mapper_writes);
+  Update(&ppu_accesses, now.ppu_accesses - last.ppu_accesses);
+  last = now;
+  frames++;
+}
+
+string Profile::Report() const {
+  // Denominator for averages.
+  const double nframes = std::max(frames, (int64)1);
+  string out =
+    StringPrintf("Profile: %lld frames, %lld samples (1 per %d "
+		 "instructions), ~%.0f instructions/frame\n",
+		 frames, samples, period, (samples * period) / nframes);
+
+  // Time by bank.
+  {
+    std::unordered_map<uint16, int64> banks;
+    for (const auto &p : pcs) banks[p.first >> 16] += p.second;
+    vector<pair<uint16, int64>> v(banks.begin(), banks.end());
+    out += "\nSamples by bank:\n";
+    for (const auto &p : ByCount(v)) {
+      out += StringPrintf("  %-12s %10lld  %5.1f%%\n",
+			  BankName(p.first).c_str(),
+			  p.second, Pct(p.second, samples));
+    }
+  }
+
+  // Hot spots.
+  {
+    vector<pair<uint32, int64>> v(pcs.begin(), pcs.end());
+    v = ByCount(v);
+    const int n = std::min((int)v.size(), 24);
+    out += StringPrintf("\nHottest %d of %d PCs:\n", n, (int)v.size());
+    int64 cumulative = 0LL;
+    for (int i = 0; i < n; i++) {
+      cumulative += v[i].second;
+      out += StringPrintf("  %-12s $%04x %10lld  %5.1f%%  (cumulative "
+			  "%5.1f%%)\n",
+			  BankName(v[i].first >> 16).c_str(),
+			  v[i].first & 0xFFFF, v[i].second,
+			  Pct(v[i].second, samples),
+			  Pct(cumulative, samples));
+    }
+  }
+
+  // Opcodes.
+  {
+    vector<pair<int, int64>> v;
+    for (int i = 0; i < 256; i++)
+      if (opcodes[i] > 0) v.emplace_back(i, opcodes[i]);
+    v = ByCount(v);
+    out += "\nOpcodes:\n";
+    for (int i = 0; i < (int)v.size() && i < 24; i++) {
+      out += StringPrintf("  $%02x %s %10lld  %5.1f%%\n",
+			  v[i].first, Mnemonic(v[i].first).c_str(),
+			  v[i].second, Pct(v[i].second, samples));
+    }
+  }
+
+  // Memory by region.
+  {
+    auto Sum = [](const int64 *a, int lo, int hi) {
+      int64 s = 0LL;
+      for (int i = lo; i < hi; i++) s += a[i];
+      return s;
+    };
+    const int64 io_r = Sum(io_reads, 0, 32), io_w = Sum(io_writes, 0, 32);
+    struct Region {
+      const char *name;
+      int64 r, w;
+    };
+    const Region regions[] = {
+      {"RAM      $0000-$1FFF", Sum(reads, 0x00, 0x20),
+       Sum(writes, 0x00, 0x20)},
+      {"PPU      $2000-$3FFF", Sum(reads, 0x20, 0x40),
+       Sum(writes, 0x20, 0x40)},
+      {"APU/IO   $4000-$401F", io_r, io_w},
+      {"Cart exp $4020-$5FFF",
+       Sum(reads, 0x40, 0x60) - io_r, Sum(writes, 0x40, 0x60) - io_w},
+      {"WRAM     $6000-$7FFF", Sum(reads, 0x60, 0x80),
+       Sum(writes, 0x60, 0x80)},
+      {"PRG      $8000-$FFFF", Sum(reads, 0x80, 0x100),
+       Sum(writes, 0x80, 0x100)},
+    };
+    out += "\nMemory accesses per frame:            reads      writes\n";
+    for (const Region &r : regions) {
+      out += StringPrintf("  %s  %10.1f  %10.1f\n",
+			  r.name, r.r / nframes, r.w / nframes);
+    }
+
+    out += "\nPPU registers per frame:     reads      writes\n";
+    for (int i = 0; i < 8; i++) {
+      if (ppu_reads[i] == 0 && ppu_writes[i] == 0) continue;
+      out += StringPrintf("  $200%d %-10s  %10.1f  %10.1f\n",
+			  i, PPU_REGS[i],
+			  ppu_reads[i] / nframes, ppu_writes[i] / nframes);
+    }
+
+    out += "\nAPU/IO registers per frame:  reads      writes\n";
+    for (int i = 0; i < 32; i++) {
+      if (io_reads[i] == 0 && io_writes[i] == 0) continue;
+      out += StringPrintf("  $40%02x             %10.1f  %10.1f\n",
+			  i, io_reads[i] / nframes, io_writes[i] / nframes);
+    }
+
+    // Pages that go to mapper handlers, other than plain PRG reads.
+    out += "\nCart pages written (mapper registers), per frame:\n";
+    for (int p = 0x40; p < 0x100; p++) {
+      const int64 w = writes[p] - (p == 0x40 ? io_w : (int64)0);
+      if (w > 0) {
+	out += StringPrintf("  $%02x00-$%02xff  %10.1f\n",
+			    p, p, w / nframes);
+      }
+    }
+  }
+
+  auto Frame = [nframes](const char *name, const PerFrame &pf) {
+    return StringPrintf("  %-14s avg %10.1f  max %8lld\n",
+			name, pf.total / nframes, pf.max);
+  };
+  out += "\nPer frame:\n";
+  out += Frame("cart reads", cart_reads);
+  out += Frame("cart writes", cart_writes);
+  out += Frame("mapper writes", mapper_writes);
+  out += Frame("PPU accesses", ppu_accesses);
+  return out;
+}
@@ -0,0 +1,104 @@
+/* Sampling profiler for the emulated 6502 program. This is for
+   finding out where a game spends its time: which banks and opcodes
+   are hot (so, whether the AOT compiler would help it) and how much
+   it talks to the mapper and PPU (so, which handlers are worth fast
+   paths). See Emulator::StartProfile.
+
+   Only the interpreter is profiled; code run by the AOT engine is
+   invisible here. Profiling doesn't change the emulation at all.
+   When it's off, the interpreter runs a copy of its loop without
+   the hooks, so it costs nothing. When on, it's a lot slower: every
+   memory access is counted whatever the period, and that's most of
+   the cost at long periods. One run of bench.cc measured +25% at
+   period 64, +43% at 16 and +67% at 1; run it for your machine.
+   hotspots.exe runs a movie and prints the report. */
+
+#ifndef __FCEULIB_PROFILE_H
+#define __FCEULIB_PROFILE_H
+
+#include <string>
+#include <unordered_map>
+
+#include "types.h"
+
+struct FC;
+
+struct Profile {
+  // Every period-th instruction is sampled (period >= 1). Memory
+  // accesses are always all counted, so that the per-frame counts
+  // are exact; that's a few increments per access, but there are
+  // several accesses per instruction.
+  explicit Profile(int period);
+
+  // Called by the interpreter for each instruction, with the address
+  // and value of the opcode.
+  inline void Instruction(const FC *fc, uint16 pc, uint8 opcode) {
+    if (--countdown == 0) {
+      countdown = period;
+      Sample(fc, pc, opcode);
+    }
+  }
+
+  // Called by the CPU for each memory access.
+  inline void Read(uint32 A) {
+    reads[A >> 8]++;
+    if ((A & 0xE000) == 0x2000) ppu_reads[A & 7]++;
+    else if ((A & 0xFFE0) == 0x4000) io_reads[A & 0x1F]++;
+  }
+  inline void Write(uint32 A) {
+    writes[A >> 8]++;
+    if ((A & 0xE000) == 0x2000) ppu_writes[A & 7]++;
+    else if ((A & 0xFFE0) == 0x4000) io_writes[A & 0x1F]++;
+  }
+
+  // Called at the end of each emulated frame.
+  void EndFrame();
+
+  // Human-readable report.
+  std::string Report() const;
+
+  const int period;
+
+  int64 samples = 0LL;
+  int64 opcodes[256] = {};
+  // Key is Bank(...) << 16 | pc.
+  std::unordered_map<uint32, int64> pcs;
+
+  // Accesses by 256-byte page, all of them.
+  int64 reads[256] = {}, writes[256] = {};
+  // PPU registers $2000-$2007, including mirrors.
+  int64 ppu_reads[8] = {}, ppu_writes[8] = {};
+  // APU and I/O registers $4000-$401F.
+  int64 io_reads[32] = {}, io_writes[32] = {};
+
+  // Per-frame counts. "Cart" means anything at $4020 and up, which
+  // is handled by the cartridge/mapper rather than the console;
+  // cart writes to $8000 and up are mapper register writes.
+  struct PerFrame {
+    int64 total = 0LL, max = 0LL;
+  };
+  int64 frames = 0LL;
+  PerFrame cart_reads, cart_writes, mapper_writes, ppu_accesses;
+
+ private:
+  // Identifies the ROM (or RAM) that pc is mapped to, since the same
+  // address means different code in different banks. Low byte is the
+  // 8k bank within the PRG chip, next byte the chip (or one of the
+  // special values below).
+  static uint16 Bank(const FC *fc, uint16 pc);
+  static std::string BankName(uint16 bank);
+
+  void Sample(const FC *fc, uint16 pc, uint8 opcode);
+
+  // Sums of the page counts at the end of the previous frame.
+  struct Totals {
+    int64 cart_reads = 0LL, cart_writes = 0LL, mapper_writes = 0LL,
+      ppu_accesses = 0LL;
+  };
+  Totals Current() const;
+  Totals last;
+
+  int countdown = 1;
+};
+
+#endif
@@ -28,6 +28,7 @@
 #include <vector>
 #include <fstream>
 #include <map>
+#include <algorithm>
 
 #include "version.h"
 #include "types.h"
@@ -47,6 +48,8 @@
 
 #include "tracing.h"
 
+#include "city/city.h"
+
 using namespace std;
 
 // Write the vector to the output file. If the file pointer is
@@ -262,6 +265,32 @@ bool State::FCEUSS_SaveRAW(std::vector<uint8> *out) const {
   return true;
 }
 
+uint64 State::SubHash(const vector<SFORMAT> &sf, uint64 h) const {
+  for (const SFORMAT &f : sf) {
+    CHECK(f.s != ~(uint32)0);
+    if (f.v == &fc->fceu->timestampbase) continue;
+    // Native byte order; the hash is only compared within a process.
+    h = CityHash64WithSeed((const char *)f.v, f.s & (~FCEUSTATE_FLAGS), h);
+  }
+  return h;
+}
+
+uint64 State::StateHash() const {
+  // Same order and hooks as FCEUSS_SaveRAW.
+  fc->ppu->FCEUPPU_SaveState();
+  fc->sound->FCEUSND_SaveState();
+  uint64 h = SubHash(sfcpu, 1);
+  h = SubHash(sfcpuc, h);
+  h = SubHash(fc->ppu->FCEUPPU_STATEINFO(), h);
+  h = SubHash(fc->input->FCEUINPUT_STATEINFO(), h);
+  h = SubHash(fc->sound->FCEUSND_STATEINFO(), h);
+
+  if (SPreSave) SPreSave(fc);
+  h = SubHash(sfmdata, h);
+  if (SPreSave && SPostSave) SPostSave(fc);
+  return h;
+}
+
 bool State::FCEUSS_LoadRAW(const std::vector<uint8> &in) {
   EmuFile_MEMORY_READONLY is{in};
 
@@ -270,6 +299,8 @@ bool State::FCEUSS_LoadRAW(const std::vector<uint8> &in) {
   int stateversion = FCEU_VERSION_NUMERIC;
 
   bool success = (ReadStateChunks(&is, totalsize) != 0);
+  // RAM was overwritten wholesale (maybe partially, on failure).
+  fc->fceu->RehashRAM();
 
   if (fc->fceu->GameStateRestore != nullptr) {
     fc->fceu->GameStateRestore(fc, stateversion);
@@ -284,6 +315,108 @@ bool State::FCEUSS_LoadRAW(const std::vector<uint8> &in) {
   }
 }
 
+// Delta format, all native-endian uint32s since these are in-memory
+// only: the length of the raw state, then any number of runs, each
+// an offset, a length, and that many bytes to overwrite the base
+// with. Runs are increasing and don't overlap. Bytes past the end
+// of the base are always in some run.
+//
+// Two differing ranges separated by fewer than this many equal bytes
+// are stored as one run, since each run costs 8 bytes of header.
+static constexpr int DELTA_MERGE_GAP = 8;
+
+static inline void PutU32(std::vector<uint8> *v, uint32 w) {
+  const size_t pos = v->size();
+  v->resize(pos + 4);
+  memcpy(v->data() + pos, &w, 4);
+}
+
+void State::EncodeDelta(const std::vector<uint8> &base,
+                        const std::vector<uint8> &raw,
+                        std::vector<uint8> *delta) {
+  delta->clear();
+  PutU32(delta, raw.size());
+
+  const uint8 *r = raw.data();
+  const uint8 *b = base.data();
+  const int n = raw.size();
+  // Bytes past here don't exist in the base, so they always differ.
+  const int m = std::min(raw.size(), base.size());
+  auto Same = [r, b, m](int i) { return i < m && r[i] == b[i]; };
+
+  int i = 0;
+  while (i < n) {
+    // Skip equal bytes, a word at a time where possible.
+    while (i + 8 <= m && !memcmp(r + i, b + i, 8)) i += 8;
+    while (i < n && Same(i)) i++;
+    if (i >= n) break;
+
+    // Now i starts a run. Extend it over differing bytes and
+    // small gaps of equal ones.
+    const int start = i;
+    int end = i + 1;
+    for (;;) {
+      while (end < n && !Same(end)) end++;
+      int gap = 0;
+      while (end + gap < n && gap < DELTA_MERGE_GAP && Same(end + gap)) gap++;
+      if (end + gap < n && gap < DELTA_MERGE_GAP) {
+        // Another difference follows closely; absorb the gap.
+        end += gap;
+      } else {
+        break;
+      }
+    }
+
+    PutU32(delta, start);
+    PutU32(delta, end - start);
+    const size_t pos = delta->size();
+    delta->resize(pos + (end - start));
+    memcpy(delta->data() + pos, r + start, end - start);
+    i = end;
+  }
+}
+
+bool State::DecodeDelta(const std::vector<uint8> &base,
+                        const std::vector<uint8> &delta,
+                        std::vector<uint8> *raw) {
+  if (delta.size() < 4) return false;
+  uint32 len;
+  memcpy(&len, delta.data(), 4);
+  raw->resize(len);
+  memcpy(raw->data(), base.data(), std::min((size_t)len, base.size()));
+
+  size_t pos = 4;
+  while (pos < delta.size()) {
+    if (pos + 8 > delta.size()) return false;
+    uint32 off, rlen;
+    memcpy(&off, delta.data() + pos, 4);
+    memcpy(&rlen, delta.data() + pos + 4, 4);
+    pos += 8;
+    if (pos + rlen > delta.size() || (uint64)off + rlen > len)
+      return false;
+    memcpy(raw->data() + off, delta.data() + pos, rlen);
+    pos += rlen;
+  }
+  return true;
+}
+
+bool State::FCEUSS_SaveDelta(const std::vector<uint8> &base,
+                             std::vector<uint8> *out) const {
+  // (SaveRAW writes from the start but keeps any longer length.)
+  delta_scratch.clear();
+  if (!FCEUSS_SaveRAW(&delta_scratch))
+    return false;
+  EncodeDelta(base, delta_scratch, out);
+  return true;
+}
+
+bool State::FCEUSS_LoadDelta(const std::vector<uint8> &base,
+                             const std::vector<uint8> &delta) {
+  if (!DecodeDelta(base, delta, &delta_scratch))
+    return false;
+  return FCEUSS_LoadRAW(delta_scratch);
+}
+
 void State::ResetExState(void (*PreSave)(FC *), void (*PostSave)(FC *)) {
 
   // If this needs to happen, it's a bug in the way the savestate
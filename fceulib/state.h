@@ -101,6 +101,30 @@ struct State {
   bool FCEUSS_SaveRAW(std::vector<uint8> *out) const;
   bool FCEUSS_LoadRAW(const std::vector<uint8> &in);
 
+  // Hash of everything FCEUSS_SaveRAW would save (cpu, ppu, input,
+  // sound, and the mapper's registered memories and registers),
+  // without serializing it. Leaves out timestampbase, which only
+  // counts up, so that states reached at different times can match.
+  uint64 StateHash() const;
+
+  // Same, but the state is stored as a delta against a base state
+  // (from FCEUSS_SaveRAW), and must be loaded with the same base.
+  // Only the byte ranges that differ are stored, so this is small
+  // when the states are similar (e.g. a few frames apart).
+  bool FCEUSS_SaveDelta(const std::vector<uint8> &base,
+                        std::vector<uint8> *out) const;
+  bool FCEUSS_LoadDelta(const std::vector<uint8> &base,
+                        const std::vector<uint8> &delta);
+
+  // The encoding used above, for raw states that were already saved.
+  static void EncodeDelta(const std::vector<uint8> &base,
+                          const std::vector<uint8> &raw,
+                          std::vector<uint8> *delta);
+  // Returns false if the delta is malformed.
+  static bool DecodeDelta(const std::vector<uint8> &base,
+                          const std::vector<uint8> &delta,
+                          std::vector<uint8> *raw);
+
   // I think these add additional locations to the set of saved memories.
   void ResetExState(void (*PreSave)(FC *),void (*PostSave)(FC *));
 
@@ -117,6 +141,7 @@ struct State {
  private:
 
   static int SubWrite(EmuFile *os, const std::vector<SFORMAT> &sf);
+  uint64 SubHash(const std::vector<SFORMAT> &sf, uint64 h) const;
 
   static int WriteStateChunk(EmuFile *os, int type,
                              const std::vector<SFORMAT> &sf);
@@ -135,6 +160,9 @@ struct State {
   // SFORMAT SFMDATA[SFMDATA_SIZE] = {};
   // int SFEXINDEX = 0;
   std::vector<SFORMAT> sfmdata;
+
+  // Reused by the delta routines to avoid allocating each time.
+  mutable std::vector<uint8> delta_scratch;
   // This is just to prevent duplicate keys, which would be
   // disastrous.
   // PERF: If all of the data were in a hash map, we could
@@ -50,22 +50,24 @@ X6502::X6502(FC *fc) : fc(fc) {
 
 uint8 X6502::DMR(uint32 A) {
   ADDCYC(1);
+  if (profile) profile->Read(A);
   return (DB = fc->fceu->ARead[A](fc, A));
 }
 
 void X6502::DMW(uint32 A, uint8 V) {
   ADDCYC(1);
+  if (profile) profile->Write(A);
   fc->fceu->BWrite[A](fc, A, V);
 }
 
-#define PUSH(V)              \
-  {                          \
-    uint8 VTMP = V;          \
-    WrRAM(0x100 + reg_S, VTMP); \
-    reg_S--;                    \
+#define PUSH(V)                          \
+  {                                      \
+    uint8 VTMP = V;                      \
+    WrRAM<PROFILE>(0x100 + reg_S, VTMP); \
+    reg_S--;                             \
   }
 
-#define POP() RdRAM(0x100 + (++reg_S))
+#define POP() RdRAM<PROFILE>(0x100 + (++reg_S))
 
 // I think this stands for "zero and negative" table, which has the
 // zero and negative cpu flag set for each possible byte. The
@@ -115,22 +117,22 @@ static constexpr uint8 ZNTable[256] = {
   reg_P |= ZNTable[zort]
 #define X_ZNT(zort) reg_P |= ZNTable[zort]
 
-#define JR(cond)                    \
-  {                                 \
-    if (cond) {                     \
-      uint32 tmp;                   \
-      int32 disp;                   \
-      disp = (int8)RdMem(reg_PC);   \
-      reg_PC++;                     \
-      ADDCYC(1);                    \
-      tmp = reg_PC;                 \
-      reg_PC += disp;               \
-      if ((tmp ^ reg_PC) & 0x100) { \
-        ADDCYC(1);                  \
-      }                             \
-    } else {                        \
-      reg_PC++;                     \
-    }                               \
+#define JR(cond)                           \
+  {                                        \
+    if (cond) {                            \
+      uint32 tmp;                          \
+      int32 disp;                          \
+      disp = (int8)RdMem<PROFILE>(reg_PC); \
+      reg_PC++;                            \
+      ADDCYC(1);                           \
+      tmp = reg_PC;                        \
+      reg_PC += disp;                      \
+      if ((tmp ^ reg_PC) & 0x100) {        \
+        ADDCYC(1);                         \
+      }                                    \
+    } else {                               \
+      reg_PC++;                            \
+    }                                      \
   }
 
 #define LDA \
@@ -251,98 +253,98 @@ static constexpr uint8 ZNTable[256] = {
 */
 
 /* Absolute */
-#define GetAB(target)             \
-  {                               \
-    target = RdMem(reg_PC);       \
-    reg_PC++;                     \
-    target |= RdMem(reg_PC) << 8; \
-    reg_PC++;                     \
+#define GetAB(target)                      \
+  {                                        \
+    target = RdMem<PROFILE>(reg_PC);       \
+    reg_PC++;                              \
+    target |= RdMem<PROFILE>(reg_PC) << 8; \
+    reg_PC++;                              \
   }
 
 /* Absolute Indexed(for reads) */
-#define GetABIRD(target, i)       \
-  {                               \
-    unsigned int tmp;             \
-    GetAB(tmp);                   \
-    target = tmp;                 \
-    target += i;                  \
-    if ((target ^ tmp) & 0x100) { \
-      target &= 0xFFFF;           \
-      RdMem(target ^ 0x100);      \
-      ADDCYC(1);                  \
-    }                             \
+#define GetABIRD(target, i)           \
+  {                                   \
+    unsigned int tmp;                 \
+    GetAB(tmp);                       \
+    target = tmp;                     \
+    target += i;                      \
+    if ((target ^ tmp) & 0x100) {     \
+      target &= 0xFFFF;               \
+      RdMem<PROFILE>(target ^ 0x100); \
+      ADDCYC(1);                      \
+    }                                 \
   }
 
 /* Absolute Indexed(for writes and rmws) */
-#define GetABIWR(target, i)                   \
-  {                                           \
-    unsigned int rt;                          \
-    GetAB(rt);                                \
-    target = rt;                              \
-    target += i;                              \
-    target &= 0xFFFF;                         \
-    RdMem((target & 0x00FF) | (rt & 0xFF00)); \
+#define GetABIWR(target, i)                            \
+  {                                                    \
+    unsigned int rt;                                   \
+    GetAB(rt);                                         \
+    target = rt;                                       \
+    target += i;                                       \
+    target &= 0xFFFF;                                  \
+    RdMem<PROFILE>((target & 0x00FF) | (rt & 0xFF00)); \
   }
 
 /* Zero Page */
-#define GetZP(target)       \
-  {                         \
-    target = RdMem(reg_PC); \
-    reg_PC++;               \
+#define GetZP(target)                \
+  {                                  \
+    target = RdMem<PROFILE>(reg_PC); \
+    reg_PC++;                        \
   }
 
 /* Zero Page Indexed */
-#define GetZPI(target, i)       \
-  {                             \
-    target = i + RdMem(reg_PC); \
-    reg_PC++;                   \
+#define GetZPI(target, i)                \
+  {                                      \
+    target = i + RdMem<PROFILE>(reg_PC); \
+    reg_PC++;                            \
   }
 
 /* Indexed Indirect */
-#define GetIX(target)             \
-  {                               \
-    uint8 tmp;                    \
-    tmp = RdMem(reg_PC);          \
-    reg_PC++;                     \
-    tmp += reg_X;                 \
-    target = RdRAM(tmp);          \
-    tmp++;                        \
-    target |= RdRAM(tmp) << 8;    \
+#define GetIX(target)                   \
+  {                                     \
+    uint8 tmp;                          \
+    tmp = RdMem<PROFILE>(reg_PC);       \
+    reg_PC++;                           \
+    tmp += reg_X;                       \
+    target = RdRAM<PROFILE>(tmp);       \
+    tmp++;                              \
+    target |= RdRAM<PROFILE>(tmp) << 8; \
   }
 
 /* Indirect Indexed(for reads) */
-#define GetIYRD(target)          \
-  {                              \
-    unsigned int rt;             \
-    uint8 tmp;                   \
-    tmp = RdMem(reg_PC);         \
-    reg_PC++;                    \
-    rt = RdRAM(tmp);             \
-    tmp++;                       \
-    rt |= RdRAM(tmp) << 8;       \
-    target = rt;                 \
-    target += reg_Y;             \
-    if ((target ^ rt) & 0x100) { \
-      target &= 0xFFFF;          \
-      RdMem(target ^ 0x100);     \
-      ADDCYC(1);                 \
-    }                            \
+#define GetIYRD(target)               \
+  {                                   \
+    unsigned int rt;                  \
+    uint8 tmp;                        \
+    tmp = RdMem<PROFILE>(reg_PC);     \
+    reg_PC++;                         \
+    rt = RdRAM<PROFILE>(tmp);         \
+    tmp++;                            \
+    rt |= RdRAM<PROFILE>(tmp) << 8;   \
+    target = rt;                      \
+    target += reg_Y;                  \
+    if ((target ^ rt) & 0x100) {      \
+      target &= 0xFFFF;               \
+      RdMem<PROFILE>(target ^ 0x100); \
+      ADDCYC(1);                      \
+    }                                 \
   }
 
 /* Indirect Indexed(for writes and rmws) */
-#define GetIYWR(target)                       \
-  {                                           \
-    unsigned int rt;                          \
-    uint8 tmp;                                \
-    tmp = RdMem(reg_PC);                      \
-    reg_PC++;                                 \
-    rt = RdRAM(tmp);                          \
-    tmp++;                                    \
-    rt |= RdRAM(tmp) << 8;                    \
-    target = rt;                              \
-    target += reg_Y;                          \
-    target &= 0xFFFF;                         \
-    RdMem((target & 0x00FF) | (rt & 0xFF00)); \
+#define GetIYWR(target)                                \
+  {                                                    \
+    unsigned int rt;                                   \
+    uint8 tmp;                                         \
+    tmp = RdMem<PROFILE>(reg_PC);                      \
+    reg_PC++;                                          \
+    rt = RdRAM<PROFILE>(tmp);                          \
+    tmp++;                                             \
+    rt |= RdRAM<PROFILE>(tmp) << 8;                    \
+    target = rt;                                       \
+    target += reg_Y;                                   \
+    target &= 0xFFFF;                                  \
+    RdMem<PROFILE>((target & 0x00FF) | (rt & 0xFF00)); \
   }
 
 /* Now come the macros to wrap up all of the above stuff addressing
@@ -357,107 +359,107 @@ static constexpr uint8 ZNTable[256] = {
     reg_A = x;       \
     break;           \
   }
-#define RMW_AB(op)   \
-  {                  \
-    unsigned int AA; \
-    uint8 x;         \
-    GetAB(AA);       \
-    x = RdMem(AA);   \
-    WrMem(AA, x);    \
-    op;              \
-    WrMem(AA, x);    \
-    break;           \
+#define RMW_AB(op)          \
+  {                         \
+    unsigned int AA;        \
+    uint8 x;                \
+    GetAB(AA);              \
+    x = RdMem<PROFILE>(AA); \
+    WrMem<PROFILE>(AA, x);  \
+    op;                     \
+    WrMem<PROFILE>(AA, x);  \
+    break;                  \
   }
-#define RMW_ABI(reg, op) \
-  {                      \
-    unsigned int AA;     \
-    uint8 x;             \
-    GetABIWR(AA, reg);   \
-    x = RdMem(AA);       \
-    WrMem(AA, x);        \
-    op;                  \
-    WrMem(AA, x);        \
-    break;               \
+#define RMW_ABI(reg, op)    \
+  {                         \
+    unsigned int AA;        \
+    uint8 x;                \
+    GetABIWR(AA, reg);      \
+    x = RdMem<PROFILE>(AA); \
+    WrMem<PROFILE>(AA, x);  \
+    op;                     \
+    WrMem<PROFILE>(AA, x);  \
+    break;                  \
   }
 #define RMW_ABX(op) RMW_ABI(reg_X, op)
 #define RMW_ABY(op) RMW_ABI(reg_Y, op)
-#define RMW_IX(op)   \
-  {                  \
-    unsigned int AA; \
-    uint8 x;         \
-    GetIX(AA);       \
-    x = RdMem(AA);   \
-    WrMem(AA, x);    \
-    op;              \
-    WrMem(AA, x);    \
-    break;           \
+#define RMW_IX(op)          \
+  {                         \
+    unsigned int AA;        \
+    uint8 x;                \
+    GetIX(AA);              \
+    x = RdMem<PROFILE>(AA); \
+    WrMem<PROFILE>(AA, x);  \
+    op;                     \
+    WrMem<PROFILE>(AA, x);  \
+    break;                  \
   }
-#define RMW_IY(op)   \
-  {                  \
-    unsigned int AA; \
-    uint8 x;         \
-    GetIYWR(AA);     \
-    x = RdMem(AA);   \
-    WrMem(AA, x);    \
-    op;              \
-    WrMem(AA, x);    \
-    break;           \
+#define RMW_IY(op)          \
+  {                         \
+    unsigned int AA;        \
+    uint8 x;                \
+    GetIYWR(AA);            \
+    x = RdMem<PROFILE>(AA); \
+    WrMem<PROFILE>(AA, x);  \
+    op;                     \
+    WrMem<PROFILE>(AA, x);  \
+    break;                  \
   }
-#define RMW_ZP(op) \
-  {                \
-    uint8 AA;      \
-    uint8 x;       \
-    GetZP(AA);     \
-    x = RdRAM(AA); \
-    op;            \
-    WrRAM(AA, x);  \
-    break;         \
+#define RMW_ZP(op)          \
+  {                         \
+    uint8 AA;               \
+    uint8 x;                \
+    GetZP(AA);              \
+    x = RdRAM<PROFILE>(AA); \
+    op;                     \
+    WrRAM<PROFILE>(AA, x);  \
+    break;                  \
   }
-#define RMW_ZPX(op)    \
-  {                    \
-    uint8 AA;          \
-    uint8 x;           \
-    GetZPI(AA, reg_X); \
-    x = RdRAM(AA);     \
-    op;                \
-    WrRAM(AA, x);      \
-    break;             \
+#define RMW_ZPX(op)         \
+  {                         \
+    uint8 AA;               \
+    uint8 x;                \
+    GetZPI(AA, reg_X);      \
+    x = RdRAM<PROFILE>(AA); \
+    op;                     \
+    WrRAM<PROFILE>(AA, x);  \
+    break;                  \
   }
 
-#define LD_IM(op)      \
-  {                    \
-    uint8 x;           \
-    x = RdMem(reg_PC); \
-    reg_PC++;          \
-    op;                \
-    break;             \
+#define LD_IM(op)               \
+  {                             \
+    uint8 x;                    \
+    x = RdMem<PROFILE>(reg_PC); \
+    reg_PC++;                   \
+    op;                         \
+    break;                      \
   }
-#define LD_ZP(op)  \
-  {                \
-    uint8 AA;      \
-    uint8 x;       \
-    GetZP(AA);     \
-    x = RdRAM(AA); \
-    op;            \
-    break;         \
+#define LD_ZP(op)           \
+  {                         \
+    uint8 AA;               \
+    uint8 x;                \
+    GetZP(AA);              \
+    x = RdRAM<PROFILE>(AA); \
+    op;                     \
+    break;                  \
   }
-#define LD_ZPX(op)      \
-  {                     \
-    uint8 AA;           \
-    uint8 x;            \
-    GetZPI(AA, reg_X);  \
-    x = RdRAM(AA);      \
-    op;                 \
-    break;              \
+#define LD_ZPX(op)          \
+  {                         \
+    uint8 AA;               \
+    uint8 x;                \
+    GetZPI(AA, reg_X);      \
+    x = RdRAM<PROFILE>(AA); \
+    op;                     \
+    break;                  \
   }
-#define LD_ZPY(op)     \
-  {                    \
-    uint8 AA;          \
-    uint8 x;           \
-    GetZPI(AA, reg_Y); \
-    x = RdRAM(AA);     \
-    op;                \
-    break;             \
+#define LD_ZPY(op)          \
+  {                         \
+    uint8 AA;               \
+    uint8 x;                \
+    GetZPI(AA, reg_Y);      \
+    x = RdRAM<PROFILE>(AA); \
+    op;                     \
+    break;                  \
   }
 #define LD_AB(op)                     \
   {                                   \
@@ -465,93 +467,93 @@ static constexpr uint8 ZNTable[256] = {
     uint8 x;                          \
     GetAB(AA);                        \
     TRACEN(AA);                       \
-    x = RdMem(AA);                    \
+    x = RdMem<PROFILE>(AA);           \
     TRACEF("Read %d -> %02x", AA, x); \
     (void) x;                         \
     op;                               \
     break;                            \
   }
-#define LD_ABI(reg, op) \
-  {                     \
-    unsigned int AA;    \
-    uint8 x;            \
-    GetABIRD(AA, reg);  \
-    x = RdMem(AA);      \
-    (void) x;           \
-    op;                 \
-    break;              \
+#define LD_ABI(reg, op)     \
+  {                         \
+    unsigned int AA;        \
+    uint8 x;                \
+    GetABIRD(AA, reg);      \
+    x = RdMem<PROFILE>(AA); \
+    (void) x;               \
+    op;                     \
+    break;                  \
   }
 #define LD_ABX(op) LD_ABI(reg_X, op)
 #define LD_ABY(op) LD_ABI(reg_Y, op)
-#define LD_IX(op)    \
-  {                  \
-    unsigned int AA; \
-    uint8 x;         \
-    GetIX(AA);       \
-    x = RdMem(AA);   \
-    op;              \
-    break;           \
+#define LD_IX(op)           \
+  {                         \
+    unsigned int AA;        \
+    uint8 x;                \
+    GetIX(AA);              \
+    x = RdMem<PROFILE>(AA); \
+    op;                     \
+    break;                  \
   }
-#define LD_IY(op)    \
-  {                  \
-    unsigned int AA; \
-    uint8 x;         \
-    GetIYRD(AA);     \
-    x = RdMem(AA);   \
-    op;              \
-    break;           \
+#define LD_IY(op)           \
+  {                         \
+    unsigned int AA;        \
+    uint8 x;                \
+    GetIYRD(AA);            \
+    x = RdMem<PROFILE>(AA); \
+    op;                     \
+    break;                  \
   }
 
-#define ST_ZP(r)  \
-  {               \
-    uint8 AA;     \
-    GetZP(AA);    \
-    WrRAM(AA, r); \
-    break;        \
+#define ST_ZP(r)           \
+  {                        \
+    uint8 AA;              \
+    GetZP(AA);             \
+    WrRAM<PROFILE>(AA, r); \
+    break;                 \
   }
-#define ST_ZPX(r)      \
-  {                    \
-    uint8 AA;          \
-    GetZPI(AA, reg_X); \
-    WrRAM(AA, r);      \
-    break;             \
+#define ST_ZPX(r)          \
+  {                        \
+    uint8 AA;              \
+    GetZPI(AA, reg_X);     \
+    WrRAM<PROFILE>(AA, r); \
+    break;                 \
   }
-#define ST_ZPY(r)      \
-  {                    \
-    uint8 AA;          \
-    GetZPI(AA, reg_Y); \
-    WrRAM(AA, r);      \
-    break;             \
+#define ST_ZPY(r)          \
+  {                        \
+    uint8 AA;              \
+    GetZPI(AA, reg_Y);     \
+    WrRAM<PROFILE>(AA, r); \
+    break;                 \
   }
-#define ST_AB(r)     \
-  {                  \
-    unsigned int AA; \
-    GetAB(AA);       \
-    WrMem(AA, r);    \
-    break;           \
+#define ST_AB(r)           \
+  {                        \
+    unsigned int AA;       \
+    GetAB(AA);             \
+    WrMem<PROFILE>(AA, r); \
+    break;                 \
   }
-#define ST_ABI(reg, r) \
-  {                    \
-    unsigned int AA;   \
-    GetABIWR(AA, reg); \
-    WrMem(AA, r);      \
-    break;             \
+#define ST_ABI(reg, r)     \
+  {                        \
+    unsigned int AA;       \
+    GetABIWR(AA, reg);     \
+    WrMem<PROFILE>(AA, r); \
+    break;                 \
   }
 #define ST_ABX(r) ST_ABI(reg_X, r)
 #define ST_ABY(r) ST_ABI(reg_Y, r)
-#define ST_IX(r)     \
-  {                  \
-    unsigned int AA; \
-    GetIX(AA);       \
-    WrMem(AA, r);    \
-    break;           \
+#define ST_IX(r)           \
+  {                        \
+    unsigned int AA;       \
+    GetIX(AA);             \
+    WrMem<PROFILE>(AA, r); \
+    break;                 \
   }
-#define ST_IY(r)     \
-  {                  \
-    unsigned int AA; \
-    GetIYWR(AA);     \
-    WrMem(AA, r);    \
-    break;           \
+#define ST_IY(r)           \
+  {                        \
+    unsigned int AA;       \
+    GetIYWR(AA);           \
+    WrMem<PROFILE>(AA, r); \
+    break;                 \
   }
 
 static constexpr uint8 CycTable[256] = {
@@ -642,6 +644,11 @@ void X6502::Power() {
   jammed, IRQlow, DB
 
 void X6502::Run(int32 cycles) {
+  if (aot_run != nullptr) {
+    (*aot_run)(fc, cycles);
+    return;
+  }
+
   // Temporarily disable tracing unless this is the particular cycle
   // we're intereted in.
   // TRACE_SCOPED_STAY_ENABLED_IF(false);
@@ -667,6 +674,14 @@ void X6502::Run(int32 cycles) {
 }
 
 void X6502::RunLoop() {
+  // Profiling is checked once here, rather than on every memory
+  // access, so that it costs nothing when off.
+  if (profile) RunLoopT<true>();
+  else RunLoopT<false>();
+}
+
+template<bool PROFILE>
+void X6502::RunLoopT() {
   while (count > 0) {
     TRACE_SCOPED_STAY_ENABLED_IF(false);
     TRACEF("while " TRACE_MACHINEFMT, TRACE_MACHINEARGS);
@@ -675,8 +690,8 @@ void X6502::RunLoop() {
     if (IRQlow) {
       TRACEF("IRQlow set.");
       if (IRQlow & FCEU_IQRESET) {
-        reg_PC = RdMem(0xFFFC);
-        reg_PC |= RdMem(0xFFFD) << 8;
+        reg_PC = RdMem<PROFILE>(0xFFFC);
+        reg_PC |= RdMem<PROFILE>(0xFFFD) << 8;
         jammed = 0;
         reg_PI = reg_P = I_FLAG;
         IRQlow &= ~FCEU_IQRESET;
@@ -690,8 +705,8 @@ void X6502::RunLoop() {
           PUSH(reg_PC);
           PUSH((reg_P & ~B_FLAG) | (U_FLAG));
           reg_P |= I_FLAG;
-          reg_PC = RdMem(0xFFFA);
-          reg_PC |= RdMem(0xFFFB) << 8;
+          reg_PC = RdMem<PROFILE>(0xFFFA);
+          reg_PC |= RdMem<PROFILE>(0xFFFB) << 8;
           IRQlow &= ~FCEU_IQNMI;
         }
       } else {
@@ -701,8 +716,8 @@ void X6502::RunLoop() {
           PUSH(reg_PC);
           PUSH((reg_P & ~B_FLAG) | (U_FLAG));
           reg_P |= I_FLAG;
-          reg_PC = RdMem(0xFFFE);
-          reg_PC |= RdMem(0xFFFF) << 8;
+          reg_PC = RdMem<PROFILE>(0xFFFE);
+          reg_PC |= RdMem<PROFILE>(0xFFFF) << 8;
         }
       }
       IRQlow &= ~(FCEU_IQTEMP);
@@ -721,7 +736,8 @@ void X6502::RunLoop() {
     pc_histo[reg_PC]++;
     #endif
     
-    const uint8 b1 = RdMem(reg_PC);
+    const uint8 b1 = RdMem<PROFILE>(reg_PC);
+    if (PROFILE) profile->Instruction(fc, reg_PC, b1);
     // printf("Read %x -> opcode %02x\n", reg_PC, b1);
 
     ADDCYC(CycTable[b1]);
@@ -740,8 +756,8 @@ void X6502::RunLoop() {
         PUSH(reg_P | U_FLAG | B_FLAG);
         reg_P |= I_FLAG;
         reg_PI |= I_FLAG;
-        reg_PC = RdMem(0xFFFE);
-        reg_PC |= RdMem(0xFFFF) << 8;
+        reg_PC = RdMem<PROFILE>(0xFFFE);
+        reg_PC |= RdMem<PROFILE>(0xFFFF) << 8;
         break;
 
       case 0x40: /* RTI */
@@ -770,27 +786,27 @@ void X6502::RunLoop() {
         uint16 ptmp = reg_PC;
         unsigned int npc;
 
-        npc = RdMem(ptmp);
+        npc = RdMem<PROFILE>(ptmp);
         ptmp++;
-        npc |= RdMem(ptmp) << 8;
+        npc |= RdMem<PROFILE>(ptmp) << 8;
         reg_PC = npc;
       } break;
       case 0x6C: {
         /* JMP INDIRECT */
         uint32 tmp;
         GetAB(tmp);
-        reg_PC = RdMem(tmp);
-        reg_PC |= RdMem(((tmp + 1) & 0x00FF) | (tmp & 0xFF00)) << 8;
+        reg_PC = RdMem<PROFILE>(tmp);
+        reg_PC |= RdMem<PROFILE>(((tmp + 1) & 0x00FF) | (tmp & 0xFF00)) << 8;
         break;
       }
       case 0x20: /* JSR */
       {
         uint8 npc;
-        npc = RdMem(reg_PC);
+        npc = RdMem<PROFILE>(reg_PC);
         reg_PC++;
         PUSH(reg_PC >> 8);
         PUSH(reg_PC);
-        reg_PC = RdMem(reg_PC) << 8;
+        reg_PC = RdMem<PROFILE>(reg_PC) << 8;
         reg_PC |= npc;
         break;
       }
@@ -21,9 +21,12 @@
 #ifndef __X6502_H
 #define __X6502_H
 
+#include <memory>
+
 #include "tracing.h"
 #include "fceu.h"
 #include "fc.h"
+#include "profile.h"
 
 // XXX
 #include "base/logging.h"
@@ -72,6 +75,16 @@ struct X6502 {
   void Run(int32 cycles);
   void RunLoop();
 
+  // If non-null, Run calls this instead of the interpreter. It's
+  // code for the loaded ROM compiled by aot.exe; see aot-engine.h.
+  // Not part of the savestate.
+  void (*aot_run)(FC *, int32) = nullptr;
+
+  // If non-null, the interpreter records instructions and memory
+  // accesses here. See Emulator::StartProfile. Not part of the
+  // savestate.
+  std::unique_ptr<Profile> profile;
+
   void Init();
   void Reset();
   void Power();
@@ -92,27 +105,57 @@ struct X6502 {
   void (*MapIRQHook)(FC *, int) = nullptr;
 
 private:
+  template<bool PROFILE>
+  void RunLoopT();
+
   // normal memory read
+  template<bool PROFILE>
   inline uint8 RdMem(unsigned int A) {
+    if (PROFILE) profile->Read(A);
+    // Plain memory (RAM and most PRG) needn't call the handler.
+    // See FCEU::fast_read.
+    const uint8 *page = fc->fceu->fast_read[A >> 11];
+    if (page != nullptr) return DB = page[A];
     return DB = fc->fceu->ARead[A](fc, A);
   }
 
   // normal memory write
+  template<bool PROFILE>
   inline void WrMem(unsigned int A, uint8 V) {
+    if (PROFILE) profile->Write(A);
+    if (A < 0x2000) {
+      if (fc->fceu->fast_ram_write) {
+        fc->fceu->WriteRAM(A & 0x7FF, V);
+        return;
+      }
+    } else {
+      uint8 *page = fc->fceu->fast_write[A >> 11];
+      if (page != nullptr) {
+        page[A] = V;
+        return;
+      }
+    }
     fc->fceu->BWrite[A](fc, A, V);
   }
 
+  template<bool PROFILE>
   inline uint8 RdRAM(unsigned int A) {
     // PERF: We should read directly from ram in this case (and
     // see what other ones are possible); cheats at this level
     // are not important. -tom7
     //bbit edited: this was changed so cheat substitution would work
+    // Now direct unless something replaced the RAM handler.
+    if (PROFILE) profile->Read(A);
+    const uint8 *page = fc->fceu->fast_read[0];
+    if (page != nullptr) return DB = page[A];
     return (DB = fc->fceu->ARead[A](fc, A));
     // return (DB=RAM[A]);
   }
 
+  template<bool PROFILE>
   inline void WrRAM(unsigned int A, uint8 V) {
-    fc->fceu->RAM[A] = V;
+    if (PROFILE) profile->Write(A);
+    fc->fceu->WriteRAM(A, V);
   }
 
   FC *fc = nullptr;
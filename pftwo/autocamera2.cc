@@ -128,8 +128,7 @@ vector<Linkage> AutoCamera2::FindLinkages(
   // This is parallelizable, but probably simpler to organize the
   // parallelism across samples rather than within one.
   ArcFour *rc = random_pool.Acquire();
-  Emulator *emu = emu_pool.Acquire();
-  emu->LoadUncompressed(save);
+  Emulator *emu = emu_pool.AcquireWithState(save);
   
   vector<uint8> orig_mem = emu->GetMemory();
   StepEmu(emu);
@@ -41,17 +41,12 @@ float AutoLives::IsInControl(const vector<uint8> &save,
 			     int xloc, int yloc,
 			     bool player_two) {
 
-  Emulator *emu = emulator_pool.Acquire();
-  Emulator *lemu = emulator_pool.Acquire();
-  Emulator *remu = emulator_pool.Acquire();
-  Emulator *memu = emulator_pool.Acquire();
-  ArcFour *rc = random_pool.Acquire();
-  
   // Initialize them all to the same state.
-  emu->LoadUncompressed(save);
-  lemu->LoadUncompressed(save);
-  remu->LoadUncompressed(save);
-  memu->LoadUncompressed(save);
+  Emulator *emu = emulator_pool.AcquireWithState(save);
+  Emulator *lemu = emulator_pool.AcquireWithState(save);
+  Emulator *remu = emulator_pool.AcquireWithState(save);
+  Emulator *memu = emulator_pool.AcquireWithState(save);
+  ArcFour *rc = random_pool.Acquire();
 
   auto MakePlayer = [player_two](uint8 inputs) {
     return player_two ? ((uint16)inputs << 8) : (uint16)inputs;
@@ -77,12 +77,14 @@ vector<AutoTimer::TimerLoc> AutoTimer::FindTimers(const vector<uint8> &save) {
   // Start back at the beginning.
   emu->LoadUncompressed(save);
   vector<uint8> mem_prev = emu->GetMemory();
+  // Copied only when RAM changes, and without allocating.
+  MemorySnapshot snapshot;
   for (int f = 0; f < EXPERIMENT_FRAMES; f++) {
     // The "safest" thing is often just to stay still, so that's what
     // we do. TODO: It would also be pretty reasonable to compare what
     // happens in the training movie if we have one.
     emu->Step16(0);
-    vector<uint8> mem_now = emu->GetMemory();
+    const vector<uint8> &mem_now = snapshot.Update(*emu);
 
     for (int i = 0; i < 2048; i++) {
       if (mem_now[i] != mem_prev[i]) {
@@ -160,7 +162,7 @@ vector<AutoTimer::TimerLoc> AutoTimer::FindTimers(const vector<uint8> &save) {
 	}
       }
     }
-    mem_prev = std::move(mem_now);
+    mem_prev = mem_now;
   }
 
   // Now that we've reached the end of the experiment, disqualify or
@@ -0,0 +1,134 @@
+// Benchmarks scoring many memories with Observations, one at a time
+// versus with the batch (MemoryBatch) functions, and checks that they
+// agree exactly.
+//
+// bench-objectives.exe [file.objectives] [num_memories]
+//
+// The objectives file is the kind that pftwo saves (game.nes.objectives)
+// or a manual one. Memories are a random walk on the objectives'
+// locations, so that like real RAM, each location takes on a modest
+// number of distinct values.
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "pftwo.h"
+
+#include "../cc-lib/arcfour.h"
+#include "../cc-lib/randutil.h"
+#include "../cc-lib/timer.h"
+
+#include "weighted-objectives.h"
+
+static constexpr int RAM_SIZE = 2048;
+// Number of memories in the trajectory that we observe.
+static constexpr int NUM_OBSERVED = 20000;
+static constexpr int ROUNDS = 5;
+
+static vector<vector<uint8>> RandomWalk(const WeightedObjectives &wo,
+					ArcFour *rc, int num) {
+  vector<int> locs;
+  for (const auto &wobj : wo.GetAll())
+    for (const int loc : wobj.first) locs.push_back(loc);
+  CHECK(!locs.empty());
+
+  vector<uint8> mem(RAM_SIZE, 0);
+  for (uint8 &b : mem) b = rc->Byte();
+
+  vector<vector<uint8>> mems;
+  mems.reserve(num);
+  for (int i = 0; i < num; i++) {
+    // Mostly small steps, like counters and positions.
+    for (int j = 0; j < 3; j++) {
+      uint8 &b = mem[locs[RandTo32(rc, locs.size())]];
+      b += (rc->Byte() & 1) ? 1 : -1;
+    }
+    // Occasionally a jump, like a room change.
+    if (rc->Byte() == 0)
+      mem[locs[RandTo32(rc, locs.size())]] = rc->Byte();
+    mems.push_back(mem);
+  }
+  return mems;
+}
+
+static void Bench(const char *name, const WeightedObjectives &wo,
+		  Observations *obs, const vector<vector<uint8>> &trajectory,
+		  const vector<vector<uint8>> &mems) {
+  for (int i = 0; i < trajectory.size(); i += 10)
+    obs->Accumulate(trajectory[i]);
+  obs->Commit();
+
+  vector<const uint8 *> ptrs;
+  for (const vector<uint8> &m : mems) ptrs.push_back(m.data());
+
+  double scalar_sec = 0.0, batch_sec = 0.0, transpose_sec = 0.0;
+  vector<double> scalar(mems.size()), batch;
+  for (int round = 0; round < ROUNDS; round++) {
+    {
+      Timer timer;
+      for (int m = 0; m < mems.size(); m++)
+	scalar[m] = obs->GetWeightedValue(mems[m]);
+      scalar_sec += timer.Seconds();
+    }
+
+    {
+      Timer timer;
+      MemoryBatch mb(wo, ptrs);
+      transpose_sec += timer.Seconds();
+      batch = obs->GetWeightedValueBatch(mb);
+      batch_sec += timer.Seconds();
+    }
+  }
+
+  CHECK(batch.size() == scalar.size());
+  for (int m = 0; m < mems.size(); m++) {
+    CHECK(batch[m] == scalar[m]) << name << " memory " << m << ": "
+				 << batch[m] << " vs " << scalar[m];
+  }
+
+  const double per = 1000000000.0 / (ROUNDS * mems.size());
+  printf("[%s] scalar %8.1f ns/memory  batch %8.1f ns/memory "
+	 "(transpose %.1f)  %.2fx\n",
+	 name, scalar_sec * per, batch_sec * per, transpose_sec * per,
+	 scalar_sec / batch_sec);
+}
+
+int main(int argc, char **argv) {
+  const string file = argc > 1 ? argv[1] : "contra.nes.manual.objectives";
+  const int num = argc > 2 ? atoi(argv[2]) : 4096;
+  CHECK(num > 0);
+
+  std::unique_ptr<WeightedObjectives> wo(
+      WeightedObjectives::LoadFromFile(file));
+  CHECK(wo.get() != nullptr && wo->Size() > 0) << file;
+  int total_len = 0;
+  for (const auto &wobj : wo->GetAll()) total_len += wobj.first.size();
+  printf("%d objectives (%d locations total) from %s, %d memories.\n",
+	 (int)wo->Size(), total_len, file.c_str(), num);
+
+  ArcFour rc("bench-objectives");
+  const vector<vector<uint8>> trajectory = RandomWalk(*wo, &rc, NUM_OBSERVED);
+  // Score states from the same walk, like nodes in the tree, plus
+  // some from beyond it (new maxima).
+  vector<vector<uint8>> mems = RandomWalk(*wo, &rc, num);
+  for (int i = 0; i < num / 2; i++)
+    mems[i] = trajectory[RandTo32(&rc, trajectory.size())];
+
+  {
+    std::unique_ptr<Observations> obs(
+	Observations::SampleObservations(*wo, 1000));
+    Bench("sample", *wo, obs.get(), trajectory, mems);
+  }
+
+  {
+    std::unique_ptr<Observations> obs(
+	Observations::MixedBaseObservations(*wo));
+    Bench("mixedbase", *wo, obs.get(), trajectory, mems);
+  }
+
+  return 0;
+}
@@ -0,0 +1,550 @@
+#include "checkpoint.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <unordered_map>
+
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+
+#include "pftwo.h"
+
+#include "../cc-lib/util.h"
+#include "../cc-lib/timer.h"
+#include "../cc-lib/city/city.h"
+
+#include "treesearch.h"
+#include "problem-twoplayer.h"
+
+using Node = Tree::Node;
+
+// Start of file. Bump the version if the format changes.
+static constexpr char MAGIC[8] = {'p', 'f', '2', 'c', 'k', 'p', 't', '1'};
+
+// Every record is the type byte, the payload length (4 bytes), the
+// CityHash64 of the payload (8 bytes), and then the payload.
+enum RecordType : uint8 {
+  // Content hash (8 bytes), then compressed bytes.
+  REC_BLOB = 'b',
+  // Compressed list of nodes.
+  REC_NODES = 'n',
+  // Compressed snapshot.
+  REC_SNAPSHOT = 's',
+};
+static constexpr int RECORD_HEADER_BYTES = 1 + 4 + 8;
+
+// If an incremental write makes the file this many times larger than
+// the last full rewrite, compact it next time.
+static constexpr int COMPACT_RATIO = 4;
+
+namespace {
+// Little-endian serialization into a byte vector.
+struct Out {
+  vector<uint8> bytes;
+  void W8(uint8 b) { bytes.push_back(b); }
+  void W32(uint32 w) {
+    for (int i = 0; i < 4; i++) W8((w >> (8 * i)) & 0xFF);
+  }
+  void W64(uint64 w) {
+    for (int i = 0; i < 8; i++) W8((w >> (8 * i)) & 0xFF);
+  }
+  void WD(double d) {
+    uint64 w;
+    static_assert(sizeof w == sizeof d, "double");
+    memcpy(&w, &d, sizeof d);
+    W64(w);
+  }
+  void WBytes(const uint8 *b, size_t n) {
+    bytes.insert(bytes.end(), b, b + n);
+  }
+};
+
+// Reading the same. Records have been verified against their hash,
+// so malformed contents are a bug.
+struct In {
+  In(const uint8 *p, size_t n) : p(p), end(p + n) {}
+  const uint8 *p = nullptr, *end = nullptr;
+  bool Done() const { return p == end; }
+  uint8 R8() {
+    CHECK(p < end) << "Checkpoint record ends early";
+    return *p++;
+  }
+  uint32 R32() {
+    uint32 w = 0;
+    for (int i = 0; i < 4; i++) w |= (uint32)R8() << (8 * i);
+    return w;
+  }
+  uint64 R64() {
+    uint64 w = 0;
+    for (int i = 0; i < 8; i++) w |= (uint64)R8() << (8 * i);
+    return w;
+  }
+  double RD() {
+    uint64 w = R64();
+    double d;
+    memcpy(&d, &w, sizeof d);
+    return d;
+  }
+};
+
+// The immutable parts of a node, as stored in a REC_NODES record.
+struct NodeRecord {
+  int64 id = 0, parent_id = -1;
+  Tree::Seq seq;
+  int64 seqlength = 0, nes_frames = 0, walltime_seconds = 0;
+  int goalx = -1, goaly = -1;
+  bool checked_in_control = false;
+  // Problem::State, with blobs by hash. 0 means none. (Neither base
+  // nor save means the save state had been evicted.)
+  int depth = 0;
+  uint64 prev1 = 0, prev2 = 0;
+  uint64 base_hash = 0, save_hash = 0, mem_hash = 0;
+  // Emulator::StateHash, not a blob.
+  uint64 state_hash = 0;
+};
+
+// A new node copied out of the tree, with its state.
+struct NodeCopy {
+  NodeRecord rec;
+  Problem::State state;
+};
+}  // namespace
+
+static uint64 BlobHash(const vector<uint8> &v) {
+  const uint64 h = CityHash64((const char *)v.data(), v.size());
+  // Reserve 0 to mean "no blob".
+  return h == 0 ? 1 : h;
+}
+
+// Checkpoints are written while the search runs, so favor speed.
+static vector<uint8> Compress(const vector<uint8> &raw) {
+  uLongf len = compressBound(raw.size());
+  Out out;
+  out.W32(raw.size());
+  out.bytes.resize(4 + len);
+  CHECK(Z_OK == compress2(out.bytes.data() + 4, &len,
+			  raw.data(), raw.size(), Z_BEST_SPEED));
+  out.bytes.resize(4 + len);
+  return std::move(out.bytes);
+}
+
+static vector<uint8> Decompress(const uint8 *p, size_t n) {
+  In in(p, n);
+  vector<uint8> raw(in.R32());
+  uLongf len = raw.size();
+  CHECK(Z_OK == uncompress(raw.data(), &len, in.p, n - 4) &&
+	len == raw.size()) << "Corrupt blob in checkpoint";
+  return raw;
+}
+
+static void AppendRecord(RecordType type, const vector<uint8> &payload,
+			 Out *out) {
+  out->W8(type);
+  out->W32(payload.size());
+  out->W64(CityHash64((const char *)payload.data(), payload.size()));
+  out->WBytes(payload.data(), payload.size());
+}
+
+static void WriteNodeRecord(const NodeRecord &r, Out *out) {
+  out->W64(r.id);
+  out->W64(r.parent_id);
+  out->W64(r.seqlength);
+  out->W64(r.nes_frames);
+  out->W64(r.walltime_seconds);
+  out->W32(r.goalx);
+  out->W32(r.goaly);
+  out->W8(r.checked_in_control ? 1 : 0);
+  out->W32(r.depth);
+  out->W64(r.prev1);
+  out->W64(r.prev2);
+  out->W64(r.base_hash);
+  out->W64(r.save_hash);
+  out->W64(r.mem_hash);
+  out->W64(r.state_hash);
+  out->W32(r.seq.size());
+  for (const Problem::Input &input : r.seq) {
+    out->W8(input.p1);
+    out->W8(input.p2);
+  }
+}
+
+static NodeRecord ReadNodeRecord(In *in) {
+  NodeRecord r;
+  r.id = in->R64();
+  r.parent_id = in->R64();
+  r.seqlength = in->R64();
+  r.nes_frames = in->R64();
+  r.walltime_seconds = in->R64();
+  r.goalx = (int32)in->R32();
+  r.goaly = (int32)in->R32();
+  r.checked_in_control = in->R8() != 0;
+  r.depth = (int32)in->R32();
+  r.prev1 = in->R64();
+  r.prev2 = in->R64();
+  r.base_hash = in->R64();
+  r.save_hash = in->R64();
+  r.mem_hash = in->R64();
+  r.state_hash = in->R64();
+  const uint32 n = in->R32();
+  r.seq.reserve(n);
+  for (uint32 i = 0; i < n; i++) {
+    const uint8 p1 = in->R8();
+    const uint8 p2 = in->R8();
+    r.seq.push_back(Problem::ControllerInput(p1, p2));
+  }
+  return r;
+}
+
+void Checkpoint::Write(TreeSearch *search) {
+  Timer timer;
+  const bool full = need_full;
+  if (full) {
+    written_blobs.clear();
+    written_nodes.clear();
+  }
+
+  // Copied out while holding the lock.
+  vector<NodeCopy> new_nodes;
+  // All live nodes in pre-order (so parents come first), with their
+  // mutable counts.
+  struct Live {
+    int64 id;
+    int chosen, was_loss;
+  };
+  vector<Live> live;
+  vector<pair<int, int64>> grid;
+  int64 marathon_id = -1;
+  double stuckness = 0.0;
+  int64 next_node_id = 0;
+  {
+    ReadMutexLock ml(&search->tree_m);
+    Tree *tree = search->tree;
+    if (tree == nullptr) return;
+
+    std::function<void(const Node *, const Tree::Seq *)> Rec =
+      [this, &Rec, &new_nodes, &live](const Node *n, const Tree::Seq *seq) {
+      live.push_back(Live{n->id, n->chosen.load(), n->was_loss});
+      if (written_nodes.find(n->id) == written_nodes.end()) {
+	NodeCopy nc;
+	nc.rec.id = n->id;
+	nc.rec.parent_id = n->parent == nullptr ? -1 : n->parent->id;
+	if (seq != nullptr) nc.rec.seq = *seq;
+	nc.rec.seqlength = n->seqlength;
+	nc.rec.nes_frames = n->nes_frames;
+	nc.rec.walltime_seconds = n->walltime_seconds;
+	nc.rec.goalx = n->goalx;
+	nc.rec.goaly = n->goaly;
+	nc.rec.checked_in_control = n->checked_in_control;
+	// Shares the base, if any.
+	nc.state = n->state;
+	new_nodes.push_back(std::move(nc));
+      }
+      for (const auto &p : n->children) Rec(p.second, &p.first);
+    };
+    Rec(tree->root, nullptr);
+
+    // Workers may be updating grid cells, but the nodes we see are
+    // alive while we hold the lock.
+    for (int cell = 0; cell < tree->grid.size(); cell++) {
+      const Node *n = tree->grid[cell].node.load();
+      if (n != nullptr) grid.emplace_back(cell, n->id);
+    }
+
+    {
+      MutexLock mlm(&tree->marathon_m);
+      if (tree->marathon.node != nullptr)
+	marathon_id = tree->marathon.node->id;
+    }
+    stuckness = tree->stuckness;
+    next_node_id = tree->next_node_id.load();
+  }
+
+  Out out;
+  if (full) out.WBytes((const uint8 *)MAGIC, sizeof MAGIC);
+
+  // Blobs first, so that they precede the nodes that use them.
+  std::unordered_set<uint64> new_blobs;
+  auto AddBlob = [this, &new_blobs, &out](const vector<uint8> &v) {
+    const uint64 h = BlobHash(v);
+    if (written_blobs.find(h) == written_blobs.end() &&
+	new_blobs.insert(h).second) {
+      Out blob;
+      blob.W64(h);
+      vector<uint8> c = Compress(v);
+      blob.WBytes(c.data(), c.size());
+      AppendRecord(REC_BLOB, blob.bytes, &out);
+    }
+    return h;
+  };
+
+  Out nodes;
+  nodes.W32(new_nodes.size());
+  for (NodeCopy &nc : new_nodes) {
+    const Problem::State &s = nc.state;
+    nc.rec.depth = s.depth;
+    nc.rec.prev1 = s.prev1;
+    nc.rec.prev2 = s.prev2;
+    if (s.base.get() != nullptr) nc.rec.base_hash = AddBlob(*s.base);
+    if (!s.save.empty()) nc.rec.save_hash = AddBlob(s.save);
+    nc.rec.mem_hash = AddBlob(s.mem);
+    nc.rec.state_hash = s.hash;
+    WriteNodeRecord(nc.rec, &nodes);
+  }
+  AppendRecord(REC_NODES, Compress(nodes.bytes), &out);
+
+  Out snap;
+  snap.W64(next_node_id);
+  snap.WD(stuckness);
+  snap.W32(live.size());
+  for (const Live &l : live) {
+    snap.W64(l.id);
+    snap.W32(l.chosen);
+    snap.W32(l.was_loss);
+  }
+  snap.W32(grid.size());
+  for (const auto &[cell, id] : grid) {
+    snap.W32(cell);
+    snap.W64(id);
+  }
+  snap.W64(marathon_id);
+  AppendRecord(REC_SNAPSHOT, Compress(snap.bytes), &out);
+
+  // Compacting writes a new file and moves it into place. If we
+  // crash in between, Load finds the temporary file.
+  const string tmpfile = filename + ".tmp";
+  const string &dest = full ? tmpfile : filename;
+  FILE *f = fopen(dest.c_str(), full ? "wb" : "ab");
+  bool ok = f != nullptr &&
+    fwrite(out.bytes.data(), 1, out.bytes.size(), f) == out.bytes.size();
+  if (f != nullptr) ok = (fclose(f) == 0) && ok;
+  if (ok && full) {
+    (void)Util::remove(filename);
+    ok = Util::move(tmpfile, filename);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "Couldn't write checkpoint %s!\n", dest.c_str());
+    // Start over next time, since we don't know what made it.
+    need_full = true;
+    return;
+  }
+
+  for (uint64 h : new_blobs) written_blobs.insert(h);
+  // Forget nodes that have been deleted, so that the set doesn't
+  // grow without bound.
+  written_nodes.clear();
+  for (const Live &l : live) written_nodes.insert(l.id);
+
+  if (full) {
+    file_bytes = full_bytes = out.bytes.size();
+  } else {
+    file_bytes += out.bytes.size();
+  }
+  need_full = file_bytes > COMPACT_RATIO * full_bytes;
+
+  const int64 usec = timer.Seconds() * 1000000.0;
+  search->stats.checkpoints.Increment();
+  search->stats.checkpoint_nodes.IncrementBy(new_nodes.size());
+  search->stats.checkpoint_bytes.fetch_add(out.bytes.size());
+  search->stats.checkpoint_usec.fetch_add(usec);
+  printf("Checkpoint%s: %d new / %d live nodes, %d blobs, %.2f MB "
+	 "in %.3fs.\n",
+	 full ? " (full)" : "",
+	 (int)new_nodes.size(), (int)live.size(), (int)new_blobs.size(),
+	 out.bytes.size() / (1024.0 * 1024.0), usec / 1000000.0);
+}
+
+Tree *Checkpoint::Load(const string &filename_in, Problem *problem) {
+  string filename = filename_in;
+  if (!Util::ExistsFile(filename)) {
+    filename = filename_in + ".tmp";
+    if (!Util::ExistsFile(filename))
+      return nullptr;
+  }
+
+  const vector<uint8> bytes = Util::ReadFileBytes(filename);
+  if (bytes.size() < sizeof MAGIC ||
+      0 != memcmp(bytes.data(), MAGIC, sizeof MAGIC)) {
+    fprintf(stderr, "%s is not a checkpoint (or is the wrong version).\n",
+	    filename.c_str());
+    return nullptr;
+  }
+
+  // Index the whole file. Blobs are decompressed lazily.
+  std::unordered_map<uint64, pair<size_t, size_t>> blobs;
+  std::unordered_map<int64, NodeRecord> records;
+  vector<uint8> snapshot;
+  size_t pos = sizeof MAGIC;
+  while (pos + RECORD_HEADER_BYTES <= bytes.size()) {
+    In header(bytes.data() + pos, RECORD_HEADER_BYTES);
+    const uint8 type = header.R8();
+    const size_t len = header.R32();
+    const uint64 hash = header.R64();
+    const size_t start = pos + RECORD_HEADER_BYTES;
+    if (start + len > bytes.size() ||
+	CityHash64((const char *)bytes.data() + start, len) != hash) {
+      // Partial (or corrupt) record, presumably the end of a write
+      // that didn't finish. Ignore it and everything after.
+      break;
+    }
+
+    switch (type) {
+    case REC_BLOB: {
+      In in(bytes.data() + start, len);
+      const uint64 h = in.R64();
+      blobs[h] = make_pair(start + 8, len - 8);
+      break;
+    }
+    case REC_NODES: {
+      const vector<uint8> raw = Decompress(bytes.data() + start, len);
+      In in(raw.data(), raw.size());
+      const uint32 n = in.R32();
+      for (uint32 i = 0; i < n; i++) {
+	NodeRecord r = ReadNodeRecord(&in);
+	const int64 id = r.id;
+	records[id] = std::move(r);
+      }
+      break;
+    }
+    case REC_SNAPSHOT:
+      snapshot = Decompress(bytes.data() + start, len);
+      break;
+    default:
+      CHECK(false) << "Unknown checkpoint record type " << (int)type;
+    }
+    pos = start + len;
+  }
+
+  if (snapshot.empty()) {
+    fprintf(stderr, "%s has no complete snapshot.\n", filename.c_str());
+    return nullptr;
+  }
+
+  auto GetBlob = [&bytes, &blobs](uint64 h) {
+    auto it = blobs.find(h);
+    CHECK(it != blobs.end()) << "Checkpoint is missing a blob";
+    return Decompress(bytes.data() + it->second.first, it->second.second);
+  };
+  // Bases are shared by many nodes; keep them that way.
+  std::unordered_map<uint64, std::shared_ptr<const vector<uint8>>> bases;
+  auto GetState = [&GetBlob, &bases](const NodeRecord &r) {
+    Problem::State s;
+    if (r.base_hash != 0) {
+      auto it = bases.find(r.base_hash);
+      if (it == bases.end()) {
+	it = bases.emplace(r.base_hash,
+			   std::make_shared<const vector<uint8>>(
+			       GetBlob(r.base_hash))).first;
+      }
+      s.base = it->second;
+    }
+    if (r.save_hash != 0) s.save = GetBlob(r.save_hash);
+    s.mem = GetBlob(r.mem_hash);
+    s.depth = r.depth;
+    s.prev1 = r.prev1;
+    s.prev2 = r.prev2;
+    s.hash = r.state_hash;
+    return s;
+  };
+
+  In in(snapshot.data(), snapshot.size());
+  const int64 next_node_id = in.R64();
+  const double stuckness = in.RD();
+  const uint32 num_live = in.R32();
+  CHECK(num_live > 0) << "Snapshot has no root";
+
+  Tree *tree = nullptr;
+  std::unordered_map<int64, Node *> nodes;
+  for (uint32 i = 0; i < num_live; i++) {
+    const int64 id = in.R64();
+    const int chosen = (int32)in.R32();
+    const int was_loss = (int32)in.R32();
+    auto rit = records.find(id);
+    CHECK(rit != records.end()) << "Checkpoint is missing node " << id;
+    const NodeRecord &r = rit->second;
+
+    Node *n = nullptr;
+    if (i == 0) {
+      CHECK(r.parent_id == -1) << "First node should be the root";
+      // The score is fixed up below.
+      tree = new Tree(0.0, GetState(r));
+      CHECK(Problem::HasSave(tree->root->state)) << "Root has no state";
+      n = tree->root;
+    } else {
+      auto pit = nodes.find(r.parent_id);
+      CHECK(pit != nodes.end()) << "Parent should precede child";
+      Node *parent = pit->second;
+      n = new Node(GetState(r), parent, r.seqlength);
+      CHECK(parent->children.insert({r.seq, n}).second);
+      tree->num_nodes++;
+      tree->max_depth = std::max(tree->max_depth, n->depth);
+      TranspositionTable<Node>::Entry e;
+      if (!tree->transpositions.Find(n->state.hash, &e) ||
+	  e.seqlength > n->seqlength) {
+	tree->transpositions.Put(n->state.hash, n, n->seqlength);
+      }
+    }
+    n->id = id;
+    n->nes_frames = r.nes_frames;
+    n->walltime_seconds = r.walltime_seconds;
+    n->goalx = r.goalx;
+    n->goaly = r.goaly;
+    n->checked_in_control = r.checked_in_control;
+    n->chosen = chosen;
+    n->was_loss = was_loss;
+    nodes[id] = n;
+  }
+
+  // Scores are relative to observations, which we don't save. But
+  // the tree contains the states worth keeping, so observing them
+  // gives a very similar normalization.
+  for (const auto &p : nodes) problem->ObserveState(p.second->state);
+  problem->Commit();
+
+  vector<Node *> all;
+  vector<const Problem::State *> states;
+  for (const auto &p : nodes) {
+    all.push_back(p.second);
+    states.push_back(&p.second->state);
+  }
+  const vector<double> batch_scores = problem->ScoreBatch(states);
+  std::unordered_map<const Node *, double> scores;
+  for (int i = 0; i < all.size(); i++) {
+    Node *n = all[i];
+    const double score = batch_scores[i];
+    scores[n] = score;
+    if (n == tree->root) {
+      tree->heap.AdjustPriority(n, -score);
+    } else {
+      tree->heap.Insert(-score, n);
+    }
+  }
+
+  const uint32 num_grid = in.R32();
+  for (uint32 i = 0; i < num_grid; i++) {
+    const int cell = in.R32();
+    const int64 id = in.R64();
+    CHECK(cell >= 0 && cell < tree->grid.size());
+    Node *n = nodes[id];
+    CHECK(n != nullptr) << "Grid has dead node " << id;
+    n->used_in_grid++;
+    tree->grid[cell].node = n;
+    tree->grid[cell].score = scores[n];
+  }
+
+  const int64 marathon_id = in.R64();
+  if (marathon_id != -1) {
+    Node *n = nodes[marathon_id];
+    CHECK(n != nullptr) << "Marathon has dead node " << marathon_id;
+    n->used_in_marathon++;
+    tree->marathon.node = n;
+    tree->marathon.score = scores[n];
+  }
+  CHECK(in.Done());
+
+  tree->stuckness = stuckness;
+  tree->next_node_id = next_node_id;
+  return tree;
+}
@@ -0,0 +1,63 @@
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include <string>
+#include <unordered_set>
+
+#include "pftwo.h"
+
+#include "treesearch.h"
+
+// On-disk checkpoints of the search tree, so that a long run can
+// survive a crash or restart.
+//
+// The file is an append-only log of records. Blob records hold a
+// zlib-compressed save state, delta, base, or memory, named by its
+// content hash; each distinct blob is written once per file, so
+// states shared by many nodes (ShareState bases, identical memories)
+// cost nothing extra. Node records describe a node's immutable parts
+// (parent, input sequence, benchmark info, and hashes for its state);
+// each node is written once. A snapshot record lists the nodes alive
+// at that moment (with their mutable counts) plus the grid and
+// marathon cells. Loading uses the last complete snapshot and ignores
+// anything after it, like a record truncated by a crash.
+//
+// Nodes are garbage collected much faster than they're created, so
+// the file is periodically compacted by rewriting only the live
+// nodes to a temporary file and renaming it over the old one.
+//
+// Explore nodes are not saved; they're transient anyway.
+struct Checkpoint {
+  explicit Checkpoint(const string &filename) : filename(filename) {}
+
+  // Append a checkpoint of the search's tree to the file (or rewrite
+  // it, if it's time to compact). Holds the tree mutex (shared) only
+  // while copying out the new nodes; hashing, compression and I/O
+  // happen after. Updates the checkpoint stats in the search. Not
+  // thread-safe, so call it from one thread.
+  void Write(TreeSearch *search);
+
+  // Load the last complete snapshot in the file as a new Tree, or
+  // return nullptr if there isn't one. Observes the memory of every
+  // node and commits, so that scores are normalized like they were
+  // when the checkpoint was written (approximately; the sample of
+  // observations is different). No emulation is performed.
+  static Tree *Load(const string &filename, Problem *problem);
+
+ private:
+  const string filename;
+
+  // Content hashes of blobs in the current file.
+  std::unordered_set<uint64> written_blobs;
+  // Ids of nodes in the current file that were alive as of the
+  // last snapshot.
+  std::unordered_set<int64> written_nodes;
+  // Current size of the file, and its size after the last rewrite.
+  int64 file_bytes = 0LL, full_bytes = 0LL;
+  // If true, the next write starts the file over. Always true at
+  // first, so that we don't append to a file from a previous run,
+  // which may end in a partial record.
+  bool need_full = true;
+};
+
+#endif
@@ -82,10 +82,11 @@ void TreeDumping::DumpTree(TreeSearch *search) {
     ret += StringPrintf(",s:%s", Rtos(score).c_str());
 
     if (node->chosen > 0) {
-      ret += StringPrintf(",e:%d,w:%d", node->chosen, node->was_loss);
+      ret += StringPrintf(",e:%d,w:%d", node->chosen.load(), node->was_loss);
     }
 
-    if (node->chosen > cutoff) {
+    // (Nodes without save states would need to be replayed.)
+    if (node->chosen > cutoff && Problem::HasSave(node->state)) {
       tmp->Restore(node->state);
 
       // UGH HACK. After restoring a state we don't have an image
@@ -2,17 +2,20 @@
 #include "emulator-pool.h"
 
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "../cc-lib/threadutil.h"
+#include "../cc-lib/city/city.h"
 #include "../fceulib/emulator.h"
 #include "../cc-lib/base/logging.h"
 
 using namespace std;
 
 EmulatorPool::EmulatorPool(const string &romfile, int initial_size) :
-  romfile(romfile) {
+  romfile(romfile), rom(LoadedROM::Create(romfile)) {
+  CHECK(rom.get() != nullptr) << "EmulatorPool failed to load: " << romfile;
   CHECK(initial_size >= 0);
   // We don't have the lock yet, but exclusive access in the ctor.
   while (initial_size--) {
@@ -21,11 +24,15 @@ EmulatorPool::EmulatorPool(const string &romfile, int initial_size) :
 }
 
 Emulator *EmulatorPool::CreateNew() const {
-  Emulator *emu = Emulator::Create(romfile);
+  Emulator *emu = Emulator::Create(*rom);
   CHECK(emu != nullptr) << "EmulatorPool failed to create: " << romfile;
   return emu;
 }
 
+uint64 EmulatorPool::StateHash(const vector<uint8> &state) {
+  return CityHash64((const char *)state.data(), state.size());
+}
+
 EmulatorPool::~EmulatorPool() {
   MutexLock ml(&sets_m);
   CHECK(claimed.empty());
@@ -47,10 +54,54 @@ Emulator *EmulatorPool::Acquire() {
   // PERF: Perhaps release lock for expensive call to Create?
   // Or create more than one?
   Emulator *e = NextOrNew();
+  ready_state.erase(e);
   CHECK(claimed.insert(e).second) << "Duplicate " << e;
   return e;
 }
 
+Emulator *EmulatorPool::AcquireWithState(const vector<uint8> &state) {
+  const uint64 h = StateHash(state);
+  Emulator *e = nullptr;
+  bool hit = false;
+  {
+    MutexLock ml(&sets_m);
+    // Prefer an emulator in the state. Otherwise, take one whose
+    // state is unknown, so that known states stick around longer.
+    int found = -1;
+    for (int i = (int)ready.size() - 1; i >= 0; i--) {
+      auto it = ready_state.find(ready[i]);
+      if (it == ready_state.end()) {
+	if (found < 0) found = i;
+      } else if (it->second == h) {
+	found = i;
+	hit = true;
+	break;
+      }
+    }
+    if (found < 0 && !ready.empty()) found = (int)ready.size() - 1;
+
+    if (found >= 0) {
+      e = ready[found];
+      ready[found] = ready.back();
+      ready.pop_back();
+      ready_state.erase(e);
+    } else {
+      // PERF: As in Acquire.
+      e = CreateNew();
+    }
+    CHECK(claimed.insert(e).second) << "Duplicate " << e;
+  }
+
+  if (hit) {
+    hits.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    misses.fetch_add(1, std::memory_order_relaxed);
+    // Outside the lock, since this is the expensive part.
+    e->LoadUncompressed(state);
+  }
+  return e;
+}
+
 void EmulatorPool::Release(Emulator *e) {
   CHECK(e != nullptr);
   
@@ -59,3 +110,15 @@ void EmulatorPool::Release(Emulator *e) {
     << "Tried to return foreign/unclaimed emulator " << e;
   ready.push_back(e);
 }
+
+void EmulatorPool::ReleaseWithState(Emulator *e,
+				    const vector<uint8> &state) {
+  CHECK(e != nullptr);
+  const uint64 h = StateHash(state);
+
+  MutexLock ml(&sets_m);
+  CHECK(1 == claimed.erase(e))
+    << "Tried to return foreign/unclaimed emulator " << e;
+  ready.push_back(e);
+  ready_state[e] = h;
+}
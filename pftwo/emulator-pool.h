@@ -2,20 +2,25 @@
 #ifndef __EMULATOR_POOL_H
 #define __EMULATOR_POOL_H
 
+#include <atomic>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include <memory>
 #include <mutex>
 
+#include "../fceulib/types.h"
+
 class Emulator;
+struct LoadedROM;
 
 // Thread-safe collection of Emulator objects for a given game.
 //
-// TODO PERF: In some workloads, we could often avoid unnecessary
-// calls to "LoadUncompressed" by reusing an emulator that's already
-// in that state. This interface could have "AcquireWithState" which
-// guarantees the emulator to be in that state. We'd need the calls
-// to SaveUncompressed to happen through this interface, etc.
+// Idle emulators can remember which saved state (from
+// SaveUncompressed) they are in, so that AcquireWithState can
+// often avoid calling LoadUncompressed. States are identified by
+// a 64-bit hash.
 struct EmulatorPool {
   EmulatorPool(const std::string &romfile, int initial_size = 3);
 
@@ -27,21 +32,46 @@ struct EmulatorPool {
   // claimed.
   Emulator *Acquire();
 
+  // Acquire an emulator that is in the given state, as though
+  // LoadUncompressed(state) had been called on it. If an idle
+  // emulator was released in this state, it is returned without
+  // loading (a hit). Otherwise the state is loaded (a miss).
+  Emulator *AcquireWithState(const std::vector<uint8> &state);
+
   // Return an emulator to the pool. The emulator must have
-  // previously been returned by Acquire.
+  // previously been returned by Acquire or AcquireWithState.
+  // Its state is considered unknown.
   void Release(Emulator *emu);
 
+  // Same, but the caller promises that the emulator is currently
+  // in exactly this state (e.g. it was just saved, or the emulator
+  // was acquired with this state and not stepped since).
+  void ReleaseWithState(Emulator *emu, const std::vector<uint8> &state);
+
+  // Number of AcquireWithState calls that did and didn't find an
+  // emulator already in the state.
+  int64 Hits() const { return hits.load(std::memory_order_relaxed); }
+  int64 Misses() const { return misses.load(std::memory_order_relaxed); }
+
   // Requires that all emulators have been released.
   ~EmulatorPool();
 
   // TODO: scoped_emulator?
   
  private:
+  static uint64 StateHash(const std::vector<uint8> &state);
+
   const std::string romfile;
+  // Read once; all the pool's emulators share its ROM.
+  std::unique_ptr<LoadedROM> rom;
   Emulator *CreateNew() const;
   std::mutex sets_m;
   std::unordered_set<Emulator *> claimed;
   std::vector<Emulator *> ready;
+  // For emulators in ready whose state is known, the hash of that
+  // state.
+  std::unordered_map<Emulator *, uint64> ready_state;
+  std::atomic<int64> hits{0}, misses{0};
 };
 
 #endif
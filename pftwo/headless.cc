@@ -80,6 +80,12 @@ struct ConsoleThread {
 	  StringPrintf(" [%s]", experiment_file.c_str());
 
 	search->PrintPerfCounters();
+	const string ckpt = search->CheckpointStatus();
+	if (!ckpt.empty()) printf("%s\n", ckpt.c_str());
+	const string tt = search->TranspositionStatus();
+	if (!tt.empty()) printf("%s\n", tt.c_str());
+	const string ev = search->EvictionStatus();
+	if (!ev.empty()) printf("%s\n", ev.c_str());
 	string pct;
 	if (max_nes_frames > 0LL) {
 	  pct = StringPrintf(" (%.1f%%)",
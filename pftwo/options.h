@@ -32,6 +32,26 @@ struct Options {
   bool symmetric_markov = true;
 
   bool use_marathon = false;
+
+  // If positive, tree nodes store their save states as deltas
+  // against the full state of an ancestor, which is stored every
+  // this many levels of depth. Much less memory per node, at the
+  // cost of some CPU on save and restore. 0 stores full states.
+  int delta_state_interval = 0;
+
+  // If true, drop new nodes whose emulator state (by
+  // Emulator::StateHash) is already in the tree via a sequence that's
+  // no longer. Different inputs often reach the same state, e.g.
+  // when the player is standing against a wall or the game is
+  // ignoring input.
+  bool transposition_table = true;
+
+  // If positive, keep the total size of the tree nodes' save states
+  // under about this many megabytes. When over, the least recently
+  // expanded nodes (lowest scoring first) drop their save states,
+  // and are recreated when needed by replaying the inputs from the
+  // nearest ancestor that still has one. 0 means no limit.
+  int state_budget_mb = 0;
   
   // Tune me!
   // Maximum chance of expanding the marathon node when it's eligible.
@@ -7,7 +7,8 @@
 //
 // TODO: Always expand nodes 100 times or whatever?
 //
-// TODO: Serialization of tree state and restarting
+// TODO: Checkpoints (config "checkpoint") don't save the explore
+// queue or the observations; should they?
 //
 // TODO: Be scientific! Build an ground truth dataset (e.g.
 // hand-written objectives that are trustworthy) and an offline
@@ -318,7 +319,7 @@ struct UIThread {
 
       bool queue_mode = false;
       {
-	WriteMutexLock ml(&search->tree_m);
+	MutexLock ml(&search->tree->explore_m);
 	// In queue mode, show the status of each outstanding ExploreNode.
 	if (!search->tree->explore_queue.empty()) {
 	  queue_mode = true;
@@ -363,6 +364,8 @@ struct UIThread {
 	// colors against it.
 	double cutoff_bestscore =
 	  -search->tree->heap.GetMinimum().priority * GRID_BESTSCORE_FRAC;
+	// Workers may be updating grid cells while we draw (see
+	// Tree::GridCell), which is fine for display.
 	double bestscore = 0.0;
 	for (const Tree::GridCell &gc : search->tree->grid)
 	  if (gc.score > bestscore) bestscore = gc.score;
@@ -542,6 +545,7 @@ struct UIThread {
       {
 	ReadMutexLock ml(&search->tree_m);
 	best_score = -search->tree->heap.GetMinimum().priority;
+	MutexLock mlm(&search->tree->marathon_m);
 	if (search->tree->marathon.node != nullptr) {
 	  marathon_score = search->tree->marathon.score;
 	  marathon_seqlength = search->tree->marathon.node->seqlength;
@@ -557,6 +561,20 @@ struct UIThread {
 		search->stats.failed_marathon.Get()));
       }
 
+      {
+	const string ckpt = search->CheckpointStatus();
+	if (!ckpt.empty())
+	  smallfont->draw(256 * 6 + 10, 210, ckpt);
+      }
+      {
+	const string tt = search->TranspositionStatus();
+	if (!tt.empty())
+	  smallfont->draw(256 * 6 + 10, 190, tt);
+	const string ev = search->EvictionStatus();
+	if (!ev.empty())
+	  smallfont->draw(256 * 6 + 10, 180, ev);
+      }
+
       // Average state size:
       // treestats.statebytes / (1024.0 * treestats.nodes)
       smallfont->draw(256 * 6 + 10, 220,
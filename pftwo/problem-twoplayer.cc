@@ -38,13 +38,10 @@ TPP::Input Worker::AnyInput() const {
 TPP::InputGenerator Worker::Generator(ArcFour *rc, const Goal *goal) {
   MutexLock ml(&mutex);
 
-  // PERF: Only need this if we have a goal or decide to sync.
-  // Better would just be to read memory without copying all of it.
-  vector<uint8> mem = emu->GetMemory();
-  const int p1x = mem[tpp->x1_loc];
-  const int p1y = mem[tpp->y1_loc];
-  const int p2x = mem[tpp->x2_loc];
-  const int p2y = mem[tpp->y2_loc];
+  const int p1x = emu->ReadRAM(tpp->x1_loc);
+  const int p1y = emu->ReadRAM(tpp->y1_loc);
+  const int p2x = emu->ReadRAM(tpp->x2_loc);
+  const int p2y = emu->ReadRAM(tpp->y2_loc);
 
   const bool sync = 
     std::abs(p1x - p2x) < 12 &&
@@ -204,8 +201,7 @@ static vector<vector<uint8>> GetSamples(
     int start_idx,
     // Number of samples to get.
     int n) {
-  Emulator *emu = pool->Acquire();
-  emu->LoadUncompressed(start);
+  Emulator *emu = pool->AcquireWithState(start);
   vector<vector<uint8>> samples;
   samples.reserve(n);
 
@@ -633,10 +629,15 @@ TPP::TwoPlayerProblem(const map<string, string> &config,
   
   // Save start state for each worker.
   vector<uint8> save_after_warmup = emu->SaveUncompressed();
+  // The initialization routines below start from this state, so
+  // one of them can get this emulator without loading it.
+  pool.ReleaseWithState(emu, save_after_warmup);
 
   InitTimers(config, &pool, save_after_warmup);
   InitCameras(config, &pool, save_after_warmup);
   InitLives(config, &pool, save_after_warmup);
+
+  emu = pool.AcquireWithState(save_after_warmup);
   
   // See if we have cached learnfun results, since it takes some
   // time to run.
@@ -682,6 +683,8 @@ TPP::TwoPlayerProblem(const map<string, string> &config,
      markov2->HistoryInDomain()};
 
   pool.Release(emu);
+  printf("Initialization emulator pool: %lld hits, %lld misses.\n",
+	 (long long)pool.Hits(), (long long)pool.Misses());
 }
 
 Worker *TPP::CreateWorker() {
@@ -699,7 +702,8 @@ void Worker::Visualize(const Goal *goal, vector<uint8> *argb) {
   // XXX PERF: How is this working if we only call ->Step?
   // Are we wasting a lot of time rendering the screen?
   emu->GetImageARGB(argb);
-  vector<uint8> mem = emu->GetMemory();
+  // No copy needed since we hold the lock.
+  const uint8 *mem = emu->RawMemory();
 
   if (goal != nullptr) {
     const int gx = goal->goalx;
@@ -731,7 +735,7 @@ void Worker::Visualize(const Goal *goal, vector<uint8> *argb) {
   // Note: This visualization is specific to Contra!
   static constexpr int XWIDTH = 10;
   static constexpr int XTHICK = 2;
-  auto DrawDeaths = [argb, &mem](int loc, int xx,
+  auto DrawDeaths = [argb, mem](int loc, int xx,
 				 uint8 rr, uint8 gg, uint8 bb, uint8 aa) {
     auto DrawX = [argb, rr, gg, bb, aa](int x, int y) {
       for (int t = 0; t < XWIDTH; t++) {
@@ -790,14 +794,8 @@ void Worker::VizText(const Goal *goal, vector<string> *text) {
 }
 
 void Worker::Observe() {
-  // PERF: If we hold the lock, we could just read
-  // directly from RAM.
-  vector<uint8> mem;
-  mem.resize(2048);
-  {
-    MutexLock ml(&mutex);
-    emu->GetMemory(&mem);
-  }
-  
-  tpp->observations->Accumulate(mem);
+  // Read directly from RAM, rather than copying it. Accumulating
+  // is quick, so it's fine to hold the lock while we do it.
+  MutexLock ml(&mutex);
+  tpp->observations->Accumulate(emu->RawMemory());
 }
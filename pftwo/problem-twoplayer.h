@@ -56,7 +56,10 @@ struct TwoPlayerProblem {
   // Save state for a worker; the worker can save and restore these
   // at will, and they are portable betwen workers.
   struct State {
-    // Emulator savestate.
+    // Emulator savestate. If base is non-null, this is instead a
+    // delta (Emulator::SaveDelta) against the uncompressed state
+    // *base, or empty if the state is exactly *base. See
+    // ShareState.
     vector<uint8> save;
     // PERF This is actually part of save. But we use it to
     // compute objective functions without having to restore
@@ -76,10 +79,48 @@ struct TwoPlayerProblem {
     // Number of NES frames
     int depth;
     ControllerHistory prev1, prev2;
+    // Shared by a state and the states that are deltas against it.
+    std::shared_ptr<const vector<uint8>> base;
+    // Emulator::StateHash, for finding transpositions.
+    uint64 hash = 0ULL;
   };
 
+  // Counts a shared base only for the state that owns it.
   static int64 StateBytes(const State &s) {
-    return s.save.size() + s.mem.size() + sizeof (State);
+    return SaveBytes(s) + s.mem.size() + sizeof (State);
+  }
+  // Just the emulator savestate, which is most of it.
+  static int64 SaveBytes(const State &s) {
+    return s.save.size() +
+      ((s.base.get() != nullptr && s.save.empty()) ? s.base->size() : 0);
+  }
+
+  // A state can have its emulator savestate dropped to save memory.
+  // Everything else (memory, hash, etc.) is kept, so it can still be
+  // scored, but it can't be restored; it has to be recreated by
+  // replaying inputs from some earlier state.
+  static bool HasSave(const State &s) {
+    return !s.save.empty() || s.base.get() != nullptr;
+  }
+  static void DropSave(State *s) {
+    vector<uint8>().swap(s->save);
+    s->base.reset();
+  }
+
+  // Convert a full state (from Worker::Save) to a more compact
+  // representation that shares storage with its ancestors. If parent
+  // is null or is not itself shared, or keyframe is true, the state
+  // becomes a new base for its descendants. Otherwise it is stored as
+  // a delta against the parent's base. Restore handles either.
+  static void ShareState(const State *parent, bool keyframe, State *s) {
+    CHECK(s->base.get() == nullptr) << "Already shared";
+    if (keyframe || parent == nullptr || parent->base.get() == nullptr) {
+      s->base = std::make_shared<const vector<uint8>>(std::move(s->save));
+      s->save.clear();
+    } else {
+      s->base = parent->base;
+      s->save = Emulator::DeltaEncode(*s->base, s->save);
+    }
   }
 
   // Object that can generate (pseudo)random inputs.
@@ -156,12 +197,18 @@ struct TwoPlayerProblem {
     State Save() {
       MutexLock ml(&mutex);
       return State{ emu->SaveUncompressed(), emu->GetMemory(), depth,
-	            previous1, previous2 };
+	            previous1, previous2, nullptr, emu->StateHash() };
     }
 
     void Restore(const State &state) {
       MutexLock ml(&mutex);
-      emu->LoadUncompressed(state.save);
+      if (state.base.get() == nullptr) {
+	emu->LoadUncompressed(state.save);
+      } else if (state.save.empty()) {
+	emu->LoadUncompressed(*state.base);
+      } else {
+	emu->LoadDelta(*state.base, state.save);
+      }
 
       depth = state.depth;
       // (Doesn't actually need the memory to restore; it's part of
@@ -260,6 +307,13 @@ struct TwoPlayerProblem {
     observations->Commit();
   }
 
+  // Adds the state's memory to the observations, as though a worker
+  // had observed it. Used when restoring a checkpoint.
+  void ObserveState(const State &state) {
+    CHECK(observations.get());
+    observations->Accumulate(state.mem);
+  }
+
   // Penalty for traveling between a pair of states. [0, 1] where 0 is
   // bad (high penalty) and 1 is neutral. This is intended to measure
   // something like lives lost when going from old_state to new, so that
@@ -326,6 +380,19 @@ struct TwoPlayerProblem {
     return penalty * objective_score;
   }
 
+  // Score for each of the states, the same as calling Score on each.
+  // Much faster when there are many.
+  vector<double> ScoreBatch(const vector<const State *> &states) const {
+    vector<const uint8 *> mems;
+    mems.reserve(states.size());
+    for (const State *s : states) mems.push_back(s->mem.data());
+    vector<double> scores =
+      observations->GetWeightedValueBatch(MemoryBatch(*objectives, mems));
+    for (int i = 0; i < states.size(); i++)
+      scores[i] *= EdgePenalty(start_state, *states[i]);
+    return scores;
+  }
+
   // Number of times to subdivide the screen in both x and y
   // coordinates. 1 would yield four quadrants. Exponential!
   static constexpr int GRID_DIVISIONS = 3;
@@ -390,6 +457,9 @@ struct TwoPlayerProblem {
   explicit TwoPlayerProblem(const map<string, string> &config,
 			    const Options &opt);
 
+  // The ROM filename, from the config.
+  const string &Game() const { return game; }
+
  private:
   void InitTimers(const map<string, string> &config,
 		  EmulatorPool *pool,
@@ -0,0 +1,86 @@
+// Transposition table for the search tree: remembers a node for each
+// emulator state (by Emulator::StateHash), so that when a different
+// input sequence reaches a state we already have, we can drop the
+// new node instead of searching from the same place twice.
+//
+// The table only holds pointers; it doesn't keep nodes alive or
+// dereference them. The caller removes a node before deleting it.
+// Since different nodes are usually compared by the length of the
+// sequence that reaches them, that's stored alongside, so that
+// workers can consult the table without the tree lock.
+
+#ifndef __TRANSPOSITION_TABLE_H
+#define __TRANSPOSITION_TABLE_H
+
+#include <mutex>
+#include <unordered_map>
+
+#include "pftwo.h"
+
+template<class Node>
+struct TranspositionTable {
+  struct Entry {
+    Node *node = nullptr;
+    int64 seqlength = 0LL;
+  };
+
+  // Returns true and sets *e if there's a node with this hash.
+  bool Find(uint64 hash, Entry *e) {
+    Shard *s = GetShard(hash);
+    std::lock_guard<std::mutex> ml(s->m);
+    auto it = s->entries.find(hash);
+    if (it == s->entries.end()) return false;
+    *e = it->second;
+    return true;
+  }
+
+  // True if there's a node with this hash that's reached with a
+  // sequence no longer than seqlength, i.e., a new node with that
+  // hash and length would be redundant.
+  bool Dominated(uint64 hash, int64 seqlength) {
+    Entry e;
+    return Find(hash, &e) && e.seqlength <= seqlength;
+  }
+
+  // Insert, or replace the existing entry for the hash.
+  void Put(uint64 hash, Node *node, int64 seqlength) {
+    Shard *s = GetShard(hash);
+    std::lock_guard<std::mutex> ml(s->m);
+    Entry &e = s->entries[hash];
+    e.node = node;
+    e.seqlength = seqlength;
+  }
+
+  // Remove the entry for the hash, but only if it's for this node
+  // (the node may have been replaced by a better one).
+  void Erase(uint64 hash, Node *node) {
+    Shard *s = GetShard(hash);
+    std::lock_guard<std::mutex> ml(s->m);
+    auto it = s->entries.find(hash);
+    if (it != s->entries.end() && it->second.node == node)
+      s->entries.erase(it);
+  }
+
+  // Approximate if other threads are modifying the table.
+  int64 Size() {
+    int64 size = 0LL;
+    for (Shard &s : shards) {
+      std::lock_guard<std::mutex> ml(s.m);
+      size += s.entries.size();
+    }
+    return size;
+  }
+
+ private:
+  static constexpr int SHARDS = 64;
+  struct Shard {
+    std::mutex m;
+    std::unordered_map<uint64, Entry> entries;
+  };
+  // The hashes are already well mixed, so any bits will do. (The
+  // map uses the low bits too, but that's fine.)
+  Shard *GetShard(uint64 hash) { return &shards[(hash >> 58) % SHARDS]; }
+  Shard shards[SHARDS];
+};
+
+#endif
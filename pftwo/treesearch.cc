@@ -26,6 +26,7 @@
 #include "../cc-lib/heap.h"
 #include "../cc-lib/randutil.h"
 #include "../cc-lib/list-util.h"
+#include "../cc-lib/timer.h"
 
 #include "atom7ic.h"
 
@@ -33,6 +34,7 @@
 #include "weighted-objectives.h"
 #include "treesearch.h"
 #include "problem-twoplayer.h"
+#include "checkpoint.h"
 
 // Base "max" nodes in heap. We start cleaning the heap when there are
 // more than this number of nodes, although we often have to keep more
@@ -67,10 +69,16 @@ enum PerfEvent {
   PE_L_COMMIT_QUEUE,
   PE_L_GET_NODES_TO_EXTEND,
   PE_L_GET_EXPLORE_NODE_E,
+  PE_L_FIND_GOOD_NODE_M,
+  PE_L_GRID,
+  PE_L_MARATHON_ADD,
   PE_L_UPDATE_TREE_A,
+  PE_L_UPDATE_TREE_AE,
   PE_L_UPDATE_TREE_B,
   PE_L_UPDATE_TREE_C,
+  PE_L_UPDATE_TREE_CE,
   PE_L_UPDATE_TREE_D,
+  PE_L_UPDATE_TREE_EVICT,
   PE_L_PROCESS_EXPLORE_QUEUE_A,
   PE_L_PROCESS_EXPLORE_QUEUE_ES,
   PE_L_PROCESS_EXPLORE_QUEUE_B,
@@ -79,17 +87,21 @@ enum PerfEvent {
   PE_L_PROCESS_EXPLORE_QUEUE_D,
   PE_L_PROCESS_EXPLORE_QUEUE_EZ,
   PE_L_PROCESS_EXPLORE_QUEUE_ED,
-  PE_L_PROCESS_EXPLORE_QUEUE_R,
   PE_L_MARATHON_START,
+  PE_L_MARATHON_START_M,
   PE_L_MARATHON_FAILED,
+  PE_L_MARATHON_FAILED_M,
   PE_L_SHOULD_DIE_EQ,
   PE_L_SHOULD_DIE_N,
+  PE_L_RESTORE_NODE,
+  PE_L_RESTORE_NODE_PUT,
   // Work
   PE_EXEC,
   PE_OBSERVE,
   PE_COMMIT,
   PE_IN_CONTROL,
   PE_ELIGIBLE,
+  PE_REPLAY,
   // Meta
   NUM_PERFEVENTS,
 };
@@ -100,10 +112,16 @@ static const char *PerfEventString(PerfEvent pe) {
     CASE(L_COMMIT_QUEUE);
     CASE(L_GET_NODES_TO_EXTEND);
     CASE(L_GET_EXPLORE_NODE_E);
+    CASE(L_FIND_GOOD_NODE_M);
+    CASE(L_GRID);
+    CASE(L_MARATHON_ADD);
     CASE(L_UPDATE_TREE_A);
+    CASE(L_UPDATE_TREE_AE);
     CASE(L_UPDATE_TREE_B);
     CASE(L_UPDATE_TREE_C);
+    CASE(L_UPDATE_TREE_CE);
     CASE(L_UPDATE_TREE_D);
+    CASE(L_UPDATE_TREE_EVICT);
     CASE(L_PROCESS_EXPLORE_QUEUE_A);
     CASE(L_PROCESS_EXPLORE_QUEUE_ES);
     CASE(L_PROCESS_EXPLORE_QUEUE_B);
@@ -112,21 +130,99 @@ static const char *PerfEventString(PerfEvent pe) {
     CASE(L_PROCESS_EXPLORE_QUEUE_D);
     CASE(L_PROCESS_EXPLORE_QUEUE_EZ);
     CASE(L_PROCESS_EXPLORE_QUEUE_ED);
-    CASE(L_PROCESS_EXPLORE_QUEUE_R);
     CASE(L_MARATHON_START);
+    CASE(L_MARATHON_START_M);
     CASE(L_MARATHON_FAILED);
+    CASE(L_MARATHON_FAILED_M);
     CASE(L_SHOULD_DIE_EQ);
     CASE(L_SHOULD_DIE_N);
+    CASE(L_RESTORE_NODE);
+    CASE(L_RESTORE_NODE_PUT);
     CASE(EXEC);
     CASE(OBSERVE);
     CASE(COMMIT);
     CASE(IN_CONTROL);
     CASE(ELIGIBLE);
+    CASE(REPLAY);
   default: return "?";
   }
 #undef CASE
 }
 
+// The locks themselves, for reporting contention per data
+// structure rather than per call site.
+enum LockStructure {
+  LS_TREE_SHARED,
+  LS_TREE_EXCLUSIVE,
+  LS_UPDATE,
+  LS_EXPLORE_QUEUE,
+  LS_EXPLORE_NODE,
+  LS_MARATHON,
+  LS_GRID,
+  LS_SHOULD_DIE,
+  NUM_LOCKSTRUCTURES,
+  // Not a lock.
+  LS_NONE,
+};
+
+static const char *LockStructureString(LockStructure ls) {
+  switch (ls) {
+  case LS_TREE_SHARED: return "tree (shared)";
+  case LS_TREE_EXCLUSIVE: return "tree (exclusive)";
+  case LS_UPDATE: return "update";
+  case LS_EXPLORE_QUEUE: return "explore queue";
+  case LS_EXPLORE_NODE: return "explore node";
+  case LS_MARATHON: return "marathon";
+  case LS_GRID: return "grid shards";
+  case LS_SHOULD_DIE: return "should die";
+  default: return "?";
+  }
+}
+
+static LockStructure PerfEventLock(PerfEvent pe) {
+  switch (pe) {
+  case PE_L_GET_NODES_TO_EXTEND:
+  case PE_L_PROCESS_EXPLORE_QUEUE_B:
+  case PE_L_MARATHON_START:
+  case PE_L_MARATHON_FAILED:
+  case PE_L_RESTORE_NODE:
+    return LS_TREE_SHARED;
+  case PE_L_COMMIT_QUEUE:
+  case PE_L_UPDATE_TREE_B:
+  case PE_L_UPDATE_TREE_C:
+  case PE_L_UPDATE_TREE_EVICT:
+  case PE_L_RESTORE_NODE_PUT:
+    return LS_TREE_EXCLUSIVE;
+  case PE_L_UPDATE_TREE_A:
+  case PE_L_UPDATE_TREE_D:
+    return LS_UPDATE;
+  case PE_L_UPDATE_TREE_AE:
+  case PE_L_UPDATE_TREE_CE:
+  case PE_L_PROCESS_EXPLORE_QUEUE_A:
+  case PE_L_PROCESS_EXPLORE_QUEUE_D:
+    return LS_EXPLORE_QUEUE;
+  case PE_L_GET_EXPLORE_NODE_E:
+  case PE_L_PROCESS_EXPLORE_QUEUE_ES:
+  case PE_L_PROCESS_EXPLORE_QUEUE_EB:
+  case PE_L_PROCESS_EXPLORE_QUEUE_EZ:
+  case PE_L_PROCESS_EXPLORE_QUEUE_ED:
+    return LS_EXPLORE_NODE;
+  case PE_L_FIND_GOOD_NODE_M:
+  case PE_L_MARATHON_ADD:
+  case PE_L_PROCESS_EXPLORE_QUEUE_C:
+  case PE_L_MARATHON_START_M:
+  case PE_L_MARATHON_FAILED_M:
+    return LS_MARATHON;
+  case PE_L_GRID:
+    return LS_GRID;
+  case PE_L_SHOULD_DIE_EQ:
+  case PE_L_SHOULD_DIE_N:
+    return LS_SHOULD_DIE;
+  default:
+    return LS_NONE;
+  }
+}
+
 static inline uint64 PerfCounterNow() {
   uint64 ret;
   QueryPerformanceCounter((LARGE_INTEGER*)&ret);
@@ -148,17 +244,27 @@ struct InternalPerfCounterScoped {
 }
 
 static_assert(sizeof (uint64) == sizeof (LARGE_INTEGER), "win64");
-#define PERF_MUTEX_LOCK_INTERNAL(pe, mut, C)			\
+// Tries the lock first so that we can count how often it was
+// contended, not just the time spent waiting.
+#define PERF_MUTEX_LOCK_INTERNAL(pe, mut, L)			\
   const uint64 perf_ml_start = PerfCounterNow();		\
-  C perf_ml(mut);						\
+  L perf_ml(*(mut), std::try_to_lock);				\
+  lock_acquired[pe]++;						\
+  if (!perf_ml.owns_lock()) {					\
+    lock_contended[pe]++;					\
+    perf_ml.lock();						\
+  }								\
   const uint64 perf_ml_end = PerfCounterNow();			\
   perf_counters[pe] += (perf_ml_end - perf_ml_start)
 
 #define PERF_READ_MUTEX_LOCK(pe, mut)				\
-  PERF_MUTEX_LOCK_INTERNAL(pe, mut, ReadMutexLock)
+  PERF_MUTEX_LOCK_INTERNAL(pe, mut, std::shared_lock<std::shared_mutex>)
 
 #define PERF_WRITE_MUTEX_LOCK(pe, mut)				\
-  PERF_MUTEX_LOCK_INTERNAL(pe, mut, WriteMutexLock)
+  PERF_MUTEX_LOCK_INTERNAL(pe, mut, std::unique_lock<std::shared_mutex>)
+
+#define PERF_MUTEX_LOCK(pe, mut)				\
+  PERF_MUTEX_LOCK_INTERNAL(pe, mut, std::unique_lock<std::mutex>)
 
 // This deliberately does not generate a distinct name to prevent
 // unintentially instantiating it multiple times in the same scope.
@@ -169,6 +275,9 @@ static_assert(sizeof (uint64) == sizeof (LARGE_INTEGER), "win64");
 struct WorkThread {
   uint64 perf_counter_start = 0LL;
   uint64 perf_counters[NUM_PERFEVENTS] = {};
+  // Only used for lock events.
+  uint64 lock_acquired[NUM_PERFEVENTS] = {};
+  uint64 lock_contended[NUM_PERFEVENTS] = {};
   
   using Node = Tree::Node;
   WorkThread(TreeSearch *search, int id) :
@@ -188,13 +297,14 @@ struct WorkThread {
   // Get the root node of the tree and associated state (which must be
   // present). Used during initialization.
   Node *GetRoot() {
-    WriteMutexLock ml(&search->tree_m);
+    ReadMutexLock ml(&search->tree_m);
     Node *n = search->tree->root;
     n->num_workers_using++;
     return n;
   }
 
-  // Populates the vector with eligible grid indices.
+  // Populates the vector with eligible grid indices. Must hold the
+  // tree mutex (shared is enough).
   void EligibleGridNodesWithMutex(vector<int> *eligible) {
     PERF_SCOPED(PE_ELIGIBLE);
     // XXX This stuff is a hack. Improve it!
@@ -208,10 +318,15 @@ struct WorkThread {
     // from (nominally) 0 to 1.
     constexpr double ival_norm = 1.0 / (1.0 - GRID_BESTSCORE_FRAC);
 
-    for (int idx = 0; idx < search->tree->grid.size(); idx++) {
-      const Tree::GridCell &gc = search->tree->grid[idx];
-      if (gc.node != nullptr && gc.score >= gminscore) {
-	const double p = (gc.score - gminscore) * ival_norm;
+    // No need for the shard locks just to read; see Tree::GridCell.
+    const vector<Tree::GridCell> &grid = search->tree->grid;
+    for (int idx = 0; idx < grid.size(); idx++) {
+      const Tree::GridCell &gc = grid[idx];
+      if (gc.node.load(std::memory_order_relaxed) == nullptr)
+	continue;
+      const double score = gc.score.load(std::memory_order_relaxed);
+      if (score >= gminscore) {
+	const double p = (score - gminscore) * ival_norm;
 	if (RandDouble(&rc) < p) {
 	  eligible->push_back(idx);
 	}
@@ -219,7 +334,7 @@ struct WorkThread {
     }
   }
   
-  // Must hold tree mutex!
+  // Must hold tree mutex (shared is enough)!
   // Doesn't update any reference counts.
   Node *FindGoodNodeWithMutex() {
     const int size = search->tree->heap.Size();
@@ -244,7 +359,9 @@ struct WorkThread {
 	// Fraction of the grid that was eligible
 	(eligible_grid.size() / (double)Problem::num_grid_cells)) {
       const int idx = eligible_grid[RandTo(&rc, eligible_grid.size())];
-      ret = tree->grid[idx].node;
+      // Cells are only cleared with the tree lock held exclusively,
+      // so this is still non-null.
+      ret = tree->grid[idx].node.load();
     }
 
     // Consider expanding the marathon node if we have one and we are
@@ -255,11 +372,13 @@ struct WorkThread {
     // the level (which often involves losing control).
     if (ret == nullptr &&
 	opt.use_marathon &&
-	tree->stuckness > 0.75 && tree->marathon.node != nullptr) {
+	tree->stuckness > 0.75) {
       const double bestscore = -tree->heap.GetMinimum().priority;
       const double mminscore = MARATHON_BESTSCORE_FRAC * bestscore;
 
-      if (tree->marathon.score >= mminscore &&
+      PERF_MUTEX_LOCK(PE_L_FIND_GOOD_NODE_M, &tree->marathon_m);
+      if (tree->marathon.node != nullptr &&
+	  tree->marathon.score >= mminscore &&
 	  RandDouble(&rc) <
 	  // Reach p_expand_marathon probability when stuckness is 1.0.
 	  opt.p_expand_marathon * ((tree->stuckness - 0.75) * 4.0)) {
@@ -304,13 +423,16 @@ struct WorkThread {
   // has its workers_using counter incremented on behalf of the
   // caller (who must eventually decrement it).
   vector<Node *> GetNodesToExtend() {
-    PERF_WRITE_MUTEX_LOCK(PE_L_GET_NODES_TO_EXTEND, &search->tree_m);
+    // Only reads the tree; the counters are atomic.
+    PERF_READ_MUTEX_LOCK(PE_L_GET_NODES_TO_EXTEND, &search->tree_m);
     vector<Node *> ret;
     ret.reserve(opt.node_batch_size);
     for (int i = 0; i < opt.node_batch_size; i++) {
       Node *n = FindGoodNodeWithMutex();
       n->num_workers_using++;
       n->chosen++;
+      n->last_used.store(search->tree->epoch.load(std::memory_order_relaxed),
+			 std::memory_order_relaxed);
       ret.push_back(n);
     }
     return ret;
@@ -319,6 +441,11 @@ struct WorkThread {
   // Construct a new node. 
   Node *NewNode(Problem::State newstate, Node *parent, int seq_length) {
     CHECK(parent != nullptr);
+    if (opt.delta_state_interval > 0) {
+      const bool keyframe =
+	(parent->depth + 1) % opt.delta_state_interval == 0;
+      Problem::ShareState(&parent->state, keyframe, &newstate);
+    }
     // XXX constructor actually reads parent depth without lock?
     Node *child = new Node(std::move(newstate), parent,
 			   parent->seqlength + seq_length);
@@ -326,39 +453,172 @@ struct WorkThread {
 	std::memory_order_relaxed);
     child->walltime_seconds = search->approx_sec.load(
     	std::memory_order_relaxed);
+    child->id = search->tree->next_node_id++;
+    child->last_used = search->tree->epoch.load(std::memory_order_relaxed);
     return child;
   }
+
+  // The inputs that get from n's parent to n. Must hold the tree
+  // lock, and n must be in the tree.
+  static const Tree::Seq &EdgeSeq(const Node *n) {
+    CHECK(n->parent != nullptr);
+    for (const auto &p : n->parent->children)
+      if (p.second == n) return p.first;
+    CHECK(false) << "Node " << n->id << " isn't its parent's child?";
+    abort();
+  }
+
+  // Put the worker in the node's state. The caller must have a
+  // reference to the node. If its save state was evicted, this
+  // replays the inputs from the nearest ancestor that has one, and
+  // puts the result back in the node, since it's likely about to be
+  // restored again.
+  void RestoreNode(Node *n) {
+    Tree::Seq replay;
+    {
+      PERF_READ_MUTEX_LOCK(PE_L_RESTORE_NODE, &search->tree_m);
+      if (Problem::HasSave(n->state)) {
+	worker->Restore(n->state);
+	return;
+      }
+      // Ancestors of a referenced node are kept, and the root always
+      // has its state.
+      vector<const Tree::Seq *> path;
+      const Node *a = n;
+      for (; !Problem::HasSave(a->state); a = a->parent)
+	path.push_back(&EdgeSeq(a));
+      worker->Restore(a->state);
+      for (int i = path.size() - 1; i >= 0; i--)
+	replay.insert(replay.end(), path[i]->begin(), path[i]->end());
+    }
+
+    {
+      PERF_SCOPED(PE_REPLAY);
+      for (const Problem::Input &input : replay)
+	worker->Exec(input);
+    }
+    search->stats.replay_frames += replay.size();
+
+    Problem::State s = worker->Save();
+    CHECK_EQ(s.hash, n->state.hash) << "Replaying node " << n->id <<
+      " from its ancestor didn't reproduce its state.";
+    {
+      PERF_WRITE_MUTEX_LOCK(PE_L_RESTORE_NODE_PUT, &search->tree_m);
+      // Another worker may have beaten us to it.
+      if (!Problem::HasSave(n->state)) {
+	n->state.save = std::move(s.save);
+	search->stats.rematerializations.Increment();
+      }
+    }
+  }
+
+  // Must hold the tree lock exclusively. If the nodes' save states
+  // total more than the budget, drop them from the coldest nodes
+  // (least recently chosen, then lowest scoring) until they don't.
+  // Nodes with references are about to be used, so they're skipped,
+  // as is the root, where replaying ultimately starts.
+  void EvictStatesWithMutex() {
+    Tree *tree = search->tree;
+    const int64 budget = (int64)opt.state_budget_mb * 1024LL * 1024LL;
+
+    struct Candidate {
+      Node *node;
+      int64 last_used;
+      double score;
+    };
+    vector<Candidate> candidates;
+    // Delta states share their base; count each one once.
+    std::unordered_set<const vector<uint8> *> bases;
+    int64 total = 0LL;
+    std::function<void(Node *)> Rec = [&](Node *n) {
+      if (Problem::HasSave(n->state)) {
+	total += n->state.save.size();
+	if (n->state.base.get() != nullptr &&
+	    bases.insert(n->state.base.get()).second)
+	  total += n->state.base->size();
+	if (n != tree->root && n->num_workers_using == 0) {
+	  candidates.push_back(
+	      Candidate{n, n->last_used.load(std::memory_order_relaxed),
+			n->location != -1 ?
+			-tree->heap.GetCell(n).priority : 0.0});
+	}
+      }
+      for (auto &p : n->children) Rec(p.second);
+    };
+    Rec(tree->root);
+
+    if (total > budget) {
+      std::sort(candidates.begin(), candidates.end(),
+		[](const Candidate &a, const Candidate &b) {
+		  if (a.last_used != b.last_used)
+		    return a.last_used < b.last_used;
+		  return a.score < b.score;
+		});
+      int evicted = 0;
+      for (const Candidate &c : candidates) {
+	if (total <= budget) break;
+	Problem::State *st = &c.node->state;
+	int64 freed = st->save.size();
+	// The base is only freed with its last user. (Other copies
+	// of the state, like in explore nodes, may keep it alive
+	// anyway.)
+	if (st->base.get() != nullptr && st->base.use_count() == 1)
+	  freed += st->base->size();
+	Problem::DropSave(st);
+	total -= freed;
+	evicted++;
+      }
+      search->stats.evictions.IncrementBy(evicted);
+      printf(" ... Evicted %d save states; %.2f MB left.\n",
+	     evicted, total / (1024.0 * 1024.0));
+    }
+    search->stats.state_bytes.store(total);
+  }
   
-  // Add to the grid if it qualifies. Called from within
-  // ExtendNodeWithLock once we're sure the node is new.
-  void AddToGridWithLock(Node *newnode, double newscore) {
+  // Add to the grid if it qualifies. Called once we're sure the node
+  // is new. Must hold the tree mutex (shared is enough); takes the
+  // grid shard locks.
+  void AddToGrid(Node *newnode, double newscore) {
+    Tree *tree = search->tree;
     search->problem->ApplyToGridCells(
 	newnode->state,
 	[&](int cell) {
-      CHECK(cell >= 0 && cell < search->tree->grid.size()) <<
-	cell << " vs " << search->tree->grid.size();
-      Tree::GridCell *gc = &search->tree->grid[cell];
-      if (gc->node == nullptr || newscore > gc->score) {
-	if (gc->node)
-	  gc->node->used_in_grid--;
+      CHECK(cell >= 0 && cell < tree->grid.size()) <<
+	cell << " vs " << tree->grid.size();
+      Tree::GridCell *gc = &tree->grid[cell];
+      // Most cells reject the node, so check without the lock first.
+      // With the tree lock shared, a cell's score can only go up, so
+      // a rejection here is final.
+      if (gc->node.load(std::memory_order_relaxed) != nullptr &&
+	  newscore <= gc->score.load(std::memory_order_relaxed))
+	return;
+
+      PERF_MUTEX_LOCK(PE_L_GRID, tree->GridMutex(cell));
+      Node *old = gc->node.load();
+      if (old == nullptr || newscore > gc->score.load()) {
+	if (old != nullptr)
+	  old->used_in_grid--;
 	newnode->used_in_grid++;
-	gc->score = newscore;
-	gc->node = newnode;
+	gc->score.store(newscore);
+	gc->node.store(newnode);
       }
 	});
   }
 
   // Set this to the marathon node if it's a new best. Caller
-  // must ensure that IsInControl for this node.
-  void AddToMarathonWithLock(Node *newnode, double newscore) {
+  // must ensure that IsInControl for this node, and hold the
+  // tree mutex (shared is enough). bestscore is the best score
+  // in the heap.
+  void AddToMarathon(Node *newnode, double newscore, double bestscore) {
     if (!opt.use_marathon)
       return;
     
     Tree *tree = search->tree;
     // We try to maximize depth (steps) but not 
-    const double bestscore = -tree->heap.GetMinimum().priority;
     const double mminscore = MARATHON_BESTSCORE_FRAC * bestscore;
 
+    PERF_MUTEX_LOCK(PE_L_MARATHON_ADD, &tree->marathon_m);
+
     if (tree->marathon.node == nullptr ||
 	(newscore >= mminscore &&
 	 newnode->seqlength > tree->marathon.node->seqlength)) {
@@ -399,10 +659,28 @@ struct WorkThread {
       return;
 
     std::unordered_set<Node *> blacklist;
+    // New nodes that are candidates for the grid and marathon
+    // cell, with their scores.
+    vector<pair<Node *, double>> cell_candidates;
+
+    // XXX This should probably be done in the caller, because
+    // if NUM_NEXTS isn't 1, we have more fine-grained evidence
+    // that we could collect. (Right now it's like, "the probability
+    // that randomly expanding the node NUM_NEXTS times and picking
+    // the best one will actually make things worse") which is maybe
+    // harder to think about, and certainly converges more slowly.
+    //
+    // Scoring doesn't need the tree, so do it before taking the lock.
+    // (All the sources have a reference.)
+    vector<bool> was_loss;
+    was_loss.reserve(local_queue.size());
+    for (const QueuedUpdate &q : local_queue)
+      was_loss.push_back(search->problem->Score(q.src->state) > q.newscore);
         
     {
       PERF_WRITE_MUTEX_LOCK(PE_L_COMMIT_QUEUE, &search->tree_m);
-      for (QueuedUpdate &q : local_queue) {
+      for (int i = 0; i < local_queue.size(); i++) {
+	QueuedUpdate &q = local_queue[i];
 
 	if (ContainsKey(blacklist, q.src)) {
 	  // We had to delete the parent node because of a collision,
@@ -412,17 +690,31 @@ struct WorkThread {
 	  continue;
 	}
 
-	// XXX This should probably be done in the caller, because
-	// if NUM_NEXTS isn't 1, we have more fine-grained evidence
-	// that we could collect. (Right now it's like, "the probability
-	// that randomly expanding the node NUM_NEXTS times and picking
-	// the best one will actually make things worse") which is maybe
-	// harder to think about, and certainly converges more slowly.
-	const double oldscore = search->problem->Score(q.src->state);
-	if (oldscore > q.newscore) {
+	if (was_loss[i]) {
 	  q.src->was_loss++;
 	}
 
+	if (opt.transposition_table) {
+	  search->stats.transposition_checks.Increment();
+	  TranspositionTable<Node>::Entry e;
+	  const uint64 hash = q.dst->state.hash;
+	  if (search->tree->transpositions.Find(hash, &e)) {
+	    if (e.seqlength <= q.dst->seqlength) {
+	      // Already have this state, at least as cheaply. As with
+	      // collisions below, anything expanded from it goes too.
+	      search->stats.transpositions.Increment();
+	      CHECK(q.src->num_workers_using > 0);
+	      q.src->num_workers_using--;
+	      blacklist.insert(q.dst);
+	      delete q.dst;
+	      continue;
+	    }
+	    // Otherwise keep both, but prefer the new one from now on.
+	    // (The old one may have descendants, grid cells, etc.)
+	    search->stats.transpositions_replaced.Increment();
+	  }
+	}
+
 	auto res = q.src->children.insert({std::move(q.seq), q.dst});
 
 	CHECK(q.src->num_workers_using > 0);
@@ -441,17 +733,27 @@ struct WorkThread {
 	  delete q.dst;
 
 	} else {
+	  if (opt.transposition_table) {
+	    search->tree->transpositions.Put(q.dst->state.hash, q.dst,
+					     q.dst->seqlength);
+	  }
 	  search->tree->num_nodes++;
 	  search->tree->heap.Insert(-q.newscore, q.dst);
 	  CHECK(q.dst->location != -1);
 
 	  if (q.checked_in_control) // XXX experimental
-	    AddToGridWithLock(q.dst, q.newscore);
-
-	  if (q.checked_in_control)
-	    AddToMarathonWithLock(q.dst, q.newscore);
+	    cell_candidates.emplace_back(q.dst, q.newscore);
 	}
       }
+
+      // Still in the same critical section, so that a rescore in
+      // MaybeUpdateTree can't clear the grid or change the heap
+      // between computing these scores and using them.
+      const double bestscore = -search->tree->heap.GetMinimum().priority;
+      for (const auto &[node, score] : cell_candidates) {
+	AddToGrid(node, score);
+	AddToMarathon(node, score, bestscore);
+      }
     }
     local_queue.clear();
   }
@@ -480,6 +782,8 @@ struct WorkThread {
       // I won the race!
       printf("Initialize tree...\n");
       Problem::State s = worker->Save();
+      if (opt.delta_state_interval > 0)
+	Problem::ShareState(nullptr, true, &s);
       search->tree = new Tree(search->problem->Score(s), s);
     }
   }
@@ -487,7 +791,7 @@ struct WorkThread {
   void MaybeUpdateTree() {
     Tree *tree = search->tree;
     {
-      PERF_WRITE_MUTEX_LOCK(PE_L_UPDATE_TREE_A, &search->tree_m);
+      PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_A, &tree->update_m);
 
       // No use in decrementing update counter -- when we
       // finish we reset it to the max value.
@@ -496,8 +800,11 @@ struct WorkThread {
 
       // Also, we're not allowed to make steps until
       // the explore queue is empty.
-      if (!tree->explore_queue.empty())
-	return;
+      {
+	PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_AE, &tree->explore_m);
+	if (!tree->explore_queue.empty())
+	  return;
+      }
       
       if (tree->steps_until_update == 0) {
 	tree->steps_until_update = opt.UpdateFrequency();
@@ -529,12 +836,14 @@ struct WorkThread {
 	printf("Clear grid ...");
 	// First, just clear the grid since every node has a chance to
 	// become the best in a cell below, including the ones that are
-	// already there.
+	// already there. With the tree lock held exclusively, nobody
+	// else can be writing the grid.
 	for (Tree::GridCell &gc : search->tree->grid) {
-	  if (gc.node != nullptr) {
-	    gc.node->used_in_grid--;
-	    gc.score = 0.0;
-	    gc.node = nullptr;
+	  Node *node = gc.node.load(std::memory_order_relaxed);
+	  if (node != nullptr) {
+	    node->used_in_grid--;
+	    gc.score.store(0.0, std::memory_order_relaxed);
+	    gc.node.store(nullptr, std::memory_order_relaxed);
 	  }
 	}
 	
@@ -542,23 +851,34 @@ struct WorkThread {
 
 	// tree->heap.Clear();
 
+	// Score every node in the heap at once (this is most of the
+	// cost of the update).
+	vector<Node *> nodes;
+	vector<const Problem::State *> states;
 	std::function<void(Node *)> ReHeapRec =
-	  [this, tree, &ReHeapRec](Node *n) {
+	  [&nodes, &states, &ReHeapRec](Node *n) {
 	  // Act on the node if it's in the heap.
 	  if (n->location != -1) {
-	    const double new_score = search->problem->Score(n->state);
-	    // Note negation of score so that bigger real scores
-	    // are more minimum for the heap ordering.
-	    tree->heap.AdjustPriority(n, -new_score);
-	    CHECK(n->location != -1);
-	    if (n->checked_in_control)  // XXX experimental
-	      AddToGridWithLock(n, new_score);
+	    nodes.push_back(n);
+	    states.push_back(&n->state);
 	  }
 	  for (pair<const Tree::Seq, Node *> &child : n->children) {
 	    ReHeapRec(child.second);
 	  }
 	};
 	ReHeapRec(tree->root);
+	const vector<double> new_scores = search->problem->ScoreBatch(states);
+
+	for (int i = 0; i < nodes.size(); i++) {
+	  Node *n = nodes[i];
+	  const double new_score = new_scores[i];
+	  // Note negation of score so that bigger real scores
+	  // are more minimum for the heap ordering.
+	  tree->heap.AdjustPriority(n, -new_score);
+	  CHECK(n->location != -1);
+	  if (n->checked_in_control)  // XXX experimental
+	    AddToGrid(n, new_score);
+	}
 
 	// We cleared the grid so its scores are vacuously accurate,
 	// but we need to make sure the marathon node at least has
@@ -639,6 +959,9 @@ struct WorkThread {
 	   &kept_score, &kept_worker, &kept_parent, &kept_grid,
 	   &kept_marathon,
 	   &CleanRec](Node *n) -> bool {
+	  // Other workers may concurrently decrement
+	  // num_workers_using (but not increment it, since we hold
+	  // the lock exclusively), which is fine.
 	  if (n->keep)
 	    kept_score++;
 	  if (n->num_workers_using)
@@ -680,6 +1003,7 @@ struct WorkThread {
 	  } else {
 	    deleted_nodes++;
 	    tree->num_nodes--;
+	    tree->transpositions.Erase(n->state.hash, n);
 	    delete n;
 	  }
 	  
@@ -710,11 +1034,12 @@ struct WorkThread {
 	       max_depth);
 
 	// Now, find some nodes for exploration.
+	PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_CE, &tree->explore_m);
 	CHECK(tree->explore_queue.empty());
 	if (tree->stuckness > 0.50) {
 	  static constexpr int NUM_EXPLORE_NODES = 50;
 
-	  // Holding the lock, add the explore node, including adding
+	  // Holding the locks, add the explore node, including adding
 	  // to the source node's reference count.
 	  auto AddExploreNode = [this, tree](
 	      Node *source, Problem::Goal goal) {
@@ -723,6 +1048,7 @@ struct WorkThread {
 	    static constexpr int NUM_EXPLORE_ITERATIONS = 10;
 	    source->num_workers_using += LOOPS_PER_EXPLORE_ITER *
 	      NUM_EXPLORE_ITERATIONS;
+	    source->last_used = tree->epoch.load();
 	    Tree::ExploreNode *en = new Tree::ExploreNode;
 	    en->source = source;
 	    en->goal = goal;
@@ -759,7 +1085,7 @@ struct WorkThread {
 	      // Also some (smaller) chance to try anyway.
 	      if (isgood.find(adjcell) == isgood.end() ||
 		  rc.Byte() < 32) {
-		Node *source = search->tree->grid[cell].node;
+		Node *source = search->tree->grid[cell].node.load();
 		Problem::Goal goal =
 		  search->problem->RandomGoalInCell(&rc, adjcell);
 		// printf("Explore %s -> %s (%d,%d)");
@@ -799,13 +1125,19 @@ struct WorkThread {
     }
 
 
+    if (opt.state_budget_mb > 0) {
+      PERF_WRITE_MUTEX_LOCK(PE_L_UPDATE_TREE_EVICT, &search->tree_m);
+      EvictStatesWithMutex();
+    }
+    tree->epoch++;
+
     {
-      PERF_WRITE_MUTEX_LOCK(PE_L_UPDATE_TREE_D, &search->tree_m);
+      PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_D, &tree->update_m);
       tree->update_in_progress = false;
     }
   }
 
-  // Holding the tree mutex, find any explore node in the explore
+  // Holding explore_m, find any explore node in the explore
   // queue, increment its reference count, and return a pointer to
   // it. The pointer stays valid even if the lock is relinquished,
   // since the reference count is nonzero. Returns nullptr if none
@@ -840,10 +1172,8 @@ struct WorkThread {
     Node *src = nullptr;
     double mminscore = 0.0;
     {
-      PERF_WRITE_MUTEX_LOCK(PE_L_MARATHON_START, &search->tree_m);
+      PERF_READ_MUTEX_LOCK(PE_L_MARATHON_START, &search->tree_m);
       Tree *tree = search->tree;
-      if (tree->marathon.node == nullptr)
-	return;
 
       // Marathon node has to be good enough to consider expanding it.
       // Otherwise we should spend our time trying to do normal
@@ -851,10 +1181,18 @@ struct WorkThread {
       const double bestscore = -tree->heap.GetMinimum().priority;
       mminscore = MARATHON_BESTSCORE_FRAC * bestscore;
 
-      if (tree->marathon.score < mminscore)
-	return;
+      {
+	PERF_MUTEX_LOCK(PE_L_MARATHON_START_M, &tree->marathon_m);
+	if (tree->marathon.node == nullptr)
+	  return;
 
-      src = tree->marathon.node;
+	if (tree->marathon.score < mminscore)
+	  return;
+
+	src = tree->marathon.node;
+      }
+      // Still holding the tree lock, so it can't have been collected
+      // even if it's no longer the marathon node.
       src->num_workers_using++;
     }
 
@@ -867,7 +1205,7 @@ struct WorkThread {
     constexpr int MARATHON_LAP_LENGTH = 30;
     worker->SetStatus(STATUS_MARATHON);
     worker->SetDenom(MARATHON_LAPS);
-    worker->Restore(src->state);
+    RestoreNode(src);
     for (int lap = 0; lap < MARATHON_LAPS; lap++) {
       worker->SetNumer(lap);
       Problem::State undo = worker->Save();
@@ -917,35 +1255,39 @@ struct WorkThread {
       // node if this happens.
       search->stats.failed_marathon.Increment();
 
-      PERF_WRITE_MUTEX_LOCK(PE_L_MARATHON_FAILED, &search->tree_m);
-      // Release refcount in any case.
+      PERF_READ_MUTEX_LOCK(PE_L_MARATHON_FAILED, &search->tree_m);
+      // Release refcount in any case. The node stays alive while
+      // we hold the tree lock.
       src->num_workers_using--;
 
       Tree *tree = search->tree;
       
-      // Make sure nobody changed the marathon node while we were
-      // working. If they did, we can just do nothing.
-      if (src == tree->marathon.node) {
-	tree->marathon.node->used_in_marathon--;
+      {
+	PERF_MUTEX_LOCK(PE_L_MARATHON_FAILED_M, &tree->marathon_m);
+	// Make sure nobody changed the marathon node while we were
+	// working. If they did, we can just do nothing.
+	if (src == tree->marathon.node) {
+	  tree->marathon.node->used_in_marathon--;
 
-	// Reset it in case we fail below.
-	tree->marathon.node = nullptr;
-	tree->marathon.score = 0.0;
+	  // Reset it in case we fail below.
+	  tree->marathon.node = nullptr;
+	  tree->marathon.score = 0.0;
 
-	if (src->parent == nullptr)
-	  return;
+	  if (src->parent == nullptr)
+	    return;
 
-	// Could just return in this case, but something is wrong
-	// if the parent is not in the heap.
-	CHECK(src->parent->location != -1);
-	auto cell = tree->heap.GetCell(src->parent);
+	  // Could just return in this case, but something is wrong
+	  // if the parent is not in the heap.
+	  CHECK(src->parent->location != -1);
+	  auto cell = tree->heap.GetCell(src->parent);
 
-	const double pscore = -cell.priority;
+	  const double pscore = -cell.priority;
 	
-	if (pscore >= mminscore) {
-	  src->parent->used_in_marathon++;
-	  tree->marathon.node = src->parent;
-	  tree->marathon.score = pscore;
+	  if (pscore >= mminscore) {
+	    src->parent->used_in_marathon++;
+	    tree->marathon.node = src->parent;
+	    tree->marathon.score = pscore;
+	  }
 	}
       }
     }
@@ -963,18 +1305,25 @@ struct WorkThread {
     // test to consider using it to replace the marathon node later.
     double marathon_minscore = 0.0;
     int64 marathon_seqlength = 0;
+    Tree *tree = search->tree;
     {
-      PERF_WRITE_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_A, &search->tree_m);
-      Tree *tree = search->tree;
+      PERF_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_A, &tree->explore_m);
       
       en = GetExploreNodeWithMutex();
       if (en == nullptr) return false;      
       // I'm going to decrement it exactly this many times.
       CHECK(en->source->num_workers_using >= LOOPS_PER_EXPLORE_ITER);
-      if (opt.use_marathon && tree->marathon.node != nullptr) {
-	const double bestscore = -tree->heap.GetMinimum().priority;
-	marathon_minscore = MARATHON_BESTSCORE_FRAC * bestscore;
-	marathon_seqlength = tree->marathon.node->seqlength;
+    }
+
+    if (opt.use_marathon) {
+      PERF_READ_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_B, &search->tree_m);
+      const double bestscore = -tree->heap.GetMinimum().priority;
+      {
+	PERF_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_C, &tree->marathon_m);
+	if (tree->marathon.node != nullptr) {
+	  marathon_minscore = MARATHON_BESTSCORE_FRAC * bestscore;
+	  marathon_seqlength = tree->marathon.node->seqlength;
+	}
       }
     }
 
@@ -998,7 +1347,12 @@ struct WorkThread {
       worker->SetNumer(loop);
       // Load source state.
       // worker->SetStatus("Exploring");
-      worker->Restore(start_state);
+      if (Problem::HasSave(start_state)) {
+	worker->Restore(start_state);
+      } else {
+	// Still the source node's state, which was evicted.
+	RestoreNode(en->source);
+      }
 
       // worker->SetStatus("Explore inputs");
 
@@ -1138,8 +1492,7 @@ struct WorkThread {
     // We batched these up instead of decrementing the refcount in
     // the loop.
     if (bad_iters > 0) {
-      // do it outside the loop...
-      PERF_WRITE_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_R, &search->tree_m);
+      // do it outside the loop... No lock needed to decrement.
       CHECK(en->source->num_workers_using >= bad_iters);
       en->source->num_workers_using -= bad_iters;
     }
@@ -1165,7 +1518,7 @@ struct WorkThread {
     if (remove_node) {
       // worker->SetStatus("Cleanup ExploreNode");
       {
-	PERF_WRITE_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_D, &search->tree_m);
+	PERF_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_D, &tree->explore_m);
 	{
 	  PERF_WRITE_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_ED, &en->node_m);
 	  CHECK(en->iterations_left == 0);
@@ -1174,7 +1527,7 @@ struct WorkThread {
 	  // PERF would be nice to avoid linear search, e.g. by retaining
 	  // the iterator.
 	  std::list<Tree::ExploreNode *> *explore_queue =
-	    &search->tree->explore_queue;
+	    &tree->explore_queue;
 	  for (std::list<Tree::ExploreNode *>::iterator it =
 		 explore_queue->begin();
 	       it != explore_queue->end(); ++it) {
@@ -1264,7 +1617,7 @@ struct WorkThread {
 	for (;;) {
 	  // worker->SetStatus("Load");
 	  CHECK(expand_me != nullptr);
-	  worker->Restore(expand_me->state);
+	  RestoreNode(expand_me);
 
 	  // worker->SetStatus("Gen inputs");
 	  // constexpr double MEAN = 300.0;
@@ -1311,7 +1664,7 @@ struct WorkThread {
 	    // If this is the first one, no need to restore
 	    // because we're already in that state.
 	    if (i != 0) {
-	      worker->Restore(expand_me->state);
+	      RestoreNode(expand_me);
 	      // Since a sequence can only "improve" if it's
 	      // not the first one, we store this denominator
 	      // separately from sequences_tried.
@@ -1349,6 +1702,18 @@ struct WorkThread {
 
 	  // worker->SetStatus("Extend tree");
 
+	  // If we already have this state, don't bother queueing it
+	  // (or expanding from it).
+	  if (opt.transposition_table &&
+	      search->tree->transpositions.Dominated(
+		  best->hash, expand_me->seqlength + nexts[best_step_idx].size())) {
+	    search->stats.transpositions_early.Increment();
+	    // As CommitQueue would have.
+	    expand_me->num_workers_using--;
+	    best.reset();
+	    goto next_node;
+	  }
+
 	  // TODO: Sometimes test for control so that it's
 	  // eligible for marathon, grid?
 	  const bool checked_in_control = false;
@@ -1430,8 +1795,27 @@ TreeSearch::TreeSearch(Options opt) : opt(opt) {
   }
 
   problem.reset(new Problem(config, opt));
+
+  checkpoint_file = config["checkpoint"];
+  if (!config["checkpoint-sec"].empty())
+    checkpoint_sec = std::max(1, atoi(config["checkpoint-sec"].c_str()));
+
+  if (!checkpoint_file.empty()) {
+    checkpoint.reset(new Checkpoint(checkpoint_file));
+    Timer resume_timer;
+    tree = Checkpoint::Load(checkpoint_file, problem.get());
+    if (tree != nullptr) {
+      resume_usec = resume_timer.Seconds() * 1000000.0;
+      resume_nodes = tree->num_nodes + 1;
+      Printf("Resumed %lld nodes from %s in %.3fs.\n",
+	     resume_nodes, checkpoint_file.c_str(), resume_usec / 1000000.0);
+    }
+  }
 }
 
+// Out of line because Checkpoint is incomplete in the header.
+TreeSearch::~TreeSearch() {}
+
 vector<Worker *> TreeSearch::WorkersWithLock() const {
   vector<Worker *> ret;
   ret.reserve(workers.size());
@@ -1450,6 +1834,11 @@ void TreeSearch::StartThreads() {
   for (int i = 0; i < num_workers; i++) {
     workers.push_back(new WorkThread(this, i));
   }
+
+  if (checkpoint.get() != nullptr) {
+    CHECK(!checkpoint_thread.joinable());
+    checkpoint_thread = std::thread(&TreeSearch::CheckpointThread, this);
+  }
 }
 
 void TreeSearch::DestroyThreads() {
@@ -1461,6 +1850,77 @@ void TreeSearch::DestroyThreads() {
   for (WorkThread *wt : workers)
     delete wt;
   workers.clear();
+
+  // Now that the tree is quiet, the checkpoint thread writes one last
+  // time and exits.
+  if (checkpoint_thread.joinable()) {
+    {
+      std::unique_lock<std::mutex> ml(checkpoint_m);
+      checkpoint_die = true;
+    }
+    checkpoint_cond.notify_all();
+    checkpoint_thread.join();
+  }
+}
+
+void TreeSearch::CheckpointThread() {
+  for (;;) {
+    bool die = false;
+    {
+      std::unique_lock<std::mutex> ml(checkpoint_m);
+      die = checkpoint_cond.wait_for(ml,
+				     std::chrono::seconds(checkpoint_sec),
+				     [this]() { return checkpoint_die; });
+    }
+    checkpoint->Write(this);
+    if (die) return;
+  }
+}
+
+string TreeSearch::CheckpointStatus() {
+  if (checkpoint.get() == nullptr) return "";
+  const int64 bytes = stats.checkpoint_bytes.load();
+  const int64 usec = stats.checkpoint_usec.load();
+  string ret =
+    StringPrintf("Checkpoint: %d written, %d nodes, %.2f MB, %.2f MB/s",
+		 stats.checkpoints.Get(), stats.checkpoint_nodes.Get(),
+		 bytes / (1024.0 * 1024.0),
+		 usec > 0 ? (bytes / (1024.0 * 1024.0)) / (usec / 1000000.0) :
+		 0.0);
+  if (resume_nodes > 0) {
+    ret += StringPrintf("; resumed %lld nodes in %.3fs",
+			resume_nodes, resume_usec / 1000000.0);
+  }
+  return ret;
+}
+
+string TreeSearch::EvictionStatus() {
+  if (opt.state_budget_mb <= 0) return "";
+  return StringPrintf("States: %.1f/%d MB; %d evicted, %d replayed "
+		      "(%lld frames)",
+		      stats.state_bytes.load() / (1024.0 * 1024.0),
+		      opt.state_budget_mb,
+		      stats.evictions.Get(), stats.rematerializations.Get(),
+		      stats.replay_frames.load());
+}
+
+string TreeSearch::TranspositionStatus() {
+  if (!opt.transposition_table) return "";
+  const int checks = stats.transposition_checks.Get();
+  const int early = stats.transpositions_early.Get();
+  // Early ones are never checked at commit.
+  const int dupes = stats.transpositions.Get() + early;
+  const int total = checks + early;
+  int64 size = 0LL;
+  {
+    ReadMutexLock ml(&tree_m);
+    if (tree != nullptr) size = tree->transpositions.Size();
+  }
+  return StringPrintf("Transpositions (%s): %d/%d new nodes dupes "
+		      "(%.1f%%, %d early), %d shorter; %lld states",
+		      problem->Game().c_str(), dupes, total,
+		      total > 0 ? (100.0 * dupes) / total : 0.0,
+		      early, stats.transpositions_replaced.Get(), size);
 }
 
 void TreeSearch::SetApproximateSeconds(int64 sec) {
@@ -1541,10 +2001,13 @@ string TreeSearch::SaveBestMovie(const string &filename) {
 }
 
 void TreeSearch::PrintPerfCounters() {
-  vector<int64> totals;
+  vector<int64> totals, acquired, contended;
   int64 total_denom = 0LL;
-  for (int i = 0; i < NUM_PERFEVENTS; i++)
+  for (int i = 0; i < NUM_PERFEVENTS; i++) {
     totals.push_back(0);
+    acquired.push_back(0);
+    contended.push_back(0);
+  }
 
   uint64 freq;
   QueryPerformanceFrequency((LARGE_INTEGER*)&freq);
@@ -1555,6 +2018,8 @@ void TreeSearch::PrintPerfCounters() {
       total_denom += w->PerfGetTotal();
       for (int i = 0; i < NUM_PERFEVENTS; i++) {
 	totals[i] += w->perf_counters[i];
+	acquired[i] += w->lock_acquired[i];
+	contended[i] += w->lock_contended[i];
       }
     }
   }
@@ -1566,6 +2031,26 @@ void TreeSearch::PrintPerfCounters() {
 	   (100.0 * totals[i]) / (double)total_denom,
 	   PerfEventString((PerfEvent)i));
   printf("\n");
+
+  // Same data, grouped by lock.
+  printf("Lock contention:\n"
+	 "        acquired   contended  %%cont       wait\t%%time\tlock\n");
+  for (int ls = 0; ls < NUM_LOCKSTRUCTURES; ls++) {
+    uint64 acq = 0ULL, cont = 0ULL, wait = 0ULL;
+    for (int i = 0; i < NUM_PERFEVENTS; i++) {
+      if (PerfEventLock((PerfEvent)i) == ls) {
+	acq += acquired[i];
+	cont += contended[i];
+	wait += totals[i];
+      }
+    }
+    printf("%16llu %11llu %6.2f%% %9.4fs\t%.6f%%\t%s\n",
+	   acq, cont, acq > 0 ? (100.0 * cont) / (double)acq : 0.0,
+	   (double)wait / (double)freq,
+	   (100.0 * wait) / (double)total_denom,
+	   LockStructureString((LockStructure)ls));
+  }
+  printf("\n");
   fflush(stdout);
 }
 
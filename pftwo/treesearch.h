@@ -9,6 +9,9 @@
 #include <list>
 #include <shared_mutex>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 
 #include <cstdio>
 #include <cstdlib>
@@ -23,6 +26,7 @@
 #include "options.h"
 #include "weighted-objectives.h"
 #include "problem-twoplayer.h"
+#include "transposition-table.h"
 
 // Base "max" nodes in heap. We start cleaning the heap when there are
 // more than this number of nodes, although we often have to keep more
@@ -50,6 +54,8 @@ using Worker = Problem::Worker;
 
 // This is a private implementation detail.
 struct WorkThread;
+// In checkpoint.h.
+struct Checkpoint;
 
 // Tree of state exploration.
 // This contains all of the non-abandoned states we've visited,
@@ -78,9 +84,14 @@ struct Tree {
       depth((parent != nullptr) ? (parent->depth + 1) : 0),
       seqlength(seqlength) {}
     // Note that this can be recreated by replaying the moves from the
-    // root. It once was optional and could be made that way again, at
-    // the cost of many complications.
-    const State state;
+    // root. With a state budget, the emulator savestate part of it is
+    // dropped for cold nodes (see Problem::HasSave), which is the only
+    // way it's modified: holding the tree lock exclusively, either
+    // evicting (when the node has no references) or putting back the
+    // replayed state. So it can be read holding the tree lock in
+    // either mode; the parts other than the savestate can also be
+    // read with just a reference.
+    State state;
 
     // Only null for the root.
     Node *const parent = nullptr;
@@ -88,6 +99,9 @@ struct Tree {
     const int depth = 0;
     // Length of the sequence that gets us here.
     const int64 seqlength = 0LL;
+    // Unique (for the life of the tree, including across checkpoints)
+    // identifier. The root is 0.
+    int64 id = 0LL;
     
     // Child nodes. Currently, no guarantee that these don't
     // share prefixes, but there cannot be duplicates.
@@ -111,7 +125,9 @@ struct Tree {
     // Total number of times chosen for expansion. This will
     // be related to the number of children, but can be more
     // in the case that the tree is pruned or children collide.
-    int chosen = 0;
+    // Atomic (as are the reference counts below) so that workers
+    // can choose nodes while sharing the tree lock.
+    std::atomic<int> chosen{0};
 
     // Number of times that expansion yielded a loss on the
     // objective function. Used to compute the chance that
@@ -128,14 +144,20 @@ struct Tree {
     // node can be garbage collected. (XXX This is no longer really
     // "workers using", since the same worker can have many oustanding
     // references.)
-    int num_workers_using = 0;
+    // Incrementing requires holding the tree lock (either mode) or
+    // already having a reference; decrementing can be done anytime.
+    std::atomic<int> num_workers_using{0};
 
     // Number of references from the grid, which also keeps nodes
     // alive.
-    int used_in_grid = 0;
+    std::atomic<int> used_in_grid{0};
     
     // Same, but for marathon cell(s).
-    int used_in_marathon = 0;
+    std::atomic<int> used_in_marathon{0};
+
+    // Tree::epoch when this node was last chosen for expansion
+    // (or created). For evicting save states.
+    std::atomic<int64> last_used{0LL};
     
     // Should only be used inside the tree cleanup procedure. Marks
     // nodes that should not be garbage collected because they are
@@ -143,7 +165,7 @@ struct Tree {
     bool keep = false;
   };
 
-  // Everything in ExploreNode also protected by the tree mutex,
+  // Everything in ExploreNode also protected by explore_m,
   // except where noted.
   struct ExploreNode {
     // Points to the tree Node that this exploration began from.
@@ -174,13 +196,10 @@ struct Tree {
     int bad = 0;
   };
   
-  Tree(double score, State state) {
+  Tree(double score, State state) : grid(Problem::num_grid_cells) {
     root = new Node(std::move(state), nullptr, 0);
     heap.Insert(-score, root);
-
-    for (int i = 0; i < Problem::num_grid_cells; i++) {
-      grid.emplace_back(0.0, nullptr);
-    }
+    transpositions.Put(root->state.hash, root, 0LL);
   }
 
   // Must hold mutex.
@@ -199,11 +218,19 @@ struct Tree {
   // objective function) for a grid of screen coordinates. In
   // principle this could be generalized to include stuff like graphics
   // on the screen, the values in arbitrary memory locations, etc.
+  //
+  // The grid is big (a cell for every value of every memory
+  // location) and every new node can land in thousands of cells, so
+  // it has its own locking. A cell is written holding the tree lock
+  // in shared mode plus the cell's shard mutex (GridMutex), or
+  // holding the tree lock exclusively. The fields are atomic so that
+  // anyone holding the tree lock can read them without the shard
+  // mutex; the node is kept alive by the tree lock in that case. The
+  // score and node may briefly disagree, which is harmless.
   struct GridCell {
     // Actual (normalized) score, not negated.
-    double score = 0.0;
-    Node *node = nullptr;
-    GridCell(double score, Node *node) : score(score), node(node) {}
+    std::atomic<double> score{0.0};
+    std::atomic<Node *> node{nullptr};
   };
   
   // Experimental: Keep around a node that has a high score (relative
@@ -219,7 +246,19 @@ struct Tree {
     MarathonCell() {}
   };
 
+  // Node (in the tree) for each distinct emulator state, if the
+  // transposition_table option is on. Among nodes with the same
+  // state, it's the one with the shortest sequence. Has its own
+  // locking; it's modified holding the tree lock exclusively, and
+  // read holding it in any mode (or not at all, by workers
+  // checking a candidate node before queueing it).
+  TranspositionTable<Node> transpositions;
+
   vector<GridCell> grid;
+  static constexpr int GRID_SHARDS = 64;
+  // Interleaved, so that nearby cells usually have different locks.
+  std::mutex *GridMutex(int cell) { return &grid_m[cell % GRID_SHARDS]; }
+  std::mutex grid_m[GRID_SHARDS];
 
   // Note: Normal for node to be nullptr.
   // If there is something in here, it must be IsInControl.
@@ -229,9 +268,16 @@ struct Tree {
   // position is part of the objective function.)
   // We then try to find the highest depth.
   MarathonCell marathon;
+  // Written holding marathon_m and the tree lock in shared mode, or
+  // the tree lock exclusively. Read holding either. Dereferencing the
+  // node also requires the tree lock.
+  std::mutex marathon_m;
   
   // If this has anything in it, we're in exploration mode.
+  // Protected by explore_m. Explore nodes are added only during
+  // the tree update, which also holds the tree lock exclusively.
   std::list<ExploreNode *> explore_queue;
+  std::mutex explore_m;
   // Stuckness estimate from the last reheap.
   double stuckness = 0.0;
   // The maximum depth of the tree.
@@ -241,6 +287,8 @@ struct Tree {
   int max_depth = 0;
   
   Node *root = nullptr;
+
+  // These two are protected by update_m, not the tree lock.
   // Number of steps until we update reheap and thin the tree.
   int steps_until_update = STEPS_TO_FIRST_UPDATE;
   // If this is true, a thread is updating the tree. It does not
@@ -248,7 +296,12 @@ struct Tree {
   // done without the tree (like sorting observations). If set,
   // another thread should avoid also beginning an update.
   bool update_in_progress = false;
+  std::mutex update_m;
   int64 num_nodes = 0;
+  // Number of tree updates so far.
+  std::atomic<int64> epoch{0LL};
+  // Next value for Node::id.
+  std::atomic<int64> next_node_id{1LL};
 };
 
 struct TreeSearch {
@@ -256,11 +309,18 @@ struct TreeSearch {
   std::unique_ptr<Problem> problem;
 
   TreeSearch(Options options);
+  ~TreeSearch();
   
   // Initialized by one of the workers with the post-warmup
   // state.
   Tree *tree = nullptr;
-  // Coarse locking.
+  // Protects the shape of the tree (children, heap, node count) and
+  // the other fields of Tree that don't have their own lock. Choosing
+  // nodes only reads the tree, so it shares the lock; linking in new
+  // nodes and the periodic update take it exclusively.
+  //
+  // Lock order: tree_m, update_m, explore_m, ExploreNode::node_m,
+  // marathon_m, grid_m. (Not all of these are ever held at once.)
   std::shared_mutex tree_m;
 
   // The UI thread must periodically call these for the benchmark
@@ -286,6 +346,32 @@ struct TreeSearch {
     Counter explore_deaths;
 
     Counter failed_marathon;
+
+    // New nodes checked against the transposition table, and those
+    // that reached a state we already had with a sequence no
+    // shorter: dropped when committing, or before even queueing
+    // them (which also saves expanding from them). Replaced is the
+    // number that reached a known state by a shorter sequence.
+    Counter transposition_checks;
+    Counter transpositions;
+    Counter transpositions_early;
+    Counter transpositions_replaced;
+
+    // With a state budget, the number of save states dropped, and
+    // then recreated by replaying, and the frames spent doing that.
+    Counter evictions;
+    Counter rematerializations;
+    std::atomic<int64> replay_frames{0LL};
+    // Total size of the save states kept in the tree, as of the last
+    // update.
+    std::atomic<int64> state_bytes{0LL};
+
+    // Checkpoints written, and the total new nodes, bytes and time
+    // spent (including compression) for them.
+    Counter checkpoints;
+    Counter checkpoint_nodes;
+    std::atomic<int64> checkpoint_bytes{0LL};
+    std::atomic<int64> checkpoint_usec{0LL};
   };
   Stats stats;
 
@@ -300,6 +386,15 @@ struct TreeSearch {
   // Should hold the lock or ensure the number of workers
   // is not changed.
   vector<Worker *> WorkersWithLock() const;
+
+  // One-line summary of checkpoint stats (throughput, resume time),
+  // or empty if checkpointing is off. No lock needed.
+  string CheckpointStatus();
+  // Same, for the transposition table (duplicate rate for this
+  // game), or empty if it's off. No lock needed.
+  string TranspositionStatus();
+  // Same, for save state eviction; empty if there's no budget.
+  string EvictionStatus();
   
  private:
   friend struct WorkThread;
@@ -316,6 +411,22 @@ struct TreeSearch {
 
   bool should_die = false;
   std::shared_mutex should_die_m;
+
+  // If the config sets "checkpoint", we resume from that file at
+  // startup (if it exists) and write to it every checkpoint_sec
+  // seconds and when the threads are destroyed.
+  string checkpoint_file;
+  int checkpoint_sec = 600;
+  std::unique_ptr<Checkpoint> checkpoint;
+  // Time spent loading the checkpoint at startup, and the number of
+  // nodes it had; zero if we didn't resume.
+  int64 resume_usec = 0LL, resume_nodes = 0LL;
+  void CheckpointThread();
+  std::thread checkpoint_thread;
+  // Protects checkpoint_die.
+  std::mutex checkpoint_m;
+  std::condition_variable checkpoint_cond;
+  bool checkpoint_die = false;
 };
 
 #endif
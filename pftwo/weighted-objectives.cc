@@ -10,6 +10,11 @@
 #include <vector>
 
 #include <mutex>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "pftwo.h"
 #include "../cc-lib/arcfour.h"
@@ -182,13 +187,194 @@ static inline double GetValueFrac(const vector<vector<uint8>> &values,
   return (double)idx / values.size();
 }
 
+MemoryBatch::MemoryBatch(const WeightedObjectives &wo,
+			 const vector<const uint8 *> &memories) :
+  num(memories.size()), stride((memories.size() + 15) & ~15) {
+  vector<int> locs;
+  for (const auto &wobj : wo.GetAll()) {
+    for (const int loc : wobj.first) {
+      if (loc >= row_of.size()) row_of.resize(loc + 1, -1);
+      if (row_of[loc] == -1) {
+	row_of[loc] = locs.size();
+	locs.push_back(loc);
+      }
+    }
+  }
+
+  // Memory-at-a-time, so that each one is only brought into cache
+  // once.
+  bytes.resize(locs.size() * stride, 0);
+  for (int m = 0; m < num; m++) {
+    const uint8 *mem = memories[m];
+    uint8 *col = &bytes[m];
+    for (int r = 0; r < locs.size(); r++)
+      col[r * stride] = mem[locs[r]];
+  }
+}
+
+// The distinct observed values for one objective, in ascending
+// order, along with how many observations are smaller than each.
+// This is what the batch functions search, rather than the sample
+// itself.
+namespace {
+struct Ranks {
+  explicit Ranks(int width) : width(width), less{0} {}
+  int NumValues() const { return (int)less.size() - 1; }
+
+  // Bytes in each value; the size of the objective.
+  int width = 0;
+  // Concatenated values, each width bytes.
+  vector<uint8> values;
+  // If width <= 8, the same values packed into big-endian integers,
+  // which compare the same way.
+  vector<uint64> keys;
+  // less[d] is the number of observations less than value d. There's
+  // one more entry at the end: the total number of observations.
+  vector<uint32> less;
+};
+}  // namespace
+
+// Sets (*idx)[m] to the number of distinct values in the ranks that
+// are lexicographically less than the objective's value in memory m.
+// When there are few distinct values (common for RAM), this compares
+// 16 memories at a time against each value with SIMD; otherwise it's a
+// binary search per memory. Either way, the comparison gives the same
+// order as vector<uint8>'s operator <.
+static void CountLess(const Ranks &r, const MemoryBatch &batch,
+		      const vector<int> &obj, vector<int> *idx) {
+  const int n = batch.Size();
+  const int width = r.width;
+  const int num_values = r.NumValues();
+  idx->resize(n);
+  vector<const uint8 *> rows;
+  rows.reserve(width);
+  for (const int loc : obj) rows.push_back(batch.Row(loc));
+
+  int m = 0;
+#ifdef __SSE2__
+  // Cost is linear in the number of values, so past a few dozen the
+  // binary search is faster (measured with bench-objectives). Must be
+  // less than 256 for the 8-bit counters anyway.
+  if (num_values <= 32) {
+    // SSE2 only has signed byte comparisons, so flip the high bits of
+    // both sides.
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    for (; m < n; m += 16) {
+      // The memories' bytes, reloaded each time since the objective
+      // may be long. They're in L1.
+      auto X = [bias, &rows, m](int j) {
+	return _mm_xor_si128(
+	    _mm_loadu_si128((const __m128i *)(rows[j] + m)), bias);
+      };
+
+      __m128i count = _mm_setzero_si128();
+      for (int d = 0; d < num_values; d++) {
+	const uint8 *v = &r.values[d * width];
+	// All-ones in lanes where v < x so far, and where they're equal
+	// so far.
+	__m128i lt = _mm_setzero_si128(), eq = ones;
+	for (int j = 0; j < width; j++) {
+	  const __m128i xj = X(j);
+	  const __m128i vj = _mm_set1_epi8((char)(v[j] ^ 0x80));
+	  lt = _mm_or_si128(lt, _mm_and_si128(eq, _mm_cmpgt_epi8(xj, vj)));
+	  eq = _mm_and_si128(eq, _mm_cmpeq_epi8(xj, vj));
+	  if (_mm_movemask_epi8(eq) == 0) break;
+	}
+	// The values are sorted, so if this one isn't less than any
+	// of the memories, no later one is.
+	if (_mm_movemask_epi8(lt) == 0) break;
+	// Subtracting -1 increments.
+	count = _mm_sub_epi8(count, lt);
+      }
+
+      alignas(16) uint8 counts[16];
+      _mm_store_si128((__m128i *)counts, count);
+      const int lanes = std::min(16, n - m);
+      for (int i = 0; i < lanes; i++) (*idx)[m + i] = counts[i];
+    }
+  }
+#endif
+
+  // Anything not done above.
+  if (m < n && width <= 8) {
+    vector<uint64> x(n - m, 0ULL);
+    for (int j = 0; j < width; j++) {
+      const uint8 *row = rows[j] + m;
+      for (int i = 0; i < n - m; i++) x[i] = (x[i] << 8) | row[i];
+    }
+    // Branch-free lower_bound.
+    const uint64 *keys = r.keys.data();
+    for (int i = 0; i < n - m; i++) {
+      const uint64 k = x[i];
+      const uint64 *b = keys;
+      int len = num_values;
+      while (len > 1) {
+	const int half = len >> 1;
+	b = (b[half] < k) ? b + half : b;
+	len -= half;
+      }
+      (*idx)[m + i] = (b - keys) + (len == 1 && *b < k);
+    }
+    return;
+  }
+
+  vector<uint8> x(width);
+  for (; m < n; m++) {
+    for (int j = 0; j < width; j++) x[j] = rows[j][m];
+    int lo = 0, hi = num_values;
+    while (lo < hi) {
+      const int mid = (lo + hi) >> 1;
+      if (memcmp(&r.values[mid * width], x.data(), width) < 0) {
+	lo = mid + 1;
+      } else {
+	hi = mid;
+      }
+    }
+    (*idx)[m] = lo;
+  }
+}
+
+vector<double> Observations::GetNormalizedValueBatch(
+    const MemoryBatch &batch) {
+  const int n = batch.Size();
+  vector<double> vals;
+  GetNormalizedValuesBatch(batch, &vals);
+  vector<double> sum(n, 0.0);
+  for (int i = 0; i < wo.Size(); i++) {
+    const double *row = &vals[i * n];
+    for (int m = 0; m < n; m++) sum[m] += row[m];
+  }
+  for (double &s : sum) s /= (double)wo.Size();
+  return sum;
+}
+
+vector<double> Observations::GetWeightedValueBatch(
+    const MemoryBatch &batch) {
+  const int n = batch.Size();
+  vector<double> vals;
+  GetNormalizedValuesBatch(batch, &vals);
+  vector<double> numer(n, 0.0);
+  double total_weight = 0.0;
+  for (int i = 0; i < wo.Size(); i++) {
+    const double weight = wo.Get(i).second;
+    const double *row = &vals[i * n];
+    for (int m = 0; m < n; m++) numer[m] += row[m] * weight;
+    total_weight += weight;
+  }
+  for (double &v : numer) v /= total_weight;
+  return numer;
+}
+
 namespace {
 struct SampleObservations : public Observations {
   SampleObservations(const WeightedObjectives &wo, int max_samples) :
     Observations(wo), max_samples(max_samples), watermark(wo.Size(), 0),
     obs_values(wo.Size(), vector<pair<uint32, vector<uint8>>>{}),
     acc_values(wo.Size(), vector<pair<uint32, vector<uint8>>>{}) {
-
+    ranks.reserve(wo.Size());
+    for (int i = 0; i < wo.Size(); i++)
+      ranks.emplace_back(wo.Get(i).first.size());
   }
 
   static bool CompareByKeyDesc(const pair<uint32, vector<uint8>> &a,
@@ -213,8 +399,11 @@ struct SampleObservations : public Observations {
   static inline
   int GetKValueIndex(const vector<pair<uint32, vector<uint8>>> &values,
 		     const vector<uint8> &now) {
-    return lower_bound(values.begin(), values.end(), make_pair(0, now),
-		       CompareByValue) -
+    return lower_bound(values.begin(), values.end(), now,
+		       [](const pair<uint32, vector<uint8>> &a,
+			  const vector<uint8> &b) {
+			 return a.second < b;
+		       }) -
       values.begin();
   }
 
@@ -227,7 +416,7 @@ struct SampleObservations : public Observations {
     return (double)idx / values.size();
   }
   
-  void Accumulate(const vector<uint8> &memory) override {
+  void Accumulate(const uint8 *memory) override {
     MutexLock ml(&acc_mutex);
     for (int i = 0; i < wo.Size(); i++) {
       const pair<vector<int>, double> &obj = wo.Get(i);
@@ -243,7 +432,8 @@ struct SampleObservations : public Observations {
 
       // OK, we'll keep the sample. Compute its value.
       
-      vector<uint8> value = WeightedObjectives::Value(memory, obj.first);
+      vector<uint8> value;
+      WeightedObjectives::Value(memory, obj.first, &value);
       
       acc_values[i].push_back({key, std::move(value)});
     }
@@ -293,6 +483,28 @@ struct SampleObservations : public Observations {
       // Now put it in sorted order by value (ascending).
       std::sort(ov.begin(), ov.end(), CompareByValue);
 
+      // And summarize for the batch functions.
+      Ranks *r = &ranks[i];
+      r->values.clear();
+      r->less.clear();
+      for (int j = 0; j < ov.size(); j++) {
+	if (j == 0 || ov[j].second != ov[j - 1].second) {
+	  r->values.insert(r->values.end(),
+			   ov[j].second.begin(), ov[j].second.end());
+	  r->less.push_back(j);
+	}
+      }
+      r->less.push_back(ov.size());
+      r->keys.clear();
+      if (r->width <= 8) {
+	for (int d = 0; d < r->NumValues(); d++) {
+	  uint64 k = 0ULL;
+	  for (int j = 0; j < r->width; j++)
+	    k = (k << 8) | r->values[d * r->width + j];
+	  r->keys.push_back(k);
+	}
+      }
+
       in_mem += ov.size();
     }
 
@@ -300,14 +512,15 @@ struct SampleObservations : public Observations {
 	   accumulated, dropped, discarded, in_mem);
   }
 
-  vector<double> GetNormalizedValues(const vector<uint8> &mem) override {
+  vector<double> GetNormalizedValues(const uint8 *mem) override {
     vector<double> vals;
     vals.reserve(wo.Size());
     {
       MutexLock mlo(&obs_mutex);
+      vector<uint8> cur;
       for (int i = 0; i < wo.Size(); i++) {
 	const vector<int> &obj = wo.Get(i).first;
-	vector<uint8> cur = WeightedObjectives::Value(mem, obj);
+	WeightedObjectives::Value(mem, obj, &cur);
 	vals.push_back(GetKValueFrac(obs_values[i], cur));
       }
     }
@@ -315,14 +528,15 @@ struct SampleObservations : public Observations {
     return vals;
   }
 
-  double GetNormalizedValue(const vector<uint8> &mem) override {
+  double GetNormalizedValue(const uint8 *mem) override {
     double sum = 0.0;
 
     {
       MutexLock mlo(&obs_mutex);
+      vector<uint8> cur;
       for (int i = 0; i < wo.Size(); i++) {
 	const vector<int> &obj = wo.Get(i).first;
-	vector<uint8> cur = WeightedObjectives::Value(mem, obj);
+	WeightedObjectives::Value(mem, obj, &cur);
 	sum += GetKValueFrac(obs_values[i], cur);
       }
     }
@@ -331,16 +545,34 @@ struct SampleObservations : public Observations {
     return sum;
   }
 
-  double GetWeightedValue(const vector<uint8> &mem) override {
+  void GetNormalizedValuesBatch(const MemoryBatch &batch,
+				vector<double> *out) override {
+    const int n = batch.Size();
+    out->resize(wo.Size() * n);
+    MutexLock mlo(&obs_mutex);
+    vector<int> idx;
+    for (int i = 0; i < wo.Size(); i++) {
+      const Ranks &r = ranks[i];
+      CountLess(r, batch, wo.Get(i).first, &idx);
+      // Same as GetKValueFrac.
+      const double total = obs_values[i].size();
+      double *vals = &(*out)[i * n];
+      for (int m = 0; m < n; m++)
+	vals[m] = (double)r.less[idx[m]] / total;
+    }
+  }
+
+  double GetWeightedValue(const uint8 *mem) override {
     double numer = 0.0;
     double total_weight = 0.0;
     
     {
       MutexLock mlo(&obs_mutex);
+      vector<uint8> cur;
       for (int i = 0; i < wo.Size(); i++) {
 	const vector<int> &obj = wo.Get(i).first;
 	const double weight = wo.Get(i).second;
-	vector<uint8> cur = WeightedObjectives::Value(mem, obj);
+	WeightedObjectives::Value(mem, obj, &cur);
 	numer += GetKValueFrac(obs_values[i], cur) * weight;
 	total_weight += weight;
       }
@@ -365,6 +597,8 @@ struct SampleObservations : public Observations {
   // value, sorted by value. No more than max_samples in each vector;
   // keys are all greater than or equal to watermark.
   vector<vector<pair<uint32, vector<uint8>>>> obs_values;
+  // Parallel to the weighted objectives. Summary of obs_values.
+  vector<Ranks> ranks;
  
   ArcFour rc{"sample"};
   // Parallel to the weighted objectives. Queue of keys (less than the
@@ -387,7 +621,7 @@ struct MixedBaseObservations : public Observations {
     obs_maxbytes = acc_maxbytes;
   }
   
-  void Accumulate(const vector<uint8> &memory) override {
+  void Accumulate(const uint8 *memory) override {
     MutexLock ml(&acc_mutex);
     for (int i = 0; i < wo.Size(); i++) {
       const vector<int> &obj = wo.Get(i).first;
@@ -406,15 +640,13 @@ struct MixedBaseObservations : public Observations {
     obs_maxbytes = acc_maxbytes;
   }
 
-  vector<double> GetNormalizedValues(const vector<uint8> &mem) override {
+  vector<double> GetNormalizedValues(const uint8 *mem) override {
     vector<double> vals;
     vals.resize(wo.Size());
     {
       MutexLock mlo(&obs_mutex);
       for (int i = 0; i < wo.Size(); i++) {
 	const vector<int> &obj = wo.Get(i).first;
-	// PERF inline
-	vector<uint8> cur = WeightedObjectives::Value(mem, obj);
 
 	// Let's say the max byte observed for each position is
 	// a, b, c, d, ..., y, z.
@@ -432,8 +664,8 @@ struct MixedBaseObservations : public Observations {
 	// precision int, as long as we can then do division?)
 	double multiplier = 1.0;
 	double seen = 0.0;
-	for (int j = cur.size() - 1; j >= 0; j--) {
-	  seen += cur[j] * multiplier;
+	for (int j = obj.size() - 1; j >= 0; j--) {
+	  seen += mem[obj[j]] * multiplier;
 	  // Radix is largest byte seen but plus one.
 	  multiplier *= ((int)obs_maxbytes[i][j] + 1);
 	}
@@ -449,9 +681,35 @@ struct MixedBaseObservations : public Observations {
     return vals;
   }
 
+  void GetNormalizedValuesBatch(const MemoryBatch &batch,
+				vector<double> *out) override {
+    const int n = batch.Size();
+    out->resize(wo.Size() * n);
+    MutexLock mlo(&obs_mutex);
+    for (int i = 0; i < wo.Size(); i++) {
+      const vector<int> &obj = wo.Get(i).first;
+      double *vals = &(*out)[i * n];
+      // As in GetNormalizedValues, but each row of the batch is
+      // contiguous, so these loops vectorize.
+      std::fill(vals, vals + n, 0.0);
+      double multiplier = 1.0;
+      for (int j = obj.size() - 1; j >= 0; j--) {
+	const uint8 *row = batch.Row(obj[j]);
+	for (int m = 0; m < n; m++) vals[m] += row[m] * multiplier;
+	multiplier *= ((int)obs_maxbytes[i][j] + 1);
+      }
+
+      for (int m = 0; m < n; m++) {
+	vals[m] /= multiplier;
+	CHECK(!isnan(vals[m])) << "\n" << multiplier;
+	CHECK(vals[m] >= 0.0);
+      }
+    }
+  }
+
   // PERF the following two could maybe be faster by inlining
   // the above (not creating the vectors).
-  double GetNormalizedValue(const vector<uint8> &mem) override {
+  double GetNormalizedValue(const uint8 *mem) override {
     double sum = 0.0;
     for (const double val : GetNormalizedValues(mem))
       sum += val;
@@ -460,7 +718,7 @@ struct MixedBaseObservations : public Observations {
     return sum;
   }
 
-  double GetWeightedValue(const vector<uint8> &mem) override {
+  double GetWeightedValue(const uint8 *mem) override {
     double numer = 0.0;
     double total_weight = 0.0;
 
@@ -485,7 +743,7 @@ struct MixedBaseObservations : public Observations {
     double numer = 0.0;
     double total_weight = 0.0;
 
-    const vector<double> vals = GetNormalizedValues(mem);
+    const vector<double> vals = GetNormalizedValues(mem.data());
     for (int i = 0; i < vals.size(); i++) {
       text->push_back(StringPrintf("%.2f x %.3f", wo.Get(i).second, vals[i]));
     }
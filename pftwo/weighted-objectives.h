@@ -54,11 +54,47 @@ struct WeightedObjectives {
     return ret;
   }
 
+  // Same, but into *out, which keeps its storage across calls.
+  static void Value(const uint8 *memory, const vector<int> &objective,
+		    vector<uint8> *out) {
+    out->resize(objective.size());
+    for (int i = 0; i < objective.size(); i++)
+      (*out)[i] = memory[objective[i]];
+  }
+
  private:
   vector<pair<vector<int>, double>> weighted;
   NOT_COPYABLE(WeightedObjectives);
 };
 
+// Many memories, transposed into structure-of-arrays form: for each
+// RAM location used by some objective, that location's byte from
+// every memory, contiguously. This lets the batch scoring functions
+// in Observations compare an objective against all of the memories at
+// once with SIMD, instead of chasing each memory's bytes separately.
+struct MemoryBatch {
+  // The memories are 2048 bytes of RAM, like the arguments to
+  // Observations. They need not outlive the batch.
+  MemoryBatch(const WeightedObjectives &wo,
+	      const vector<const uint8 *> &memories);
+
+  // Number of memories.
+  int Size() const { return num; }
+
+  // The byte at RAM location loc (which must appear in some objective)
+  // for each memory, followed by zeroes up to a multiple of 16.
+  const uint8 *Row(int loc) const {
+    return bytes.data() + row_of[loc] * stride;
+  }
+
+ private:
+  int num = 0, stride = 0;
+  // For each RAM location, its row index, or -1 if no objective
+  // uses it.
+  vector<int> row_of;
+  vector<uint8> bytes;
+};
+
 // Dynamic observations for computing "value fraction"-based metrics.
 // From observing some states during exploration, we can compute an
 // "absolute" score for a memory alone. (This is more flexible than
@@ -79,7 +115,14 @@ struct Observations {
   // since we thin this to keep a sample of the observed range. It's
   // more important to observe a *variety* of states.
   // Observing is a little expensive.
-  virtual void Accumulate(const vector<uint8> &memory) = 0;
+  //
+  // The memory arguments here and below are 2048 bytes of RAM. The
+  // pointer versions allow reading directly from the emulator (see
+  // Emulator::RawMemory) without copying.
+  virtual void Accumulate(const uint8 *memory) = 0;
+  void Accumulate(const vector<uint8> &memory) {
+    Accumulate(memory.data());
+  }
 
   // Rebases values for GetNormalizedValue.
   virtual void Commit() = 0;
@@ -89,17 +132,41 @@ struct Observations {
   // function relative to the values we've observed and committed; 1 means
   // that this is the higest value we've ever seen for that objective.
   // Does not observe the memory.
-  virtual double GetNormalizedValue(const vector<uint8> &memory) = 0;
+  virtual double GetNormalizedValue(const uint8 *memory) = 0;
+  double GetNormalizedValue(const vector<uint8> &memory) {
+    return GetNormalizedValue(memory.data());
+  }
 
   // As GetNormalizedValue, but the weighted average of each fraction.
   // In [0, 1].
-  virtual double GetWeightedValue(const vector<uint8> &memory) = 0;
+  virtual double GetWeightedValue(const uint8 *memory) = 0;
+  double GetWeightedValue(const vector<uint8> &memory) {
+    return GetWeightedValue(memory.data());
+  }
   
   // As above, but rather than producing a single value for all objectives,
   // returns one value fraction per objective, in the same order they
   // appear within the WeightedObjectives object.
   // Weights are ignored. Does not observe the memory.
-  virtual vector<double> GetNormalizedValues(const vector<uint8> &memory) = 0;
+  virtual vector<double> GetNormalizedValues(const uint8 *memory) = 0;
+  vector<double> GetNormalizedValues(const vector<uint8> &memory) {
+    return GetNormalizedValues(memory.data());
+  }
+
+  // Batch versions of the above, for scoring many memories (e.g. every
+  // node in the tree after a Commit) at once. The results are exactly
+  // the same as calling the single-memory versions on each memory in
+  // turn.
+  //
+  // Sets out to wo.Size() * batch.Size() values, where
+  // (*out)[i * batch.Size() + m] is the normalized value of objective
+  // i for memory m.
+  virtual void GetNormalizedValuesBatch(const MemoryBatch &batch,
+					vector<double> *out) = 0;
+  // GetNormalizedValue for each memory.
+  vector<double> GetNormalizedValueBatch(const MemoryBatch &batch);
+  // GetWeightedValue for each memory.
+  vector<double> GetWeightedValueBatch(const MemoryBatch &batch);
 
   // Write some short strings into the text to describe the memory.
   virtual void VizText(const vector<uint8> &mem, vector<string> *text) {}
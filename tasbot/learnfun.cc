@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <map>
+#include <thread>
 
 #include "tasbot.h"
 
@@ -26,6 +27,8 @@
 #include "objective.h"
 #include "weighted-objectives.h"
 #include "motifs.h"
+#include "../cc-lib/threadutil.h"
+#include "../cc-lib/timer.h"
 
 #ifdef MARIONET
 #include "SDL.h"
@@ -52,11 +55,21 @@ static void PrintAndSave(const vector<int> &ordering) {
   objectives->push_back(ordering);
 }
 
+// One call to Enumerate. These are all independent, so we run
+// them in parallel, but then print and save the results in order
+// so that the output is the same as running them serially.
+struct Job {
+  // Printed before the job's orderings, if non-empty.
+  string header;
+  vector<int> look;
+  int seed;
+};
+
 // With e.g. an divisor of 3, generate slices covering
 // the first third, middle third, and last third.
 static void GenerateNthSlices(int divisor, int num, 
 			      const vector< vector<uint8> > &memories,
-			      Objective *obj) {
+			      vector<Job> *jobs) {
   const int onenth = memories.size() / divisor;
   for (int slicenum = 0; slicenum < divisor; slicenum++) {
     vector<int> look;
@@ -64,34 +77,39 @@ static void GenerateNthSlices(int divisor, int num,
     for (int i = 0; i < onenth; i++) {
       look.push_back(low + i);
     }
-    printf("For slice %ld-%ld:\n", low, low + onenth - 1);
+    string header = StringPrintf("For slice %d-%d:\n", low, low + onenth - 1);
     for (int i = 0; i < num; i++) {
-      obj->EnumerateFull(look, PrintAndSave, 1, slicenum * 0xBEAD + i);
+      jobs->push_back(Job{header, look, slicenum * 0xBEAD + i});
+      header.clear();
     }
   }
 }
 
 static void GenerateOccasional(int stride, int offsets, int num,
 			       const vector< vector<uint8> > &memories,
-			       Objective *obj) {
+			       vector<Job> *jobs) {
   for (int off = 0; off < offsets; off++) {
     vector<int> look;
     // Consider starting at various places throughout the first stide?
     for (int start = off; start < memories.size(); start += stride) {
       look.push_back(start);
     }
-    printf("For occasional @%d (every %d):\n", off, stride);
+    string header = StringPrintf("For occasional @%d (every %d):\n",
+				 off, stride);
     for (int i = 0; i < num; i++) {
-      obj->EnumerateFull(look, PrintAndSave, 1, off * 0xF00D + i);
+      jobs->push_back(Job{header, look, off * 0xF00D + i});
+      header.clear();
     }
   }
 }
 
 static void MakeObjectives(const string &game,
-			   const vector< vector<uint8> > &memories) {
+			   const vector< vector<uint8> > &memories,
+			   double max_seconds) {
   printf("Now generating objectives.\n");
   objectives = new vector< vector<int> >;
   Objective obj(memories);
+  vector<Job> jobs;
 
   // Going to generate a bunch of objective functions.
   // Some things will never violate the objective, like
@@ -101,28 +119,44 @@ static void MakeObjectives(const string &game,
   // TODO: In Mario, all 50 appear to be effectively the same
   // when graphed. Are they all equivalent, and should we be
   // accounting for that e.g. in weighting or deduplication?
+  const vector<int> all = obj.LookAll();
   for (int i = 0; i < 50; i++) // was 10
-    obj.EnumerateFullAll(PrintAndSave, 1, i);
+    jobs.push_back(Job{"", all, i});
 
   // XXX Not sure how I feel about these, based on the
   // graphics. They are VERY noisy.
 
   // Next, generate objectives for each tenth of the game.
-  GenerateNthSlices(10, 3, memories, &obj);
+  GenerateNthSlices(10, 3, memories, &jobs);
 
   // And for each 1/100th.
-  // GenerateNthSlices(100, 1, memories, &obj);
+  // GenerateNthSlices(100, 1, memories, &jobs);
 
   // Now, for individual frames spread throughout the
   // whole movie.
   // This one looks great.
-  GenerateOccasional(100, 10, 10, memories, &obj);
+  GenerateOccasional(100, 10, 10, memories, &jobs);
   // was 5,2
 
-  GenerateOccasional(250, 10, 10, memories, &obj);
+  GenerateOccasional(250, 10, 10, memories, &jobs);
 
   // This one looks okay; noisy at times.
-  GenerateOccasional(1000, 10, 1, memories, &obj);
+  GenerateOccasional(1000, 10, 1, memories, &jobs);
+
+  const int num_threads = std::max(1U, std::thread::hardware_concurrency());
+  Timer timer;
+  vector< vector< vector<int> > > results =
+    ParallelMap(jobs, [&obj, max_seconds](const Job &job) {
+	return obj.Enumerate(job.look, 1, job.seed, max_seconds);
+      }, num_threads);
+  fprintf(stderr, "Enumerated %d jobs in %.2fs with %d threads.\n",
+	  (int)jobs.size(), timer.Seconds(), num_threads);
+
+  for (int j = 0; j < jobs.size(); j++) {
+    printf("%s", jobs[j].header.c_str());
+    for (const vector<int> &ordering : results[j])
+      PrintAndSave(ordering);
+  }
 
   // Weight them. Currently this is just removing duplicates.
   printf("There are %d objectives\n", objectives->size());
@@ -203,7 +237,11 @@ int main(int argc, char *argv[]) {
          memories.size(),
          time_end - time_start);
 
-  MakeObjectives(game, memories);
+  // Optional time budget for each enumeration, in seconds. If it
+  // runs out, we keep the prefix found so far, which is still an
+  // objective but may not be maximal.
+  const double max_seconds = atof(config["objective-seconds"].c_str());
+  MakeObjectives(game, memories, max_seconds);
   Motifs motifs;
   motifs.AddInputs(inputs);
   motifs.SaveToFile(game + ".motifs");
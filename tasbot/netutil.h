@@ -4,6 +4,7 @@
 
 #include <vector>
 #include <string>
+#include <thread>
 
 #include "tasbot.h"
 
@@ -12,7 +13,9 @@
 #include "SDL_net/SDLnetsys.h"
 #include "marionet.pb.h"
 #include "util.h"
+#include "shmutil.h"
 #include "errno.h"
+#include "../cc-lib/timer.h"
 
 // You can change this, but it must be less than 2^32 since
 // we only send 4 bytes.
@@ -101,8 +104,20 @@ struct GetAnswers {
   // Request vector must outlast the object.
   GetAnswers(const vector<int> &ports,
              const vector<Request> &requests)
-  : workdone_(0),
+    : GetAnswers(ports, vector<ShmChannel *>(), requests, NULL) {}
+
+  // If channels is non-empty, it has a shared-memory channel for each
+  // port (not owned), and we use those instead of TCP. If stats is
+  // non-null, updates it.
+  GetAnswers(const vector<int> &ports,
+             const vector<ShmChannel *> &channels,
+             const vector<Request> &requests,
+             TransportStats *stats)
+  : channels_(channels),
+    stats_(stats),
+    workdone_(0),
     workqueued_(0) {
+    CHECK(channels.empty() || channels.size() == ports.size());
 
     for (int i = 0; i < ports.size(); i++) {
       helpers_.push_back(Helper(ports[i]));
@@ -117,6 +132,7 @@ struct GetAnswers {
   }
 
   void Loop() {
+    Timer loop_timer;
     InPlaceTerminal term(1);
     for (;;) {
       static const int MAXCOLS = 77;
@@ -167,6 +183,7 @@ struct GetAnswers {
 
       // Are we done?
       if (workdone_ == work_.size()) {
+        if (stats_ != NULL) stats_->total_sec += loop_timer.Seconds();
         return;
       }
 
@@ -181,82 +198,16 @@ struct GetAnswers {
         DoNextWork(idle);
       }
 
-      // Figure out what we're waiting on.
-      SDLNet_SocketSet ss = SDLNet_AllocSocketSet(helpers_.size());
-      CHECK(ss != NULL);
-
-      // Wait on anything in working state.
-      int numworking = 0;
-      for (int i = 0; i < helpers_.size(); i++) {
-        if (helpers_[i].state == WORKING) {
-          numworking++;
-          CHECK(-1 != SDLNet_TCP_AddSocket(ss, helpers_[i].sock));
-        }
-      }
-      CHECK(numworking > 0);
-
-      // Block until something is ready.
-      for (;;) {
-        int numready = SDLNet_CheckSockets(ss, 10000);
-        if (numready == -1) {
-          term.Advance();
-          fprintf(stderr, "SDLNet_CheckSockets: %s\n", SDLNet_GetError());
-          perror("SDLNet_CheckSockets");
-          abort();
-        }
-
-        if (numready > 0) break;
-      }
-
-      for (int i = 0; i < helpers_.size(); i++) {
-        Helper *helper = &helpers_[i];
-
-        // If working, then it's in the socket set and
-        // safe to call SocketReady on.
-        if (helper->state == WORKING &&
-            SDLNet_SocketReady(helper->sock)) {
-          // PERF: Does ready definitely mean that we
-          // can read bytes?
-          // This often fails right at the beginning. I think
-          // maybe it's reporting SocketReady because of
-          // the connection / write finishing, rather than
-          // because there's data to read. Maybe should stream
-          // data into the helper; it's not too hard.
-          int workidx = helper->workidx;
-          if (ReadProto(helper->sock,
-                        &work_[workidx].res)) {
-            CHECK(done_[workidx] == false);
-            // fprintf(stderr, "Got result from port %d for work #%d\n",
-            // helper->port,
-            // workidx);
-            done_[workidx] = true;
-            SDLNet_TCP_Close(helper->sock);
-            helper->sock = NULL;
-            helper->state = DISCONNECTED;
-            helper->workidx = -1;
-
-          } else {
-            // If we failed to read, reenqueue it in the same
-            // helper, which preserves any invariants.
-            SDLNet_TCP_Close(helper->sock);
-            helper->sock = NULL;
-            helper->state = DISCONNECTED;
-            term.Advance();
-            fprintf(stderr, "Error reading result from port %d "
-                    "for work #%d!\n",
-                    helper->port,
-                    workidx);
-            FetchWork(helper, workidx);
-          }
-        }
+      if (channels_.empty()) {
+        WaitSockets(&term);
+      } else {
+        WaitChannels(&term);
       }
 
       // Advance workdone if we can.
       while (workdone_ < work_.size() && done_[workdone_]) {
         workdone_++;
       }
-
-      SDLNet_FreeSocketSet(ss);
     }
   }
 
@@ -288,19 +239,160 @@ struct GetAnswers {
     int workidx;
     // Current connection, if in state WORKING.
     TCPsocket sock;
+    // Since the request was sent, if in state WORKING.
+    Timer sent;
   };
 
+  // Block until some working helper's socket is ready, and read the
+  // results from any that are.
+  void WaitSockets(InPlaceTerminal *term) {
+    // Figure out what we're waiting on.
+    SDLNet_SocketSet ss = SDLNet_AllocSocketSet(helpers_.size());
+    CHECK(ss != NULL);
+
+    // Wait on anything in working state.
+    int numworking = 0;
+    for (int i = 0; i < helpers_.size(); i++) {
+      if (helpers_[i].state == WORKING) {
+        numworking++;
+        CHECK(-1 != SDLNet_TCP_AddSocket(ss, helpers_[i].sock));
+      }
+    }
+    CHECK(numworking > 0);
+
+    // Block until something is ready.
+    for (;;) {
+      int numready = SDLNet_CheckSockets(ss, 10000);
+      if (numready == -1) {
+        term->Advance();
+        fprintf(stderr, "SDLNet_CheckSockets: %s\n", SDLNet_GetError());
+        perror("SDLNet_CheckSockets");
+        abort();
+      }
+
+      if (numready > 0) break;
+    }
+
+    for (int i = 0; i < helpers_.size(); i++) {
+      Helper *helper = &helpers_[i];
+
+      // If working, then it's in the socket set and
+      // safe to call SocketReady on.
+      if (helper->state == WORKING &&
+          SDLNet_SocketReady(helper->sock)) {
+        // PERF: Does ready definitely mean that we
+        // can read bytes?
+        // This often fails right at the beginning. I think
+        // maybe it's reporting SocketReady because of
+        // the connection / write finishing, rather than
+        // because there's data to read. Maybe should stream
+        // data into the helper; it's not too hard.
+        int workidx = helper->workidx;
+        Timer io_timer;
+        const bool ok = ReadProto(helper->sock, &work_[workidx].res);
+        const double io_sec = io_timer.Seconds();
+        SDLNet_TCP_Close(helper->sock);
+        helper->sock = NULL;
+        helper->state = DISCONNECTED;
+        if (ok) {
+          Received(helper, workidx,
+                   work_[workidx].res.ByteSize(), io_sec);
+        } else {
+          // If we failed to read, reenqueue it in the same
+          // helper, which preserves any invariants.
+          term->Advance();
+          fprintf(stderr, "Error reading result from port %d "
+                  "for work #%d!\n",
+                  helper->port,
+                  workidx);
+          FetchWork(helper, workidx);
+        }
+      }
+    }
+
+    SDLNet_FreeSocketSet(ss);
+  }
+
+  // Same, for shared memory. Polls each working helper's channel.
+  void WaitChannels(InPlaceTerminal *term) {
+    for (int spins = 0; /* in loop */; spins++) {
+      bool any = false;
+      for (int i = 0; i < helpers_.size(); i++) {
+        Helper *helper = &helpers_[i];
+        if (helper->state == WORKING && channels_[i]->Ready()) {
+          any = true;
+          int workidx = helper->workidx;
+          Timer io_timer;
+          const int bytes = channels_[i]->Read(&work_[workidx].res);
+          const double io_sec = io_timer.Seconds();
+          helper->state = DISCONNECTED;
+          if (bytes >= 0) {
+            Received(helper, workidx, bytes, io_sec);
+          } else {
+            term->Advance();
+            fprintf(stderr, "Error reading result from shm %d "
+                    "for work #%d!\n",
+                    helper->port,
+                    workidx);
+            FetchWork(helper, workidx);
+          }
+        }
+      }
+      if (any) return;
+
+      // Nothing yet. Helpers usually take milliseconds or more per
+      // request, so back off quickly.
+      if (spins < 64) {
+        std::this_thread::yield();
+      } else {
+        SDL_Delay(1);
+      }
+    }
+  }
+
+  // Helper finished workidx successfully (now DISCONNECTED).
+  void Received(Helper *helper, int workidx, int bytes, double io_sec) {
+    CHECK(done_[workidx] == false);
+    // fprintf(stderr, "Got result from port %d for work #%d\n",
+    // helper->port,
+    // workidx);
+    done_[workidx] = true;
+    helper->workidx = -1;
+    if (stats_ != NULL) {
+      const double latency = helper->sent.Seconds();
+      stats_->responses++;
+      stats_->bytes_received += bytes;
+      stats_->io_sec += io_sec;
+      stats_->total_latency_sec += latency;
+      stats_->max_latency_sec = max(stats_->max_latency_sec, latency);
+    }
+  }
+
   // Work must already be assigned (marked as queued).
   void FetchWork(Helper *helper, int workidx) {
     CHECK(workidx < workqueued_);
     CHECK(helper->state == DISCONNECTED);
     helper->state = WORKING;
     helper->workidx = workidx;
-    helper->sock = ConnectLocal(helper->port);
-    CHECK(helper->sock);
-    // PERF -- could parallelize this with other writes,
-    // by waiting until the socket is actually ready.
-    WriteProto(helper->sock, *work_[workidx].req);
+    helper->sent = Timer();
+    int bytes = 0;
+    if (channels_.empty()) {
+      helper->sock = ConnectLocal(helper->port);
+      CHECK(helper->sock);
+      // PERF -- could parallelize this with other writes,
+      // by waiting until the socket is actually ready.
+      WriteProto(helper->sock, *work_[workidx].req);
+      if (stats_ != NULL) bytes = work_[workidx].req->ByteSize();
+    } else {
+      const int idx = helper - &helpers_[0];
+      helper->sock = NULL;
+      bytes = channels_[idx]->Write(*work_[workidx].req);
+    }
+    if (stats_ != NULL) {
+      stats_->requests++;
+      stats_->bytes_sent += bytes;
+      stats_->io_sec += helper->sent.Seconds();
+    }
     // fprintf(stderr, "Doing work #%d on port %d.\n",
     // workidx,
     // helper->port);
@@ -323,6 +415,9 @@ struct GetAnswers {
     return -1;
   }
 
+  // Parallel to helpers_, or empty to use TCP.
+  const vector<ShmChannel *> channels_;
+  TransportStats *stats_;
   vector<Helper> helpers_;
   vector<Work> work_;
   vector<bool> done_;
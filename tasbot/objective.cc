@@ -1,6 +1,11 @@
 
 #include "objective.h"
+
+#include <functional>
+
 #include "tasbot.h"
+#include "../cc-lib/timer.h"
+#include "../cc-lib/threadutil.h"
 
 // Self-check output.
 #define DEBUG_OBJECTIVE 1
@@ -8,6 +13,40 @@
 
 #define VPRINTF if (VERBOSE_OBJECTIVE) printf
 
+struct Objective::PairBits {
+  // Number of consecutive pairs in the look, and the number of words
+  // in each bitset.
+  int num_pairs = 0, words = 0;
+  // For memory location c, words [c * words, (c + 1) * words) are
+  // the bitset. Bit lo is set when location c increases (inc) or
+  // decreases (dec) from memories[look[lo]] to memories[look[lo + 1]].
+  vector<uint64> inc, dec;
+
+  const uint64 *Inc(int c) const { return &inc[c * words]; }
+  const uint64 *Dec(int c) const { return &dec[c * words]; }
+
+  // All pairs, i.e., equal on the empty prefix.
+  vector<uint64> All() const {
+    vector<uint64> all(words, ~0ULL);
+    if (num_pairs % 64 != 0)
+      all[words - 1] = (1ULL << (num_pairs % 64)) - 1ULL;
+    return all;
+  }
+};
+
+struct Objective::Enumeration {
+  const vector<int> *look = nullptr;
+  const PairBits *bits = nullptr;
+  // Called for each ordering found.
+  std::function<void(const vector<int> &)> emit;
+  // If set and returns true, we're out of time. The prefix being
+  // extended is output as is (it's a valid ordering, but may not be
+  // maximal) and the search gives up as though it reached the limit.
+  std::function<bool()> stop;
+
+  bool Stopped() const { return stop && stop(); }
+};
+
 Objective::Objective(const vector< vector<uint8> > &mm) :
   memories(mm) {
   CHECK(!memories.empty());
@@ -75,7 +114,41 @@ static bool LessEqual(const vector<uint8> &mem1,
   return true;
 }
 
-void Objective::EnumeratePartial(const vector<int> &look,
+std::shared_ptr<const Objective::PairBits>
+Objective::GetPairBits(const vector<int> &look) {
+  MutexLock ml(&pair_bits_m);
+  auto it = pair_bits.find(look);
+  if (it != pair_bits.end()) return it->second;
+
+  std::shared_ptr<PairBits> bits(new PairBits);
+  const int width = memories[0].size();
+  bits->num_pairs = look.size() > 1 ? look.size() - 1 : 0;
+  bits->words = (bits->num_pairs + 63) / 64;
+  bits->inc.resize(width * bits->words, 0ULL);
+  bits->dec.resize(width * bits->words, 0ULL);
+  // A word (64 pairs) at a time, so that the 65 memories involved
+  // stay in cache while we go through every location.
+  for (int w = 0; w < bits->words; w++) {
+    const int lo_end = std::min(bits->num_pairs, (w + 1) * 64);
+    for (int c = 0; c < width; c++) {
+      uint64 inc = 0ULL, dec = 0ULL;
+      for (int lo = w * 64; lo < lo_end; lo++) {
+	const uint8 a = memories[look[lo]][c], b = memories[look[lo + 1]][c];
+	const uint64 bit = 1ULL << (lo - w * 64);
+	if (a < b) inc |= bit;
+	if (a > b) dec |= bit;
+      }
+      bits->inc[c * bits->words + w] = inc;
+      bits->dec[c * bits->words + w] = dec;
+    }
+  }
+
+  pair_bits[look] = bits;
+  return bits;
+}
+
+void Objective::EnumeratePartial(const Enumeration &e,
+				 const vector<uint64> &equal,
 				 vector<int> *prefix,
 				 const vector<int> &left,
 				 vector<int> *remain,
@@ -88,26 +161,13 @@ void Objective::EnumeratePartial(const vector<int> &look,
   // in look where memory[i] == memory[j] for the prefix.
   // We only need to check consecutive memories; a distant
   // counterexample means that there is an adjacent
-  // counterexample somewhere in between.
-
-  // Cache this.
-  // indices lo in look where look[lo] and look[lo + 1]
-  // are equal on the prefix
-  vector<int> lequal;
-  lequal.reserve(look.size() - 1);
-  VPRINTF("Equal on prefix:");
-  for (int lo = 0; lo < look.size() - 1; lo++) {
-    int i = look[lo], j = look[lo + 1];
-    if (EqualOnPrefix(memories[i], memories[j], *prefix)) {
-      lequal.push_back(lo);
-      VPRINTF(" %d-%d", i, j);
-    }
-  }
-  VPRINTF("\n");
+  // counterexample somewhere in between. The consecutive
+  // pairs that are equal on the prefix are the bitset equal.
+  const PairBits &bits = *e.bits;
+  const int words = bits.words;
 
   for (int le = 0; le < left.size(); le++) {
     int c = left[le];
-    bool less = false;
 
     // PERF I don't think this is actually necessary. Since this
     // function returns ALL candidates, the candidates are also all in
@@ -122,28 +182,28 @@ void Objective::EnumeratePartial(const vector<int> &look,
       }
     }
 
-    for (int li = 0; li < lequal.size(); li++) {
-      int lo = lequal[li];
-      int i = look[lo], j = look[lo + 1];
-      VPRINTF("  at lo %d. i=%d, j=%d\n", lo, i, j);
-      if (memories[i][c] > memories[j][c]) {
-	// It may be legal later, but not a candidate.
-	remain->push_back(c);
-	VPRINTF("  skip %d because memories #%d and #%d have %d->%d\n",
-		c, i, j, memories[i][c], memories[j][c]);
-	goto skip;
+    {
+      const uint64 *inc = bits.Inc(c), *dec = bits.Dec(c);
+      uint64 less = 0ULL;
+      for (int w = 0; w < words; w++) {
+	if (equal[w] & dec[w]) {
+	  // It may be legal later, but not a candidate.
+	  remain->push_back(c);
+	  VPRINTF("  skip %d because it decreases near pair %d\n",
+		  c, w * 64);
+	  goto skip;
+	}
+	less |= equal[w] & inc[w];
       }
 
-      less = less || memories[i][c] < memories[j][c];
-    }
-
-    if (less) {
-      candidates->push_back(c);
-      remain->push_back(c);
-    } else {
-      // Always equal. Filtered out and can never become
-      // interesting.
-      VPRINTF("  %d is always equal; filtered.\n", c);
+      if (less) {
+	candidates->push_back(c);
+	remain->push_back(c);
+      } else {
+	// Always equal. Filtered out and can never become
+	// interesting.
+	VPRINTF("  %d is always equal; filtered.\n", c);
+      }
     }
 
     skip:;
@@ -205,11 +265,20 @@ static void CheckOrdering(const vector<int> &look,
   
 }
 
-void Objective::EnumeratePartialRec(const vector<int> &look,
+void Objective::EnumeratePartialRec(const Enumeration &e,
+				    const vector<uint64> &equal,
 				    vector<int> *prefix,
 				    const vector<int> &left,
-				    void (*f)(const vector<int> &ordering),
 				    int *limit, int seed) {
+  const vector<int> &look = *e.look;
+  // The empty prefix is always extended, so that something is output
+  // even if we're out of time right away.
+  if (!prefix->empty() && e.Stopped()) {
+    e.emit(*prefix);
+    *limit = 0;
+    return;
+  }
+
 #if VERBOSE_OBJECTIVE
   VPRINTF("EPR: [");
   for (int i = 0; i < prefix->size(); i++) {
@@ -233,7 +302,7 @@ void Objective::EnumeratePartialRec(const vector<int> &look,
 #endif
 
   vector<int> candidates, remain;
-  EnumeratePartial(look, prefix, left, &remain, &candidates);
+  EnumeratePartial(e, equal, prefix, left, &remain, &candidates);
 
   if (seed != 0) {
     seed += *limit + prefix->size();
@@ -258,14 +327,21 @@ void Objective::EnumeratePartialRec(const vector<int> &look,
     CheckOrdering(look, memories, *prefix);
     // printf("Checked:\n");
 #   endif
-    (*f)(*prefix);
+    e.emit(*prefix);
     if (*limit > 0) --*limit;
   } else {
+    const PairBits &bits = *e.bits;
+    vector<uint64> child_equal(bits.words);
     prefix->resize(prefix->size() + 1);
     for (int i = 0; i < candidates.size(); i++) {
-      (*prefix)[prefix->size() - 1] = candidates[i];
-      EnumeratePartialRec(look, prefix, remain, f, limit, seed);
-      if (*limit == 0) {
+      const int c = candidates[i];
+      (*prefix)[prefix->size() - 1] = c;
+      // Still equal if c didn't change.
+      const uint64 *inc = bits.Inc(c), *dec = bits.Dec(c);
+      for (int w = 0; w < bits.words; w++)
+	child_equal[w] = equal[w] & ~(inc[w] | dec[w]);
+      EnumeratePartialRec(e, child_equal, prefix, remain, limit, seed);
+      if (*limit == 0 || e.Stopped()) {
 	prefix->resize(prefix->size() - 1);
 	return;
       }
@@ -277,15 +353,46 @@ void Objective::EnumeratePartialRec(const vector<int> &look,
 void Objective::EnumerateFull(const vector<int> &look,
 			      void (*f)(const vector<int> &ordering),
 			      int limit, int seed) {
+  std::shared_ptr<const PairBits> bits = GetPairBits(look);
+  Enumeration e;
+  e.look = &look;
+  e.bits = bits.get();
+  e.emit = f;
+
   vector<int> prefix, left;
   for (int i = 0; i < memories[0].size(); i++) {
     left.push_back(i);
   }
-  EnumeratePartialRec(look, &prefix, left, f, &limit, seed);
+  EnumeratePartialRec(e, bits->All(), &prefix, left, &limit, seed);
 }
 
-void Objective::EnumerateFullAll(void (*f)(const vector<int> &ordering),
-				 int limit, int seed) {
+// Stop function for a time budget, or nullptr if none.
+static std::function<bool()> Deadline(double max_seconds) {
+  if (max_seconds <= 0.0) return nullptr;
+  Timer timer;
+  return [timer, max_seconds]() { return timer.Seconds() > max_seconds; };
+}
+
+vector< vector<int> > Objective::Enumerate(const vector<int> &look,
+					   int limit, int seed,
+					   double max_seconds) {
+  std::shared_ptr<const PairBits> bits = GetPairBits(look);
+  vector< vector<int> > out;
+  Enumeration e;
+  e.look = &look;
+  e.bits = bits.get();
+  e.emit = [&out](const vector<int> &ordering) { out.push_back(ordering); };
+  e.stop = Deadline(max_seconds);
+
+  vector<int> prefix, left;
+  for (int i = 0; i < memories[0].size(); i++) {
+    left.push_back(i);
+  }
+  EnumeratePartialRec(e, bits->All(), &prefix, left, &limit, seed);
+  return out;
+}
+
+vector<int> Objective::LookAll() const {
   vector<int> look;
   for (int i = 0; i < memories.size(); i++) {
     if (i > 0 && memories[i] == memories[i - 1]) {
@@ -296,5 +403,10 @@ void Objective::EnumerateFullAll(void (*f)(const vector<int> &ordering),
       look.push_back(i);
     }
   }
-  EnumerateFull(look, f, limit, seed);
+  return look;
+}
+
+void Objective::EnumerateFullAll(void (*f)(const vector<int> &ordering),
+				 int limit, int seed) {
+  EnumerateFull(LookAll(), f, limit, seed);
 }
@@ -55,9 +55,20 @@
      of observations.
 
    This is great easy.
+
+   To make the span checks fast, for each look we precompute, for
+   every memory location, bitsets over the consecutive pairs in look:
+   the pairs where that location increases, and the pairs where it
+   decreases. The pairs that are equal on the prefix are then also a
+   bitset (the AND of "neither" for each location in it), and a
+   location is a candidate when its decrease bits don't intersect it
+   and its increase bits do.
  */
 
 #include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
 
 #include "fceu/types.h"
 
@@ -86,9 +97,33 @@ struct Objective {
   void EnumerateFullAll(void (*f)(const vector<int> &ordering),
                         int limit, int seed);
 
-private:
+  // The look used by EnumerateFullAll: every memory, skipping
+  // ones that are the same as their predecessor.
+  vector<int> LookAll() const;
+
+  // Same as EnumerateFull, but returns the orderings, and may be called
+  // from many threads at once. If max_seconds is positive, gives up
+  // after about that long, returning the orderings found so far plus
+  // the one it was extending, which may not be maximal. So there's
+  // at least one ordering (with a positive limit) in any case, and
+  // it's only empty if there are no non-empty orderings.
+  vector< vector<int> > Enumerate(const vector<int> &look,
+                                  int limit, int seed,
+                                  double max_seconds);
 
-  // Look gives the memory indices to look at.
+private:
+  struct PairBits;
+  struct Enumeration;
+
+  // Get the pair bitsets for the look, computing them if this is
+  // the first time we've seen it. They're kept for the life of the
+  // Objective, which is typical (learnfun uses the same looks with
+  // many seeds).
+  std::shared_ptr<const PairBits> GetPairBits(const vector<int> &look);
+
+  // The enumeration gives the memory indices to look at (and their
+  // pair bitsets). Equal is the bitset of consecutive pairs in look
+  // that are equal on the prefix.
   // Prefix is memory locations forming a lexicographic ordering.
   // Left contains the indices of memory locations left to consider
   // for extending the prefix. These may not overlap the prefix.
@@ -97,17 +132,22 @@ private:
   // All arguments are morally constant, but can be modified and replaced
   // during recursion.
   // XXX docs
-  void EnumeratePartial(const vector<int> &look,
+  void EnumeratePartial(const Enumeration &e,
+                        const vector<uint64> &equal,
                         vector<int> *prefix,
                         const vector<int> &left,
                         vector<int> *remain,
                         vector<int> *candidates);
 
-  void EnumeratePartialRec(const vector<int> &look,
+  void EnumeratePartialRec(const Enumeration &e,
+                           const vector<uint64> &equal,
                            vector<int> *prefix,
                            const vector<int> &left,
-                           void (*f)(const vector<int> &ordering),
                            int *limit, int seed);
 
   const vector< vector<uint8> > &memories;
+
+  // Protects pair_bits.
+  std::mutex pair_bits_m;
+  std::map< vector<int>, std::shared_ptr<const PairBits> > pair_bits;
 };
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "tasbot.h"
 #include "fceu/types.h"
 #include "../cc-lib/util.h"
@@ -96,12 +98,54 @@ static void FindCounterExample() {
 	  memories.push_back(mem);
 	}
 	Objective obj(memories);
-	obj.EnumerateFullAll(ignore, 1, 0);
+	obj.EnumerateFullAll(::ignore, 1, 0);
       }
     }
   }
 }
 
+// Memories in the look must be non-decreasing on the ordering.
+static bool IsOrdering(const vector< vector<uint8> > &memories,
+		       const vector<int> &look,
+		       const vector<int> &ordering) {
+  for (int i = 0; i + 1 < look.size(); i++) {
+    const vector<uint8> &a = memories[look[i]], &b = memories[look[i + 1]];
+    for (int p : ordering) {
+      if (a[p] < b[p]) break;
+      if (a[p] > b[p]) return false;
+    }
+  }
+  return true;
+}
+
+// Running out of time should still give a (non-maximal) objective,
+// the start of the one we'd get without the deadline.
+static void TestDeadline() {
+  ArcFour rc("deadline");
+  for (int t = 0; t < 200; t++) {
+    const int nmem = 2 + rc.Byte() % 150;
+    const int size = 1 + rc.Byte() % 40;
+    vector< vector<uint8> > memories;
+    for (int i = 0; i < nmem; i++) {
+      vector<uint8> mem;
+      for (int j = 0; j < size; j++) {
+	// Mostly counters, so that the orderings are long.
+	mem.push_back(rc.Byte() < 16 ? rc.Byte() % 4 : i);
+      }
+      memories.push_back(mem);
+    }
+    Objective obj(memories);
+    const vector<int> look = obj.LookAll();
+    const vector< vector<int> > full = obj.Enumerate(look, 1, 0, 0.0);
+    const vector< vector<int> > part = obj.Enumerate(look, 1, 0, 1e-12);
+    CHECK(full.size() == 1 && part.size() == 1);
+    CHECK(IsOrdering(memories, look, part[0]));
+    CHECK(part[0].size() <= full[0].size());
+    CHECK(std::equal(part[0].begin(), part[0].end(), full[0].begin()));
+    CHECK(full[0].empty() || !part[0].empty());
+  }
+}
+
 int main(int argc, char *argv[]) {
   fprintf(stderr, "Testing objectives.\n");
 
@@ -137,6 +181,7 @@ int main(int argc, char *argv[]) {
     obj.EnumerateFullAll(pr, -1, 0);
   }
   
+  TestDeadline();
   FindCounterExample();
 
   return 0;
@@ -306,22 +306,6 @@ struct PlayFun {
     }
   }
 
-  // DESTROYS THE STATE
-  void ScoreByFuture(const Future &future,
-		     const vector<uint8> &base_memory,
-		     vector<uint8> *base_state,
-		     double *positive_scores,
-		     double *negative_scores,
-		     double *integral_score) {
-    vector<uint8> future_memory;
-    double integral = ScoreIntegral(base_state, future.inputs, &future_memory);
-
-    *integral_score = integral / future.inputs.size();
-    *positive_scores = objectives->WeightedLess(base_memory, future_memory);
-    // Note negation; WeightedLess always returns non-negative score.
-    *negative_scores = -objectives->WeightedLess(future_memory, base_memory);
-  }
-
   #if MARIONET
   static void ReadBytesFromProto(const string &pf, vector<uint8> *bytes) {
     // PERF iterators.
@@ -332,7 +316,19 @@ struct PlayFun {
 
   void Helper(int port) {
     SingleServer server(port);
+    HelperLoop(port, &server);
+  }
+
+  // Same, but takes requests over shared memory (see shmutil.h)
+  // instead of TCP. The master has to use shared memory too.
+  void HelperShm(int port) {
+    ShmServer server(port);
+    HelperLoop(port, &server);
+  }
 
+  // Server is SingleServer or ShmServer.
+  template<class Server>
+  void HelperLoop(int port, Server *server) {
     fprintf(stderr, "[%d] " ANSI_CYAN " Ready." ANSI_RESET "\n",
 	    port);
 
@@ -344,22 +340,22 @@ struct PlayFun {
     InPlaceTerminal term(1);
     int connections = 0;
     for (;;) {
-      server.Listen();
+      server->Listen();
 
       connections++;
       string line = StringPrintf("[%d] Connection #%d from %s",
 				 port,
 				 connections,
-				 server.PeerString().c_str());
+				 server->PeerString().c_str());
       term.Output(line + "\n");
 
       HelperRequest hreq;
-      if (server.ReadProto(&hreq)) {
+      if (server->ReadProto(&hreq)) {
 
 	if (const Message *res = cache.Lookup(hreq)) {
 	  line += ", " ANSI_GREEN "cached!" ANSI_RESET;
 	  term.Output(line + "\n");
-	  if (!server.WriteProto(*res)) {
+	  if (!server->WriteProto(*res)) {
 	    term.Advance();
 	    fprintf(stderr, "Failed to send cached result...\n");
 	    // keep going...
@@ -400,7 +396,7 @@ struct PlayFun {
 
 	  // fprintf(stderr, "Result: %s\n", res.DebugString().c_str());
 	  cache.Save(hreq, res);
-	  if (!server.WriteProto(res)) {
+	  if (!server->WriteProto(res)) {
 	    term.Advance();
 	    fprintf(stderr, "Failed to send playfun result...\n");
 	    // But just keep going.
@@ -418,7 +414,7 @@ struct PlayFun {
 	  DoTryImprove(req, &res);
 
 	  cache.Save(hreq, res);
-	  if (!server.WriteProto(res)) {
+	  if (!server->WriteProto(res)) {
 	    term.Advance();
 	    fprintf(stderr, "Failed to send tryimprove result...\n");
 	    // Keep going...
@@ -431,7 +427,7 @@ struct PlayFun {
 	term.Advance();
 	fprintf(stderr, "\nFailed to read request...\n");
       }
-      server.Hangup();
+      server->Hangup();
     }
   }
 
@@ -715,10 +711,12 @@ struct PlayFun {
     Emulator::LoadUncompressed(start_state);
     vector<uint8> previous_memory;
     Emulator::GetMemory(&previous_memory);
+    // Outside the loop; since the two vectors are swapped each
+    // iteration, GetMemory reuses their storage instead of allocating.
+    vector<uint8> new_memory;
     double sum = 0.0;
     for (int i = 0; i < inputs.size(); i++) {
       Emulator::CachingStep(inputs[i]);
-      vector<uint8> new_memory;
       Emulator::GetMemory(&new_memory);
       sum += objectives->Evaluate(previous_memory, new_memory);
       previous_memory.swap(new_memory);
@@ -913,13 +911,24 @@ struct PlayFun {
       futures.push_back(fakefuture_hold);
     }
 
+    // Play out every future first, so that their end states can be
+    // compared to new_memory all at once.
+    vector<double> integral_scores;
+    vector< vector<uint8> > future_memories(futures.size());
+    for (int f = 0; f < futures.size(); f++) {
+      double integral =
+	ScoreIntegral(&new_state, futures[f].inputs, &future_memories[f]);
+      integral_scores.push_back(integral / futures[f].inputs.size());
+    }
+    vector<double> ups, downs;
+    objectives->WeightedLessBatch(new_memory, future_memories, &ups, &downs);
+
     *futures_score = 0.0;
     for (int f = 0; f < futures.size(); f++) {
-      if (f != 0) Emulator::LoadUncompressed(&new_state);
-      double positive_scores, negative_scores, integral_score;
-      ScoreByFuture(futures[f], new_memory, &new_state,
-		    &positive_scores, &negative_scores,
-		    &integral_score);
+      const double integral_score = integral_scores[f];
+      const double positive_scores = ups[f];
+      // Note negation; WeightedLess always returns non-negative score.
+      const double negative_scores = -downs[f];
       CHECK(positive_scores >= 0);
       CHECK(negative_scores <= 0);
 
@@ -997,8 +1006,11 @@ struct PlayFun {
       // if (!i) fprintf(stderr, "REQ: %s\n", req->DebugString().c_str());
     }
 
-    GetAnswers<HelperRequest, PlayFunResponse> getanswers(ports_, requests);
+    GetAnswers<HelperRequest, PlayFunResponse>
+      getanswers(ports_, channels_, requests, &transport_stats_);
     getanswers.Loop();
+    fprintf(stderr, "%s\n",
+	    transport_stats_.Summary(channels_.empty() ? "tcp" : "shm").c_str());
 
     const vector<GetAnswers<HelperRequest, PlayFunResponse>::Work> &work =
       getanswers.GetWork();
@@ -1290,10 +1302,20 @@ struct PlayFun {
 
   // Main loop for the master, or when compiled without MARIONET support.
   // Helpers is an array of helper ports, which is ignored unless MARIONET
-  // is active.
-  void Master(const vector<int> &helpers) {
+  // is active. If shm is true, talk to the helpers over shared memory
+  // instead of TCP; they must have been started with --helper-shm.
+  void Master(const vector<int> &helpers, bool shm) {
     // XXX
     ports_ = helpers;
+    #if MARIONET
+    if (shm) {
+      for (int i = 0; i < ports_.size(); i++) {
+	channels_.push_back(ShmChannel::Open(ports_[i]));
+      }
+    }
+    #else
+    CHECK(!shm);
+    #endif
 
     string logname = StringPrintf("%s-log.html", game.c_str());
     log = fopen(logname.c_str(), "w");
@@ -1514,7 +1536,7 @@ struct PlayFun {
     }
 
     GetAnswers<HelperRequest, TryImproveResponse>
-      getanswers(ports_, requests);
+      getanswers(ports_, channels_, requests, &transport_stats_);
     getanswers.Loop();
 
     const vector<GetAnswers<HelperRequest,
@@ -1796,6 +1818,12 @@ struct PlayFun {
 
   // Ports for the helpers.
   vector<int> ports_;
+  #if MARIONET
+  // Shared-memory channels to the helpers, parallel to ports_, or
+  // empty if using TCP. Never freed.
+  vector<ShmChannel *> channels_;
+  TransportStats transport_stats_;
+  #endif
 
   // For making SVG.
   vector<Scoredist> distributions;
@@ -1828,16 +1856,28 @@ int main(int argc, char *argv[]) {
 
   #if MARIONET
   if (argc >= 2) {
-    if (0 == strcmp(argv[1], "--helper")) {
+    // The -shm variants use shared memory instead of TCP, when
+    // everything is on the same machine. The port numbers just
+    // name the channels.
+    const bool shm = 0 == strcmp(argv[1], "--helper-shm") ||
+      0 == strcmp(argv[1], "--master-shm");
+    if (0 == strcmp(argv[1], "--helper") ||
+	0 == strcmp(argv[1], "--helper-shm")) {
       if (argc < 3) {
 	fprintf(stderr, "Need one port number after --helper.\n");
 	abort();
       }
       int port = atoi(argv[2]);
-      fprintf(stderr, "Starting helper on port %d...\n", port);
-      pf.Helper(port);
+      fprintf(stderr, "Starting helper on %s %d...\n",
+	      shm ? "shm" : "port", port);
+      if (shm) {
+	pf.HelperShm(port);
+      } else {
+	pf.Helper(port);
+      }
       fprintf(stderr, "helper returned?\n");
-    } else if (0 == strcmp(argv[1], "--master")) {
+    } else if (0 == strcmp(argv[1], "--master") ||
+	       0 == strcmp(argv[1], "--master-shm")) {
       vector<int> helpers;
       for (int i = 2; i < argc; i++) {
 	int hp = atoi(argv[i]);
@@ -1848,16 +1888,16 @@ int main(int argc, char *argv[]) {
 	}
 	helpers.push_back(hp);
       }
-      pf.Master(helpers);
+      pf.Master(helpers, shm);
       fprintf(stderr, "master returned?\n");
     }
   } else {
     vector<int> empty;
-    pf.Master(empty);
+    pf.Master(empty, false);
   }
   #else
   vector<int> nobody;
-  pf.Master(nobody);
+  pf.Master(nobody, false);
   #endif
 
   Emulator::Shutdown();
@@ -0,0 +1,356 @@
+#include "shmutil.h"
+
+#include <string>
+#include <thread>
+#include <chrono>
+#include <new>
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Size of each ring. A PlayFunRequest is dominated by the uncompressed
+// save state, which is tens of kilobytes; messages must fit in half
+// the ring.
+static constexpr uint32 RING_BYTES = 8 << 20;
+// Messages are 8-byte aligned, preceded by their 32-bit length and
+// the master's 32-bit session.
+static constexpr uint32 WRAP = 0xFFFFFFFF;
+static constexpr uint32 MAGIC = 0x7A5B0702;
+
+static uint32 FrameBytes(uint32 len) {
+  return (8 + len + 7) & ~7;
+}
+
+struct ShmRing {
+  // Total bytes ever written. Only the producer writes it.
+  alignas(64) std::atomic<uint64> head;
+  // Total bytes ever consumed. Only the consumer writes it.
+  alignas(64) std::atomic<uint64> tail;
+  alignas(64) uint8 data[RING_BYTES];
+};
+
+struct ShmSegment {
+  // Set by the helper once the rings are initialized.
+  std::atomic<uint32> magic;
+  // Changed whenever a helper starts or exits; see shmutil.h.
+  std::atomic<uint64> generation;
+  ShmRing request, response;
+};
+
+static_assert(std::atomic<uint64>::is_always_lock_free,
+	      "Atomics in shared memory must be lock-free.");
+
+namespace {
+// Spin briefly, then yield, then sleep, so that a quick response has
+// low latency but an idle waiter doesn't burn a core.
+struct Backoff {
+  void Wait() {
+    if (count < 64) {
+      // nothing; spin
+    } else if (count < 256) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    count++;
+  }
+  int count = 0;
+};
+}
+
+static string SegmentName(int port) {
+#ifdef _WIN32
+  return StringPrintf("Local\\tasbot-shm-%d", port);
+#else
+  return StringPrintf("/tasbot-shm-%d", port);
+#endif
+}
+
+ShmChannel::ShmChannel(int port, bool creator) :
+  port(port), creator(creator) {}
+
+// A number that's unlikely to be repeated by another process.
+static uint32 NewSession(int port) {
+  const uint64 t =
+    std::chrono::high_resolution_clock::now().time_since_epoch().count();
+  const uint64 x =
+    (t ^ (t >> 29) ^ ((uint64)port << 40)) * 0x9E3779B97F4A7C15ULL;
+  const uint32 s = (uint32)(x >> 32);
+  return s == 0 ? 1 : s;
+}
+
+ShmChannel *ShmChannel::Create(int port) {
+  ShmChannel *channel = new ShmChannel(port, true);
+  const string name = SegmentName(port);
+  void *mem = nullptr;
+  // Generation of the segment this one replaces, if any.
+  uint64 old_generation = 0ULL;
+
+#ifdef _WIN32
+  const uint64 bytes = sizeof (ShmSegment);
+  HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+				(DWORD)(bytes >> 32), (DWORD)bytes,
+				name.c_str());
+  if (h == NULL) {
+    fprintf(stderr, "CreateFileMapping(%s) failed: %d\n",
+	    name.c_str(), (int)GetLastError());
+    abort();
+  }
+  mem = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+  CHECK(mem != NULL);
+  channel->handle = (void *)h;
+#else
+  // Remove any segment left over from a crashed helper, first
+  // telling any master still attached to it that it's gone.
+  {
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    struct stat st;
+    if (fd >= 0 && 0 == fstat(fd, &st) && st.st_size == sizeof (ShmSegment)) {
+      ShmSegment *old = (ShmSegment *)mmap(NULL, sizeof (ShmSegment),
+					   PROT_READ | PROT_WRITE,
+					   MAP_SHARED, fd, 0);
+      if (old != MAP_FAILED) {
+	if (old->magic.load(std::memory_order_acquire) == MAGIC)
+	  old_generation = old->generation.fetch_add(1) + 1;
+	munmap((void *)old, sizeof (ShmSegment));
+      }
+    }
+    if (fd >= 0) close(fd);
+  }
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    perror("shm_open");
+    abort();
+  }
+  CHECK(0 == ftruncate(fd, sizeof (ShmSegment)));
+  mem = mmap(NULL, sizeof (ShmSegment), PROT_READ | PROT_WRITE,
+	     MAP_SHARED, fd, 0);
+  CHECK(mem != MAP_FAILED);
+  close(fd);
+#endif
+
+  // Only the headers need initialization. On Windows, this can be
+  // the previous helper's mapping, if a master still has it open.
+  ShmSegment *seg = (ShmSegment *)mem;
+  if (seg->magic.load(std::memory_order_acquire) == MAGIC) {
+    old_generation = seg->generation.load();
+    seg->magic.store(0);
+  }
+  new (&seg->generation) std::atomic<uint64>(old_generation + 1);
+  new (&seg->request.head) std::atomic<uint64>(0ULL);
+  new (&seg->request.tail) std::atomic<uint64>(0ULL);
+  new (&seg->response.head) std::atomic<uint64>(0ULL);
+  new (&seg->response.tail) std::atomic<uint64>(0ULL);
+  seg->magic.store(MAGIC, std::memory_order_release);
+
+  channel->segment = seg;
+  channel->in = &seg->request;
+  channel->out = &seg->response;
+  return channel;
+}
+
+ShmChannel *ShmChannel::Open(int port) {
+  ShmChannel *channel = new ShmChannel(port, false);
+  channel->session = NewSession(port);
+  channel->Attach();
+  return channel;
+}
+
+void ShmChannel::Attach() {
+  CHECK(!creator);
+  const string name = SegmentName(port);
+  void *mem = nullptr;
+
+  if (segment != nullptr) {
+#ifdef _WIN32
+    UnmapViewOfFile((void *)segment);
+    CloseHandle((HANDLE)handle);
+    handle = nullptr;
+#else
+    munmap((void *)segment, sizeof (ShmSegment));
+#endif
+    segment = nullptr;
+  }
+
+  for (int tries = 0; /* in loop */; tries++) {
+#ifdef _WIN32
+    HANDLE h = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (h != NULL) {
+      mem = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, sizeof (ShmSegment));
+      CHECK(mem != NULL);
+      handle = (void *)h;
+    }
+#else
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    struct stat st;
+    if (fd >= 0 && 0 == fstat(fd, &st) && st.st_size == sizeof (ShmSegment)) {
+      mem = mmap(NULL, sizeof (ShmSegment), PROT_READ | PROT_WRITE,
+		 MAP_SHARED, fd, 0);
+      CHECK(mem != MAP_FAILED);
+    }
+    if (fd >= 0) close(fd);
+#endif
+
+    if (mem != nullptr &&
+	((ShmSegment *)mem)->magic.load(std::memory_order_acquire) == MAGIC)
+      break;
+
+#ifdef _WIN32
+    if (mem != nullptr) {
+      UnmapViewOfFile(mem);
+      CloseHandle((HANDLE)handle);
+      handle = nullptr;
+    }
+#else
+    if (mem != nullptr) munmap(mem, sizeof (ShmSegment));
+#endif
+    mem = nullptr;
+
+    if (tries == 0) {
+      fprintf(stderr, "Waiting for helper %d's shared memory...\n", port);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  ShmSegment *seg = (ShmSegment *)mem;
+  generation = seg->generation.load(std::memory_order_acquire);
+  segment = seg;
+  in = &seg->response;
+  out = &seg->request;
+}
+
+bool ShmChannel::Stale() const {
+  return !creator &&
+    (segment->magic.load(std::memory_order_acquire) != MAGIC ||
+     segment->generation.load(std::memory_order_acquire) != generation);
+}
+
+ShmChannel::~ShmChannel() {
+  // Tell an attached master that this helper is gone.
+  if (creator) segment->generation.fetch_add(1);
+#ifdef _WIN32
+  UnmapViewOfFile((void *)segment);
+  CloseHandle((HANDLE)handle);
+#else
+  munmap((void *)segment, sizeof (ShmSegment));
+  if (creator) shm_unlink(SegmentName(port).c_str());
+#endif
+}
+
+uint8 *ShmChannel::Reserve(uint32 len) {
+  const uint32 frame = FrameBytes(len);
+  if (frame > RING_BYTES / 2) {
+    fprintf(stderr, "Message of %u bytes too big for shared memory; "
+	    "use TCP.\n", len);
+    abort();
+  }
+
+  uint64 head = out->head.load(std::memory_order_relaxed);
+  uint32 pos = head % RING_BYTES;
+  // Messages are contiguous, so skip the end of the ring if it
+  // doesn't fit.
+  const uint32 skip = (pos + frame > RING_BYTES) ? RING_BYTES - pos : 0;
+
+  Backoff backoff;
+  while (RING_BYTES - (head - out->tail.load(std::memory_order_acquire)) <
+	 skip + frame) {
+    backoff.Wait();
+  }
+
+  if (skip > 0) {
+    memcpy(&out->data[pos], &WRAP, 4);
+    head += skip;
+    pos = 0;
+  }
+  memcpy(&out->data[pos], &len, 4);
+  memcpy(&out->data[pos + 4], &session, 4);
+  pending_head = head + frame;
+  return &out->data[pos + 8];
+}
+
+void ShmChannel::Commit() {
+  out->head.store(pending_head, std::memory_order_release);
+}
+
+void ShmChannel::WriteFailure() {
+  uint8 *buf = Reserve(0);
+  memcpy(buf - 8, &FAILURE, 4);
+  Commit();
+}
+
+const uint8 *ShmChannel::Peek(uint32 *len, uint32 *sess) const {
+  uint64 tail = in->tail.load(std::memory_order_relaxed);
+  if (in->head.load(std::memory_order_acquire) == tail) return nullptr;
+  uint32 pos = tail % RING_BYTES;
+  memcpy(len, &in->data[pos], 4);
+  if (*len == WRAP) {
+    // The message follows at the start of the ring; the head was
+    // published after both.
+    tail += RING_BYTES - pos;
+    pos = 0;
+    memcpy(len, &in->data[pos], 4);
+  }
+  memcpy(sess, &in->data[pos + 4], 4);
+  return &in->data[pos + 8];
+}
+
+void ShmChannel::Consume() {
+  uint64 tail = in->tail.load(std::memory_order_relaxed);
+  uint32 pos = tail % RING_BYTES;
+  uint32 len;
+  memcpy(&len, &in->data[pos], 4);
+  if (len == WRAP) {
+    tail += RING_BYTES - pos;
+    pos = 0;
+    memcpy(&len, &in->data[pos], 4);
+  }
+  if (len == FAILURE) len = 0;
+  in->tail.store(tail + FrameBytes(len), std::memory_order_release);
+}
+
+bool ShmChannel::Ready() {
+  uint32 len = 0, sess = 0;
+  while (Peek(&len, &sess) != nullptr) {
+    if (creator || sess == session) return true;
+    // A response to a previous master's request.
+    Consume();
+  }
+  // Responses the helper sent before exiting are still good, but
+  // nothing more is coming.
+  return Stale();
+}
+
+void ShmChannel::Wait() {
+  Backoff backoff;
+  while (!Ready()) backoff.Wait();
+}
+
+string TransportStats::Summary(const string &name) const {
+  const double mb = (bytes_sent + bytes_received) / (1024.0 * 1024.0);
+  return StringPrintf("[%s] %lld requests, %.1f MB out, %.1f MB in, "
+		      "io %.3fs (%.1f MB/s), latency avg %.1fms max %.1fms, "
+		      "total %.1fs",
+		      name.c_str(),
+		      requests,
+		      bytes_sent / (1024.0 * 1024.0),
+		      bytes_received / (1024.0 * 1024.0),
+		      io_sec,
+		      io_sec > 0.0 ? mb / io_sec : 0.0,
+		      responses > 0 ?
+		      (total_latency_sec * 1000.0) / responses : 0.0,
+		      max_latency_sec * 1000.0,
+		      total_sec);
+}
@@ -0,0 +1,202 @@
+#ifndef __TASBOT_SHMUTIL_H
+#define __TASBOT_SHMUTIL_H
+
+// Shared-memory transport between the playfun master and helpers
+// running on the same machine, as an alternative to a TCP connection
+// per request (netutil.h).
+//
+// Each helper creates a segment named after its "port" number. The
+// segment holds two single-producer, single-consumer ring buffers:
+// requests from the master, and responses back. Protos are serialized
+// directly into the ring and parsed directly out of it, so unlike the
+// socket path there's no intermediate buffer, malloc, or system call
+// per message; the bulky fields (save states, input sequences) are
+// copied exactly once on each side, by the proto library itself.
+//
+// Waiting is by polling with backoff, since there is no portable
+// cross-process condition variable. An idle helper costs a wakeup
+// every few hundred microseconds.
+//
+// Either side can be restarted while the other keeps running. The
+// segment has a generation that a new helper bumps (on the old
+// segment too, if one's left over) and an exiting helper changes, so
+// a master still attached to the old one sees that its request is
+// lost, reattaches, and retries. Each master picks a random session
+// number that's stamped on its requests and echoed on the responses,
+// so that a new master ignores responses meant for an old one.
+
+#include <string>
+#include <atomic>
+
+#include "tasbot.h"
+#include "fceu/types.h"
+
+using namespace std;
+
+// Counters for comparing transports. The master keeps one of these
+// and GetAnswers updates it for either transport.
+struct TransportStats {
+  int64 requests = 0LL, responses = 0LL;
+  int64 bytes_sent = 0LL, bytes_received = 0LL;
+  // Time the master spent serializing and sending requests, and
+  // reading and parsing responses; the transport's own overhead.
+  double io_sec = 0.0;
+  // From sending a request until its response was read. This includes
+  // the helper's work, so it's mostly useful for comparing the same
+  // workload on different transports.
+  double total_latency_sec = 0.0, max_latency_sec = 0.0;
+  // Wall time spent waiting on answers overall.
+  double total_sec = 0.0;
+
+  string Summary(const string &name) const;
+};
+
+// Layout of the shared segment. Defined in shmutil.cc.
+struct ShmSegment;
+struct ShmRing;
+
+// One end of a helper's channel.
+struct ShmChannel {
+  // Helper side. Creates the segment for the port, replacing any
+  // stale one from a previous run. Aborts on failure.
+  static ShmChannel *Create(int port);
+  // Master side. Blocks until the helper has created the segment.
+  // Responses to anything sent before this (by a previous master)
+  // are skipped.
+  static ShmChannel *Open(int port);
+
+  ~ShmChannel();
+
+  // True if there's a message waiting to be read, or (master side)
+  // the helper has restarted, in which case Read fails.
+  bool Ready();
+  // Block until Ready.
+  void Wait();
+
+  // Blocks until there's room. Returns the number of bytes written.
+  template<class T>
+  int Write(const T &t);
+
+  // Must be Ready. Consumes the message even if it fails to parse.
+  // Returns the number of bytes read, or -1 on failure. If the
+  // helper restarted, this reattaches to its new segment and fails,
+  // since the request was lost.
+  template<class T>
+  int Read(T *t);
+
+  // Send a message that the other side's Read fails on, like a
+  // connection that's hung up without a response.
+  void WriteFailure();
+
+ private:
+  ShmChannel(int port, bool creator);
+
+  // Master side: map the helper's segment, waiting for it to exist.
+  void Attach();
+  // Master side: true if the helper has gone away or restarted since
+  // Attach.
+  bool Stale() const;
+
+  // Reserve contiguous space for a message of len bytes in the
+  // outgoing ring, blocking until there's room, and return a pointer
+  // to it. Then Commit publishes it.
+  uint8 *Reserve(uint32 len);
+  void Commit();
+  // Length of a message written by WriteFailure.
+  static constexpr uint32 FAILURE = 0xFFFFFFFE;
+  // Return the next incoming message (and its length and session),
+  // or nullptr.
+  const uint8 *Peek(uint32 *len, uint32 *session) const;
+  void Consume();
+
+  const int port;
+  const bool creator;
+  // The master's session. Set when the master opens the channel, and
+  // on the helper side, from the last request read.
+  uint32 session = 0;
+  // Master side: the segment's generation when attached.
+  uint64 generation = 0ULL;
+  ShmSegment *segment = nullptr;
+  ShmRing *in = nullptr, *out = nullptr;
+  // Value of the outgoing head after the reserved message.
+  uint64 pending_head = 0ULL;
+  // Opaque OS handle for the mapping.
+  void *handle = nullptr;
+
+  NOT_COPYABLE(ShmChannel);
+};
+
+// Helper-side channel with the same interface as SingleServer, so
+// that the helper loop can be written once for both transports. Each
+// request is like a connection that is hung up after the response.
+// The master waits for exactly one response per request, so hanging
+// up without one sends a failure, which it retries.
+struct ShmServer {
+  explicit ShmServer(int port) : channel(ShmChannel::Create(port)) {}
+  ~ShmServer() { delete channel; }
+
+  // Blocks until there's a request.
+  void Listen() {
+    channel->Wait();
+    responded = false;
+  }
+
+  template <class T>
+  bool ReadProto(T *t) { return channel->Read(t) >= 0; }
+
+  template <class T>
+  bool WriteProto(const T &t) {
+    responded = true;
+    return channel->Write(t) >= 0;
+  }
+
+  void Hangup() {
+    if (!responded) channel->WriteFailure();
+    responded = true;
+  }
+
+  string PeerString() { return "shared memory"; }
+
+ private:
+  ShmChannel *channel;
+  bool responded = true;
+  NOT_COPYABLE(ShmServer);
+};
+
+// Template implementations follow.
+
+template<class T>
+int ShmChannel::Write(const T &t) {
+  const int len = t.ByteSize();
+  uint8 *buf = Reserve(len);
+  t.SerializeWithCachedSizesToArray(buf);
+  Commit();
+  return len;
+}
+
+template<class T>
+int ShmChannel::Read(T *t) {
+  uint32 len = 0, sess = 0;
+  const uint8 *buf = Peek(&len, &sess);
+  if (buf == NULL) {
+    // Then it was Ready because the helper went away.
+    CHECK(Stale());
+    fprintf(stderr, "ShmChannel %d: Helper restarted.\n", port);
+    Attach();
+    return -1;
+  }
+  if (creator) session = sess;
+  if (len == FAILURE) {
+    Consume();
+    return -1;
+  }
+  const bool ok = t->ParseFromArray((const void *)buf, len);
+  Consume();
+  if (!ok) {
+    fprintf(stderr, "ShmChannel %d: Failed to parse proto.\n", port);
+    return -1;
+  }
+  return len;
+}
+
+#endif
@@ -0,0 +1,151 @@
+/* Tests for the shared-memory transport. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#include "tasbot.h"
+#include "fceu/types.h"
+#include "../cc-lib/arcfour.h"
+#include "marionet.pb.h"
+#include "shmutil.h"
+
+static const int PORT = 29123;
+
+// Responds to each playfun request with the sizes of its fields, and
+// sends nothing for any other request, like the helper does when it
+// doesn't understand one.
+static void EchoHelper(int port, int num) {
+  ShmServer server(port);
+  for (int i = 0; i < num; i++) {
+    server.Listen();
+    HelperRequest hreq;
+    if (server.ReadProto(&hreq) && hreq.has_playfun()) {
+      const PlayFunRequest &req = hreq.playfun();
+      PlayFunResponse res;
+      res.set_immediate_score(req.current_state().size());
+      for (int f = 0; f < req.futures_size(); f++)
+	res.add_futurescores(req.futures(f).inputs().size());
+      CHECK(server.WriteProto(res));
+    }
+    server.Hangup();
+  }
+}
+
+static HelperRequest MakeRequest(int state_size) {
+  HelperRequest hreq;
+  hreq.mutable_playfun()->set_current_state(string(state_size, 's'));
+  return hreq;
+}
+
+// Send the request and return the echoed state size, or -1.
+static int RoundTrip(ShmChannel *channel, int state_size) {
+  CHECK(channel->Write(MakeRequest(state_size)) >= 0);
+  channel->Wait();
+  PlayFunResponse res;
+  if (channel->Read(&res) < 0) return -1;
+  return res.immediate_score();
+}
+
+static void TestRoundTrips() {
+  static const int NUM = 2000;
+  std::thread helper(EchoHelper, PORT, NUM);
+  ShmChannel *channel = ShmChannel::Open(PORT);
+
+  ArcFour rc("shm");
+  int failures = 0;
+  for (int i = 0; i < NUM; i++) {
+    HelperRequest hreq;
+    // Every so often, a request the helper can't handle.
+    const bool unknown = i % 10 == 3;
+    if (!unknown) {
+      PlayFunRequest *req = hreq.mutable_playfun();
+      // Sometimes big, so that messages wrap around the ring.
+      const int size = (i % 50 == 0) ? 3000000 : 1 + rc.Byte() * 100;
+      req->set_current_state(string(size, 'a' + i % 26));
+      const int nfutures = rc.Byte() % 8;
+      for (int f = 0; f < nfutures; f++)
+	req->add_futures()->set_inputs(string(f * 7, 'x'));
+    }
+    CHECK(channel->Write(hreq) >= 0);
+    channel->Wait();
+
+    PlayFunResponse res;
+    const int bytes = channel->Read(&res);
+    if (unknown) {
+      CHECK(bytes == -1);
+      failures++;
+    } else {
+      const PlayFunRequest &req = hreq.playfun();
+      CHECK(bytes >= 0);
+      CHECK(res.immediate_score() == req.current_state().size());
+      CHECK(res.futurescores_size() == req.futures_size());
+      for (int f = 0; f < req.futures_size(); f++)
+	CHECK(res.futurescores(f) == f * 7);
+    }
+    // (After the last one, the helper exits, which makes it Ready.)
+    if (i < NUM - 1) CHECK(!channel->Ready());
+  }
+
+  helper.join();
+  delete channel;
+  printf("%d round trips (%d failures) OK.\n", NUM, failures);
+}
+
+// A master that exits with a request outstanding, and a new one that
+// attaches to the same helper. The new one must not get the old
+// one's response.
+static void TestNewMaster() {
+  std::thread helper(EchoHelper, PORT + 1, 2);
+  ShmChannel *old_master = ShmChannel::Open(PORT + 1);
+  CHECK(old_master->Write(MakeRequest(111)) >= 0);
+  delete old_master;
+
+  ShmChannel *channel = ShmChannel::Open(PORT + 1);
+  CHECK(RoundTrip(channel, 222) == 222);
+  helper.join();
+  delete channel;
+  printf("New master OK.\n");
+}
+
+// A helper that dies with the master's request outstanding, then one
+// that exits normally, each replaced by a new one. The master must
+// notice, rather than wait forever on the old segment.
+static void TestHelperRestart() {
+  std::thread crashed([]() {
+      // Leaked on purpose, like a crashed process.
+      ShmServer *server = new ShmServer(PORT + 2);
+      server->Listen();
+    });
+  ShmChannel *channel = ShmChannel::Open(PORT + 2);
+  CHECK(channel->Write(MakeRequest(333)) >= 0);
+  crashed.join();
+
+  std::thread helper(EchoHelper, PORT + 2, 1);
+  // The request was lost.
+  channel->Wait();
+  PlayFunResponse res;
+  CHECK(channel->Read(&res) == -1);
+  CHECK(RoundTrip(channel, 444) == 444);
+  helper.join();
+
+  // That helper has exited, so this request is also lost.
+  CHECK(channel->Write(MakeRequest(555)) >= 0);
+  std::thread helper2(EchoHelper, PORT + 2, 1);
+  channel->Wait();
+  CHECK(channel->Read(&res) == -1);
+  CHECK(RoundTrip(channel, 666) == 666);
+  helper2.join();
+  delete channel;
+  printf("Helper restart OK.\n");
+}
+
+int main(int argc, char **argv) {
+  TestRoundTrips();
+  TestNewMaster();
+  TestHelperRestart();
+  printf("OK.\n");
+  return 0;
+}
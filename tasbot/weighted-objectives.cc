@@ -8,6 +8,11 @@
 #include <sstream>
 #include <utility>
 #include <vector>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "tasbot.h"
 #include "../cc-lib/arcfour.h"
@@ -17,7 +22,7 @@
 using namespace std;
 
 struct WeightedObjectives::Info {
-  explicit Info(double w) : weight(w), is_sorted(true) {}
+  explicit Info(double w) : weight(w), is_sorted(true), has_ranks(false) {}
   double weight;
 
   // Sorted, ascending.
@@ -28,10 +33,33 @@ struct WeightedObjectives::Info {
     if (!is_sorted) {
       std::sort(observations.begin(), observations.end());
       is_sorted = true;
+      has_ranks = false;
     }
 
     return observations;
   }
+
+  // The distinct observations, concatenated (each is the size of the
+  // objective), and the number of observations less than each one,
+  // plus the total at the end. Used by GetNormalizedValueBatch.
+  bool has_ranks;
+  vector<uint8> distinct;
+  vector<int> less;
+
+  void MakeRanks() {
+    const vector< vector<uint8> > &obs = GetObservations();
+    if (has_ranks) return;
+    distinct.clear();
+    less.clear();
+    for (int i = 0; i < obs.size(); i++) {
+      if (i == 0 || obs[i] != obs[i - 1]) {
+	distinct.insert(distinct.end(), obs[i].begin(), obs[i].end());
+	less.push_back(i);
+      }
+    }
+    less.push_back(obs.size());
+    has_ranks = true;
+  }
 };
 
 WeightedObjectives::WeightedObjectives() {}
@@ -124,6 +152,7 @@ void WeightedObjectives::Observe(const vector<uint8> &memory) {
     }
 
     info->is_sorted = false;
+    info->has_ranks = false;
 
     // Maybe should just keep the unique values? Otherwise
     // lower_bound is doing something kind of funny when there
@@ -258,12 +287,13 @@ static inline double GetValueFrac(const vector< vector<uint8> > &values,
 double WeightedObjectives::GetNormalizedValue(const vector<uint8> &mem) {
   double sum = 0.0;
 
+  // Reused for each objective.
+  vector<uint8> cur;
   for (Weighted::iterator it = weighted.begin(); it != weighted.end(); ++it) {
     const vector<int> &obj = it->first;
     Info *info = &*it->second;
     
-    vector<uint8> cur;
-    cur.reserve(obj.size());
+    cur.clear();
     for (int i = 0; i < obj.size(); i++) {
       cur.push_back(mem[obj[i]]);
     }
@@ -278,12 +308,13 @@ double WeightedObjectives::GetNormalizedValue(const vector<uint8> &mem) {
 vector<double> WeightedObjectives::
 GetNormalizedValues(const vector<uint8> &mem) {
   vector<double> out;
+  out.reserve(weighted.size());
+  vector<uint8> cur;
   for (Weighted::iterator it = weighted.begin(); it != weighted.end(); ++it) {
     const vector<int> &obj = it->first;
     Info *info = &*it->second;
     
-    vector<uint8> cur;
-    cur.reserve(obj.size());
+    cur.clear();
     for (int i = 0; i < obj.size(); i++) {
       cur.push_back(mem[obj[i]]);
     }
@@ -294,6 +325,171 @@ GetNormalizedValues(const vector<uint8> &mem) {
   return out;
 }
 
+// Sets idx[m] to the number of distinct values (concatenated in
+// distinct, each of width bytes, ascending) that are lexicographically
+// less than memory m's value, whose bytes are in the transposed rows.
+// Rows are padded to a multiple of 16.
+static void CountLess(const vector<uint8> &distinct, int width,
+		      const vector<const uint8 *> &rows, int n,
+		      vector<int> *idx) {
+  const int num_values = width == 0 ? 0 : distinct.size() / width;
+  idx->resize(n);
+  int m = 0;
+#ifdef __SSE2__
+  // Linear in the number of values, so only worth it for a few.
+  // (At most 255 for the 8-bit counters.)
+  if (num_values <= 32) {
+    // Only signed byte comparisons, so flip the high bits.
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    for (; m < n; m += 16) {
+      __m128i count = _mm_setzero_si128();
+      for (int d = 0; d < num_values; d++) {
+	const uint8 *v = &distinct[d * width];
+	// Lanes where v < x, and v == x, so far.
+	__m128i lt = _mm_setzero_si128(), eq = ones;
+	for (int j = 0; j < width; j++) {
+	  const __m128i xj =
+	    _mm_xor_si128(_mm_loadu_si128((const __m128i *)(rows[j] + m)),
+			  bias);
+	  const __m128i vj = _mm_set1_epi8((char)(v[j] ^ 0x80));
+	  lt = _mm_or_si128(lt, _mm_and_si128(eq, _mm_cmpgt_epi8(xj, vj)));
+	  eq = _mm_and_si128(eq, _mm_cmpeq_epi8(xj, vj));
+	  if (_mm_movemask_epi8(eq) == 0) break;
+	}
+	// Sorted, so no later value is less, either.
+	if (_mm_movemask_epi8(lt) == 0) break;
+	count = _mm_sub_epi8(count, lt);
+      }
+
+      uint8 counts[16];
+      _mm_storeu_si128((__m128i *)counts, count);
+      for (int i = 0; i < 16 && m + i < n; i++) (*idx)[m + i] = counts[i];
+    }
+  }
+#endif
+
+  // Otherwise, binary search. memcmp gives the same order as
+  // vector<uint8>.
+  vector<uint8> x(width);
+  for (; m < n; m++) {
+    for (int j = 0; j < width; j++) x[j] = rows[j][m];
+    int lo = 0, hi = num_values;
+    while (lo < hi) {
+      const int mid = (lo + hi) >> 1;
+      if (memcmp(&distinct[mid * width], &x[0], width) < 0) {
+	lo = mid + 1;
+      } else {
+	hi = mid;
+      }
+    }
+    (*idx)[m] = lo;
+  }
+}
+
+// Transposed memories: a row for each location used by some
+// objective, with that byte from every memory. Rows are padded to a
+// multiple of 16.
+struct WeightedObjectives::Transposed {
+  Transposed(const Weighted &weighted,
+	     const vector< vector<uint8> > &memories) :
+    stride((memories.size() + 15) & ~15) {
+    vector<int> locs;
+    for (Weighted::const_iterator it = weighted.begin();
+	 it != weighted.end(); ++it) {
+      const vector<int> &obj = it->first;
+      for (int j = 0; j < obj.size(); j++) {
+	if (obj[j] >= row_of.size()) row_of.resize(obj[j] + 1, -1);
+	if (row_of[obj[j]] == -1) {
+	  row_of[obj[j]] = locs.size();
+	  locs.push_back(obj[j]);
+	}
+      }
+    }
+    bytes.resize(locs.size() * stride, 0);
+    for (int m = 0; m < memories.size(); m++) {
+      const vector<uint8> &mem = memories[m];
+      for (int r = 0; r < locs.size(); r++) {
+	CHECK(locs[r] < mem.size());
+	bytes[r * stride + m] = mem[locs[r]];
+      }
+    }
+  }
+
+  const uint8 *Row(int loc) const { return &bytes[row_of[loc] * stride]; }
+
+  const int stride;
+  // Index of the row for each location, or -1.
+  vector<int> row_of;
+  vector<uint8> bytes;
+};
+
+vector<double> WeightedObjectives::
+GetNormalizedValueBatch(const vector< vector<uint8> > &memories) {
+  const int n = memories.size();
+  const Transposed tr(weighted, memories);
+
+  // Same order of additions as GetNormalizedValue, so the results
+  // are identical.
+  vector<double> sum(n, 0.0);
+  vector<const uint8 *> rows;
+  vector<int> idx;
+  for (Weighted::iterator it = weighted.begin(); it != weighted.end(); ++it) {
+    const vector<int> &obj = it->first;
+    Info *info = it->second;
+    info->MakeRanks();
+
+    rows.clear();
+    for (int j = 0; j < obj.size(); j++)
+      rows.push_back(tr.Row(obj[j]));
+    CountLess(info->distinct, obj.size(), rows, n, &idx);
+
+    // As GetValueFrac.
+    const double total = info->observations.size();
+    for (int m = 0; m < n; m++)
+      sum[m] += (double)info->less[idx[m]] / total;
+  }
+
+  for (int m = 0; m < n; m++)
+    sum[m] /= (double)weighted.size();
+  return sum;
+}
+
+void WeightedObjectives::
+WeightedLessBatch(const vector<uint8> &base,
+		  const vector< vector<uint8> > &memories,
+		  vector<double> *up, vector<double> *down) const {
+  const int n = memories.size();
+  const Transposed tr(weighted, memories);
+
+  up->assign(n, 0.0);
+  down->assign(n, 0.0);
+  // For each memory, 1 if base < memory for the current objective,
+  // -1 if base > memory, and 0 if equal so far.
+  vector<int8> order(tr.stride);
+  for (Weighted::const_iterator it = weighted.begin();
+       it != weighted.end(); ++it) {
+    const vector<int> &obj = it->first;
+    const double weight = it->second->weight;
+    std::fill(order.begin(), order.end(), 0);
+    for (int j = 0; j < obj.size(); j++) {
+      const uint8 *row = tr.Row(obj[j]);
+      const uint8 b = base[obj[j]];
+      // Branch-free, so that it vectorizes.
+      for (int m = 0; m < tr.stride; m++) {
+	const int8 o = (int8)(row[m] > b) - (int8)(row[m] < b);
+	order[m] = order[m] != 0 ? order[m] : o;
+      }
+    }
+
+    // Same order of additions as WeightedLess.
+    for (int m = 0; m < n; m++) {
+      if (order[m] > 0) (*up)[m] += weight;
+      else if (order[m] < 0) (*down)[m] += weight;
+    }
+  }
+}
+
 void WeightedObjectives::WeightByExamples(const vector< vector<uint8> >
 					  &memories) {
   for (Weighted::iterator it = weighted.begin();
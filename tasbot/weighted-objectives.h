@@ -66,6 +66,20 @@ struct WeightedObjectives {
   // Weights are ignored.
   vector<double> GetNormalizedValues(const vector<uint8> &memory);
 
+  // GetNormalizedValue for each of the memories, with exactly the
+  // same results. The memories are transposed so that each objective
+  // is compared against all of them at once (with SIMD when it has
+  // few distinct observed values), which is much faster when there
+  // are many, like the end states of all the futures.
+  vector<double> GetNormalizedValueBatch(const vector< vector<uint8> > &memories);
+
+  // Sets up[m] to WeightedLess(base, memories[m]) and down[m] to
+  // WeightedLess(memories[m], base), with exactly the same results,
+  // comparing against all of the memories at once like the above.
+  void WeightedLessBatch(const vector<uint8> &base,
+                         const vector< vector<uint8> > &memories,
+                         vector<double> *up, vector<double> *down) const;
+
   // XXX weighted version, unnormalized version?
   std::vector< std::pair<const std::vector<int> *, double> > GetAll() const;
 
@@ -73,6 +87,8 @@ struct WeightedObjectives {
   WeightedObjectives();
   struct Info;
   typedef std::map< std::vector<int>, Info* > Weighted;
+  // For the batch functions.
+  struct Transposed;
   Weighted weighted;
 
   NOT_COPYABLE(WeightedObjectives);
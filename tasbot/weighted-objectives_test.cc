@@ -10,7 +10,113 @@
 #include "../cc-lib/arcfour.h"
 #include "weighted-objectives.h"
 
-int main(int argc, char *argv[]) {
+// Memories where each byte takes on only a few values, so that
+// objectives have few distinct observations, like real RAM.
+static vector<uint8> RandomMemory(ArcFour *rc, int size, int spread) {
+  vector<uint8> mem;
+  for (int i = 0; i < size; i++) {
+    mem.push_back(rc->Byte() % spread);
+  }
+  return mem;
+}
+
+// GetNormalizedValueBatch should be exactly GetNormalizedValue on
+// each memory.
+static void TestBatch() {
+  ArcFour rc("batch");
+  static const int MEMSIZE = 64;
+  // Small spreads take the SIMD path; large ones the binary search.
+  static const int spreads[] = { 2, 5, 256 };
+  for (int s = 0; s < 3; s++) {
+    const int spread = spreads[s];
+    vector< vector<int> > objs;
+    for (int i = 0; i < 40; i++) {
+      vector<int> obj;
+      const int len = 1 + rc.Byte() % 6;
+      for (int j = 0; j < len; j++) obj.push_back(rc.Byte() % MEMSIZE);
+      objs.push_back(obj);
+    }
+    WeightedObjectives wo(objs);
 
+    for (int i = 0; i < 300; i++)
+      wo.Observe(RandomMemory(&rc, MEMSIZE, spread));
+
+    // Include some sizes that aren't multiples of 16, and memories
+    // outside the observed range.
+    for (int n = 0; n < 50; n += 7) {
+      vector< vector<uint8> > mems;
+      for (int i = 0; i < n; i++)
+	mems.push_back(RandomMemory(&rc, MEMSIZE, spread + (i & 1)));
+      vector<double> batch = wo.GetNormalizedValueBatch(mems);
+      CHECK(batch.size() == n);
+      for (int i = 0; i < n; i++) {
+	const double one = wo.GetNormalizedValue(mems[i]);
+	if (batch[i] != one) {
+	  fprintf(stderr, "spread %d, memory %d/%d: batch %f, single %f\n",
+		  spread, i, n, batch[i], one);
+	  abort();
+	}
+      }
+    }
+
+    // Observing again invalidates the cached ranks.
+    wo.Observe(RandomMemory(&rc, MEMSIZE, 256));
+    vector< vector<uint8> > mems;
+    mems.push_back(RandomMemory(&rc, MEMSIZE, 256));
+    CHECK(wo.GetNormalizedValueBatch(mems)[0] ==
+	  wo.GetNormalizedValue(mems[0]));
+  }
+}
+
+// Same for WeightedLessBatch and WeightedLess, in both directions.
+static void TestLessBatch() {
+  ArcFour rc("lessbatch");
+  static const int MEMSIZE = 64;
+  vector< vector<int> > objs;
+  for (int i = 0; i < 40; i++) {
+    vector<int> obj;
+    const int len = 1 + rc.Byte() % 6;
+    for (int j = 0; j < len; j++) obj.push_back(rc.Byte() % MEMSIZE);
+    objs.push_back(obj);
+  }
+  WeightedObjectives wo(objs);
+  // So that the weights aren't all the same. Every objective is
+  // higher at the end than at the start, so none gets weight 0.
+  vector< vector<uint8> > examples;
+  examples.push_back(vector<uint8>(MEMSIZE, 0));
+  for (int i = 0; i < 100; i++)
+    examples.push_back(RandomMemory(&rc, MEMSIZE, 4));
+  vector<uint8> last = RandomMemory(&rc, MEMSIZE, 3);
+  for (int i = 0; i < MEMSIZE; i++) last[i]++;
+  examples.push_back(last);
+  wo.WeightByExamples(examples);
+
+  for (int n = 0; n < 50; n += 7) {
+    const vector<uint8> base = RandomMemory(&rc, MEMSIZE, 3);
+    vector< vector<uint8> > mems;
+    for (int i = 0; i < n; i++)
+      mems.push_back(RandomMemory(&rc, MEMSIZE, 3));
+    // Equal to the base, too.
+    if (n > 0) mems[0] = base;
+    vector<double> ups, downs;
+    wo.WeightedLessBatch(base, mems, &ups, &downs);
+    CHECK(ups.size() == n && downs.size() == n);
+    for (int i = 0; i < n; i++) {
+      const double up = wo.WeightedLess(base, mems[i]);
+      const double down = wo.WeightedLess(mems[i], base);
+      if (ups[i] != up || downs[i] != down) {
+	fprintf(stderr, "memory %d/%d: batch %f %f, single %f %f\n",
+		i, n, ups[i], downs[i], up, down);
+	abort();
+      }
+    }
+    if (n > 0) CHECK(ups[0] == 0.0 && downs[0] == 0.0);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  TestBatch();
+  TestLessBatch();
+  printf("OK\n");
   return 0;
 }